@@ -0,0 +1,151 @@
+/// @file main.cpp
+/// Headless batch converter of images to DDS files, compressed on the CPU so it needs neither a window nor a GL driver.
+///
+/// Usage: inexor-ddsconvert [-bc5] [-nomips] [-force] <file or directory>...
+/// Directories are walked recursively and every png, jpg, tga and bmp gets a .dds file next to it,
+/// unless that one is newer than the image already. Images with alpha become DXT5, the others DXT1.
+/// -bc5 writes normal maps (*_nm.*, *_normal.*) as BC5 (ATI2), which the engine always decodes on load since the shaders want rgb normals.
+
+#include <SDL.h>                              // for SDL_Init, SDL_Quit
+#include <SDL_image.h>                        // for IMG_Load
+#include <boost/filesystem/operations.hpp>    // for recursive_directory_iterator, last_write_time
+#include <boost/filesystem/path.hpp>          // for path
+#include <boost/system/error_code.hpp>        // for error_code
+#include <ctype.h>                            // for tolower
+#include <stdio.h>                            // for FILE, fopen, fwrite
+#include <string.h>                           // for strcmp
+#include <algorithm>                          // for transform
+#include <chrono>                             // for steady_clock
+#include <iostream>                           // for cout, cerr
+#include <string>                             // for string
+#include <vector>                             // for vector
+
+#include "inexor/shared/cube_endian.hpp"      // for lilswap
+#include "inexor/texture/compressedtex.hpp"   // for DDSURFACEDESC2, initddsheader
+#include "inexor/util/blockcompression.hpp"   // for compressmipmaps
+#include "inexor/util/jobs.hpp"               // for jobs
+
+namespace bfs = boost::filesystem;
+using namespace inexor::util;
+
+struct options
+{
+    bool bc5 = false, mips = true, force = false;
+};
+
+static std::string lowercase(std::string s)
+{
+    std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+    return s;
+}
+
+static bool isimage(const bfs::path &file)
+{
+    std::string ext = lowercase(file.extension().string());
+    return ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".tga" || ext == ".bmp";
+}
+
+static bool isnormalmap(const bfs::path &file)
+{
+    std::string stem = lowercase(file.stem().string());
+    auto endswith = [&stem](const std::string &s) { return stem.size() >= s.size() && !stem.compare(stem.size() - s.size(), s.size(), s); };
+    return endswith("_nm") || endswith("_normal") || endswith("_normals");
+}
+
+/// Convert one image, returns false on errors.
+static bool convert(const bfs::path &file, const options &opts, int &skipped)
+{
+    bfs::path out = file;
+    out.replace_extension(".dds");
+    boost::system::error_code ec;
+    if(!opts.force && bfs::exists(out, ec) && bfs::last_write_time(out, ec) >= bfs::last_write_time(file, ec) && !ec)
+    {
+        skipped++;
+        return true;
+    }
+
+    SDL_Surface *loaded = IMG_Load(file.string().c_str());
+    if(!loaded) { std::cerr << "could not load " << file.string() << ": " << IMG_GetError() << std::endl; return false; }
+    SDL_Surface *s = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+    SDL_FreeSurface(loaded);
+    if(!s) { std::cerr << "could not convert " << file.string() << ": " << SDL_GetError() << std::endl; return false; }
+
+    const unsigned char *pixels = (const unsigned char *)s->pixels;
+    bool alpha = false;
+    for(int y = 0; y < s->h && !alpha; y++) for(int x = 0; x < s->w; x++) if(pixels[y*s->pitch + x*4 + 3] < 255) { alpha = true; break; }
+    bcformat f = opts.bc5 && isnormalmap(file) ? BC5 : (alpha ? BC3 : BC1);
+
+    std::vector<unsigned char> data;
+    int levels = 1;
+    if(opts.mips) levels = compressmipmaps(f, pixels, s->w, s->h, 4, s->pitch, data);
+    else
+    {
+        data.resize(((s->w + 3)/4)*((s->h + 3)/4)*bcblocksize(f));
+        compressimage(f, pixels, s->w, s->h, 4, s->pitch, data.data());
+    }
+
+    static const uint fourccs[] = { FOURCC_DXT1, FOURCC_DXT1, FOURCC_DXT5, FOURCC_ATI2 };
+    DDSURFACEDESC2 d;
+    initddsheader(d, fourccs[f], f == BC3, s->w, s->h, levels, int(data.size()));
+    lilswap((uint *)&d, sizeof(d) / sizeof(uint));
+    SDL_FreeSurface(s);
+
+    FILE *o = fopen(out.string().c_str(), "wb");
+    bool ok = o && fwrite("DDS ", 1, 4, o) == 4 && fwrite(&d, 1, sizeof(d), o) == sizeof(d) && fwrite(data.data(), 1, data.size(), o) == data.size();
+    if(o) ok = !fclose(o) && ok;
+    if(!ok) { std::cerr << "could not write " << out.string() << std::endl; bfs::remove(out, ec); return false; }
+
+    static const char * const names[] = { "DXT1", "DXT1a", "DXT5", "BC5" };
+    std::cout << out.string() << " (" << names[f] << ", " << levels << " levels)" << std::endl;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    options opts;
+    std::vector<bfs::path> inputs;
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-bc5")) opts.bc5 = true;
+        else if(!strcmp(argv[i], "-nomips")) opts.mips = false;
+        else if(!strcmp(argv[i], "-force")) opts.force = true;
+        else if(argv[i][0] == '-') { std::cerr << "unknown option " << argv[i] << std::endl; return 1; }
+        else inputs.push_back(argv[i]);
+    }
+    if(inputs.empty())
+    {
+        std::cerr << "usage: " << argv[0] << " [-bc5] [-nomips] [-force] <file or directory>..." << std::endl;
+        return 1;
+    }
+
+    if(SDL_Init(0) < 0) { std::cerr << "could not initialize SDL: " << SDL_GetError() << std::endl; return 1; }
+    IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG);
+
+    // every image is spread over all cores block row by block row
+    std::cout << "compressing on " << jobs().concurrency() << " threads" << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    int converted = 0, skipped = 0, failed = 0;
+    for(const bfs::path &input : inputs)
+    {
+        boost::system::error_code ec;
+        std::vector<bfs::path> files;
+        if(bfs::is_directory(input, ec))
+        {
+            for(bfs::recursive_directory_iterator it(input, ec), end; !ec && it != end; it.increment(ec))
+                if(bfs::is_regular_file(it->path(), ec) && isimage(it->path())) files.push_back(it->path());
+        }
+        else files.push_back(input);
+        for(const bfs::path &file : files)
+        {
+            int wasskipped = skipped;
+            if(!convert(file, opts, skipped)) failed++;
+            else if(skipped == wasskipped) converted++;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << converted << " converted, " << skipped << " up to date, " << failed << " failed in " << seconds << " seconds" << std::endl;
+
+    IMG_Quit();
+    SDL_Quit();
+    return failed ? 1 : 0;
+}
@@ -10,7 +10,6 @@
 #include "SDL_mutex.h"                                // for SDL_UnlockMutex
 #include "SDL_opengl.h"                               // for glGenTextures
 #include "SDL_stdinc.h"                               // for Uint32
-#include "SDL_thread.h"                               // for SDL_CreateThread
 #include "SDL_timer.h"                                // for SDL_GetTicks
 #include "inexor/engine/blend.hpp"                    // for setblendmaporigin
 #include "inexor/engine/lightmap.hpp"                 // for LightMap, Light...
@@ -45,9 +44,10 @@
 #include "inexor/texture/slot.hpp"                    // for VSlot, lookupvslot
 #include "inexor/texture/texsettings.hpp"             // for hwtexsize, maxt...
 #include "inexor/texture/texture.hpp"                 // for createtexture
+#include "inexor/util/jobs.hpp"                       // for jobs, task_ptr
 
 struct BlendMapCache;
-struct ShadowRayCache;
+struct clipcache;
 
 using namespace inexor::io;
 
@@ -73,11 +73,11 @@ struct lightmapworker
     VSlot *vslot;
     Slot *slot;
     vector<const extentity *> lights;
-    ShadowRayCache *shadowraycache;
+    clipcache *planecache;
     BlendMapCache *blendmapcache;
     bool needspace, doneworking;
     SDL_cond *spacecond;
-    SDL_Thread *thread;
+    inexor::util::task_ptr thread; ///< a background task of the job system, it blocks while waiting for work
 
     lightmapworker();
     ~lightmapworker();
@@ -596,7 +596,7 @@ FVARR(ambientocclusionradius, 1.0, 2.0, 200.0);
 VAR(debugao, 0, 0, 1);
 /// Calculates a value between 0 and 1 representing the occulation of a pixel
 /// @attention crashes if a normal vector of length zero occurs
-static float calcocclusion(ShadowRayCache *cache, const vec &o, const vec &normal, float tolerance)
+static float calcocclusion(clipcache *cache, const vec &o, const vec &normal, float tolerance)
 {
     //  more precise but slower:
     /*static const std::array<vec, 17> rays =
@@ -692,7 +692,7 @@ static uint generatelumel(lightmapworker *w, const float tolerance, uint lightma
         }
         if(lmshadows && mag)
         {
-            float dist = shadowray(w->shadowraycache, light.o, ray, mag - tolerance, RAY_SHADOW | (lmshadows > 1 ? RAY_ALPHAPOLY : 0));
+            float dist = shadowray(w->planecache, light.o, ray, mag - tolerance, RAY_SHADOW | (lmshadows > 1 ? RAY_ALPHAPOLY : 0));
             if(dist < mag - tolerance) continue;
         }
         lightused |= 1<<i;
@@ -716,7 +716,7 @@ static uint generatelumel(lightmapworker *w, const float tolerance, uint lightma
         float angle = sunlightdir.dot(normal);
         if(angle > 0 &&
            (!lmshadows ||
-            shadowray(w->shadowraycache, vec(sunlightdir).mul(tolerance).add(target), sunlightdir, 1e16f, RAY_SHADOW | (lmshadows > 1 ? RAY_ALPHAPOLY : 0) | (skytexturelight ? RAY_SKIPSKY : 0)) > 1e15f))
+            shadowray(w->planecache, vec(sunlightdir).mul(tolerance).add(target), sunlightdir, 1e16f, RAY_SHADOW | (lmshadows > 1 ? RAY_ALPHAPOLY : 0) | (skytexturelight ? RAY_SKIPSKY : 0)) > 1e15f))
         {
             float intensity;
             switch(w->type&LM_TYPE)
@@ -735,7 +735,7 @@ static uint generatelumel(lightmapworker *w, const float tolerance, uint lightma
         }
     }
 
-    if(ambientocclusion && lmao) occlusion = calcocclusion(w->shadowraycache, target, normal, tolerance);
+    if(ambientocclusion && lmao) occlusion = calcocclusion(w->planecache, target, normal, tolerance);
 
     switch(w->type&LM_TYPE)
     {
@@ -818,7 +818,7 @@ static void calcskylight(lightmapworker *w, const vec &o, const vec &normal, flo
     int hit = 0;
     if(w) loopi(17) 
     {
-        if(normal.dot(rays[i])>=0 && shadowray(w->shadowraycache, vec(rays[i]).mul(tolerance).add(o), rays[i], 1e16f, flags, t)>1e15f) hit++;
+        if(normal.dot(rays[i])>=0 && shadowray(w->planecache, vec(rays[i]).mul(tolerance).add(o), rays[i], 1e16f, flags, t)>1e15f) hit++;
     }
     else loopi(17) 
     {
@@ -2189,11 +2189,10 @@ lightmapworker::lightmapworker()
     occlusiondata = new uchar[4*(LM_MAXW+1 + 4)*(LM_MAXH+1 + 4)];
     colordata = new vec[4*(LM_MAXW+1 + 4)*(LM_MAXH+1 + 4)];
     raydata = new vec[(LM_MAXW + 4)*(LM_MAXH + 4)];
-    shadowraycache = newshadowraycache();
+    planecache = newclipcache();
     blendmapcache = newblendmapcache();
     needspace = doneworking = false;
     spacecond = nullptr;
-    thread = nullptr;
 }
 
 lightmapworker::~lightmapworker()
@@ -2204,14 +2203,14 @@ lightmapworker::~lightmapworker()
     delete[] blur;
     delete[] colordata;
     delete[] raydata;
-    freeshadowraycache(shadowraycache);
+    freeclipcache(planecache);
     freeblendmapcache(blendmapcache);
 }
 
 void lightmapworker::cleanupthread()
 {
     if(spacecond) { SDL_DestroyCond(spacecond); spacecond = nullptr; }
-    thread = nullptr;
+    thread.reset();
 }
 
 void lightmapworker::reset()
@@ -2219,15 +2218,15 @@ void lightmapworker::reset()
     bufstart = bufused = 0;
     firstlightmap = lastlightmap = curlightmaps = nullptr;
     needspace = doneworking = false;
-    resetshadowraycache(shadowraycache);
+    resetclipcache(planecache);
 }
 
 bool lightmapworker::setupthread()
 {
     if(!spacecond) spacecond = SDL_CreateCond();
     if(!spacecond) return false;
-    thread = SDL_CreateThread(work, "lightmap worker", this);
-    return thread!=nullptr;
+    thread = inexor::util::jobs().spawn([this] { work(this); }, {}, true);
+    return true;
 }
 
 static Uint32 calclighttimer(Uint32 interval, void *param)
@@ -2266,7 +2265,8 @@ static void setupthreads(int numthreads)
     loopi(2) lightmaptasks[i].setsize(0);
     lightmapexts.setsize(0);
     packidx = allocidx = 0;
-    lightmapping = numthreads;
+    // the workers block until there is work, so there must not be more of them than the job system has threads
+    lightmapping = numthreads > 1 ? max(min(numthreads, inexor::util::jobs().numworkers()), 1) : 1;
     if(lightmapping > 1)
     {
         ALLOCLOCK(lightlock, SDL_CreateMutex);
@@ -2304,7 +2304,7 @@ static void cleanupthreads()
         loopv(lightmapworkers) 
         {
             lightmapworker *w = lightmapworkers[i];
-            if(w->thread) SDL_WaitThread(w->thread, nullptr);
+            if(w->thread) inexor::util::jobs().wait(w->thread);
         }
     }
     loopv(lightmapexts)
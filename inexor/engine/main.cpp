@@ -9,7 +9,6 @@
 #include <string>                                     // for string
 
 #include "SDL.h"                                      // for SDL_Quit, SDL_Init
-#include "SDL_cpuinfo.h"                              // for SDL_GetCPUCount
 #include "SDL_error.h"                                // for SDL_GetError
 #include "SDL_hints.h"                                // for SDL_SetHint
 #include "SDL_mouse.h"                                // for SDL_ShowCursor
@@ -32,6 +31,7 @@
 #include "inexor/engine/rendertext.hpp"               // for setfont
 #include "inexor/engine/shader.hpp"                   // for loadshaders
 #include "inexor/engine/world.hpp"                    // for emptymap
+#include "inexor/fpsgame/ai.hpp"                      // for stoproutes
 #include "inexor/fpsgame/client.hpp"                  // for ispaused, games...
 #include "inexor/fpsgame/config.hpp"                  // for savedservers
 #include "inexor/fpsgame/fps.hpp"                     // for initclient, ite...
@@ -47,10 +47,11 @@
 #include "inexor/shared/tools.hpp"                    // for clamp
 #include "inexor/sound/mumble.hpp"                    // for initmumble
 #include "inexor/sound/sound.hpp"                     // for clear_sound
-#include "inexor/texture/texture.hpp"                 // for reloadtexture
+#include "inexor/texture/texture.hpp"                 // for reloadtexture, uploadtextures
 #include "inexor/ui/legacy/menus.hpp"                 // for initwarning
 #include "inexor/ui/screen/ScreenManager.hpp"         // for ScreenManager
 #include "inexor/util/Subsystem.hpp"                  // for Metasystem, SUB...
+#include "inexor/util/jobs.hpp"                       // for jobs, detect_cpu_...
 #include "inexor/util/legacy_time.hpp"                // for updatetime, las...
 
 using namespace inexor::sound;
@@ -74,6 +75,7 @@ void cleanup()
     extern void clear_mdls();
 
     recorder::stop();
+    ai::stoproutes();
 
     screen_manager.cleanupSDL();
 
@@ -267,7 +269,9 @@ COMMAND(resetgl, "");
 
 
 
-VAR(numcpus, 1, 1, 16);
+/// The hardware threads we use: the main thread plus numcpus-1 workers of the engine wide job system.
+/// There is always at least one worker, the background tasks (lightmap workers, name lookups) need one.
+VARF(numcpus, 1, 1, inexor::util::job_system::MAXWORKERS, inexor::util::jobs().start(max(int(numcpus) - 1, 1)));
 
 /// find command line argument
 static bool findarg(int argc, char **argv, const char *str)
@@ -330,7 +334,10 @@ int main(int argc, char **argv)
 
     initing = NOT_INITING;
 
-    numcpus = clamp(SDL_GetCPUCount(), 1, 16);
+    inexor::util::cpu_topology cpus = inexor::util::detect_cpu_topology();
+    Log.start_stop->info("init: {} hardware threads on {} cores in {} packages", cpus.logical, cpus.cores, cpus.packages);
+    numcpus = min(cpus.logical, int(inexor::util::job_system::MAXWORKERS));
+    inexor::util::jobs().start(max(int(numcpus) - 1, 1));
 
     Log.start_stop->info("init: SDL");
 
@@ -465,6 +472,7 @@ int main(int argc, char **argv)
 
         inbetweenframes = false;
 
+        uploadtextures();
         if(mainmenu) gl_drawmainmenu();
         else gl_drawframe();
 
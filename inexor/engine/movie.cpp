@@ -19,7 +19,6 @@
 #include "SDL_mutex.h"                                // for SDL_UnlockMutex
 #include "SDL_opengl.h"                               // for GLuint, glReadP...
 #include "SDL_stdinc.h"                               // for Uint16, Uint8
-#include "SDL_thread.h"                               // for SDL_CreateThread
 #include "inexor/engine/frame.hpp"                    // for getfps, inbetwe...
 #include "inexor/engine/glexts.hpp"                   // for glBindFramebuffer_
 #include "inexor/engine/movie.hpp"
@@ -42,6 +41,7 @@
 #include "inexor/shared/tools.hpp"                    // for max, swap
 #include "inexor/texture/texture.hpp"                 // for texalign, creat...
 #include "inexor/ui/screen/ScreenManager.hpp"         // for ScreenManager
+#include "inexor/util/jobs.hpp"                       // for jobs, task_ptr
 #include "inexor/util/legacy_time.hpp"                // for time_since_prog...
 
 struct unionfind
@@ -891,9 +891,11 @@ namespace recorder
     static uint scalew = 0, scaleh = 0;
     static GLuint encodefb = 0, encoderb = 0;
 
-    static SDL_Thread *thread = nullptr;
+    /// Every read frame is encoded by a task of the job system which depends on the one of the frame before, so they are written in order.
+    /// The task encoding the frame in videobuffers.data[i] is in encoding[i%MAXVIDEOBUFFERS], counted by numqueued.
+    static inexor::util::task_ptr encoding[MAXVIDEOBUFFERS], lastencode;
+    static uint numqueued = 0;
     static SDL_mutex *videolock = nullptr;
-    static SDL_cond *shouldencode = nullptr, *shouldread = nullptr;
 
     bool isrecording() { return file != nullptr; }
     
@@ -907,37 +909,35 @@ namespace recorder
         return inbetweenframes ? time_since_program_start() : totalmillis;
     }
 
-    int videoencoder(void *data) // runs on a separate thread
+    void encodeframe() // runs on a worker of the job system
     {
-        for(int numvid = 0, numsound = 0;;)
-        {   
-            SDL_LockMutex(videolock);
-            for(; numvid > 0; numvid--) videobuffers.remove();
-            SDL_CondSignal(shouldread);
-            while(videobuffers.empty() && state == REC_OK) SDL_CondWait(shouldencode, videolock);
-            if(state != REC_OK) { SDL_UnlockMutex(videolock); break; }
-            videobuffer &m = videobuffers.removing();
-            numvid++;
-            SDL_UnlockMutex(videolock);
-            
-            if(file->soundfrequency > 0)
+        SDL_LockMutex(videolock);
+        videobuffer &m = videobuffers.removing();
+        SDL_UnlockMutex(videolock);
+
+        if(state == REC_OK && file->soundfrequency > 0)
+        {
+            // chug data from lock protected buffer to avoid holding lock while writing to file
+            int numsound = 0;
+            SDL_LockMutex(soundlock);
+            for(; numsound < soundbuffers.length(); numsound++)
             {
-                // chug data from lock protected buffer to avoid holding lock while writing to file
-                SDL_LockMutex(soundlock);
-                for(; numsound > 0; numsound--) soundbuffers.remove();
-                for(; numsound < soundbuffers.length(); numsound++)
-                {
-                    soundbuffer &s = soundbuffers.removing(numsound);
-                    if(s.frame > m.frame) break; // sync with video
-                }
-                SDL_UnlockMutex(soundlock);
-                loopi(numsound)
-                {
-                    soundbuffer &s = soundbuffers.removing(i);
-                    if(!file->writesound(s.sound, s.size, s.frame)) state = REC_FILERROR;
-                }
+                soundbuffer &s = soundbuffers.removing(numsound);
+                if(s.frame > m.frame) break; // sync with video
             }
-            
+            SDL_UnlockMutex(soundlock);
+            loopi(numsound)
+            {
+                soundbuffer &s = soundbuffers.removing(i);
+                if(!file->writesound(s.sound, s.size, s.frame)) state = REC_FILERROR;
+            }
+            SDL_LockMutex(soundlock);
+            loopi(numsound) soundbuffers.remove();
+            SDL_UnlockMutex(soundlock);
+        }
+
+        if(state == REC_OK)
+        {
             int duplicates = m.frame - (int)file->videoframes + 1;
             if(duplicates > 0) // determine how many frames have been dropped over the sample window
             {
@@ -949,11 +949,12 @@ namespace recorder
             //printf("frame %d->%d (%d dps): sound = %d bytes\n", file->videoframes, nextframenum, dps, m.soundlength);
             if(calcquality() < movieminquality) state = REC_TOOSLOW;
             else if(!file->writevideoframe(m.video, m.w, m.h, m.format, m.frame)) state = REC_FILERROR;
-            
-            m.frame = ~0U;
         }
-        
-        return 0;
+
+        SDL_LockMutex(videolock);
+        m.frame = ~0U;
+        videobuffers.remove();
+        SDL_UnlockMutex(videolock);
     }
     
     void soundencoder(void *udata, Uint8 *stream, int len) // callback occurs on a separate thread
@@ -1017,9 +1018,7 @@ namespace recorder
 
         soundlock = SDL_CreateMutex();
         videolock = SDL_CreateMutex();
-        shouldencode = SDL_CreateCond();
-        shouldread = SDL_CreateCond();
-        thread = SDL_CreateThread(videoencoder, "video encoder", nullptr); 
+        numqueued = 0;
         //if(file->soundfrequency > 0) Mix_SetPostMix(soundencoder, NULL); // TODO Sound refractoring
     }
 
@@ -1038,11 +1037,9 @@ namespace recorder
         if(state == REC_OK) state = REC_USERHALT;
         //if(file->soundfrequency > 0) Mix_SetPostMix(NULL, NULL); // TODO Sound refractoring
 
-        SDL_LockMutex(videolock); // wakeup thread enough to kill it
-        SDL_CondSignal(shouldencode);
-        SDL_UnlockMutex(videolock);
-
-        SDL_WaitThread(thread, nullptr); // block until thread is finished
+        inexor::util::jobs().wait(lastencode); // the frames still queued skip encoding now
+        lastencode.reset();
+        loopi(MAXVIDEOBUFFERS) encoding[i].reset();
 
         cleanup();
 
@@ -1051,12 +1048,8 @@ namespace recorder
 
         SDL_DestroyMutex(soundlock);
         SDL_DestroyMutex(videolock);
-        SDL_DestroyCond(shouldencode);
-        SDL_DestroyCond(shouldread);
 
         soundlock = videolock = nullptr;
-        shouldencode = shouldread = nullptr;
-        thread = nullptr;
 
         static const char * const mesgs[] = { "ok", "stopped", "computer too slow", "file error"};
         Log.std->info("movie recording halted: {0} ({1} frames)", mesgs[state], file->videoframes);
@@ -1171,20 +1164,21 @@ namespace recorder
             stop();
             return false;
         }
+        // the buffer we would read into next is the oldest one still being encoded
+        if(moviesync) inexor::util::jobs().wait(encoding[numqueued%MAXVIDEOBUFFERS]);
         SDL_LockMutex(videolock);
-        if(moviesync && videobuffers.full()) SDL_CondWait(shouldread, videolock);
         uint nextframe = (max(gettime() - starttime, 0)*file->videofps)/1000;
-        if(!videobuffers.full() && (lastframe == ~0U || nextframe > lastframe))
+        videobuffer *m = !videobuffers.full() && (lastframe == ~0U || nextframe > lastframe) ? &videobuffers.adding() : nullptr;
+        SDL_UnlockMutex(videolock);
+        if(m)
         {
-            videobuffer &m = videobuffers.adding();
-            SDL_UnlockMutex(videolock);
-            readbuffer(m, nextframe);
+            readbuffer(*m, nextframe);
             SDL_LockMutex(videolock);
             lastframe = nextframe;
             videobuffers.add();
-            SDL_CondSignal(shouldencode);
+            SDL_UnlockMutex(videolock);
+            lastencode = encoding[numqueued++%MAXVIDEOBUFFERS] = inexor::util::jobs().spawn(encodeframe, { lastencode });
         }
-        SDL_UnlockMutex(videolock);
         return true;
     }
 
@@ -19,6 +19,7 @@
 #include "inexor/engine/octaedit.hpp"
 #include "inexor/engine/octarender.hpp"               // for allchanged, des...
 #include "inexor/engine/octree.hpp"                   // for selinfo, cube
+#include "inexor/engine/pvs.hpp"                      // for pvschanged
 #include "inexor/engine/rendergl.hpp"                 // for camdir, disable...
 #include "inexor/engine/renderva.hpp"                 // for isvisiblesphere
 #include "inexor/engine/shader.hpp"                   // for SlotShaderParam
@@ -725,7 +726,9 @@ void commitchanges(bool force)
 void changed(const block3 &sel, bool commit = true)
 {
     if(sel.s.iszero()) return;
-    readychanges(ivec(sel.o).sub(1), ivec(sel.s).mul(sel.grid).add(sel.o).add(1), worldroot, ivec(0, 0, 0), worldsize/2);
+    ivec bbmin = ivec(sel.o).sub(1), bbmax = ivec(sel.s).mul(sel.grid).add(sel.o).add(1);
+    readychanges(bbmin, bbmax, worldroot, ivec(0, 0, 0), worldsize/2);
+    pvschanged(bbmin, bbmax);
     haschanged = true;
 
     if(commit) commitchanges();
@@ -2601,7 +2604,9 @@ void mpreplacetex(int oldtex, int newtex, bool insel, selinfo &sel, bool local,
     {
         loopi(8) replacetexcube(worldroot[i], oldtex, newtex);
     }
-    if(update) allchanged();
+    if(!update) return;
+    if(insel) texchanged(oldtex, sel.o, ivec(sel.s).mul(sel.grid).add(sel.o));
+    else texchanged(oldtex, ivec(0, 0, 0), ivec(worldsize, worldsize, worldsize));
 }
 
 bool mpreplacetex(int oldtex, int newtex, bool insel, selinfo &sel, ucharbuf &buf)
@@ -9,8 +9,10 @@
 #include <string.h>                                   // for memcpy, memset
 #include <algorithm>                                  // for max, min, swap
 #include <memory>                                     // for __shared_ptr
+#include <vector>                                     // for vector
 
 #include "SDL_opengl.h"                               // for GLuint, GLenum
+#include "SDL_timer.h"                                // for SDL_GetTicks
 #include "inexor/engine/blob.hpp"                     // for resetblobs
 #include "inexor/engine/glemu.hpp"                    // for bindebo, bindvbo
 #include "inexor/engine/glexts.hpp"                   // for glBindBuffer_
@@ -40,6 +42,7 @@
 #include "inexor/texture/cubemap.hpp"                 // for closestenvmap
 #include "inexor/texture/slot.hpp"                    // for VSlot, lookupvslot
 #include "inexor/texture/texture.hpp"                 // for ::TEX_ENVMAP
+#include "inexor/util/jobs.hpp"                       // for jobs, task_ptr
 
 struct vboinfo
 {
@@ -250,9 +253,11 @@ struct vacollect : verthash
     vector<grasstri> grasstris;
     vector<materialsurface> matsurfs;
     vector<octaentities *> mapmodels;
+    vector<occluder> occluders;
     vector<ushort> skyindices, explicitskyindices;
     vector<facebounds> skyfaces[6];
     int worldtris, skytris, skymask, skyclip, skyarea;
+    vec shadowmapmin, shadowmapmax;
 
     void clear()
     {
@@ -266,6 +271,7 @@ struct vacollect : verthash
         explicitskyindices.setsize(0);
         matsurfs.setsize(0);
         mapmodels.setsize(0);
+        occluders.setsize(0);
         grasstris.setsize(0);
         texs.setsize(0);
         loopi(6) skyfaces[i].setsize(0);
@@ -544,21 +550,24 @@ struct vacollect : verthash
         }
 
         if(mapmodels.length()) va->mapmodels.put(mapmodels.getbuf(), mapmodels.length());
+
+        if(occluders.length()) va->occluders.move(occluders);
     }
 
     bool emptyva()
     {
-        return verts.empty() && matsurfs.empty() && skyindices.empty() && explicitskyindices.empty() && grasstris.empty() && mapmodels.empty();
+        return verts.empty() && matsurfs.empty() && skyindices.empty() && explicitskyindices.empty() && grasstris.empty() && mapmodels.empty() && occluders.empty();
     }            
-} vc;
+};
+
+/// The va the calling thread is generating geometry for, see genvajob().
+static thread_local vacollect *vc = nullptr;
 
 int recalcprogress = 0;
 #define progress(s)     if((recalcprogress++&0xFFF)==0) renderprogress(recalcprogress/(float)allocnodes, s);
 
 vector<tjoint> tjoints;
 
-vec shadowmapmin, shadowmapmax;
-
 int calcshadowmask(vec *pos, int numpos)
 {
     extern vec shadowdir;
@@ -578,8 +587,8 @@ int calcshadowmask(vec *pos, int numpos)
     loopk(numpos) if(used&(1<<k))
     {
         const vec &v = pos[k];
-        shadowmapmin.min(v);
-        shadowmapmax.max(v);
+        vc->shadowmapmin.min(v);
+        vc->shadowmapmax.max(v);
     }
     return mask;
 }
@@ -624,11 +633,11 @@ vec orientation_bitangent[6][3] =
 
 void addtris(const sortkey &key, int orient, vertex *verts, int *index, int numverts, int convex, int shadowmask, int tj)
 {
-    int &total = key.tex==DEFAULT_SKY ? vc.skytris : vc.worldtris;
+    int &total = key.tex==DEFAULT_SKY ? vc->skytris : vc->worldtris;
     int edge = orient*(MAXFACEVERTS+1);
     loopi(numverts-2) if(index[0]!=index[i+1] && index[i+1]!=index[i+2] && index[i+2]!=index[0])
     {
-        vector<ushort> &idxs = key.tex==DEFAULT_SKY ? vc.explicitskyindices : vc.indices[key].tris[(shadowmask>>i)&1];
+        vector<ushort> &idxs = key.tex==DEFAULT_SKY ? vc->explicitskyindices : vc->indices[key].tris[(shadowmask>>i)&1];
         int left = index[0], mid = index[i+1], right = index[i+2], start = left, i0 = left, i1 = -1;
         loopk(4)
         {
@@ -691,7 +700,7 @@ void addtris(const sortkey &key, int orient, vertex *verts, int *index, int numv
                     vt.lm.y = short(v1.lm.y + (v2.lm.y-v1.lm.y)*offset);
                     vt.norm.lerp(v1.norm, v2.norm, offset);
                     vt.tangent.lerp(v1.tangent, v2.tangent, offset);
-                    int i2 = vc.addvert(vt);
+                    int i2 = vc->addvert(vt);
                     if(i2 < 0) return;
                     if(i1 >= 0)
                     {
@@ -712,7 +721,7 @@ void addtris(const sortkey &key, int orient, vertex *verts, int *index, int numv
 
 void addgrasstri(int face, vertex *verts, int numv, ushort texture, ushort lmid)
 {
-    grasstri &g = vc.grasstris.add();
+    grasstri &g = vc->grasstris.add();
     int i1, i2, i3, i4;
     if(numv <= 3 && face%2) { i1 = face+1; i2 = face+2; i3 = i4 = 0; }
     else { i1 = 0; i2 = face+1; i3 = face+2; i4 = numv > 3 ? face+3 : i3; } 
@@ -723,7 +732,7 @@ void addgrasstri(int face, vertex *verts, int numv, ushort texture, ushort lmid)
     g.numv = numv;
 
     g.surface.toplane(g.v[0], g.v[1], g.v[2]);
-    if(g.surface.z <= 0) { vc.grasstris.pop(); return; }
+    if(g.surface.z <= 0) { vc->grasstris.pop(); return; }
 
     g.minz = min(min(g.v[0].z, g.v[1].z), min(g.v[2].z, g.v[3].z));
     g.maxz = max(max(g.v[0].z, g.v[1].z), max(g.v[2].z, g.v[3].z));
@@ -890,14 +899,14 @@ void addcubeverts(VSlot &vslot, int orient, int size, vec *pos, int convex, usho
             v.norm = vinfo && vinfo[k].norm && envmap != EMID_NONE ? bvec(decodenormal(vinfo[k].norm)) : bvec(128, 128, 255);
             v.tangent = bvec4(255, 128, 128, 255);
         }
-        index[k] = vc.addvert(v);
+        index[k] = vc->addvert(v);
         if(index[k] < 0) return;
     }
 
     if(texture == DEFAULT_SKY)
     {
-        loopk(numverts) vc.skyclip = min(vc.skyclip, int(pos[k].z*8)>>3);
-        vc.skymask |= 0x3F&~(1<<orient);
+        loopk(numverts) vc->skyclip = min(vc->skyclip, int(pos[k].z*8)>>3);
+        vc->skymask |= 0x3F&~(1<<orient);
     }
 
     if(lmid >= LMID_RESERVED) lmid = lm ? lm->tex : LMID_AMBIENT;
@@ -1185,8 +1194,8 @@ void genskyfaces(cube &c, const ivec &o, int size)
         m.v2 = m.v1 + (size<<3);
         minskyface(c, orient, o, size, m);
         if(m.u1 >= m.u2 || m.v1 >= m.v2) continue;
-        vc.skyarea += (int(m.u2-m.u1)*int(m.v2-m.v1) + (1<<(2*3))-1)>>(2*3);
-        vc.skyfaces[orient].add(m);
+        vc->skyarea += (int(m.u2-m.u1)*int(m.v2-m.v1) + (1<<(2*3))-1)>>(2*3);
+        vc->skyfaces[orient].add(m);
     }
 }
 
@@ -1195,9 +1204,9 @@ void addskyverts(const ivec &o, int size)
     loopi(6)
     {
         int dim = dimension(i), c = C[dim], r = R[dim];
-        vector<facebounds> &sf = vc.skyfaces[i]; 
+        vector<facebounds> &sf = vc->skyfaces[i]; 
         if(sf.empty()) continue;
-        vc.skymask |= 0x3F&~(1<<opposite(i));
+        vc->skymask |= 0x3F&~(1<<opposite(i));
         sf.setsize(mergefaces(i, sf.getbuf(), sf.length()));
         loopvj(sf)
         {
@@ -1211,19 +1220,19 @@ void addskyverts(const ivec &o, int size)
                 if(coords[dim]) v[dim] += size;
                 v[c] = (o[c]&~0xFFF) + (coords[c] ? m.u2 : m.u1)/8.0f;
                 v[r] = (o[r]&~0xFFF) + (coords[r] ? m.v2 : m.v1)/8.0f;
-                index[k] = vc.addvert(v);
+                index[k] = vc->addvert(v);
                 if(index[k] < 0) goto nextskyface;
-                vc.skyclip = min(vc.skyclip, int(v.z*8)>>3);
+                vc->skyclip = min(vc->skyclip, int(v.z*8)>>3);
             }
-            if(vc.skytris + 6 > USHRT_MAX) break;
-            vc.skytris += 6;
-            vc.skyindices.add(index[0]);
-            vc.skyindices.add(index[1]);
-            vc.skyindices.add(index[2]);
-
-            vc.skyindices.add(index[0]);
-            vc.skyindices.add(index[2]);
-            vc.skyindices.add(index[3]);
+            if(vc->skytris + 6 > USHRT_MAX) break;
+            vc->skytris += 6;
+            vc->skyindices.add(index[0]);
+            vc->skyindices.add(index[1]);
+            vc->skyindices.add(index[2]);
+
+            vc->skyindices.add(index[0]);
+            vc->skyindices.add(index[2]);
+            vc->skyindices.add(index[3]);
         nextskyface:;
         }
     }
@@ -1235,17 +1244,16 @@ int allocva = 0;
 int wtris = 0, wverts = 0, vtris = 0, vverts = 0, glde = 0, gbatches = 0;
 vector<vtxarray *> valist, varoot;
 
+/// Allocate an empty va, its geometry is filled in by uploadvajob() once it was generated.
 vtxarray *newva(const ivec &co, int size)
 {
-    vc.optimize();
-
     vtxarray *va = new vtxarray;
     va->parent = nullptr;
     va->o = co;
     va->size = size;
-    va->skyarea = vc.skyarea;
-    va->skyfaces = vc.skymask;
-    va->skyclip = vc.skyclip < INT_MAX ? vc.skyclip : INT_MAX;
+    va->skyarea = 0;
+    va->skyfaces = 0;
+    va->skyclip = INT_MAX;
     va->curvfc = VFC_NOT_VISIBLE;
     va->occluded = OCCLUDE_NOTHING;
     va->query = nullptr;
@@ -1253,11 +1261,11 @@ vtxarray *newva(const ivec &co, int size)
     va->bbmax = ivec(-1, -1, -1);
     va->hasmerges = 0;
     va->mergelevel = -1;
+    va->verts = va->tris = va->blends = va->alphabacktris = va->alphafronttris = 0;
+    va->vbuf = va->ebuf = va->skybuf = 0;
+    va->eslist = nullptr;
+    va->matbuf = nullptr;
 
-    vc.setupdata(va);
-
-    wverts += va->verts;
-    wtris  += va->tris + va->blends + va->alphabacktris + va->alphafronttris;
     allocva++;
     valist.add(va);
 
@@ -1266,6 +1274,7 @@ vtxarray *newva(const ivec &co, int size)
 
 void destroyva(vtxarray *va, bool reparent)
 {
+    invalidatevacull();
     wverts -= va->verts;
     wtris -= va->tris + va->blends + va->alphabacktris + va->alphafronttris;
     allocva--;
@@ -1352,7 +1361,7 @@ void updatevabbs(bool force)
 
 struct mergedface
 {   
-    uchar orient, lmid, numverts;
+    uchar orient, lmid, numverts, level;
     ushort mat, tex, envmap;
     vertinfo *verts;
     int tjoints;
@@ -1362,6 +1371,22 @@ struct mergedface
 static int vahasmerges = 0, vamergemax = 0;
 static vector<mergedface> vamerges[MAXMERGELEVEL+1];
 
+/// A va to fill: planned by setva() on the main thread, generated by genvajob() on any thread and uploaded by uploadvajob() on the main thread again.
+struct vajob
+{
+    cube *c;
+    ivec o;
+    int size, csi;
+    vtxarray *va;
+    const cube *neighbours[32];     ///< the neighbourstack above c
+    int numneighbours;
+    vector<mergedface> merges;      ///< faces merged from further down which end up in this va
+    vacollect *vc;                  ///< where the geometry is generated to, only set while the job is in flight
+    ivec geommin, geommax;
+    bool dropped;
+};
+static vector<vajob> vajobs;
+
 int genmergedfaces(cube &c, const ivec &co, int size, int minlevel = -1)
 {
     if(!c.ext || isempty(c)) return -1;
@@ -1436,30 +1461,97 @@ int findmergedfaces(cube &c, const ivec &co, int size, int csi, int minlevel)
     else return -1;
 }
 
-void addmergedverts(int level, const ivec &o)
+static vector<int> vaslots;       ///< the vslots updateva() found which are not linked yet, see loadvaslots()
+static vector<uchar> vaslotqueued; ///< whether a vslot index is in vaslots
+
+static void queuevaslot(int index)
+{
+    if(lookupvslot(index, false).linked) return;
+    while(vaslotqueued.length() <= index) vaslotqueued.add(0);
+    if(vaslotqueued[index]) return;
+    vaslotqueued[index] = 1;
+    vaslots.add(index);
+}
+
+/// Load the slots of all queued vslots at once, so their textures are decoded in parallel, and link their shaders.
+/// The vertices depend on the texture sizes, so this has to be done before genvas().
+static void loadvaslots()
+{
+    vector<Slot *> load;
+    loopv(vaslots)
+    {
+        Slot *s = lookupvslot(vaslots[i], false).slot;
+        if(!s->loaded && load.find(s) < 0) load.add(s);
+    }
+    loadslots(load);
+    loopv(vaslots)
+    {
+        lookupvslot(vaslots[i], true);
+        vaslotqueued[vaslots[i]] = 0;
+    }
+    vaslots.setsize(0);
+}
+
+/// Hand the faces merged at this level to the va being planned, genvajob() generates them with the rest of it.
+void addmergedverts(int level)
 {
     vector<mergedface> &mfl = vamerges[level];
     if(mfl.empty()) return;
-    vec vo(ivec(o).mask(~0xFFF));
-    vec pos[MAXFACEVERTS];
+    vector<mergedface> &merges = vajobs.last().merges;
     loopv(mfl)
     {
-        mergedface &mf = mfl[i];
-        int numverts = mf.numverts&MAXFACEVERTS;
-        loopi(numverts)
-        {
-            vertinfo &v = mf.verts[i];
-            pos[i] = vec(v.x, v.y, v.z).mul(1.0f/8).add(vo);
-        }
-        VSlot &vslot = lookupvslot(mf.tex, true);
-        int grassy = vslot.slot->autograss && mf.orient!=O_BOTTOM && mf.numverts&LAYER_TOP ? 2 : 0;
-        addcubeverts(vslot, mf.orient, 1<<level, pos, 0, mf.tex, mf.lmid, mf.verts, numverts, mf.tjoints, mf.envmap, grassy, (mf.mat&MAT_ALPHA)!=0, mf.numverts&LAYER_BLEND);
-        vahasmerges |= MERGE_USE;
+        mergedface &mf = merges.add(mfl[i]);
+        mf.level = level;
+        queuevaslot(mf.tex); // workers must not load textures
     }
+    vahasmerges |= MERGE_USE;
     mfl.setsize(0);
 }
 
-void rendercube(cube &c, const ivec &co, int size, int csi, int &maxlevel)  // creates vertices and indices ready to be put into a va
+static void addmergedface(const mergedface &mf, const vec &vo)
+{
+    int numverts = mf.numverts&MAXFACEVERTS;
+    vec pos[MAXFACEVERTS];
+    loopi(numverts)
+    {
+        const vertinfo &v = mf.verts[i];
+        pos[i] = vec(v.x, v.y, v.z).mul(1.0f/8).add(vo);
+    }
+    VSlot &vslot = lookupvslot(mf.tex, false);
+    int grassy = vslot.slot->autograss && mf.orient!=O_BOTTOM && mf.numverts&LAYER_TOP ? 2 : 0;
+    addcubeverts(vslot, mf.orient, 1<<mf.level, pos, 0, mf.tex, mf.lmid, mf.verts, numverts, mf.tjoints, mf.envmap, grassy, (mf.mat&MAT_ALPHA)!=0, mf.numverts&LAYER_BLEND);
+}
+
+VARF(occludersize, 1, 8, 0x1000, allchanged());
+
+/// Remember solid cubes of at least occludersize which can be seen from somewhere, their visible sides hide whatever is behind them.
+static void addoccluder(cube &c, const ivec &co, int size)
+{
+    if(size < occludersize || !isentirelysolid(c) || c.material&MAT_ALPHA) return;
+    int faces = 0;
+    loopi(6) if(visibleface(c, i, co, size)) faces |= 1<<i;
+    if(!faces) return;
+    occluder &o = vc->occluders.add();
+    o.o = co;
+    o.size = size;
+    o.faces = faces;
+}
+
+/// Queue the textures gencubeverts() will look up for this cube, it may run on a worker thread which can not load them.
+static void preloadcubeslots(cube &c, const ivec &co, int size)
+{
+    if(!(c.visible&0xC0)) return;
+    int vismask = ~c.merged & 0x3F;
+    if(!(c.visible&0x80)) vismask &= c.visible;
+    loopi(6) if(vismask&(1<<i) && visibletris(c, i, co, size))
+    {
+        queuevaslot(c.texture[i]);
+        VSlot &vslot = lookupvslot(c.texture[i], false);
+        if(vslot.layer && !(c.material&MAT_ALPHA)) queuevaslot(vslot.layer);
+    }
+}
+
+void rendercube(cube &c, const ivec &co, int size, int csi, int &maxlevel)  // finds the faces merged into a va, genvacube() creates its vertices
 {
     //if(size<=16) return;
     if(c.ext && c.ext->va) 
@@ -1483,30 +1575,49 @@ void rendercube(cube &c, const ivec &co, int size, int csi, int &maxlevel)  // c
         }
         --neighbourdepth;
 
-        if(csi <= MAXMERGELEVEL && vamerges[csi].length()) addmergedverts(csi, co);
-
-        if(c.ext)
-        {
-            if(c.ext->ents && c.ext->ents->mapmodels.length()) vc.mapmodels.add(c.ext->ents);
-        }
+        if(csi <= MAXMERGELEVEL && vamerges[csi].length()) addmergedverts(csi);
         return;
     }
     
-    genskyfaces(c, co, size);
-
     if(!isempty(c)) 
     {
-        gencubeverts(c, co, size, csi);
+        preloadcubeslots(c, co, size);
         if(c.merged) maxlevel = max(maxlevel, genmergedfaces(c, co, size));
     }
-    if(c.material != MAT_AIR) genmatsurfs(c, co, size, vc.matsurfs);
 
-    if(c.ext)
+    if(csi <= MAXMERGELEVEL && vamerges[csi].length()) addmergedverts(csi);
+}
+
+/// Create the vertices, sky, materials and occluders of the cubes of a va, but not of the vas below it.
+static void genvacube(cube &c, const ivec &co, int size, int csi, bool root = false)
+{
+    if(!root && c.ext && c.ext->va) return;
+
+    if(c.children)
     {
-        if(c.ext->ents && c.ext->ents->mapmodels.length()) vc.mapmodels.add(c.ext->ents);
+        neighbourstack[++neighbourdepth] = c.children;
+        loopi(8)
+        {
+            ivec o(i, co, size/2);
+            genvacube(c.children[i], o, size/2, csi-1);
+        }
+        --neighbourdepth;
+    }
+    else
+    {
+        genskyfaces(c, co, size);
+        if(!isempty(c))
+        {
+            gencubeverts(c, co, size, csi);
+            addoccluder(c, co, size);
+        }
+        if(c.material != MAT_AIR) genmatsurfs(c, co, size, vc->matsurfs);
     }
 
-    if(csi <= MAXMERGELEVEL && vamerges[csi].length()) addmergedverts(csi, co);
+    if(c.ext)
+    {
+        if(c.ext->ents && c.ext->ents->mapmodels.length()) vc->mapmodels.add(c.ext->ents);
+    }
 }
 
 void calcgeombb(const ivec &co, int size, ivec &bbmin, ivec &bbmax)
@@ -1514,9 +1625,9 @@ void calcgeombb(const ivec &co, int size, ivec &bbmin, ivec &bbmax)
     vec vmin(co), vmax = vmin;
     vmin.add(size);
 
-    loopv(vc.verts)
+    loopv(vc->verts)
     {
-        const vec &v = vc.verts[i].pos;
+        const vec &v = vc->verts[i].pos;
         vmin.min(v);
         vmax.max(v);
     }
@@ -1529,9 +1640,9 @@ void calcmatbb(const ivec &co, int size, ivec &bbmin, ivec &bbmax)
 {
     bbmax = co;
     (bbmin = bbmax).add(size);
-    loopv(vc.matsurfs)
+    loopv(vc->matsurfs)
     {
-        materialsurface &m = vc.matsurfs[i];
+        materialsurface &m = vc->matsurfs[i];
         switch(m.material&MATF_VOLUME)
         {
             case MAT_WATER:
@@ -1557,46 +1668,140 @@ void calcmatbb(const ivec &co, int size, ivec &bbmin, ivec &bbmax)
     }
 }
 
+/// Plan a va for c: allocate it and collect the faces merged into it, its geometry is generated later (see genvas()).
 void setva(cube &c, const ivec &co, int size, int csi)
 {
     ASSERT(size <= 0x1000);
 
-    int vamergeoffset[MAXMERGELEVEL+1];
-    loopi(MAXMERGELEVEL+1) vamergeoffset[i] = vamerges[i].length();
-
-    vc.origin = co;
-    vc.size = size;
-
-    shadowmapmin = vec(co).add(size);
-    shadowmapmax = vec(co);
+    vajob &j = vajobs.add();
+    j.c = &c;
+    j.o = co;
+    j.size = size;
+    j.csi = csi;
+    j.numneighbours = neighbourdepth+1;
+    memcpy(j.neighbours, neighbourstack, j.numneighbours*sizeof(j.neighbours[0]));
+    j.vc = nullptr;
+    j.dropped = false;
 
     int maxlevel = -1;
     rendercube(c, co, size, csi, maxlevel);
 
-    ivec bbmin, bbmax;
-
-    calcgeombb(co, size, bbmin, bbmax);
+    vtxarray *va = newva(co, size);
+    ext(c).va = va;
+    va->hasmerges = vahasmerges;
+    va->mergelevel = vamergemax;
+    j.va = va;
+}
 
-    addskyverts(co, size);
+/// Generate the geometry of a planned va into j.vc, this touches nothing but j and may run on any thread.
+static void genvajob(vajob &j)
+{
+    vc = j.vc;
+    vc->origin = j.o;
+    vc->size = j.size;
+    vc->shadowmapmin = vec(j.o).add(j.size);
+    vc->shadowmapmax = vec(j.o);
+
+    memcpy(neighbourstack, j.neighbours, j.numneighbours*sizeof(neighbourstack[0]));
+    neighbourdepth = j.numneighbours-1;
+    genvacube(*j.c, j.o, j.size, j.csi, true);
+    neighbourdepth = -1;
+
+    vec vo(ivec(j.o).mask(~0xFFF));
+    loopv(j.merges) addmergedface(j.merges[i], vo);
+
+    calcgeombb(j.o, j.size, j.geommin, j.geommax);
+    addskyverts(j.o, j.size);
+    vc->optimize();
+}
 
-    if(size == min(0x1000, worldsize/2) || !vc.emptyva())
+/// Copy the generated geometry into the va and its vbos, vas which turned out empty are only marked to be dropped.
+static void uploadvajob(vajob &j)
+{
+    vc = j.vc;
+    if(j.size != min(0x1000, worldsize/2) && vc->emptyva())
     {
-        vtxarray *va = newva(co, size);
-        ext(c).va = va;
-        va->geommin = bbmin;
-        va->geommax = bbmax;
-        calcmatbb(co, size, va->matmin, va->matmax);
-        va->shadowmapmin = ivec(shadowmapmin.mul(8)).shr(3);
-        va->shadowmapmax = ivec(shadowmapmax.mul(8)).add(7).shr(3);
-        va->hasmerges = vahasmerges;
-        va->mergelevel = vamergemax;
+        j.dropped = true;
+        return;
     }
-    else
+
+    vtxarray *va = j.va;
+    va->skyarea = vc->skyarea;
+    va->skyfaces = vc->skymask;
+    va->skyclip = vc->skyclip < INT_MAX ? vc->skyclip : INT_MAX;
+    vc->setupdata(va);
+
+    wverts += va->verts;
+    wtris  += va->tris + va->blends + va->alphabacktris + va->alphafronttris;
+
+    va->geommin = j.geommin;
+    va->geommax = j.geommax;
+    calcmatbb(j.o, j.size, va->matmin, va->matmax);
+    va->shadowmapmin = ivec(vc->shadowmapmin.mul(8)).shr(3);
+    va->shadowmapmax = ivec(vc->shadowmapmax.mul(8)).add(7).shr(3);
+}
+
+/// Give the cubes of an empty va back to the va above, as if it had never been planned.
+static void dropva(vajob &j)
+{
+    vtxarray *va = j.va;
+    if(!va->parent) loopv(va->children) varoot.add(va->children[i]);
+    destroyva(va, true);
+    j.c->ext->va = nullptr;
+}
+
+VARP(vathreads, 0, 0, inexor::util::job_system::MAXWORKERS); ///< threads generating vas, 0 uses numcpus
+
+static vector<vacollect *> vacollects; ///< the unused ones, every job in flight owns one
+
+static vacollect *getvacollect()
+{
+    vacollect *c = vacollects.length() ? vacollects.pop() : new vacollect;
+    c->clear();
+    return c;
+}
+
+/// Generate and upload all planned vas in the order they were planned.
+/// The workers stay at most a few jobs per thread ahead of the uploads, so only those have their geometry in memory at the same time.
+static void genvas(int numthreads)
+{
+    numthreads = min(numthreads, vajobs.length());
+    if(numthreads <= 1)
     {
-        loopi(MAXMERGELEVEL+1) vamerges[i].setsize(vamergeoffset[i]);
+        loopv(vajobs)
+        {
+            vajob &j = vajobs[i];
+            j.vc = getvacollect();
+            genvajob(j);
+            uploadvajob(j);
+            vacollects.add(j.vc);
+            j.vc = nullptr;
+        }
+        return;
     }
 
-    vc.clear();
+    // every job is a task of the job system, uploading one va starts the next
+    std::vector<inexor::util::task_ptr> tasks(vajobs.length());
+    int next = 0;
+    auto spawnjob = [&tasks](int i)
+    {
+        vajob &j = vajobs[i];
+        j.vc = getvacollect();
+        tasks[i] = inexor::util::jobs().spawn([&j] { genvajob(j); });
+    };
+    while(next < min(2*numthreads, vajobs.length())) spawnjob(next++);
+    loopv(vajobs)
+    {
+        vajob &j = vajobs[i];
+        inexor::util::jobs().wait(tasks[i]); // generates it here if nobody took it yet
+        tasks[i].reset();
+
+        uploadvajob(j);
+
+        vacollects.add(j.vc);
+        j.vc = nullptr;
+        if(next < vajobs.length()) spawnjob(next++);
+    }
 }
 
 static inline int setcubevisibility(cube &c, const ivec &co, int size)
@@ -1761,16 +1966,22 @@ void findtjoints()
     edgegroups.clear();
 }
 
-void octarender()                               // creates va s for all leaf cubes that don't already have them
+static void octarender(int numthreads)
 {
     int csi = 0;
     while(1<<csi < worldsize) csi++;
 
     recalcprogress = 0;
     varoot.setsize(0);
+    vajobs.shrink(0);
     updateva(worldroot, ivec(0, 0, 0), worldsize/2, csi-1);
+    loadvaslots();
     loadprogress = 0;
+    genvas(numthreads);
+    loopv(vajobs) if(vajobs[i].dropped) dropva(vajobs[i]);
+    vajobs.shrink(0);
     flushvbo();
+    invalidatevacull();
 
     explicitsky = 0;
     skyarea = 0;
@@ -1784,6 +1995,89 @@ void octarender()                               // creates va s for all leaf cub
     visibleva = nullptr;
 }
 
+void octarender()                               // creates va s for all leaf cubes that don't already have them
+{
+    extern SharedVar<int> numcpus;
+    octarender(vathreads > 0 ? int(vathreads) : int(numcpus));
+}
+
+/// Whether va renders texture tex (or layer, the texture blended below it) anywhere.
+static bool vausestexture(const vtxarray *va, int tex, int layer)
+{
+    loopi(va->texs + va->blends + va->alphaback + va->alphafront) if(va->eslist[i].texture == tex || va->eslist[i].texture == layer) return true;
+    loopv(va->grasstris) if(va->grasstris[i].texture == tex) return true;
+    return false;
+}
+
+static void discardvas(cube *c, vector<vtxarray *> &vas)
+{
+    loopi(8)
+    {
+        if(c[i].ext && c[i].ext->va && vas.find(c[i].ext->va) >= 0)
+        {
+            destroyva(c[i].ext->va);
+            c[i].ext->va = nullptr;
+        }
+        if(c[i].children) discardvas(c[i].children, vas);
+    }
+}
+
+/// Rebuild only the vas which may render texture tex within the box after its faces got another texture (see mpreplacetex()).
+/// The vas above them are rebuilt too as they may hold faces merged from below, the geometry itself is left alone.
+void texchanged(int tex, const ivec &bbmin, const ivec &bbmax)
+{
+    if(tex == DEFAULT_SKY) { allchanged(); return; } // sky is not drawn through the element sets
+    int layer = vslots.inrange(tex) && vslots[tex]->layer ? vslots[tex]->layer : -1;
+    vector<vtxarray *> dirty;
+    loopv(valist)
+    {
+        vtxarray *va = valist[i];
+        if(va->o.x > bbmax.x || va->o.y > bbmax.y || va->o.z > bbmax.z ||
+           va->o.x + va->size < bbmin.x || va->o.y + va->size < bbmin.y || va->o.z + va->size < bbmin.z ||
+           !vausestexture(va, tex, layer))
+            continue;
+        for(vtxarray *p = va; p && dirty.find(p) < 0; p = p->parent) dirty.add(p);
+    }
+    if(dirty.empty()) return;
+
+    discardvas(worldroot, dirty); // parents first, like readychanges()
+    int oldlen = valist.length();
+    octarender();
+    setupmaterials(oldlen);
+    invalidatepostfx();
+    updatevabbs();
+}
+
+/// Regenerate all vas on one and on the given number of threads (numcpus if 0), for comparing the time it takes on every stock map.
+void vabench(int *threads)
+{
+    if(!worldsize) return;
+    extern SharedVar<int> numcpus;
+    int numthreads = *threads > 0 ? *threads : max(int(numcpus), 2), counts[2][3];
+    uint millis[2];
+    loopi(2)
+    {
+        clearvas(worldroot);
+        resetqueries();
+        uint start = SDL_GetTicks();
+        octarender(i ? numthreads : 1);
+        millis[i] = SDL_GetTicks() - start;
+        counts[i][0] = allocva;
+        counts[i][1] = wverts;
+        counts[i][2] = wtris;
+    }
+    setupmaterials();
+    invalidatepostfx();
+    updatevabbs(true);
+    resetblobs();
+
+    Log.std->info("vabench: {} vas, {} verts, {} tris: {} ms on 1 thread, {} ms on {} threads",
+                  counts[1][0], counts[1][1], counts[1][2], millis[0], millis[1], numthreads);
+    if(memcmp(counts[0], counts[1], sizeof(counts[0])))
+        Log.std->error("vabench: results differ ({} vas, {} verts, {} tris on 1 thread)", counts[0][0], counts[0][1], counts[0][2]);
+}
+COMMAND(vabench, "i");
+
 void precachetextures()
 {
     vector<int> texs;
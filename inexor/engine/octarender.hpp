@@ -19,6 +19,7 @@ extern void reduceslope(ivec &n);
 extern void findtjoints();
 extern void octarender();
 extern void allchanged(bool load = false);
+extern void texchanged(int tex, const ivec &bbmin, const ivec &bbmax);
 extern void clearvas(cube *c);
 extern void destroyva(vtxarray *va, bool reparent = true);
 extern bool readva(vtxarray *va, ushort *&edata, vertex *&vdata);
@@ -139,6 +139,13 @@ enum
     MERGE_USE    = 1<<2
 };
 
+/// A solid cube which hides what is behind it, for the software occlusion culling (see occlusionbuffer).
+struct occluder
+{
+    ivec o;
+    int size, faces; ///< faces: bitmask of the visible sides, 1<<O_LEFT ...
+};
+
 struct vtxarray
 {
     vtxarray *parent;
@@ -163,6 +170,7 @@ struct vtxarray
     occludequery *query;
     vector<octaentities *> mapmodels;
     vector<grasstri> grasstris;
+    vector<occluder> occluders;
     int hasmerges, mergelevel;
     uint dynlightmask;
     bool shadowed;
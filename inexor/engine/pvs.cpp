@@ -3,11 +3,11 @@
 #include <string.h>                                   // for memset, memcpy
 #include <algorithm>                                  // for max, min, swap
 #include <memory>                                     // for __shared_ptr
+#include <vector>                                     // for vector
 
 #include "SDL_keycode.h"                              // for ::SDLK_ESCAPE
 #include "SDL_mutex.h"                                // for SDL_LockMutex
 #include "SDL_stdinc.h"                               // for Uint32
-#include "SDL_thread.h"                               // for SDL_CreateThread
 #include "SDL_timer.h"                                // for SDL_GetTicks
 #include "inexor/engine/material.hpp"                 // for ::MATF_CLIP
 #include "inexor/engine/octarender.hpp"               // for valist
@@ -30,7 +30,9 @@
 #include "inexor/shared/cube_types.hpp"               // for uchar, uint
 #include "inexor/shared/cube_vector.hpp"              // for vector
 #include "inexor/shared/ents.hpp"                     // for physent
+#include "inexor/shared/simd.hpp"                     // for simd4f, simdmov...
 #include "inexor/shared/tools.hpp"                    // for max, min, swap
+#include "inexor/util/jobs.hpp"                       // for jobs, task_ptr
 
 using namespace inexor::io;
 
@@ -267,6 +269,42 @@ struct shaft
         }
         return true;
     }
+
+    /// Classifies all 8 children of size csize of the node at co at once and returns them as bit masks.
+    /// Equivalent to calling outside() and inside() on every child, 4 children per SIMD lane group.
+    void classifychildren(const ivec &co, int csize, uchar &outsidemask, uchar &insidemask) const
+    {
+        simd4f zero(0.0f), fcsize = simd4f(float(csize));
+        simd4f bmin[3], bmax[3];
+        loopk(3)
+        {
+            bmin[k] = simd4f(float(bounds.min[k]));
+            bmax[k] = simd4f(float(bounds.max[k]));
+        }
+        outsidemask = insidemask = 0;
+        loop(z, 2)
+        {
+            simd4f o[6];
+            o[0] = simd4f(float(co.x)) + simd4f(0, float(csize), 0, float(csize));
+            o[1] = simd4f(float(co.y)) + simd4f(0, 0, float(csize), float(csize));
+            o[2] = simd4f(float(co.z + z*csize));
+            loopk(3) o[3+k] = o[k] + fcsize;
+            simd4f outside = zero < zero, notinside = outside;
+            loopk(3)
+            {
+                outside = outside | (o[k] > bmax[k]) | (o[3+k] < bmin[k]);
+                notinside = notinside | (o[k] < bmin[k]) | (o[3+k] > bmax[k]);
+            }
+            for(const shaftplane *p = planes; p < &planes[numplanes]; p++)
+            {
+                simd4f r(p->r), c(p->c), offset(p->offset);
+                outside = outside | (o[p->rnear]*r + o[p->cnear]*c + offset > zero);
+                notinside = notinside | (o[p->rfar]*r + o[p->cfar]*c + offset > zero);
+            }
+            outsidemask |= simdmovemask(outside)<<(4*z);
+            insidemask |= (~simdmovemask(notinside)&0xF)<<(4*z);
+        }
+    }
 };
 
 struct pvsdata
@@ -291,22 +329,49 @@ static inline bool htcmp(const pvsdata &x, const pvsdata &y)
     return x.len==y.len && !memcmp(&pvsbuf[x.offset], &pvsbuf[y.offset], x.len);
 }
 
-static SDL_mutex *pvsmutex = nullptr;
 static hashtable<pvsdata, int> pvscompress;
 static vector<pvsdata> pvs;
 
+/// A view cell PVS in the private buffer of a worker.
+/// Every worker deduplicates its own results, they only get merged into pvsbuf once all workers are done.
+struct workerpvsdata : pvsdata
+{
+    const vector<uchar> *buf;
+
+    workerpvsdata() {}
+    workerpvsdata(const pvsdata &d, const vector<uchar> *buf) : pvsdata(d), buf(buf) {}
+};
+
+static inline uint hthash(const workerpvsdata &k)
+{
+    uint h = 5381;
+    const uchar *buf = &(*k.buf)[k.offset];
+    loopi(k.len) h = ((h<<5)+h)^buf[i];
+    return h;
+}
+
+static inline bool htcmp(const workerpvsdata &x, const workerpvsdata &y)
+{
+    return x.len==y.len && !memcmp(&(*x.buf)[x.offset], &(*y.buf)[y.offset], x.len);
+}
+
 static SDL_mutex *viewcellmutex = nullptr;
 struct viewcellrequest
 {
     int *result;
     ivec o;
     int size;
+    int worker, index;
 };
 static vector<viewcellrequest> viewcellrequests;
+static int nextviewcellrequest = 0;
 
 static bool genpvs_canceled = false;
 static int numviewcells = 0;
 
+static volatile bool check_genpvs_progress = false;
+static void show_genpvs_progress();
+
 VAR(maxpvsblocker, 1, 512, 1<<16);
 VAR(pvsleafsize, 1, 64, 1024);
 
@@ -322,7 +387,7 @@ uint numwaterplanes = 0;
 
 struct pvsworker
 {
-    pvsworker() : thread(nullptr), pvsnodes(new pvsnode[origpvsnodes.length()])
+    pvsworker(int id) : id(id), pvsnodes(new pvsnode[origpvsnodes.length()])
     {
     }
     ~pvsworker()
@@ -330,7 +395,7 @@ struct pvsworker
         delete[] pvsnodes;
     }
 
-    SDL_Thread *thread;
+    int id;
     pvsnode *pvsnodes;
 
     shaftbb viewcellbb;
@@ -422,15 +487,27 @@ struct pvsworker
         shaftbb bb(co, size);
         if(s.outside(bb)) return;
         if(s.inside(bb)) { hidepvs(p); return; }
+        shaftcullchildren(s, p, co, size);
+    }
+
+    /// same as shaftcullpvs() for a node which is known to intersect the shaft
+    void shaftcullchildren(shaft &s, pvsnode &p, const ivec &co, int size)
+    {
         if(p.children)
         {
             pvsnode *children = &pvsnodes[p.children];
-            uchar flags = 0xFF;
+            int csize = size>>1;
+            uchar outside, inside, flags = 0xFF;
+            s.classifychildren(co, csize, outside, inside);
             loopi(8)
             {
-                ivec o(i, co, size>>1);
-                shaftcullpvs(s, children[i], o, size>>1);
-                flags &= children[i].flags;
+                pvsnode &c = children[i];
+                if(!(c.flags&PVS_HIDE_BB) && !(outside&(1<<i)))
+                {
+                    if(inside&(1<<i)) hidepvs(c);
+                    else shaftcullchildren(s, c, ivec(i, co, csize), csize);
+                }
+                flags &= c.flags;
             }
             if(flags & PVS_HIDE_BB) p.flags |= PVS_HIDE_BB;
             return;
@@ -806,41 +883,43 @@ struct pvsworker
         return buf;
     }
 
+    vector<uchar> localbuf;
+    vector<pvsdata> localpvs;
+    hashtable<workerpvsdata, int> localcompress;
+    vector<int> remap;
+
     int genviewcell(const ivec &co, int size)
     {
         calcpvs(co, size);
 
-        if(pvsmutex) SDL_LockMutex(pvsmutex);
-        numviewcells++;
-        pvsdata key(pvsbuf.length(), waterbytes + outbuf.length());
-        loopi(waterbytes) pvsbuf.add((wateroccluded>>(i*8))&0xFF);
-        pvsbuf.put(outbuf.getbuf(), outbuf.length());
-        int *val = pvscompress.access(key);
-        if(val) pvsbuf.setsize(key.offset);
+        workerpvsdata key(pvsdata(localbuf.length(), waterbytes + outbuf.length()), &localbuf);
+        loopi(waterbytes) localbuf.add((wateroccluded>>(i*8))&0xFF);
+        localbuf.put(outbuf.getbuf(), outbuf.length());
+        int *val = localcompress.access(key);
+        if(val) localbuf.setsize(key.offset);
         else
         {
-            val = &pvscompress[key];
-            *val = pvs.length();
-            pvs.add(key);
+            val = &localcompress[key];
+            *val = localpvs.length();
+            localpvs.add(key);
         }
-        if(pvsmutex) SDL_UnlockMutex(pvsmutex);
         return *val;
     }
 
-    static int run(void *data)
+    void processrequests(bool mainthread)
     {
-        pvsworker *w = (pvsworker *)data;
         SDL_LockMutex(viewcellmutex);
-        while(viewcellrequests.length())
+        while(!genpvs_canceled && nextviewcellrequest < viewcellrequests.length())
         {
-            viewcellrequest req = viewcellrequests.pop();
+            viewcellrequest &req = viewcellrequests[nextviewcellrequest++];
             SDL_UnlockMutex(viewcellmutex);
-            int result = w->genviewcell(req.o, req.size);
+            req.index = genviewcell(req.o, req.size);
+            req.worker = id;
+            if(mainthread && check_genpvs_progress) show_genpvs_progress();
             SDL_LockMutex(viewcellmutex);
-            *req.result = result;
+            numviewcells++;
         }
         SDL_UnlockMutex(viewcellmutex);
-        return 0;
     }
 };
 
@@ -866,8 +945,6 @@ struct viewcellnode
 VARP(pvsthreads, 0, 0, 16);
 static vector<pvsworker *> pvsworkers;
 
-static volatile bool check_genpvs_progress = false;
-
 static Uint32 genpvs_timer(Uint32 interval, void *param)
 {
     check_genpvs_progress = true;
@@ -876,11 +953,12 @@ static Uint32 genpvs_timer(Uint32 interval, void *param)
 
 static int totalviewcells = 0;
 
-static void show_genpvs_progress(int unique = pvs.length(), int processed = numviewcells)
+static void show_genpvs_progress()
 {
+    int processed = numviewcells;
     float bar1 = float(processed) / float(totalviewcells>0 ? totalviewcells : 1);
 
-    defformatstring(text1, "%d%% - %d of %d view cells (%d unique)", int(bar1 * 100), processed, totalviewcells, unique);
+    defformatstring(text1, "%d%% - %d of %d view cells", int(bar1 * 100), processed, totalviewcells);
 
     renderprogress(bar1, text1);
 
@@ -940,43 +1018,103 @@ static int countviewcells(cube *c, const ivec &co, int size, int threshold)
     return count;
 }
 
+static void genviewcells(viewcellnode &p, cube *c, const ivec &co, int size, int threshold);
+
+/// Queues the view cell for child i of p, or subdivides it further if it is bigger than threshold.
+static void addviewcell(viewcellnode &p, int i, cube &h, const ivec &o, int size, int threshold)
+{
+    if(pvsbounds.outside(o, size)) return;
+    if(h.children)
+    {
+        if(size>threshold)
+        {
+            p.leafmask &= ~(1<<i);
+            p.children[i].node = new viewcellnode;
+            genviewcells(*p.children[i].node, h.children, o, size>>1, threshold);
+            return;
+        }
+        if(isallclip(h.children)) return;
+    }
+    else if(isentirelysolid(h) || (h.material&MATF_CLIP)==MAT_CLIP) return;
+    viewcellrequest &req = viewcellrequests.add();
+    req.result = &p.children[i].pvs;
+    req.o = o;
+    req.size = size;
+    req.worker = req.index = -1;
+}
+
 static void genviewcells(viewcellnode &p, cube *c, const ivec &co, int size, int threshold)
 {
-    if(genpvs_canceled) return;
     loopi(8)
     {
         ivec o(i, co, size);
-        if(pvsbounds.outside(o, size)) continue;
-        cube &h = c[i];
-        if(h.children)
+        addviewcell(p, i, c[i], o, size, threshold);
+    }
+}
+
+/// Merges the results of all workers into pvsbuf and hands the final indices out to the view cells.
+static void mergeviewcells()
+{
+    loopv(pvsworkers)
+    {
+        pvsworker &w = *pvsworkers[i];
+        loopvj(w.localpvs)
         {
-            if(size>threshold)
+            const pvsdata &src = w.localpvs[j];
+            pvsdata key(pvsbuf.length(), src.len);
+            pvsbuf.put(&w.localbuf[src.offset], src.len);
+            int *val = pvscompress.access(key);
+            if(val) pvsbuf.setsize(key.offset);
+            else
             {
-                p.leafmask &= ~(1<<i);
-                p.children[i].node = new viewcellnode;
-                genviewcells(*p.children[i].node, h.children, o, size>>1, threshold);
-                continue;
+                val = &pvscompress[key];
+                *val = pvs.length();
+                pvs.add(key);
             }
-            if(isallclip(h.children)) continue;
-        }
-        else if(isentirelysolid(h) || (h.material&MATF_CLIP)==MAT_CLIP) continue;
-        if(pvsworkers.length())
-        {
-            if(genpvs_canceled) return;
-            p.children[i].pvs = pvsworkers[0]->genviewcell(o, size);
-            if(check_genpvs_progress) show_genpvs_progress();
-        }
-        else
-        {
-            viewcellrequest &req = viewcellrequests.add();
-            req.result = &p.children[i].pvs;
-            req.o = o;
-            req.size = size;
+            w.remap.add(*val);
         }
     }
+    loopv(viewcellrequests)
+    {
+        viewcellrequest &req = viewcellrequests[i];
+        if(req.worker >= 0) *req.result = pvsworkers[req.worker]->remap[req.index];
+    }
+}
+
+/// Processes all queued view cell requests: the calling thread works on them as well (and shows the progress),
+/// the other workers are tasks of the job system.
+static void runviewcellrequests(int numthreads)
+{
+    if(!viewcellmutex) viewcellmutex = SDL_CreateMutex();
+    nextviewcellrequest = 0;
+    numviewcells = 0;
+    check_genpvs_progress = false;
+    SDL_TimerID timer = SDL_AddTimer(500, genpvs_timer, nullptr);
+
+    numthreads = clamp(numthreads, 1, min(max(viewcellrequests.length(), 1), inexor::util::jobs().concurrency()));
+    loopi(numthreads) pvsworkers.add(new pvsworker(i));
+    std::vector<inexor::util::task_ptr> helpers;
+    for(int i = 1; i < numthreads; i++)
+    {
+        pvsworker *w = pvsworkers[i];
+        helpers.push_back(inexor::util::jobs().spawn([w] { w->processrequests(false); }));
+    }
+    show_genpvs_progress();
+    pvsworkers[0]->processrequests(true);
+    inexor::util::jobs().wait(helpers);
+    if(timer) SDL_RemoveTimer(timer);
+
+    if(!genpvs_canceled) mergeviewcells();
+    // a view cell queued for an update may keep an outdated PVS otherwise, which could cull what it can see now
+    else loopv(viewcellrequests) *viewcellrequests[i].result = -1;
+    pvsworkers.deletecontents();
+    viewcellrequests.setsize(0);
 }
 
 static viewcellnode *viewcells = nullptr;
+static int pvsviewcellsize = 32;
+static bool pvsdirty = false;
+static ivec pvsdirtymin, pvsdirtymax;
 static int lockedwaterplanes[MAXWATERPVS];
 static uchar *curpvs = nullptr, *lockedpvs = nullptr;
 static int curwaterpvs = 0, lockedwaterpvs = 0;
@@ -1046,6 +1184,7 @@ void clearpvs()
     pvsbuf.setsize(0);
     curpvs = nullptr;
     numwaterplanes = 0;
+    pvsdirty = false;
     lockpvs = 0;
     lockpvs_(false);
 }
@@ -1113,7 +1252,7 @@ void testpvs(int *vcsize)
     for(int mask = 1; mask < size; mask <<= 1) size &= ~mask;
 
     ivec o = ivec(camera1->o).mask(~(size-1));
-    pvsworker w;
+    pvsworker w(0);
     int len;
     lockedpvs = w.testviewcell(o, size, &lockedwaterpvs, &len);
     loopi(MAXWATERPVS) lockedwaterplanes[i] = waterplanes[i].height;
@@ -1151,53 +1290,17 @@ void genpvs(int *viewcellsize)
     root.children = 0;
     genpvsnodes(worldroot);
 
-    totalviewcells = countviewcells(worldroot, ivec(0, 0, 0), worldsize>>1, *viewcellsize>0 ? *viewcellsize : 32);
-    numviewcells = 0;
-    genpvs_canceled = false;
-    check_genpvs_progress = false;
-    SDL_TimerID timer = 0;
+    pvsviewcellsize = *viewcellsize>0 ? *viewcellsize : 32;
+    totalviewcells = countviewcells(worldroot, ivec(0, 0, 0), worldsize>>1, pvsviewcellsize);
     extern SharedVar<int> numcpus;
     int numthreads = pvsthreads > 0 ? pvsthreads : numcpus;
-    if(numthreads<=1) 
-    {
-        pvsworkers.add(new pvsworker);
-        timer = SDL_AddTimer(500, genpvs_timer, nullptr);
-    }
     viewcells = new viewcellnode;
-    genviewcells(*viewcells, worldroot, ivec(0, 0, 0), worldsize>>1, *viewcellsize>0 ? *viewcellsize : 32);
-    if(numthreads<=1)
-    {
-        SDL_RemoveTimer(timer);
-    }
-    else
-    {
-        renderprogress(0, "creating threads");
-        if(!pvsmutex) pvsmutex = SDL_CreateMutex();
-        if(!viewcellmutex) viewcellmutex = SDL_CreateMutex();
-        loopi(numthreads)
-        {
-            pvsworker *w = pvsworkers.add(new pvsworker);
-            w->thread = SDL_CreateThread(pvsworker::run, "pvs worker", w);
-        }
-        show_genpvs_progress(0, 0);
-        while(!genpvs_canceled)
-        {
-            SDL_Delay(500);
-            SDL_LockMutex(viewcellmutex);
-            int unique = pvs.length(), processed = numviewcells, remaining = viewcellrequests.length();
-            SDL_UnlockMutex(viewcellmutex);
-            show_genpvs_progress(unique, processed);
-            if(!remaining) break;
-        }        
-        SDL_LockMutex(viewcellmutex);
-        viewcellrequests.setsize(0);
-        SDL_UnlockMutex(viewcellmutex);
-        loopv(pvsworkers) SDL_WaitThread(pvsworkers[i]->thread, nullptr);
-    }
-    pvsworkers.deletecontents();
+    genviewcells(*viewcells, worldroot, ivec(0, 0, 0), worldsize>>1, pvsviewcellsize);
+    runviewcellrequests(numthreads);
 
     origpvsnodes.setsize(0);
     pvscompress.clear();
+    pvsdirty = false;
 
     Uint32 end = SDL_GetTicks();
     if(genpvs_canceled) 
@@ -1268,6 +1371,165 @@ bool pvsoccludedsphere(const vec &center, float radius)
     return pvsoccluded(curpvs, bbmin, bbmax);
 }
 
+void pvschanged(const ivec &bbmin, const ivec &bbmax)
+{
+    if(!viewcells) return;
+    if(!pvsdirty)
+    {
+        pvsdirtymin = bbmin;
+        pvsdirtymax = bbmax;
+        pvsdirty = true;
+    }
+    else
+    {
+        pvsdirtymin.min(bbmin);
+        pvsdirtymax.max(bbmax);
+    }
+}
+
+/// Queues all view cells which can see into the edited region, the PVS of all others can not have changed:
+/// whatever hides the edited region from them was not edited.
+/// View cells inside the edited region are rebuilt from scratch, since the octree may have changed there.
+static void updateviewcells(viewcellnode &p, cube *c, const ivec &co, int size, int threshold)
+{
+    loopi(8)
+    {
+        ivec o(i, co, size);
+        bool edited = o.x < pvsdirtymax.x && o.y < pvsdirtymax.y && o.z < pvsdirtymax.z &&
+                      o.x+size > pvsdirtymin.x && o.y+size > pvsdirtymin.y && o.z+size > pvsdirtymin.z;
+        if(!(p.leafmask&(1<<i)))
+        {
+            if(!edited || (c[i].children && size>threshold))
+            {
+                updateviewcells(*p.children[i].node, c[i].children, o, size>>1, threshold);
+                continue;
+            }
+            delete p.children[i].node;
+            p.leafmask |= 1<<i;
+            p.children[i].pvs = -1;
+        }
+        if(edited)
+        {
+            p.children[i].pvs = -1;
+            addviewcell(p, i, c[i], o, size, threshold);
+            continue;
+        }
+        int index = p.children[i].pvs;
+        if(index < 0) continue;
+        const pvsdata &d = pvs[index];
+        if(pvsoccluded(&pvsbuf[d.offset + d.len%9], pvsdirtymin, pvsdirtymax)) continue;
+        viewcellrequest &req = viewcellrequests.add();
+        req.result = &p.children[i].pvs;
+        req.o = o;
+        req.size = size;
+        req.worker = req.index = -1;
+    }
+}
+
+static void markviewcells(viewcellnode &p, vector<int> &remap)
+{
+    loopi(8)
+    {
+        if(!(p.leafmask&(1<<i))) markviewcells(*p.children[i].node, remap);
+        else if(p.children[i].pvs >= 0) remap[p.children[i].pvs] = 0;
+    }
+}
+
+static void remapviewcells(viewcellnode &p, const vector<int> &remap)
+{
+    loopi(8)
+    {
+        if(!(p.leafmask&(1<<i))) remapviewcells(*p.children[i].node, remap);
+        else if(p.children[i].pvs >= 0) p.children[i].pvs = remap[p.children[i].pvs];
+    }
+}
+
+/// drops the view cell PVS which are no longer referenced after an update
+static void compactpvs()
+{
+    vector<int> remap;
+    loopv(pvs) remap.add(-1);
+    markviewcells(*viewcells, remap);
+    vector<uchar> oldbuf;
+    oldbuf.move(pvsbuf);
+    vector<pvsdata> oldpvs;
+    oldpvs.move(pvs);
+    loopv(oldpvs) if(remap[i] >= 0)
+    {
+        remap[i] = pvs.length();
+        pvs.add(pvsdata(pvsbuf.length(), oldpvs[i].len));
+        pvsbuf.put(&oldbuf[oldpvs[i].offset], oldpvs[i].len);
+    }
+    remapviewcells(*viewcells, remap);
+}
+
+/// Incrementally updates the PVS after editing, only regenerating the view cells which can be affected.
+void updatepvs()
+{
+    if(!viewcells || !pvsdirty)
+    {
+        Log.edit->info("PVS is up to date");
+        return;
+    }
+
+    uint oldnumwaterplanes = numwaterplanes;
+    int oldwaterplanes[MAXWATERPVS];
+    loopi(numwaterplanes) oldwaterplanes[i] = waterplanes[i].height;
+    findwaterplanes();
+    bool waterchanged = numwaterplanes != oldnumwaterplanes;
+    loopi(numwaterplanes) if(!waterchanged && waterplanes[i].height != oldwaterplanes[i]) waterchanged = true;
+    if(waterchanged)
+    {
+        // the water bits of the existing view cells would no longer match
+        Log.edit->info("water planes changed, regenerating the whole PVS");
+        genpvs(&pvsviewcellsize);
+        return;
+    }
+
+    renderbackground("updating PVS (esc to abort)");
+    genpvs_canceled = false;
+    Uint32 start = SDL_GetTicks();
+
+    renderprogress(0, "finding view cells");
+
+    lockpvs = 0;
+    lockpvs_(false);
+    calcpvsbounds();
+
+    pvsnode &root = origpvsnodes.add();
+    memset(root.edges.v, 0xFF, 3);
+    root.flags = 0;
+    root.children = 0;
+    genpvsnodes(worldroot);
+
+    loopv(pvs) pvscompress[pvs[i]] = i;
+    // whatever touches the edited cubes has to be reconsidered as well
+    pvsdirtymin.sub(1);
+    pvsdirtymax.add(1);
+    updateviewcells(*viewcells, worldroot, ivec(0, 0, 0), worldsize>>1, pvsviewcellsize);
+    totalviewcells = viewcellrequests.length();
+    extern SharedVar<int> numcpus;
+    int numthreads = pvsthreads > 0 ? pvsthreads : numcpus;
+    runviewcellrequests(numthreads);
+
+    origpvsnodes.setsize(0);
+    pvscompress.clear();
+
+    Uint32 end = SDL_GetTicks();
+    if(genpvs_canceled)
+    {
+        // the edited and requeued view cells are left without PVS (see runviewcellrequests), which just disables culling there
+        Log.edit->info("updatepvs aborted");
+        return;
+    }
+    pvsdirty = false;
+    compactpvs();
+    Log.edit->info("updated {0} view cells, now {1} unique view cells totaling {2} kB ({3} seconds)",
+                   totalviewcells, pvs.length(), (pvsbuf.length()/1024.0f), ((end - start) / 1000.0f));
+}
+
+COMMAND(updatepvs, "");
+
 bool waterpvsoccluded(int height)
 {
     if(!curwaterpvs) return false;
@@ -13,6 +13,8 @@ extern bool pvsoccluded(const ivec &bbmin, const ivec &bbmax);
 extern bool pvsoccludedsphere(const vec &center, float radius);
 extern bool waterpvsoccluded(int height);
 extern void setviewcell(const vec &p);
+/// marks the region as edited, so updatepvs knows which view cells need to be regenerated
+extern void pvschanged(const ivec &bbmin, const ivec &bbmax);
 extern void savepvs(stream *f);
 extern void loadpvs(stream *f, int numpvs);
 extern int getnumviewcells();
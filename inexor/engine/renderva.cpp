@@ -8,6 +8,7 @@
 #include <unordered_set>                              // for unordered_set
 
 #include "SDL_opengl.h"                               // for GL_TRUE, glDept...
+#include "SDL_timer.h"                                // for SDL_GetTicks
 #include "inexor/engine/dynlight.hpp"                 // for calcdynlightmask
 #include "inexor/engine/glare.hpp"                    // for glaring
 #include "inexor/engine/glemu.hpp"                    // for bindebo, bindvbo
@@ -36,10 +37,13 @@
 #include "inexor/shared/cube_vector.hpp"              // for vector
 #include "inexor/shared/ents.hpp"                     // for extentity, ::EF...
 #include "inexor/shared/geom.hpp"                     // for ivec, ivec::(an...
+#include "inexor/shared/occlusionbuffer.hpp"          // for occlusionbuffer
+#include "inexor/shared/simd.hpp"                     // for simd4f
 #include "inexor/shared/tools.hpp"                    // for min, max, swap
 #include "inexor/texture/cubemap.hpp"                 // for lookupenvmap
 #include "inexor/texture/slot.hpp"                    // for VSlot, Slot
 #include "inexor/texture/texture.hpp"                 // for Texture, notexture
+#include "inexor/util/jobs.hpp"                       // for jobs
 #include "inexor/util/legacy_time.hpp"                // for lastmillis
 
 static inline void drawtris(GLsizei numindices, const GLvoid *indices, ushort minvert, ushort maxvert)
@@ -127,6 +131,7 @@ float vadist(vtxarray *va, const vec &p)
 #define VASORTSIZE 64
 
 static vtxarray *vasort[VASORTSIZE];
+static bool swoccvalid = false; ///< whether the software occlusion buffer was drawn for the current view
 
 void addvisibleva(vtxarray *va)
 {
@@ -159,6 +164,7 @@ void sortvisiblevas()
     }
 }
 
+/// The recursive reference for findvisiblevas() below, only used by vacullbench anymore.
 void findvisiblevas(vector<vtxarray *> &vas, bool resetocclude = false)
 {
     loopv(vas)
@@ -184,6 +190,161 @@ void findvisiblevas(vector<vtxarray *> &vas, bool resetocclude = false)
     }
 }
 
+/// The cubes of all vas in depth first order, as one array per coordinate so 4 of them are culled at once.
+/// va i is followed by its descendants up to end[i] (exclusive), so a hidden subtree is skipped by jumping there.
+static struct vacullarrays
+{
+    vector<vtxarray *> vas;
+    vector<int> parent, end;
+    vector<float> x, y, z, size; ///< padded to a multiple of 4
+    vector<uchar> vfc;           ///< what classifyvas() found, VFC_*
+    vector<uchar> reset;         ///< findvisiblevas(): whether the children have to forget their occlusion state
+    bool valid;
+} vacull;
+
+static vector<vtxarray *> vacullsorted, vacullscratch;
+
+void invalidatevacull()
+{
+    vacull.valid = false;
+}
+
+static void addvacull(vtxarray *va, int parent)
+{
+    int i = vacull.vas.length();
+    vacull.vas.add(va);
+    vacull.parent.add(parent);
+    vacull.end.add(0);
+    vacull.x.add(va->o.x);
+    vacull.y.add(va->o.y);
+    vacull.z.add(va->o.z);
+    vacull.size.add(va->size);
+    loopvj(va->children) addvacull(va->children[j], i);
+    vacull.end[i] = vacull.vas.length();
+}
+
+static void buildvacull()
+{
+    vacull.vas.setsize(0);
+    vacull.parent.setsize(0);
+    vacull.end.setsize(0);
+    vacull.x.setsize(0);
+    vacull.y.setsize(0);
+    vacull.z.setsize(0);
+    vacull.size.setsize(0);
+    loopv(varoot) addvacull(varoot[i], -1);
+    while(vacull.x.length()&3)
+    {
+        vacull.x.add(0);
+        vacull.y.add(0);
+        vacull.z.add(0);
+        vacull.size.add(0);
+    }
+    vacull.vfc.setsize(0);
+    vacull.vfc.pad(vacull.x.length());
+    vacull.reset.setsize(0);
+    vacull.reset.pad(vacull.vas.length());
+    vacull.valid = true;
+}
+
+/// isvisiblecube() for every va against the current vfcP, 4 at a time.
+/// isfoggedcube() is true for VFC_FOGGED and VFC_NOT_VISIBLE, ishiddencube() for VFC_NOT_VISIBLE.
+static void classifyvas()
+{
+    if(!vacull.valid) buildvacull();
+    simd4f px[5], py[5], pz[5], offset[5], nearsize[5], farsize[5];
+    loopi(5)
+    {
+        px[i] = simd4f(vfcP[i].x);
+        py[i] = simd4f(vfcP[i].y);
+        pz[i] = simd4f(vfcP[i].z);
+        offset[i] = simd4f(vfcP[i].offset);
+        nearsize[i] = simd4f(-vfcDnear[i]);
+        farsize[i] = simd4f(-vfcDfar[i]);
+    }
+    const simd4f fog(vfcDfog), zero(0.0f);
+    const float *x = vacull.x.getbuf(), *y = vacull.y.getbuf(), *z = vacull.z.getbuf(), *size = vacull.size.getbuf();
+    uchar *vfc = vacull.vfc.getbuf();
+    for(int i = 0, n = vacull.x.length(); i < n; i += 4)
+    {
+        simd4f bx = simd4f::load(&x[i]), by = simd4f::load(&y[i]), bz = simd4f::load(&z[i]), bs = simd4f::load(&size[i]),
+               hidden = zero, part = zero, dist = zero;
+        loopj(5)
+        {
+            dist = bx*px[j] + by*py[j] + bz*pz[j] + offset[j];
+            hidden = hidden | (dist < farsize[j]*bs);
+            part = part | (dist < nearsize[j]*bs);
+        }
+        dist = dist - fog;
+        int hiddenmask = simdmovemask(hidden), foggedmask = simdmovemask(dist > nearsize[4]*bs),
+            partmask = simdmovemask(part | (dist > farsize[4]*bs));
+        loopk(4)
+        {
+            int bit = 1<<k;
+            vfc[i+k] = hiddenmask&bit ? VFC_NOT_VISIBLE : (foggedmask&bit ? VFC_FOGGED : (partmask&bit ? VFC_PART_VISIBLE : VFC_FULL_VISIBLE));
+        }
+    }
+}
+
+/// Stable sort by distance, a radix sort over 2 passes of 11 bits.
+static void sortvadistances(vector<vtxarray *> &vas)
+{
+    const int BITS = 11, BUCKETS = 1<<BITS, MAXKEY = (1<<(2*BITS))-1;
+    vacullscratch.setsize(0);
+    vtxarray **src = vas.getbuf(), **dst = vacullscratch.pad(vas.length());
+    for(int shift = 0; shift < 2*BITS; shift += BITS)
+    {
+        int offsets[BUCKETS];
+        memset(offsets, 0, sizeof(offsets));
+        loopv(vas) offsets[(min(src[i]->distance, MAXKEY)>>shift)&(BUCKETS-1)]++;
+        for(int i = 0, total = 0; i < BUCKETS; i++)
+        {
+            int count = offsets[i];
+            offsets[i] = total;
+            total += count;
+        }
+        loopv(vas) dst[offsets[(min(src[i]->distance, MAXKEY)>>shift)&(BUCKETS-1)]++] = src[i];
+        swap(src, dst);
+    }
+}
+
+/// The same as findvisiblevas(varoot) followed by sortvisiblevas(), but on the flat arrays.
+static void findvisiblevas()
+{
+    classifyvas();
+    vacullsorted.setsize(0);
+    for(int i = 0, n = vacull.vas.length(); i < n;)
+    {
+        vtxarray &v = *vacull.vas[i];
+        int parent = vacull.parent[i], prevvfc = parent >= 0 && vacull.reset[parent] ? VFC_NOT_VISIBLE : v.curvfc;
+        v.curvfc = vacull.vfc[i];
+        if(v.curvfc == VFC_NOT_VISIBLE) { i = vacull.end[i]; continue; }
+        if(pvsoccluded(v.o, v.size))
+        {
+            v.curvfc += PVS_FULL_VISIBLE - VFC_FULL_VISIBLE;
+            i = vacull.end[i];
+            continue;
+        }
+        v.distance = int(vadist(&v, camera1->o));
+        vacullsorted.add(&v);
+        vacull.reset[i] = prevvfc >= VFC_NOT_VISIBLE;
+        if(vacull.reset[i])
+        {
+            v.occluded = !v.texs ? OCCLUDE_GEOM : OCCLUDE_NOTHING;
+            v.query = nullptr;
+        }
+        i++;
+    }
+    sortvadistances(vacullsorted);
+
+    visibleva = nullptr;
+    for(int i = vacullsorted.length()-1; i >= 0; i--)
+    {
+        vacullsorted[i]->next = visibleva;
+        visibleva = vacullsorted[i];
+    }
+}
+
 void calcvfcD()
 {
     loopi(5)
@@ -225,12 +386,12 @@ void restorevfcP()
 void visiblecubes(bool cull)
 {
     memset(vasort, 0, sizeof(vasort));
+    swoccvalid = false;
 
     if(cull)
     {
         setvfcP();
-        findvisiblevas(varoot);
-        sortvisiblevas();
+        findvisiblevas();
     }
     else
     {
@@ -349,6 +510,210 @@ bool checkquery(occludequery *query, bool nowait)
     return fragments < uint(oqfrags);
 }
 
+VAR(swocclusion, 0, 1, 1);       ///< cull with the software occlusion buffer instead of hardware occlusion queries
+VAR(swoccwidth, 64, 256, 1024);  ///< width of the occlusion buffer, the height follows the aspect ratio
+VAR(swoccvas, 0, 64, 1024);      ///< how many of the nearest visible VAs contribute occluders
+VAR(swoccquads, 0, 8192, 65536); ///< upper limit for the occluder faces per frame
+VAR(swoccthreads, 0, 0, inexor::util::job_system::MAXWORKERS); ///< 0 uses numcpus
+
+static occlusionbuffer swocc;
+static int swocctests = 0, swoccculled = 0;
+
+/// Rasterize all bands of buf, spread over numthreads threads.
+static void rasterswocc(occlusionbuffer &buf, int numthreads)
+{
+    int numbands = buf.numbands();
+    numthreads = min(numthreads, numbands);
+    if(numthreads <= 1 || buf.quads.length() < 64)
+    {
+        buf.raster();
+        return;
+    }
+    inexor::util::jobs().parallel_for(0, numbands, 1, [&buf](int from, int to)
+    {
+        for(int band = from; band < to; band++) buf.rasterband(band);
+    }, numthreads);
+}
+
+/// Add the occluders of vas (nearest first) to buf until swoccvas VAs or swoccquads faces are used.
+static void addswoccluders(occlusionbuffer &buf, vtxarray **vas, int numvas)
+{
+    int used = 0, quads = 0;
+    loopi(numvas)
+    {
+        vtxarray *va = vas[i];
+        if(va->occluders.empty()) continue;
+        if(++used > swoccvas) break;
+        loopvj(va->occluders)
+        {
+            const occluder &o = va->occluders[j];
+            quads += buf.addbox(vec(o.o), vec(o.o).add(o.size), o.faces);
+            if(quads >= swoccquads) return;
+        }
+    }
+}
+
+static int swoccthreadcount()
+{
+    extern SharedVar<int> numcpus;
+    return swoccthreads > 0 ? int(swoccthreads) : int(numcpus);
+}
+
+/// Draw the occluders in front of the camera for this frame, the VAs and mapmodels are tested against them while they are rendered.
+static void buildswocclusion()
+{
+    static vector<vtxarray *> vas;
+    vas.setsize(0);
+    for(vtxarray *va = visibleva; va; va = va->next) if(va->curvfc < VFC_FOGGED) vas.add(va);
+    swocc.setup(camprojmatrix, camera1->o, swoccwidth, int(swoccwidth/max(aspect, 0.1f)));
+    addswoccluders(swocc, vas.getbuf(), vas.length());
+    rasterswocc(swocc, swoccthreadcount());
+    swoccvalid = true;
+    swocctests = swoccculled = 0;
+}
+
+static bool swoccluded(const ivec &bbmin, const ivec &bbmax)
+{
+    swocctests++;
+    if(!swocc.isoccluded(vec(bbmin), vec(bbmax))) return false;
+    swoccculled++;
+    return true;
+}
+
+void swoccstats()
+{
+    if(!swoccvalid) { Log.std->info("software occlusion culling was not used this frame"); return; }
+    Log.std->info("swocc: {} quads in {}x{} pixels, {} of {} boxes culled", swocc.quads.length(), swocc.width, swocc.height, swoccculled, swocctests);
+}
+COMMAND(swoccstats, "");
+
+/// A recorded camera, so culling can be benchmarked on the same views again.
+struct swoccview
+{
+    matrix4 camprojmatrix;
+    vec o;
+    float aspect;
+};
+static vector<swoccview> swoccpath;
+static const int MAXSWOCCVIEWS = 10000; ///< a few minutes of frames, recording stops by itself after that
+
+VARF(swoccrecord, 0, 0, 1, { if(swoccrecord) swoccpath.setsize(0); });
+
+static bool swoccdistcmp(vtxarray *x, vtxarray *y)
+{
+    return x->distance < y->distance;
+}
+
+/// Replay the views recorded with swoccrecord: draw the occlusion buffer on one and on threads threads, check both agree and test all VAs and mapmodels.
+void swoccbench(int *threads)
+{
+    if(swoccpath.empty()) { Log.std->warn("swoccbench: nothing recorded, set swoccrecord 1 and walk around first"); return; }
+    int numthreads = *threads > 0 ? *threads : max(swoccthreadcount(), 2);
+    vector<vtxarray *> vas;
+    occlusionbuffer single, multi;
+    uint buildtime = 0, singletime = 0, multitime = 0, testtime = 0;
+    int tests = 0, culled = 0, mismatches = 0;
+    loopv(swoccpath)
+    {
+        const swoccview &v = swoccpath[i];
+        vas.setsize(0);
+        loopvj(valist)
+        {
+            vtxarray *va = valist[j];
+            va->distance = int(vadist(va, v.o));
+            vas.add(va);
+        }
+        vas.sort(swoccdistcmp);
+
+        int h = int(swoccwidth/max(v.aspect, 0.1f));
+        uint start = SDL_GetTicks();
+        single.setup(v.camprojmatrix, v.o, swoccwidth, h);
+        addswoccluders(single, vas.getbuf(), vas.length());
+        multi.setup(v.camprojmatrix, v.o, swoccwidth, h);
+        addswoccluders(multi, vas.getbuf(), vas.length());
+        buildtime += (SDL_GetTicks() - start)/2;
+
+        start = SDL_GetTicks();
+        single.raster();
+        singletime += SDL_GetTicks() - start;
+        start = SDL_GetTicks();
+        rasterswocc(multi, numthreads);
+        multitime += SDL_GetTicks() - start;
+        if(memcmp(single.depth.getbuf(), multi.depth.getbuf(), single.depth.length()*sizeof(float))) mismatches++;
+
+        start = SDL_GetTicks();
+        loopvj(valist)
+        {
+            vtxarray *va = valist[j];
+            tests++;
+            if(multi.isoccluded(vec(va->bbmin), vec(va->bbmax))) culled++;
+            loopvk(va->mapmodels)
+            {
+                tests++;
+                if(multi.isoccluded(vec(va->mapmodels[k]->bbmin), vec(va->mapmodels[k]->bbmax))) culled++;
+            }
+        }
+        testtime += SDL_GetTicks() - start;
+    }
+    Log.std->info("swoccbench: {} views, build {} ms, raster {} ms on 1 thread / {} ms on {} threads, {} tests in {} ms, {} culled, {} mismatches",
+                  swoccpath.length(), buildtime, singletime, multitime, numthreads, tests, testtime, culled, mismatches);
+}
+COMMAND(swoccbench, "i");
+
+/// Cull every view recorded with swoccrecord repeat times with the recursive reference and with the flat pass, and check both find the same vas in the same order.
+void vacullbench(int *repeat)
+{
+    if(swoccpath.empty()) { Log.std->warn("vacullbench: nothing recorded, set swoccrecord 1 and walk around first"); return; }
+    int reps = *repeat > 0 ? *repeat : 100, visible = 0, mismatches = 0;
+    matrix4 oldcamprojmatrix = camprojmatrix;
+    vec oldo = camera1->o;
+    vector<uchar> startvfc, refvfc;
+    vector<vtxarray *> reforder;
+    uint reftime = 0, flattime = 0;
+    loopv(swoccpath)
+    {
+        const swoccview &v = swoccpath[i];
+        camprojmatrix = v.camprojmatrix;
+        camera1->o = v.o;
+        setvfcP();
+
+        startvfc.setsize(0);
+        loopvj(valist) startvfc.add(valist[j]->curvfc);
+        uint start = SDL_GetTicks();
+        loopj(reps)
+        {
+            memset(vasort, 0, sizeof(vasort));
+            findvisiblevas(varoot);
+            sortvisiblevas();
+        }
+        reftime += SDL_GetTicks() - start;
+        reforder.setsize(0);
+        for(vtxarray *va = visibleva; va; va = va->next) reforder.add(va);
+        refvfc.setsize(0);
+        loopvj(valist)
+        {
+            refvfc.add(valist[j]->curvfc);
+            valist[j]->curvfc = startvfc[j];
+        }
+
+        start = SDL_GetTicks();
+        loopj(reps) findvisiblevas();
+        flattime += SDL_GetTicks() - start;
+        visible += reforder.length();
+        int n = 0;
+        bool same = true;
+        for(vtxarray *va = visibleva; va; va = va->next, n++) if(n >= reforder.length() || reforder[n] != va) same = false;
+        loopvj(valist) if(valist[j]->curvfc != refvfc[j]) same = false;
+        if(!same || n != reforder.length()) mismatches++;
+    }
+    camprojmatrix = oldcamprojmatrix;
+    camera1->o = oldo;
+    setvfcP();
+    Log.std->info("vacullbench: {} views x {} of {} vas, {} visible on average: {} ms recursive, {} ms flat, {} mismatches",
+                  swoccpath.length(), reps, valist.length(), visible/swoccpath.length(), reftime, flattime, mismatches);
+}
+COMMAND(vacullbench, "i");
+
 static GLuint bbvbo = 0, bbebo = 0;
 
 static void setupbb()
@@ -446,7 +811,7 @@ void findvisiblemms(const vector<extentity *> &ents)
             octaentities *oe = va->mapmodels[i];
             if(isfoggedcube(oe->o, oe->size) || pvsoccluded(oe->bbmin, oe->bbmax)) continue;
 
-            bool occluded = oe->query && oe->query->owner == oe && checkquery(oe->query);
+            bool occluded = swoccvalid ? !insideoe(oe, camera1->o) && swoccluded(oe->bbmin, oe->bbmax) : oe->query && oe->query->owner == oe && checkquery(oe->query);
             if(occluded)
             {
                 oe->distance = -1;
@@ -553,7 +918,7 @@ void rendermapmodels()
     findvisiblemms(ents);
 
     static int skipoq = 0;
-    bool doquery = oqfrags && oqmm;
+    bool doquery = oqfrags && oqmm && !swoccvalid;
 
     startmodelbatches();
     for(octaentities *oe = visiblemms; oe; oe = oe->next) if(oe->distance>=0)
@@ -1580,7 +1945,8 @@ void rendergeom(float causticspass, bool fogpass)
     if(causticspass && (!causticscale || !causticmillis)) causticspass = 0;
 
     bool mainpass = !reflecting && !refracting && !drawtex && !glaring,
-         doOQ = oqfrags && oqgeom && mainpass,
+         doSW = swocclusion && mainpass,
+         doOQ = oqfrags && oqgeom && mainpass && !doSW,
          doZP = doOQ && zpass,
          doSM = shadowmap && !drawtex && !glaring;
     renderstate cur;
@@ -1588,7 +1954,20 @@ void rendergeom(float causticspass, bool fogpass)
     {
         flipqueries();
         vtris = vverts = 0;
+        if(swoccrecord)
+        {
+            swoccview &v = swoccpath.add();
+            v.camprojmatrix = camprojmatrix;
+            v.o = camera1->o;
+            v.aspect = aspect;
+            if(swoccpath.length() >= MAXSWOCCVIEWS)
+            {
+                swoccrecord = 0;
+                Log.std->info("swoccrecord: stopped after {} views", swoccpath.length());
+            }
+        }
     }
+    if(doSW) buildswocclusion();
     if(!doZP) 
     {
         if(shadowmap && mainpass) rendershadowmap();
@@ -1613,6 +1992,17 @@ void rendergeom(float causticspass, bool fogpass)
         {
             if(va->geommax.z <= reflectz) continue;
         }
+        else if(doSW && !insideva(va, camera1->o))
+        {
+            va->query = nullptr;
+            if(va->parent && va->parent->occluded >= OCCLUDE_BB)
+            {
+                va->occluded = OCCLUDE_PARENT;
+                continue;
+            }
+            va->occluded = swoccluded(va->bbmin, va->bbmax) ? OCCLUDE_BB : (pvsoccluded(va->geommin, va->geommax) ? OCCLUDE_GEOM : OCCLUDE_NOTHING);
+            if(va->occluded >= OCCLUDE_GEOM) continue;
+        }
         else if(doOQ && (zpass || va->distance > oqdist) && !insideva(va, camera1->o))
         {
             if(va->parent && va->parent->occluded >= OCCLUDE_BB)
@@ -1834,33 +2224,41 @@ void renderalphageom(bool fogpass)
     glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, fading ? GL_FALSE : GL_TRUE);
 }
  
-void findreflectedvas(vector<vtxarray *> &vas, int prevvfc = VFC_PART_VISIBLE)
+/// The vas seen in the reflection, culled against the reflected vfcP with classifyvas().
+void findreflectedvas()
 {
-    loopv(vas)
+    classifyvas();
+    vacullsorted.setsize(0);
+    for(int i = 0, n = vacull.vas.length(); i < n;)
     {
-        vtxarray *va = vas[i];
+        vtxarray *va = vacull.vas[i];
+        int parent = vacull.parent[i], prevvfc = parent >= 0 ? vacull.vas[parent]->curvfc : VFC_PART_VISIBLE;
         if(prevvfc >= VFC_NOT_VISIBLE) va->curvfc = prevvfc;
-        if(va->curvfc == VFC_FOGGED || va->curvfc == PVS_FOGGED || va->o.z+va->size <= reflectz || isfoggedcube(va->o, va->size)) continue;
+        int skip = vacull.end[i];
+        i++;
+        if(va->curvfc == VFC_FOGGED || va->curvfc == PVS_FOGGED || va->o.z+va->size <= reflectz || vacull.vfc[i-1] >= VFC_FOGGED) { i = skip; continue; }
         bool render = true;
         if(va->curvfc == VFC_FULL_VISIBLE)
         {
-            if(va->occluded >= OCCLUDE_BB) continue;
+            if(va->occluded >= OCCLUDE_BB) { i = skip; continue; }
             if(va->occluded >= OCCLUDE_GEOM) render = false;
         }
-        else if(va->curvfc == PVS_FULL_VISIBLE) continue;
+        else if(va->curvfc == PVS_FULL_VISIBLE) { i = skip; continue; }
         if(render)
         {
             if(va->curvfc >= VFC_NOT_VISIBLE) va->distance = (int)vadist(va, camera1->o);
-            vtxarray **vprev = &reflectedva, *vcur = reflectedva;
-            while(vcur && va->distance > vcur->distance)
-            {
-                vprev = &vcur->rnext;
-                vcur = vcur->rnext;
-            }
-            va->rnext = *vprev;
-            *vprev = va;
+            vacullsorted.add(va);
         }
-        if(va->children.length()) findreflectedvas(va->children, va->curvfc);
+    }
+    // vas at the same distance end up in reverse order, as they always did
+    for(int i = 0, j = vacullsorted.length()-1; i < j; i++, j--) swap(vacullsorted[i], vacullsorted[j]);
+    sortvadistances(vacullsorted);
+
+    reflectedva = nullptr;
+    for(int i = vacullsorted.length()-1; i >= 0; i--)
+    {
+        vacullsorted[i]->rnext = reflectedva;
+        reflectedva = vacullsorted[i];
     }
 }
 
@@ -1868,8 +2266,7 @@ void renderreflectedgeom(bool causticspass, bool fogpass)
 {
     if(reflecting)
     {
-        reflectedva = nullptr;
-        findreflectedvas(varoot);
+        findreflectedvas();
         rendergeom(causticspass ? 1 : 0, fogpass);
     }
     else rendergeom(causticspass ? 1 : 0, fogpass);
@@ -1907,20 +2304,26 @@ static inline void updateskystats(vtxarray *va)
     else renderedskyclip = 0;
 }
 
-void renderreflectedskyvas(vector<vtxarray *> &vas, int prevvfc = VFC_PART_VISIBLE)
+void renderreflectedskyvas()
 {
-    loopv(vas)
+    classifyvas();
+    for(int i = 0, n = vacull.vas.length(); i < n;)
     {
-        vtxarray *va = vas[i];
+        vtxarray *va = vacull.vas[i];
+        int parent = vacull.parent[i], prevvfc = parent >= 0 ? vacull.vas[parent]->curvfc : VFC_PART_VISIBLE;
         if(prevvfc >= VFC_NOT_VISIBLE) va->curvfc = prevvfc;
-        if((va->curvfc == VFC_FULL_VISIBLE && va->occluded >= OCCLUDE_BB) || va->curvfc==PVS_FULL_VISIBLE) continue;
-        if(va->o.z+va->size <= reflectz || ishiddencube(va->o, va->size)) continue;
+        if((va->curvfc == VFC_FULL_VISIBLE && va->occluded >= OCCLUDE_BB) || va->curvfc==PVS_FULL_VISIBLE ||
+           va->o.z+va->size <= reflectz || vacull.vfc[i] == VFC_NOT_VISIBLE)
+        {
+            i = vacull.end[i];
+            continue;
+        }
         if(va->sky+va->explicitsky) 
         {
             updateskystats(va);
             renderskyva(va);
         }
-        if(va->children.length()) renderreflectedskyvas(va->children, va->curvfc);
+        i++;
     }
 }
 
@@ -1932,7 +2335,7 @@ bool rendersky(bool explicitonly)
 
     if(reflecting)
     {
-        renderreflectedskyvas(varoot);
+        renderreflectedskyvas();
     }
     else for(vtxarray *va = visibleva; va; va = va->next)
     {
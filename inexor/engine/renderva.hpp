@@ -9,6 +9,8 @@
 extern vtxarray *visibleva, *reflectedva;
 
 extern void visiblecubes(bool cull = true);
+/// The va hierarchy changed, the flat culling arrays have to be rebuilt.
+extern void invalidatevacull();
 extern void setvfcP(float z = -1, const vec &bbmin = vec(-1, -1, -1), const vec &bbmax = vec(1, 1, 1));
 extern void savevfcP();
 extern void restorevfcP();
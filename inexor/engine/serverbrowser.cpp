@@ -15,6 +15,8 @@
 
 using namespace inexor::io;
 
+/// Name lookups block for as long as the name server takes, so they get threads of their own instead of tying up the job system.
+/// A lookup which takes too long is given up on: its thread is left to finish it and exit, a new one takes its place.
 struct resolverthread
 {
     SDL_Thread *thread;
@@ -93,6 +95,7 @@ void resolverstop(resolverthread &rt)
     SDL_LockMutex(resolvermutex);
     if(rt.query)
     {
+        SDL_DetachThread(rt.thread);
         rt.thread = SDL_CreateThread(resolverloop, "resolver", &rt);
     }
     rt.query = nullptr;
@@ -141,9 +144,10 @@ bool resolvercheck(const char **name, ENetAddress *address)
         resolverthread &rt = resolverthreads[i];
         if(rt.query && totalmillis - rt.starttime > RESOLVERLIMIT)        
         {
-            resolverstop(rt);
             *name = rt.query;
+            resolverstop(rt);
             resolved = true;
+            break;
         }    
     }
     SDL_UnlockMutex(resolvermutex);
@@ -186,6 +190,7 @@ bool resolverwait(const char *name, ENetAddress *address)
             resolverthread &rt = resolverthreads[i];
             if(rt.query == name) { resolverstop(rt); break; }
         }
+        resolverqueries.removeobj(name);
     }
     SDL_UnlockMutex(resolvermutex);
     return resolved;
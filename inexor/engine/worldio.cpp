@@ -30,6 +30,7 @@
 #include "inexor/io/filesystem/mediadirs.hpp"  // for getmediapath, ::DIR_MAP
 #include "inexor/io/legacy/stream.hpp"         // for stream, opengzfile, path
 #include "inexor/model/model.hpp"                     // for flushpreloadedm...
+#include "inexor/model/modelcache.hpp"                // for modelcachereport
 #include "inexor/model/rendermodel.hpp"               // for preloadusedmapm...
 #include "inexor/network/SharedVar.hpp"        // for SharedVar
 #include "inexor/shared/command.hpp"           // for ::ID_FVAR, ::ID_SVAR
@@ -43,6 +44,7 @@
 #include "inexor/shared/tools.hpp"             // for min
 #include "inexor/sound/sound.hpp"                     // for preloadmapsounds
 #include "inexor/texture/slot.hpp"                    // for VSlot, vslots
+#include "inexor/texture/texcache.hpp"                // for texcachereport
 #include "inexor/texture/texture.hpp"                 // for textureload
 #include "inexor/ui/legacy/menus.hpp"                 // for clearmainmenu
 #include "inexor/util/legacy_time.hpp"                // for totalmillis
@@ -1483,6 +1485,10 @@ bool load_world(const char *mname, const char *cname)        // still supports a
     attachentities();
     initlights();
     allchanged(true);
+    const char *loadedmsg = tempformatstring("loaded map %s in %.1f seconds", ogzname, (SDL_GetTicks()-loadingstart)/1000.0f);
+    texcachereport(loadedmsg);
+    modelcachereport(loadedmsg);
+    vfsreport(loadedmsg);
 
     renderbackground("loading...", mapshot, mname);
 
@@ -21,12 +21,15 @@
 #include "inexor/fpsgame/weapon.hpp"                   // for avoidweapons
 #include "inexor/gamemode/gamemode.hpp"                // for m_bomb, isteam
 #include "inexor/io/Logging.hpp"                       // for Log, Logger
+#include "inexor/model/model.hpp"                      // for model
 #include "inexor/model/ragdoll.hpp"                    // for cleanragdoll
+#include "inexor/model/rendermodel.hpp"                // for loadmapmodel, preloadusedmapmodels
 #include "inexor/network/SharedVar.hpp"                // for SharedVar
 #include "inexor/network/legacy/game_types.hpp"        // for ::N_ADDBOT
-#include "inexor/physics/physics.hpp"                  // for moveplayer
+#include "inexor/physics/physics.hpp"                  // for moveplayers
 #include "inexor/shared/command.hpp"                   // for ICOMMAND, VAR
 #include "inexor/shared/cube_formatting.hpp"           // for defformatstring
+#include "inexor/shared/cube_hash.hpp"                 // for hashtable, enumeratekt
 #include "inexor/shared/cube_loops.hpp"                // for i, loopv, loopi
 #include "inexor/shared/cube_tools.hpp"                // for copystring
 #include "inexor/shared/cube_types.hpp"                // for ushort, RAD
@@ -34,6 +37,7 @@
 #include "inexor/shared/ents.hpp"                      // for extentity, ::C...
 #include "inexor/shared/geom.hpp"                      // for vec, vec::(ano...
 #include "inexor/shared/tools.hpp"                     // for rnd, clamp, min
+#include "inexor/util/jobs.hpp"                        // for jobs
 #include "inexor/util/legacy_time.hpp"                 // for lastmillis
 
 
@@ -99,7 +103,221 @@ namespace ai
         return e->state == CS_ALIVE && !isteam(d->team, e->team);
     }
 
-    bool getsight(vec &o, float yaw, float pitch, vec &q, vec &v, float mdist, float fovx, float fovy)
+    // Line of sight cache: the same bot asks whether it sees the same target several times per frame (target(), violence(), process())
+    // and the answer rarely changes between frames. Every pair remembers its last ray, which is reused as long as neither end moved
+    // further than ailosmove; with the default of 0 this only saves the repeated rays, so the bots react exactly as without it.
+    // At the start of every frame the rays of the pairs asked for in the last frame are cast ahead on worker threads.
+
+    VAR(ailoscache, 0, 1, 1);
+    VAR(ailosmove, 0, 0, 64);       ///< how far the ends of a ray may move before it is cast again
+    VAR(ailosbudget, 0, 512, 8192); ///< rays cast ahead per frame, the rest is cast when asked for
+    VAR(ailosthreads, 0, 0, inexor::util::job_system::MAXWORKERS); ///< 0 uses numcpus
+
+    struct losentry
+    {
+        vec from, to, hit;
+        bool visible, valid;
+        uint lastused; ///< the frame it was asked for last
+
+        losentry() : valid(false), lastused(0) {}
+    };
+
+    struct losjob
+    {
+        losentry *l;
+        vec from, to, hit;
+        bool visible;
+    };
+
+    struct loscounters
+    {
+        int queries, hits, rays, ahead;
+    };
+
+    static hashtable<uint, losentry> losentries;
+    static uint losframe = 1;
+    static int losgeneration = -1, lospruned = 0;
+    static loscounters loscount = { 0, 0, 0, 0 };
+
+    static vector<losjob> losjobs;
+
+    static inline uint loskey(fpsent *d, fpsent *e) { return (uint(d->clientnum)<<16) | uint(e->clientnum&0xFFFF); }
+
+    static inline bool losreusable(const losentry &l, const vec &from, const vec &to)
+    {
+        return l.valid && l.from.squaredist(from) <= float(ailosmove*ailosmove) && l.to.squaredist(to) <= float(ailosmove*ailosmove);
+    }
+
+    /// Whether d at from sees to at e, taken from the cache if possible.
+    static bool losvisible(fpsent *d, fpsent *e, const vec &from, const vec &to, vec &hit)
+    {
+        loscount.queries++;
+        if(!ailoscache)
+        {
+            loscount.rays++;
+            return raycubelos(from, to, hit);
+        }
+        losentry &l = losentries[loskey(d, e)];
+        l.lastused = losframe;
+        if(losreusable(l, from, to)) { loscount.hits++; hit = l.hit; return l.visible; }
+        loscount.rays++;
+        l.from = from;
+        l.to = to;
+        l.visible = raycubelos(from, to, l.hit);
+        l.valid = true;
+        hit = l.hit;
+        return l.visible;
+    }
+
+    /// The rays may hit map models, whose BIHs would otherwise get built on first use, on whichever worker got there first.
+    /// Building them touches the textures (GL), so it has to happen here on the main thread.
+    static void preloadlosmodels()
+    {
+        preloadmapmodels();
+        const vector<extentity *> &ents = entities::getents();
+        loopv(ents) if(ents[i]->type == ET_MAPMODEL)
+        {
+            model *m = loadmapmodel(ents[i]->attr2);
+            if(m && !m->bih) { preloadusedmapmodels(false, true); return; }
+        }
+    }
+
+    /// Cast all queued rays, on worker threads if there are enough of them.
+    static void castlosjobs()
+    {
+        extern SharedVar<int> numcpus;
+        int numthreads = min(ailosthreads > 0 ? int(ailosthreads) : int(numcpus), losjobs.length()/32);
+        if(numthreads <= 1)
+        {
+            loopv(losjobs) losjobs[i].visible = raycubelos(losjobs[i].from, losjobs[i].to, losjobs[i].hit);
+            return;
+        }
+        preloadlosmodels();
+        inexor::util::jobs().parallel_for(0, losjobs.length(), 16, [](int from, int to)
+        {
+            for(int i = from; i < to; i++) losjobs[i].visible = raycubelos(losjobs[i].from, losjobs[i].to, losjobs[i].hit);
+        }, numthreads);
+    }
+
+    static vec aimpos(fpsent *d, fpsent *e);
+
+    /// Start a new frame: drop the cache if the geometry changed, forget pairs nobody asked for in a while
+    /// and cast the rays of the pairs asked for in the last frame whose ends moved.
+    static void updatelos()
+    {
+        losframe++;
+        int generation = geometrygeneration();
+        if(generation != losgeneration)
+        {
+            losentries.clear();
+            losgeneration = generation;
+        }
+        if(!ailoscache) return;
+        if(totalmillis - lospruned >= 1000)
+        {
+            static vector<uint> stale;
+            stale.setsize(0);
+            enumeratekt(losentries, uint, key, losentry, l, { if(losframe - l.lastused > 100) stale.add(key); });
+            loopv(stale) losentries.remove(stale[i]);
+            lospruned = totalmillis;
+        }
+        if(!ailosbudget) return;
+
+        losjobs.setsize(0);
+        loopv(players)
+        {
+            fpsent *d = players[i];
+            if(!d->ai || d->state != CS_ALIVE) continue;
+            // the aim point is going to be randomized again before the next query, so there is nothing to guess
+            if(d->skill <= 100 && lastmillis >= d->ai->lastaimrnd) continue;
+            vec from = d->headpos();
+            loopvj(players)
+            {
+                fpsent *e = players[j];
+                if(e == d) continue;
+                losentry *l = losentries.access(loskey(d, e));
+                if(!l || l->lastused + 1 < losframe) continue;
+                vec to = aimpos(d, e);
+                if(losreusable(*l, from, to)) continue;
+                losjob &job = losjobs.add();
+                job.l = l;
+                job.from = from;
+                job.to = to;
+                if(losjobs.length() >= ailosbudget) goto full;
+            }
+        }
+    full:
+        if(losjobs.empty()) return;
+        castlosjobs();
+        loopv(losjobs)
+        {
+            losjob &job = losjobs[i];
+            losentry &l = *job.l;
+            l.from = job.from;
+            l.to = job.to;
+            l.hit = job.hit;
+            l.visible = job.visible;
+            l.valid = true;
+        }
+        loscount.ahead += losjobs.length();
+    }
+
+    void losstats()
+    {
+        Log.std->info("ai line of sight: {} queries, {} answered from the cache ({:.1f}%), {} rays cast when asked, {} ahead, {} pairs cached",
+                      loscount.queries, loscount.hits, loscount.queries ? 100.0f*loscount.hits/loscount.queries : 0.0f,
+                      loscount.rays, loscount.ahead, losentries.numelems);
+        loscount.queries = loscount.hits = loscount.rays = loscount.ahead = 0;
+    }
+    COMMAND(losstats, "");
+
+    /// Check that the cache gives the same answers as casting every ray, bot against bot: every simulated frame moves all players
+    /// along a fixed pattern of offsets, lets updatelos() cast ahead and compares each answer with a ray cast right away.
+    void lostest(int *frames)
+    {
+        int numframes = max(*frames, 1), oldmove = ailosmove, oldcache = ailoscache, oldbudget = ailosbudget, checked = 0, mismatches = 0;
+        ailosmove = 0;
+        ailoscache = 1;
+        ailosbudget = 8192;
+        losentries.clear();
+        loscounters before = loscount;
+        static const vec offsets[4] = { vec(0, 0, 0), vec(3, -2, 0), vec(0, 0, 4), vec(-5, 1, -1) };
+        static vector<vec> positions;
+        positions.setsize(0);
+        loopv(players) positions.add(players[i]->o);
+        loop(frame, numframes)
+        {
+            loopv(players) players[i]->o = vec(positions[i]).add(offsets[frame%4]);
+            updatelos();
+            loopv(players)
+            {
+                fpsent *d = players[i];
+                if(!d->ai || d->state != CS_ALIVE) continue;
+                vec from = d->headpos();
+                loopvj(players)
+                {
+                    fpsent *e = players[j];
+                    if(e == d || !e->ai || e->state != CS_ALIVE) continue;
+                    vec to = aimpos(d, e), cached, cast;
+                    bool visible = losvisible(d, e, from, to, cached);
+                    if(!frame) continue;
+                    checked++;
+                    if(visible != raycubelos(from, to, cast)) mismatches++;
+                }
+            }
+        }
+        loopv(players) players[i]->o = positions[i];
+        Log.std->info("lostest: {} frames, {} checks, {} mismatches, {} rays cast ahead, {} answered from the cache",
+                      numframes, checked, mismatches, loscount.ahead - before.ahead, loscount.hits - before.hits);
+        ailosmove = oldmove;
+        ailoscache = oldcache;
+        ailosbudget = oldbudget;
+        losentries.clear();
+    }
+    COMMAND(lostest, "i");
+
+    /// If d and e are given the ray is looked up in the line of sight cache.
+    bool getsight(vec &o, float yaw, float pitch, vec &q, vec &v, float mdist, float fovx, float fovy, fpsent *d = nullptr, fpsent *e = nullptr)
     {
         float dist = o.dist(q);
 
@@ -107,7 +325,7 @@ namespace ai
         {
             float x = fmod(fabs(asin((q.z-o.z)/dist)/RAD-pitch), 360);
             float y = fmod(fabs(-atan2(q.x-o.x, q.y-o.y)/RAD-yaw), 360);
-            if(min(x, 360-x) <= fovx && min(y, 360-y) <= fovy) return raycubelos(o, q, v);
+            if(min(x, 360-x) <= fovx && min(y, 360-y) <= fovy) return d && e ? losvisible(d, e, o, q, v) : raycubelos(o, q, v);
         }
         return false;
     }
@@ -120,6 +338,14 @@ namespace ai
         return false;
     }
 
+    bool cansee(fpsent *d, fpsent *e, vec &x, vec &y, vec &targ)
+    {
+        aistate &b = d->ai->getstate();
+        if(canmove(d) && b.type != AI_S_WAIT)
+            return getsight(x, d->yaw, d->pitch, y, targ, d->ai->views[2], d->ai->views[0], d->ai->views[1], d, e);
+        return false;
+    }
+
     bool canshoot(fpsent *d, fpsent *e)
     {
         if(weaprange(d, d->gunselect, e->o.squaredist(d->o)) && targetable(d, e))
@@ -146,24 +372,27 @@ namespace ai
         return false;
 	}
 
-    vec getaimpos(fpsent *d, fpsent *e)
+    /// Where d aims at e with its current aim error.
+    static vec aimpos(fpsent *d, fpsent *e)
     {
         vec o = e->o;
         if(d->gunselect == GUN_RL) o.z += (e->aboveeye*0.2f)-(0.8f*d->eyeheight);
         else if(d->gunselect != GUN_GL) o.z += (e->aboveeye-e->eyeheight)*0.5f;
-        if(d->skill <= 100)
+        if(d->skill <= 100) loopk(3) o[k] += d->ai->aimrnd[k];
+        return o;
+    }
+
+    vec getaimpos(fpsent *d, fpsent *e)
+    {
+        if(d->skill <= 100 && lastmillis >= d->ai->lastaimrnd)
         {
-            if(lastmillis >= d->ai->lastaimrnd)
-            {
-                const int aiskew[NUMGUNS] = { 1, 10, 50, 5, 20, 1, 100, 1, 10, 10, 10, 1, 1 };
-                #define rndaioffset(r) ((rnd(int(r*aiskew[d->gunselect]*2)+1)-(r*aiskew[d->gunselect]))*(1.f/float(max(d->skill, 1))))
-                loopk(3) d->ai->aimrnd[k] = rndaioffset(e->radius);
-                int dur = (d->skill+10)*10;
-                d->ai->lastaimrnd = lastmillis+dur+rnd(dur);
-            }
-            loopk(3) o[k] += d->ai->aimrnd[k];
+            const int aiskew[NUMGUNS] = { 1, 10, 50, 5, 20, 1, 100, 1, 10, 10, 10, 1, 1 };
+            #define rndaioffset(r) ((rnd(int(r*aiskew[d->gunselect]*2)+1)-(r*aiskew[d->gunselect]))*(1.f/float(max(d->skill, 1))))
+            loopk(3) d->ai->aimrnd[k] = rndaioffset(e->radius);
+            int dur = (d->skill+10)*10;
+            d->ai->lastaimrnd = lastmillis+dur+rnd(dur);
         }
-        return o;
+        return aimpos(d, e);
     }
 
     void create(fpsent *d)
@@ -223,6 +452,21 @@ namespace ai
         else if(d->ai) destroy(d);
     }
 
+    /// Bots think one after the other but move together, everything which depends on the move is done in aftermove().
+    /// So every bot plans against where the others were at the start of the frame, not against where the bots before it in
+    /// the list already moved to. That makes the plans independent of the order of the players, just like remote players,
+    /// which are only seen at their last known positions as well.
+    struct aimove
+    {
+        fpsent *d;
+        bool active; ///< whether the state whose logic ran wanted to move, so getting stuck counts
+        bool moved;  ///< whether the bot was alive and moved
+    };
+    static vector<aimove> aimoves;
+    static vector<physbatchent> aibatch;
+
+    static void aftermove(const aimove &m);
+
     void update()
     {
         if(intermission) { loopv(players) if(players[i]->ai) players[i]->stopmoving(); }
@@ -239,8 +483,14 @@ namespace ai
                 iteration = 1;
                 itermillis = totalmillis;
             }
+            applyroutes();
+            updatelos();
             int count = 0;
+            aimoves.setsize(0);
+            aibatch.setsize(0);
             loopv(players) if(players[i]->ai) think(players[i], ++count == iteration ? true : false);
+            moveplayers(aibatch.getbuf(), aibatch.length());
+            loopv(aimoves) aftermove(aimoves[i]);
             if(++iteration > count) iteration = 0;
         }
     }
@@ -268,6 +518,17 @@ namespace ai
     {
         if(!iswaypoint(d->lastnode)) return false;
 		if(changed && d->ai->route.length() > 1 && d->ai->route[0] == node) return true;
+        if(!retries && wproutethreads > 0)
+        {
+            // plan in the background and keep following the current route meanwhile, the planner does the retries itself
+            // it found nothing from here, unless waypoints got added or linked since
+            if(d->ai->noroutenode == d->lastnode && d->ai->noroutegoal == node && d->ai->noroutever == waypointversion()) return false;
+            if(d->ai->routegoal == node || requestroute(d, d->lastnode, node, obstacles))
+            {
+                b.override = false;
+                return true;
+            }
+        }
 		if(route(d, d->lastnode, node, d->ai->route, obstacles, retries))
 		{
 			b.override = false;
@@ -320,7 +581,7 @@ namespace ai
             if(e == d || !targetable(d, e)) continue;
             vec ep = getaimpos(d, e);
             float dist = ep.squaredist(dp);
-            if(dist < bestdist && (cansee(d, dp, ep) || dist <= mindist))
+            if(dist < bestdist && (cansee(d, e, dp, ep) || dist <= mindist))
             {
                 t = e;
                 bestdist = dist;
@@ -404,7 +665,7 @@ namespace ai
                 if(e == d || hastried.find(e) >= 0 || !targetable(d, e)) continue;
             vec ep = getaimpos(d, e);
                 float v = ep.squaredist(dp);
-                if((!t || v < dist) && (mindist <= 0 || v <= mindist) && (force || cansee(d, dp, ep)))
+                if((!t || v < dist) && (mindist <= 0 || v <= mindist) && (force || cansee(d, e, dp, ep)))
             {
                 t = e;
                     dist = v;
@@ -1082,7 +1343,7 @@ namespace ai
             float yaw, pitch;
             getyawpitch(dp, ep, yaw, pitch);
             fixrange(yaw, pitch);
-            bool insight = cansee(d, dp, ep), hasseen = d->ai->enemyseen && lastmillis-d->ai->enemyseen <= (d->skill*10)+3000,
+            bool insight = cansee(d, e, dp, ep), hasseen = d->ai->enemyseen && lastmillis-d->ai->enemyseen <= (d->skill*10)+3000,
                 quick = d->ai->enemyseen && lastmillis-d->ai->enemyseen <= (d->gunselect == GUN_CG ? 300 : skmod)+30;
             if(insight) d->ai->enemyseen = lastmillis;
             if(idle || insight || hasseen || quick)
@@ -1202,7 +1463,7 @@ namespace ai
         return process(d, b) >= 2;
     }
 
-	void timeouts(fpsent *d, aistate &b)
+	void timeouts(fpsent *d)
 	{
         if(d->blocked)
         {
@@ -1267,6 +1528,9 @@ namespace ai
 
     void logic(fpsent *d, aistate &b, bool run)
     {
+        aimove &m = aimoves.add();
+        m.d = d;
+        m.active = m.moved = false;
         bool allowmove = canmove(d) && b.type != AI_S_WAIT;
         if(d->state != CS_ALIVE || !allowmove) d->stopmoving();
         if(d->state == CS_ALIVE)
@@ -1279,11 +1543,9 @@ namespace ai
             if(!intermission)
             {
                 if(d->ragdoll) cleanragdoll(d);
-                moveplayer(d, 10, true);
-                if(allowmove && !b.idle) timeouts(d, b);
-                if(d->quadmillis) entities::checkquad(curtime, d);
-				entities::checkitems(d);
-				if(cmode) cmode->checkitems(d);
+                aibatch.add(physbatchent(d, 10, true));
+                m.moved = true;
+                m.active = allowmove && !b.idle;
             }
         }
         else if(d->state == CS_DEAD)
@@ -1292,10 +1554,26 @@ namespace ai
             else if(lastmillis-d->lastpain<2000)
             {
                 d->move = d->strafe = 0;
-                moveplayer(d, 10, false);
+                aibatch.add(physbatchent(d, 10, false));
             }
         }
+    }
+
+    static void aftermove(const aimove &m)
+    {
+        fpsent *d = m.d;
+        if(!d->ai) return;
+        // the callbacks of the move may have killed the bot (and reset its states), only what is still alive picks things up
+        if(m.moved && d->state == CS_ALIVE)
+        {
+            if(m.active) timeouts(d);
+            if(d->quadmillis) entities::checkquad(curtime, d);
+            entities::checkitems(d);
+            if(cmode) cmode->checkitems(d);
+        }
         d->attacking = d->jumping = false;
+        if(d->ai->trywipe) d->ai->wipe();
+        d->ai->lastrun = lastmillis;
     }
 
 	void avoid()
@@ -1363,8 +1641,6 @@ namespace ai
             logic(d, c, run);
             break;
         }
-        if(d->ai->trywipe) d->ai->wipe();
-        d->ai->lastrun = lastmillis;
     }
 
     void drawroute(fpsent *d, float amt = 1.f)
@@ -33,15 +33,11 @@ namespace ai
     struct waypoint
     {
         vec o;
-        float curscore, estscore;
 		int weight;
-        ushort route, prev;
         ushort links[MAXWAYPOINTLINKS];
 
         waypoint() {}
-        waypoint(const vec &o, int weight = 0) : o(o), weight(weight), route(0) { memset(links, 0, sizeof(links)); }
-
-        int score() const { return int(curscore) + int(estscore); }
+        waypoint(const vec &o, int weight = 0) : o(o), weight(weight) { memset(links, 0, sizeof(links)); }
 
         int find(int wp)
 		{
@@ -58,7 +54,7 @@ namespace ai
         return n > 0 && n < waypoints.length();
     }
 
-    extern SharedVar<int> showwaypoints, dropwaypoints;
+    extern SharedVar<int> showwaypoints, dropwaypoints, wproutethreads;
     extern int closestwaypoint(const vec &pos, float mindist, bool links, fpsent *d = nullptr);
     extern void findwaypointswithin(const vec &pos, float mindist, float maxdist, vector<int> &results);
 	extern void inferwaypoints(fpsent *d, const vec &o, const vec &v, float mindist = ai::CLOSEDIST);
@@ -138,11 +134,26 @@ namespace ai
     };
 
     extern bool route(fpsent *d, int node, int goal, vector<int> &route, const avoidset &obstacles, int retries = 0);
+    /// Queue a route for the bot d to be planned on a worker thread, it keeps following its current route until applyroutes() replaces it.
+    /// @return false if routes are planned synchronously (wproutethreads 0) or there is no route to plan
+    extern bool requestroute(fpsent *d, int node, int goal, const avoidset &obstacles, int retries = 0);
+    /// Hand the planned routes to their bots, at most wprouteresults per call; call once per frame.
+    extern void applyroutes();
+    /// Drop the queued route requests and wait for the routes being planned, so nothing runs on the route data at exit.
+    extern void stoproutes();
+    /// Changes with every change of the waypoint graph, so a route which was not found may be found afterwards.
+    extern int waypointversion();
     extern void navigate();
+    extern int addwaypoint(const vec &o, int weight = -1);
+    /// Whether o is in gameclip, death or lava material, bots never go there.
+    extern bool clipped(const vec &o);
+    extern void clearwpcache(bool full = true);
     extern void clearwaypoints(bool full = false);
     extern void seedwaypoints();
     extern void loadwaypoints(bool force = false, const char *mname = nullptr);
     extern void savewaypoints(bool force = false, const char *mname = nullptr);
+    /// Generate the waypoints of the current map from its geometry and save them as the map's .wpt file.
+    extern void genwaypoints(const char *mname = nullptr);
 
     // ai state information for the owner client
     enum
@@ -197,7 +208,8 @@ namespace ai
         vector<int> route;
         vec target, spot;
         int enemy, enemyseen, enemymillis, weappref, prevnodes[NUMPREVNODES], targnode, targlast, targtime, targseq,
-            lastrun, lasthunt, lastaction, lastcheck, jumpseed, jumprand, blocktime, huntseq, blockseq, lastaimrnd;
+            lastrun, lasthunt, lastaction, lastcheck, jumpseed, jumprand, blocktime, huntseq, blockseq, lastaimrnd,
+            routejob, routegoal, noroutenode, noroutegoal, noroutever; ///< the pending route request and the last one which found nothing
         float targyaw, targpitch, views[3], aimrnd[3];
         bool dontmove, becareful, tryreset, trywipe;
 
@@ -220,6 +232,8 @@ namespace ai
         void wipe(bool prev = false)
         {
             clear(prev);
+            routejob = 0;
+            routegoal = noroutenode = noroutegoal = noroutever = -1;
             state.setsize(0);
             addstate(AI_S_WAIT);
             trywipe = false;
@@ -283,6 +297,8 @@ namespace ai
     extern float viewfieldy(int x = 101);
     extern bool targetable(fpsent *d, fpsent *e);
     extern bool cansee(fpsent *d, vec &x, vec &y, vec &targ = aitarget);
+    /// Same as above for the target e, which lets the answer come from the line of sight cache.
+    extern bool cansee(fpsent *d, fpsent *e, vec &x, vec &y, vec &targ = aitarget);
 
     extern void init(fpsent *d, int at, int on, int sk, int bn, int pm, const char *name, const char *team, const char *tag);
     extern void update();
@@ -35,7 +35,7 @@
 #include "inexor/network/legacy/administration.hpp"    // for ::PRIV_ADMIN
 #include "inexor/network/legacy/cube_network.hpp"      // for filtertext
 #include "inexor/network/legacy/game_types.hpp"        // for ::N_SOUND, ::N...
-#include "inexor/physics/physics.hpp"                  // for moveplayer
+#include "inexor/physics/physics.hpp"                  // for moveplayer, moveplayers
 #include "inexor/shared/command.hpp"                   // for intret, ICOMMAND
 #include "inexor/shared/cube_formatting.hpp"           // for tempformatstring
 #include "inexor/shared/cube_loops.hpp"                // for i, loopi, loopv
@@ -255,19 +255,21 @@ namespace game
 	/// use latency and assume player movement to
 	/// predict a player's new position. Improves visual appearance
 	/// of his movement tremendous - even under lag
-    /// @see moveplayer
-    void predictplayer(fpsent *d, bool move)
+    /// resets the player to the last state received, moveplayer() then predicts from there.
+    /// @see smoothplayer
+    void predictplayer(fpsent *d)
     {
         d->o = d->newpos;
         d->yaw = d->newyaw;
         d->pitch = d->newpitch;
         d->roll = d->newroll;
+    }
 
-        if(move)
-        {
-            moveplayer(d, 1, false);
-            d->newpos = d->o;
-        }
+    /// blend the predicted position with the previously displayed one
+    /// @see predictplayer
+    void smoothplayer(fpsent *d)
+    {
+        d->newpos = d->o;
         float k = 1.0f - float(lastmillis - d->smoothmillis)/smoothmove;
         if(k>0)
         {
@@ -285,8 +287,13 @@ namespace game
     /// @see updateworld
     /// @see moveragdoll
     /// @see predictplayer
+    /// @see moveplayers
     void otherplayers(int curtime)
     {
+        static vector<physbatchent> moves;
+        static vector<fpsent *> smoothed;
+        moves.setsize(0);
+        smoothed.setsize(0);
         loopv(players)
         {
             fpsent *d = players[i];
@@ -308,11 +315,17 @@ namespace game
             }
             if(d->state==CS_ALIVE || d->state==CS_EDITING)
             {
-                if(smoothmove && d->smoothmillis>0) predictplayer(d, true);
-                else moveplayer(d, 1, false);
+                if(smoothmove && d->smoothmillis>0)
+                {
+                    predictplayer(d);
+                    smoothed.add(d);
+                }
+                moves.add(physbatchent(d, 1, false));
             }
-            else if(d->state==CS_DEAD && !d->ragdoll && lastmillis-d->lastpain<2000) moveplayer(d, 1, true);
+            else if(d->state==CS_DEAD && !d->ragdoll && lastmillis-d->lastpain<2000) moves.add(physbatchent(d, 1, true));
         }
+        moveplayers(moves.getbuf(), moves.length());
+        loopv(smoothed) smoothplayer(smoothed[i]);
     }
 
     /// called in game loop to the update game world
@@ -3,8 +3,12 @@
 #include <boost/algorithm/clamp.hpp>                  // for clamp
 #include <math.h>                                     // for sqrtf
 #include <string.h>                                   // for memcmp, strcmp
-#include <algorithm>                                  // for max, min, swap
-#include <memory>                                     // for __shared_ptr
+#include <algorithm>                                  // for max, min, swap, remove_if
+#include <memory>                                     // for shared_ptr
+#include <vector>                                     // for vector
+
+#include "SDL_mutex.h"                                // for SDL_LockMutex, SDL_UnlockMutex
+#include "SDL_timer.h"                                // for SDL_GetTicks
 
 #include "inexor/engine/material.hpp"                 // for ::MATF_VOLUME
 #include "inexor/engine/octa.hpp"                     // for lookupmaterial
@@ -22,6 +26,7 @@
 #include "inexor/network/SharedVar.hpp"               // for SharedVar
 #include "inexor/physics/physics.hpp"                 // for collide, raycube
 #include "inexor/shared/command.hpp"                  // for ICOMMAND, _icmd...
+#include "inexor/shared/cube_hash.hpp"                // for hashtable
 #include "inexor/shared/cube_formatting.hpp"          // for nformatstring
 #include "inexor/shared/cube_loops.hpp"               // for i, loopi, j, loopv
 #include "inexor/shared/cube_tools.hpp"               // for copystring
@@ -30,6 +35,7 @@
 #include "inexor/shared/ents.hpp"                     // for extentity, ::BASE
 #include "inexor/shared/geom.hpp"                     // for vec, vec::(anon...
 #include "inexor/shared/tools.hpp"                    // for max, min, rnd
+#include "inexor/util/jobs.hpp"                       // for jobs
 
 extern selinfo sel;
 
@@ -205,8 +211,20 @@ namespace ai
         }
     }
 
-    void clearwpcache(bool full = true)
+    static void clearwproutes();
+
+    static int wpversion = 0; ///< bumped by every change of the waypoint graph
+    static int wplayout = 0; ///< bumped whenever waypoints might have been renumbered or removed
+
+    int waypointversion() { return wpversion; }
+
+    void clearwpcache(bool full)
     {
+        if(full)
+        {
+            wplayout++;
+            clearwproutes();
+        }
         loopi(NUMWPCACHES) if(full || invalidatedwpcaches&(1<<i)) { wpcaches[i].clear(); clearedwpcaches |= 1<<i; }
         if(full || invalidatedwpcaches == (1<<NUMWPCACHES)-1)
 	      {
@@ -448,103 +466,1062 @@ namespace ai
         return n;
     }
 
-    static inline float heapscore(waypoint *q) { return q->score(); }
+    /// Binary min heap of waypoints with O(log n) decrease-key: every waypoint remembers where it is queued.
+    struct wpqueue
+    {
+        struct item
+        {
+            float key;
+            int wp;
+        };
+
+        vector<item> heap;
+        vector<int> pos; ///< index into heap for every waypoint, -1 if it is not queued
 
-    bool route(fpsent *d, int node, int goal, vector<int> &route, const avoidset &obstacles, int retries)
+        /// Empty the queue and make room for numwp waypoints.
+        void reset(int numwp)
+        {
+            loopv(heap) pos[heap[i].wp] = -1;
+            heap.setsize(0);
+            while(pos.length() < numwp) pos.add(-1);
+        }
+
+        bool empty() const { return heap.empty(); }
+        float minkey() const { return heap[0].key; }
+
+        void up(int i)
+        {
+            item x = heap[i];
+            while(i > 0)
+            {
+                int parent = (i-1)/2;
+                if(heap[parent].key <= x.key) break;
+                heap[i] = heap[parent];
+                pos[heap[i].wp] = i;
+                i = parent;
+            }
+            heap[i] = x;
+            pos[x.wp] = i;
+        }
+
+        void down(int i)
+        {
+            item x = heap[i];
+            for(;;)
+            {
+                int child = 2*i+1;
+                if(child >= heap.length()) break;
+                if(child+1 < heap.length() && heap[child+1].key < heap[child].key) child++;
+                if(x.key <= heap[child].key) break;
+                heap[i] = heap[child];
+                pos[heap[i].wp] = i;
+                i = child;
+            }
+            heap[i] = x;
+            pos[x.wp] = i;
+        }
+
+        /// Queue wp with the given key or lower its key if it is queued already.
+        void set(int wp, float key)
+        {
+            int i = pos[wp];
+            if(i >= 0)
+            {
+                if(key < heap[i].key) { heap[i].key = key; up(i); }
+                return;
+            }
+            item &x = heap.add();
+            x.key = key;
+            x.wp = wp;
+            up(heap.length()-1);
+        }
+
+        int pop()
+        {
+            int wp = heap[0].wp;
+            pos[wp] = -1;
+            item last = heap.pop();
+            if(heap.length()) { heap[0] = last; down(0); }
+            return wp;
+        }
+    };
+
+    static inline float linkcost(const waypoint &from, const waypoint &to) { return to.o.dist(from.o)*max(to.weight, 1); }
+
+    // Hierarchical routing: waypoints are grouped into clusters on a uniform grid, and within a cluster into the parts which can
+    // all reach each other by links inside it (e.g. the two sides of a wall). Links between such parts of neighbouring clusters
+    // are crossings. For every cluster we keep the cheapest way from each crossing into it to each crossing out of it. A search over
+    // the crossings finds the corridor of clusters a route passes through, the actual route is then only searched within it.
+
+    VARF(wpclustersize, 64, 256, 4096, clearwproutes());
+    VAR(wphierarchy, 0, 1, 1);
+    VAR(wphierarchymin, 0, 512, 65535); ///< smaller graphs are fast enough for a plain search
+    VARF(wproutecache, 0, 256, 4096, clearwproutes());
+    VAR(wpcorridorwidth, 0, 1, 4); ///< rings of neighbouring clusters added around a corridor
+
+    struct wpcluster
     {
-        if(waypoints.empty() || !iswaypoint(node) || !iswaypoint(goal) || goal == node || !waypoints[node].links[0])
-            return false;
+        /// A connected part of a neighbouring cluster (out) or the part of this one a neighbour links into (in).
+        struct side
+        {
+            int cluster, part;
 
-        static ushort routeid = 1;
-        static vector<waypoint *> queue;
+            bool operator==(const side &o) const { return cluster == o.cluster && part == o.part; }
+        };
+
+        struct entry
+        {
+            int member, from; ///< index into members and into in
+        };
+
+        struct exit
+        {
+            int member, to; ///< index into members and into out
+            float cost; ///< of the link leaving the cluster
+        };
+
+        vector<ushort> members, parts; ///< the strongly connected part of every member
+        vector<ushort> incoming; ///< pairs of waypoints linking from another cluster into this one
+        vector<side> in, out;
+        vector<entry> entries;
+        vector<exit> exits;
+        vector<int> sources; ///< members which are entries, one cost table each
+        vector<float> costs; ///< sources x members, < 0 if unreachable
+        vector<float> transit; ///< in x out: cheapest way from entering to leaving, including the leaving link, < 0 if there is none
+        vec bbmin, bbmax;
+        int firstcrossing; ///< global index of the crossing into out[0]
+        bool dirty;
+
+        wpcluster() : bbmin(1e16f, 1e16f, 1e16f), bbmax(-1e16f, -1e16f, -1e16f), firstcrossing(0), dirty(true) {}
+
+        float cost(int source, int member) const { return costs[source*members.length() + member]; }
+
+        template<class T> static int find(const vector<T> &v, const T &x) { loopv(v) if(v[i] == x) return i; return -1; }
+
+        /// Lower bound of the cost to reach pos from anywhere in this cluster.
+        float mindist(const vec &pos) const
+        {
+            vec d(max(max(bbmin.x - pos.x, pos.x - bbmax.x), 0.0f), max(max(bbmin.y - pos.y, pos.y - bbmax.y), 0.0f), max(max(bbmin.z - pos.z, pos.z - bbmax.z), 0.0f));
+            return d.magnitude();
+        }
+    };
+
+    /// An LRU cache of cluster corridors, shared by all bots since it only depends on the parts the start and the goal are in.
+    struct corridorcache
+    {
+        struct key
+        {
+            wpcluster::side start, goal;
 
-        if(!routeid)
+            friend uint hthash(const key &k) { return uint(k.start.cluster)*0x9E3779B1U ^ uint(k.start.part)*0x85EBCA77U ^ uint(k.goal.cluster)*0xC2B2AE3DU ^ uint(k.goal.part); }
+            friend bool htcmp(const key &x, const key &y) { return x.start == y.start && x.goal == y.goal; }
+        };
+
+        struct entry
+        {
+            key k;
+            int prev, next;
+            vector<ushort> clusters; ///< empty if there is no connection
+        };
+
+        vector<entry> entries;
+        hashtable<key, int> index;
+        int head, tail;
+
+        corridorcache() : head(-1), tail(-1) {}
+
+        void clear()
         {
-            loopv(waypoints) waypoints[i].route = 0;
-            routeid = 1;
+            entries.shrink(0);
+            index.clear();
+            head = tail = -1;
         }
 
-        if(d)
+        void unlink(int i)
         {
-            if(retries <= 1 && d->ai) loopi(ai::NUMPREVNODES) if(d->ai->prevnodes[i] != node && iswaypoint(d->ai->prevnodes[i]))
+            entry &e = entries[i];
+            if(e.prev >= 0) entries[e.prev].next = e.next; else head = e.next;
+            if(e.next >= 0) entries[e.next].prev = e.prev; else tail = e.prev;
+        }
+
+        void linkfront(int i)
+        {
+            entry &e = entries[i];
+            e.prev = -1;
+            e.next = head;
+            if(head >= 0) entries[head].prev = i; else tail = i;
+            head = i;
+        }
+
+        const vector<ushort> *find(const key &k)
+        {
+            int *i = index.access(k);
+            if(!i) return nullptr;
+            if(*i != head) { unlink(*i); linkfront(*i); }
+            return &entries[*i].clusters;
+        }
+
+        vector<ushort> &insert(const key &k, int capacity)
+        {
+            int i;
+            if(entries.length() < capacity) { i = entries.length(); entries.add(); }
+            else
             {
-                waypoints[d->ai->prevnodes[i]].route = routeid;
-                waypoints[d->ai->prevnodes[i]].curscore = -1;
-                waypoints[d->ai->prevnodes[i]].estscore = 0;
+                i = tail;
+                unlink(i);
+                index.remove(entries[i].k);
             }
-			if(retries <= 0)
-			{
-            loopavoid(obstacles, d,
+            entry &e = entries[i];
+            e.k = k;
+            e.clusters.setsize(0);
+            index[k] = i;
+            linkfront(i);
+            return e.clusters;
+        }
+    };
+
+    static vector<wpcluster> wpclusters;
+    static hashtable<int, int> wpclusterindex;
+    static vector<int> wpclusterof; ///< cluster of every waypoint which was assigned one yet
+    static vector<ushort> wpmemberof; ///< index into the members of its cluster
+    static vector<int> wpnewlinks; ///< pairs of waypoints linked since the last update
+    static vector<int> crossingcluster; ///< the cluster every crossing leaves
+    static bool wproutesfull = true;
+    static corridorcache corridors;
+    static wpqueue clusterqueue, corridorqueue;
+
+    static void clearwproutes()
+    {
+        wpversion++;
+        wproutesfull = true;
+        corridors.clear();
+    }
+
+    static void invalidatewproutes(int from, int to)
+    {
+        wpversion++;
+        if(wproutesfull) return;
+        if(wpnewlinks.length() >= 2048) { clearwproutes(); return; } // cheaper to start over
+        wpnewlinks.add(from);
+        wpnewlinks.add(to);
+        corridors.clear();
+    }
+
+    static int clusterkey(const vec &o)
+    {
+        int shift = 0;
+        while((1<<(shift+1)) <= wpclustersize) shift++;
+        int x = clamp(int(o.x)>>shift, 0, 1023), y = clamp(int(o.y)>>shift, 0, 1023), z = clamp(int(o.z)>>shift, 0, 1023);
+        return (x<<20) | (y<<10) | z;
+    }
+
+    static void assigncluster(int wp)
+    {
+        const vec &o = waypoints[wp].o;
+        int key = clusterkey(o), *c = wpclusterindex.access(key), cluster;
+        if(c) cluster = *c;
+        else
+        {
+            cluster = wpclusters.length();
+            wpclusters.add();
+            wpclusterindex[key] = cluster;
+        }
+        wpcluster &cl = wpclusters[cluster];
+        wpclusterof[wp] = cluster;
+        wpmemberof[wp] = cl.members.length();
+        cl.members.add(wp);
+        cl.parts.add(0);
+        cl.bbmin.min(o);
+        cl.bbmax.max(o);
+        cl.dirty = true;
+    }
+
+    /// Remember a link from a waypoint into another cluster.
+    static void addcrossing(int from, int to)
+    {
+        wpcluster &src = wpclusters[wpclusterof[from]], &dst = wpclusters[wpclusterof[to]];
+        src.dirty = true;
+        for(int i = 0; i+1 < dst.incoming.length(); i += 2) if(dst.incoming[i] == from && dst.incoming[i+1] == to) return;
+        dst.incoming.add(from);
+        dst.incoming.add(to);
+        dst.dirty = true;
+    }
+
+    /// Split a cluster into its strongly connected parts (Tarjan's algorithm): every member of a part can reach all members of it
+    /// without leaving the cluster, so it does not matter where exactly a route enters a part.
+    static void updateparts(wpcluster &cl)
+    {
+        static vector<int> index, low, stack, calls;
+        int cluster = &cl - wpclusters.getbuf(), counter = 0, numparts = 0;
+        index.setsize(0);
+        low.setsize(0);
+        loopv(cl.members) { index.add(-1); low.add(0); cl.parts[i] = USHRT_MAX; }
+        loopv(cl.members) if(index[i] < 0)
+        {
+            index[i] = low[i] = counter++;
+            stack.add(i);
+            calls.add(i);
+            calls.add(0); // next link to follow
+            while(calls.length())
             {
-					if(iswaypoint(wp) && wp != node && wp != goal && waypoints[node].find(wp) < 0 && waypoints[goal].find(wp) < 0)
+                int v = calls[calls.length()-2], k = calls.last();
+                const waypoint &w = waypoints[cl.members[v]];
+                if(k < MAXWAYPOINTLINKS && w.links[k])
                 {
-                    waypoints[wp].route = routeid;
-                    waypoints[wp].curscore = -1;
-                    waypoints[wp].estscore = 0;
+                    calls.last()++;
+                    int link = w.links[k];
+                    if(!iswaypoint(link) || wpclusterof[link] != cluster) continue;
+                    int u = wpmemberof[link];
+                    if(index[u] < 0)
+                    {
+                        index[u] = low[u] = counter++;
+                        stack.add(u);
+                        calls.add(u);
+                        calls.add(0);
+                    }
+                    else if(cl.parts[u] == USHRT_MAX) low[v] = min(low[v], index[u]); // still on the stack
+                    continue;
                 }
-            });
-        }
+                calls.setsize(calls.length()-2);
+                if(calls.length()) { int parent = calls[calls.length()-2]; low[parent] = min(low[parent], low[v]); }
+                if(low[v] == index[v])
+                {
+                    int u;
+                    do { u = stack.pop(); cl.parts[u] = numparts; } while(u != v);
+                    numparts++;
+                }
+            }
         }
+    }
 
-        waypoints[node].route = routeid;
-        waypoints[node].curscore = waypoints[node].estscore = 0;
-        waypoints[node].prev = 0;
-        queue.setsize(0);
-        queue.add(&waypoints[node]);
-        route.setsize(0);
-
-        int lowest = -1;
-        while(!queue.empty())
+    /// Cheapest cost from start to every member of its cluster, without leaving it.
+    static void clusterdistances(int start, float *dists)
+    {
+        const wpcluster &cl = wpclusters[wpclusterof[start]];
+        loopv(cl.members) dists[i] = -1;
+        dists[wpmemberof[start]] = 0;
+        clusterqueue.reset(waypoints.length());
+        clusterqueue.set(start, 0);
+        while(!clusterqueue.empty())
         {
-            waypoint &m = *queue.removeheap();
-            float prevscore = m.curscore;
-            m.curscore = -1;
+            int cur = clusterqueue.pop();
+            const waypoint &m = waypoints[cur];
+            float curdist = dists[wpmemberof[cur]];
             loopi(MAXWAYPOINTLINKS)
             {
                 int link = m.links[i];
                 if(!link) break;
-                if(iswaypoint(link) && (link == node || link == goal || waypoints[link].links[0]))
+                if(!iswaypoint(link) || wpclusterof[link] != wpclusterof[start]) continue;
+                float dist = curdist + linkcost(m, waypoints[link]);
+                float &best = dists[wpmemberof[link]];
+                if(best >= 0 && best <= dist) continue;
+                best = dist;
+                clusterqueue.set(link, dist);
+            }
+        }
+    }
+
+    static inline wpcluster::side sideof(int wp)
+    {
+        wpcluster::side s;
+        s.cluster = wpclusterof[wp];
+        s.part = wpclusters[s.cluster].parts[wpmemberof[wp]];
+        return s;
+    }
+
+    /// Rebuild the crossings of a cluster and the costs between them, the parts of all clusters must be up to date.
+    static void updatecluster(wpcluster &cl)
+    {
+        int cluster = &cl - wpclusters.getbuf();
+        cl.out.setsize(0);
+        cl.exits.setsize(0);
+        loopv(cl.members)
+        {
+            const waypoint &w = waypoints[cl.members[i]];
+            loopj(MAXWAYPOINTLINKS)
+            {
+                int link = w.links[j];
+                if(!link) break;
+                if(!iswaypoint(link) || wpclusterof[link] == cluster) continue;
+                wpcluster::side s = sideof(link);
+                int to = wpcluster::find(cl.out, s);
+                if(to < 0) { to = cl.out.length(); cl.out.add(s); }
+                wpcluster::exit &e = cl.exits.add();
+                e.member = i;
+                e.to = to;
+                e.cost = linkcost(w, waypoints[link]);
+            }
+        }
+
+        cl.in.setsize(0);
+        cl.entries.setsize(0);
+        cl.sources.setsize(0);
+        vector<int> source;
+        for(int i = 0; i+1 < cl.incoming.length(); i += 2)
+        {
+            int from = cl.incoming[i], to = cl.incoming[i+1];
+            if(waypoints[from].find(to) < 0) continue; // the link was replaced meanwhile
+            wpcluster::side s;
+            s.cluster = wpclusterof[from];
+            s.part = cl.parts[wpmemberof[to]];
+            int in = wpcluster::find(cl.in, s);
+            if(in < 0) { in = cl.in.length(); cl.in.add(s); }
+            int member = wpmemberof[to], src = wpcluster::find(cl.sources, member);
+            if(src < 0) { src = cl.sources.length(); cl.sources.add(member); }
+            wpcluster::entry &e = cl.entries.add();
+            e.member = member;
+            e.from = in;
+            source.add(src);
+        }
+        cl.costs.setsize(0);
+        float *costs = cl.costs.pad(cl.sources.length()*cl.members.length());
+        loopv(cl.sources) clusterdistances(cl.members[cl.sources[i]], &costs[i*cl.members.length()]);
+
+        cl.transit.setsize(0);
+        float *transit = cl.transit.pad(cl.in.length()*cl.out.length());
+        loopi(cl.in.length()*cl.out.length()) transit[i] = -1;
+        loopv(cl.entries)
+        {
+            float *row = &transit[cl.entries[i].from*cl.out.length()];
+            loopvj(cl.exits)
+            {
+                const wpcluster::exit &e = cl.exits[j];
+                float dist = cl.cost(source[i], e.member);
+                if(dist < 0) continue;
+                dist += e.cost;
+                if(row[e.to] < 0 || dist < row[e.to]) row[e.to] = dist;
+            }
+        }
+        cl.dirty = false;
+    }
+
+    /// Bring the clusters up to date with all waypoints and links added since the last route.
+    static void updatewproutes()
+    {
+        if(wproutesfull)
+        {
+            wpclusters.shrink(0);
+            wpclusterindex.clear();
+            wpclusterof.setsize(0);
+            wpmemberof.setsize(0);
+            wpnewlinks.setsize(0);
+            wproutesfull = false;
+        }
+        int assigned = wpclusterof.length();
+        if(assigned < waypoints.length())
+        {
+            wpclusterof.pad(waypoints.length()-assigned);
+            wpmemberof.pad(waypoints.length()-assigned);
+            if(!assigned) { wpclusterof[0] = -1; assigned = 1; }
+            for(int i = assigned; i < waypoints.length(); i++) assigncluster(i);
+            // links into the new waypoints were recorded by linkwaypoint, the ones out of them were not
+            for(int i = assigned; i < waypoints.length(); i++)
+            {
+                const waypoint &w = waypoints[i];
+                loopj(MAXWAYPOINTLINKS)
                 {
-                    waypoint &n = waypoints[link];
-                    int weight = max(n.weight, 1);
-                    float curscore = prevscore + n.o.dist(m.o)*weight;
-                    if(n.route == routeid && curscore >= n.curscore) continue;
-                    n.curscore = curscore;
-                    n.prev = ushort(&m - &waypoints[0]);
-                    if(n.route != routeid)
+                    int link = w.links[j];
+                    if(!link) break;
+                    if(iswaypoint(link) && wpclusterof[link] != wpclusterof[i]) addcrossing(i, link);
+                }
+            }
+        }
+        for(int i = 0; i+1 < wpnewlinks.length(); i += 2)
+        {
+            int from = wpnewlinks[i], to = wpnewlinks[i+1];
+            if(!iswaypoint(from) || !iswaypoint(to)) continue;
+            if(wpclusterof[from] != wpclusterof[to]) addcrossing(from, to);
+            else wpclusters[wpclusterof[from]].dirty = true;
+        }
+        wpnewlinks.setsize(0);
+
+        // new parts change the crossings of every cluster linking into them
+        vector<int> changed;
+        loopv(wpclusters) if(wpclusters[i].dirty) { updateparts(wpclusters[i]); changed.add(i); }
+        if(changed.empty()) return;
+        loopv(changed)
+        {
+            const wpcluster &cl = wpclusters[changed[i]];
+            for(int j = 0; j+1 < cl.incoming.length(); j += 2) wpclusters[wpclusterof[cl.incoming[j]]].dirty = true;
+        }
+        loopv(wpclusters) if(wpclusters[i].dirty) updatecluster(wpclusters[i]);
+
+        crossingcluster.setsize(0);
+        loopv(wpclusters)
+        {
+            wpclusters[i].firstcrossing = crossingcluster.length();
+            loopj(wpclusters[i].out.length()) crossingcluster.add(i);
+        }
+    }
+
+    static vector<float> corridorscore, startdists, goaldists;
+    static vector<int> corridorprev;
+    static vector<uint> corridorstamp;
+    static uint corridorid = 0;
+
+    static inline void relaxcrossing(const wpcluster &cl, int out, float score, int prev, const vec &goalpos)
+    {
+        int crossing = cl.firstcrossing + out;
+        if(corridorstamp[crossing] == corridorid && corridorscore[crossing] <= score) return;
+        corridorstamp[crossing] = corridorid;
+        corridorscore[crossing] = score;
+        corridorprev[crossing] = prev;
+        corridorqueue.set(crossing, score + wpclusters[cl.out[out].cluster].mindist(goalpos));
+    }
+
+    /// Search the crossings between clusters for the clusters a route from node to goal passes through.
+    static bool findcorridor(int node, int goal, vector<ushort> &clusters)
+    {
+        int startcluster = wpclusterof[node], goalcluster = wpclusterof[goal];
+        const wpcluster &start = wpclusters[startcluster], &dest = wpclusters[goalcluster];
+        int numcrossings = crossingcluster.length();
+        if(corridorstamp.length() < numcrossings)
+        {
+            int pad = numcrossings - corridorstamp.length();
+            corridorscore.pad(pad);
+            corridorprev.pad(pad);
+            loopi(pad) corridorstamp.add(0);
+        }
+        if(!++corridorid)
+        {
+            loopv(corridorstamp) corridorstamp[i] = 0;
+            corridorid = 1;
+        }
+        corridorqueue.reset(numcrossings);
+        const vec &goalpos = waypoints[goal].o;
+
+        startdists.setsize(0);
+        clusterdistances(node, startdists.pad(start.members.length()));
+        loopv(start.exits)
+        {
+            const wpcluster::exit &e = start.exits[i];
+            if(startdists[e.member] < 0) continue;
+            relaxcrossing(start, e.to, startdists[e.member] + e.cost, -1, goalpos);
+        }
+
+        // cheapest way to the goal depending on where we enter its cluster
+        goaldists.setsize(0);
+        loopv(dest.in) goaldists.add(-1);
+        loopv(dest.entries)
+        {
+            const wpcluster::entry &e = dest.entries[i];
+            float dist = dest.cost(wpcluster::find(dest.sources, e.member), wpmemberof[goal]);
+            if(dist >= 0 && (goaldists[e.from] < 0 || dist < goaldists[e.from])) goaldists[e.from] = dist;
+        }
+
+        float best = 1e16f;
+        int bestcrossing = -1;
+        while(!corridorqueue.empty() && corridorqueue.minkey() < best)
+        {
+            int crossing = corridorqueue.pop(), from = crossingcluster[crossing];
+            const wpcluster &src = wpclusters[from];
+            wpcluster::side side = src.out[crossing - src.firstcrossing];
+            const wpcluster &cl = wpclusters[side.cluster];
+            side.cluster = from;
+            int in = wpcluster::find(cl.in, side);
+            if(in < 0) continue;
+            float score = corridorscore[crossing];
+            if(&cl == &dest && goaldists[in] >= 0 && score + goaldists[in] < best)
+            {
+                best = score + goaldists[in];
+                bestcrossing = crossing;
+            }
+            const float *transit = &cl.transit[in*cl.out.length()];
+            loopv(cl.out) if(transit[i] >= 0) relaxcrossing(cl, i, score + transit[i], crossing, goalpos);
+        }
+        if(bestcrossing < 0) return false;
+
+        clusters.add(goalcluster);
+        for(int crossing = bestcrossing; crossing >= 0; crossing = corridorprev[crossing])
+            if(clusters.find(crossingcluster[crossing]) < 0) clusters.add(crossingcluster[crossing]);
+        return true;
+    }
+
+    /// The clusters a route from node to goal should stay in, widened by wpcorridorwidth rings of neighbours.
+    /// The transit costs only know the cheapest entry of a part, so a slightly wider corridor often allows a shorter route.
+    /// @return false if the route should not be restricted
+    static bool findcorridorclusters(int node, int goal, vector<ushort> &corridor)
+    {
+        static vector<uint> incorridor; ///< per cluster
+        static uint corridormark = 0;
+
+        corridor.setsize(0);
+        updatewproutes();
+        int startcluster = wpclusterof[node], goalcluster = wpclusterof[goal];
+        if(startcluster == goalcluster) return false;
+        corridorcache::key key;
+        key.start = sideof(node);
+        key.goal = sideof(goal);
+        const vector<ushort> *clusters = wproutecache ? corridors.find(key) : nullptr;
+        if(!clusters)
+        {
+            static vector<ushort> found;
+            vector<ushort> &dst = wproutecache ? corridors.insert(key, wproutecache) : found;
+            dst.setsize(0);
+            findcorridor(node, goal, dst);
+            clusters = &dst;
+        }
+        if(clusters->empty()) return false;
+        while(incorridor.length() < wpclusters.length()) incorridor.add(0);
+        if(!++corridormark)
+        {
+            loopv(incorridor) incorridor[i] = 0;
+            corridormark = 1;
+        }
+        loopv(*clusters) { incorridor[(*clusters)[i]] = corridormark; corridor.add((*clusters)[i]); }
+        loopi(wpcorridorwidth)
+        {
+            int numclusters = corridor.length();
+            loopj(numclusters)
+            {
+                const wpcluster &cl = wpclusters[corridor[j]];
+                loopvk(cl.in) if(incorridor[cl.in[k].cluster] != corridormark) { incorridor[cl.in[k].cluster] = corridormark; corridor.add(cl.in[k].cluster); }
+                loopvk(cl.out) if(incorridor[cl.out[k].cluster] != corridormark) { incorridor[cl.out[k].cluster] = corridormark; corridor.add(cl.out[k].cluster); }
+            }
+        }
+        return true;
+    }
+
+    /// The live waypoint graph as the route planners see it, only to be used on the main thread.
+    struct livegraph
+    {
+        int length() const { return waypoints.length(); }
+        const vec &pos(int wp) const { return waypoints[wp].o; }
+        int weight(int wp) const { return waypoints[wp].weight; }
+        const ushort *links(int wp) const { return waypoints[wp].links; }
+        int cluster(int wp) const { return wpclusterof.inrange(wp) ? wpclusterof[wp] : -1; }
+    };
+
+    /// An immutable copy of the waypoint graph, so route planner threads never see the main thread editing the waypoints.
+    struct wpsnapshot
+    {
+        int version, layout;
+        vector<vec> o;
+        vector<int> weights, clusters;
+        vector<ushort> linkdata; ///< MAXWAYPOINTLINKS per waypoint
+
+        int length() const { return o.length(); }
+        const vec &pos(int wp) const { return o[wp]; }
+        int weight(int wp) const { return weights[wp]; }
+        const ushort *links(int wp) const { return &linkdata[wp*MAXWAYPOINTLINKS]; }
+        int cluster(int wp) const { return clusters.inrange(wp) ? clusters[wp] : -1; }
+    };
+
+    /// The scratch state of the A* search, every thread which plans routes needs its own.
+    struct routeplanner
+    {
+        vector<float> curscore, estscore;
+        vector<ushort> prev, visited;
+        ushort routeid;
+        vector<uint> incorridor; ///< per cluster
+        uint corridormark;
+        wpqueue queue;
+
+        routeplanner() : routeid(1), corridormark(0) {}
+
+        /// Mark the clusters the next search may enter.
+        /// @return the mark to pass to find()
+        uint markcorridor(const vector<ushort> &clusters)
+        {
+            if(!++corridormark)
+            {
+                loopv(incorridor) incorridor[i] = 0;
+                corridormark = 1;
+            }
+            loopv(clusters)
+            {
+                while(incorridor.length() <= clusters[i]) incorridor.add(0);
+                incorridor[clusters[i]] = corridormark;
+            }
+            return corridormark;
+        }
+
+        /// A* search from node to goal which never enters the blocked waypoints, and only enters the clusters marked with corridor if it is set.
+        /// The route is stored backward: it starts at the goal or, if nothing got there, at the closest waypoint reached next to it.
+        template<class G> bool find(const G &g, int node, int goal, const ushort *blocked, int numblocked, uint corridor, vector<int> &route)
+        {
+            int numwp = g.length();
+            while(visited.length() < numwp) { visited.add(0); curscore.add(0); estscore.add(0); prev.add(0); }
+            if(!routeid)
+            {
+                loopv(visited) visited[i] = 0;
+                routeid = 1;
+            }
+
+            loopi(numblocked)
+            {
+                int wp = blocked[i];
+                visited[wp] = routeid;
+                curscore[wp] = -1;
+                estscore[wp] = 0;
+            }
+
+            visited[node] = routeid;
+            curscore[node] = estscore[node] = 0;
+            prev[node] = 0;
+            queue.reset(numwp);
+            queue.set(node, 0);
+            route.setsize(0);
+
+            const vec &goalpos = g.pos(goal);
+            int lowest = -1;
+            while(!queue.empty())
+            {
+                int m = queue.pop();
+                float prevscore = curscore[m];
+                curscore[m] = -1;
+                const vec &mpos = g.pos(m);
+                const ushort *links = g.links(m);
+                loopi(MAXWAYPOINTLINKS)
+                {
+                    int link = links[i];
+                    if(!link) break;
+                    if(link > 0 && link < numwp && (link == node || link == goal || g.links(link)[0]))
                     {
-                        n.estscore = n.o.dist(waypoints[goal].o)*weight;
-                        if(n.estscore <= WAYPOINTRADIUS*4 && (lowest < 0 || n.estscore <= waypoints[lowest].estscore))
-                            lowest = link;
-                        n.route = routeid;
-                        if(link == goal) goto foundgoal;
-                        queue.addheap(&n);
+                        if(corridor && link != goal)
+                        {
+                            int cluster = g.cluster(link);
+                            if(!incorridor.inrange(cluster) || incorridor[cluster] != corridor) continue;
+                        }
+                        const vec &npos = g.pos(link);
+                        int weight = max(g.weight(link), 1);
+                        float score = prevscore + npos.dist(mpos)*weight;
+                        if(visited[link] == routeid && score >= curscore[link]) continue;
+                        curscore[link] = score;
+                        prev[link] = ushort(m);
+                        if(visited[link] != routeid)
+                        {
+                            estscore[link] = npos.dist(goalpos)*weight;
+                            if(estscore[link] <= WAYPOINTRADIUS*4 && (lowest < 0 || estscore[link] <= estscore[lowest]))
+                                lowest = link;
+                            visited[link] = routeid;
+                            if(link == goal) goto foundgoal;
+                        }
+                        queue.set(link, int(curscore[link]) + int(estscore[link]));
                     }
-                    else loopvj(queue) if(queue[j] == &n) { queue.upheap(j); break; }
                 }
             }
+            foundgoal:
+
+            routeid++;
+
+            if(lowest >= 0) // otherwise nothing got there
+            {
+                for(int m = lowest; m > 0; m = prev[m]) route.add(m); // just keep it stored backward
+            }
+
+            return !route.empty();
+        }
+
+        /// Search within the corridor first if there is one and fall back to the whole graph.
+        template<class G> bool plan(const G &g, int node, int goal, const ushort *blocked, int numblocked, const vector<ushort> &corridor, vector<int> &route)
+        {
+            // a route which only got close to the goal within the corridor might still reach it outside
+            if(corridor.length() && find(g, node, goal, blocked, numblocked, markcorridor(corridor), route) && route[0] == goal) return true;
+            return find(g, node, goal, blocked, numblocked, 0, route);
+        }
+    };
+
+    /// Collect the waypoints a route of d must not pass: its previous nodes unless retries > 1, the obstacles unless retries > 0.
+    /// @return the number of previous nodes, they come first
+    static int blockedwaypoints(fpsent *d, int node, int goal, const avoidset &obstacles, int retries, vector<ushort> &blocked)
+    {
+        blocked.setsize(0);
+        if(!d) return 0;
+        if(retries <= 1 && d->ai) loopi(ai::NUMPREVNODES) if(d->ai->prevnodes[i] != node && iswaypoint(d->ai->prevnodes[i])) blocked.add(d->ai->prevnodes[i]);
+        int numprev = blocked.length();
+        if(retries <= 0)
+        {
+            loopavoid(obstacles, d,
+            {
+                if(iswaypoint(wp) && wp != node && wp != goal && waypoints[node].find(wp) < 0 && waypoints[goal].find(wp) < 0)
+                    blocked.add(wp);
+            });
+        }
+        return numprev;
+    }
+
+    static inline bool userouthierarchy() { return wphierarchy && waypoints.length() >= wphierarchymin; }
+
+    /// The most recent route queries, to replay them in routebench.
+    struct routequery
+    {
+        ushort node, goal;
+    };
+    static vector<routequery> routequeries;
+    static int nextroutequery = 0;
+    enum { MAXROUTEQUERIES = 4096 };
+
+    static inline bool validroute(int node, int goal)
+    {
+        return !waypoints.empty() && iswaypoint(node) && iswaypoint(goal) && goal != node && waypoints[node].links[0];
+    }
+
+    static void recordroute(int node, int goal)
+    {
+        routequery &q = routequeries.length() < MAXROUTEQUERIES ? routequeries.add() : routequeries[nextroutequery++ % MAXROUTEQUERIES];
+        q.node = node;
+        q.goal = goal;
+    }
+
+    bool route(fpsent *d, int node, int goal, vector<int> &route, const avoidset &obstacles, int retries)
+    {
+        if(!validroute(node, goal)) return false;
+        recordroute(node, goal);
+
+        static routeplanner planner;
+        static vector<ushort> blocked, corridor;
+        blockedwaypoints(d, node, goal, obstacles, retries, blocked);
+        if(!userouthierarchy() || !findcorridorclusters(node, goal, corridor)) corridor.setsize(0);
+        return planner.plan(livegraph(), node, goal, blocked.getbuf(), blocked.length(), corridor, route);
+    }
+
+    // Asynchronous routes: the main thread queues route jobs, which background tasks of the job system plan against a snapshot of the waypoint graph.
+    // Any edit of the waypoints bumps wpversion, so the next job gets a new snapshot while the planners keep using their old one.
+    // Edits which renumber the waypoints also bump wplayout: results planned with an older layout are thrown away.
+
+    VAR(wproutethreads, 0, 2, inexor::util::job_system::MAXWORKERS); ///< how many routes are planned at once, 0 plans all routes on the main thread
+    VAR(wprouteresults, 1, 4, 64); ///< results applied per frame
+
+    struct routejob
+    {
+        int id, node, goal, retries, numprev;
+        vector<ushort> blocked, corridor;
+        std::shared_ptr<const wpsnapshot> graph;
+        vector<int> route;
+        bool found;
+    };
+
+    static std::shared_ptr<const wpsnapshot> wpgraph;
+    static vector<routejob *> routejobs, routeresults, freeroutejobs;
+    static SDL_mutex *routemutex = nullptr;
+    static int nextroutejob = 0, activeroutetasks = 0;
+    static std::vector<inexor::util::task_ptr> routetasks; ///< the ones spawned which may still run, see stoproutes()
+
+    static const std::shared_ptr<const wpsnapshot> &getwpgraph()
+    {
+        bool clusters = userouthierarchy();
+        if(clusters) updatewproutes();
+        if(!wpgraph || wpgraph->version != wpversion || wpgraph->layout != wplayout || wpgraph->clusters.empty() == clusters)
+        {
+            wpsnapshot *g = new wpsnapshot;
+            g->version = wpversion;
+            g->layout = wplayout;
+            g->o.reserve(waypoints.length());
+            g->weights.reserve(waypoints.length());
+            g->linkdata.reserve(waypoints.length()*MAXWAYPOINTLINKS);
+            loopv(waypoints)
+            {
+                const waypoint &w = waypoints[i];
+                g->o.add(w.o);
+                g->weights.add(w.weight);
+                loopj(MAXWAYPOINTLINKS) g->linkdata.add(w.links[j]);
+            }
+            if(clusters) g->clusters = wpclusterof;
+            wpgraph.reset(g);
+        }
+        return wpgraph;
+    }
+
+    /// Plan a job through all its retries, like makeroute() does synchronously.
+    static void planroutejob(routeplanner &planner, routejob &j)
+    {
+        for(int retries = j.retries; retries <= 2; retries++)
+        {
+            int numblocked = retries <= 0 ? j.blocked.length() : (retries <= 1 ? j.numprev : 0);
+            if(planner.plan(*j.graph, j.node, j.goal, j.blocked.getbuf(), numblocked, j.corridor, j.route)) { j.found = true; return; }
+        }
+        j.found = false;
+    }
+
+    /// Plan queued jobs until there are none left.
+    static void routetask()
+    {
+        static thread_local routeplanner planner;
+        SDL_LockMutex(routemutex);
+        while(routejobs.length())
+        {
+            routejob *j = routejobs.remove(0);
+            SDL_UnlockMutex(routemutex);
+            planroutejob(planner, *j);
+            SDL_LockMutex(routemutex);
+            routeresults.add(j);
+        }
+        activeroutetasks--;
+        SDL_UnlockMutex(routemutex);
+    }
+
+    static void cancelroutejob(int id)
+    {
+        loopv(routejobs) if(routejobs[i]->id == id)
+        {
+            routejob *j = routejobs.remove(i);
+            j->graph.reset();
+            freeroutejobs.add(j);
+            break;
+        }
+    }
+
+    bool requestroute(fpsent *d, int node, int goal, const avoidset &obstacles, int retries)
+    {
+        if(wproutethreads <= 0 || !d->ai || !validroute(node, goal)) return false;
+        recordroute(node, goal);
+
+        if(!routemutex) routemutex = SDL_CreateMutex();
+
+        SDL_LockMutex(routemutex);
+        if(d->ai->routejob) cancelroutejob(d->ai->routejob);
+        routejob *j = freeroutejobs.empty() ? new routejob : freeroutejobs.pop();
+        SDL_UnlockMutex(routemutex);
+
+        if(!++nextroutejob) nextroutejob = 1;
+        j->id = nextroutejob;
+        j->node = node;
+        j->goal = goal;
+        j->retries = retries;
+        j->numprev = blockedwaypoints(d, node, goal, obstacles, retries, j->blocked);
+        if(!userouthierarchy() || !findcorridorclusters(node, goal, j->corridor)) j->corridor.setsize(0);
+        j->graph = getwpgraph();
+        j->found = false;
+        d->ai->routejob = j->id;
+        d->ai->routegoal = goal;
+
+        SDL_LockMutex(routemutex);
+        routejobs.add(j);
+        bool spawn = activeroutetasks < wproutethreads;
+        if(spawn) activeroutetasks++;
+        SDL_UnlockMutex(routemutex);
+        // nobody waits for the routes, so the workers plan them when they have nothing else to do
+        if(spawn)
+        {
+            routetasks.erase(std::remove_if(routetasks.begin(), routetasks.end(),
+                                            [](const inexor::util::task_ptr &t) { return t->done(); }), routetasks.end());
+            routetasks.push_back(inexor::util::jobs().spawn(routetask, {}, true));
+        }
+        return true;
+    }
+
+    void stoproutes()
+    {
+        if(!routemutex) return;
+        SDL_LockMutex(routemutex);
+        while(routejobs.length())
+        {
+            routejob *j = routejobs.pop();
+            j->graph.reset();
+            freeroutejobs.add(j);
+        }
+        SDL_UnlockMutex(routemutex);
+        // the ones planning a route finish it, then find nothing left to do
+        inexor::util::jobs().wait(routetasks);
+        routetasks.clear();
+    }
+
+    void applyroutes()
+    {
+        if(!routemutex) return;
+        static vector<routejob *> done;
+        done.setsize(0);
+        SDL_LockMutex(routemutex);
+        int numdone = min(routeresults.length(), int(wprouteresults));
+        loopi(numdone) done.add(routeresults[i]);
+        routeresults.remove(0, numdone);
+        SDL_UnlockMutex(routemutex);
+
+        loopv(done)
+        {
+            routejob &job = *done[i];
+            loopvj(players)
+            {
+                fpsent *d = players[j];
+                if(!d->ai || d->ai->routejob != job.id) continue;
+                d->ai->routejob = 0;
+                d->ai->routegoal = -1;
+                if(job.graph->layout != wplayout) break; // planned with old waypoint numbers, the bot will ask again
+                if(job.found) d->ai->route.move(job.route);
+                else
+                {
+                    d->ai->noroutenode = job.node;
+                    d->ai->noroutegoal = job.goal;
+                    d->ai->noroutever = job.graph->version;
+                }
+                break;
+            }
+            job.graph.reset();
         }
-        foundgoal:
 
-        routeid++;
+        SDL_LockMutex(routemutex);
+        loopv(done) freeroutejobs.add(done[i]);
+        SDL_UnlockMutex(routemutex);
+    }
 
-        if(lowest >= 0) // otherwise nothing got there
+    static float routecost(const vector<int> &route)
+    {
+        float cost = 0;
+        for(int i = 1; i < route.length(); i++) cost += linkcost(waypoints[route[i]], waypoints[route[i-1]]);
+        return cost;
+    }
+
+    /// Replay the recorded route queries (or random ones if there are none yet) with and without the hierarchy and compare.
+    void routebench(int *iterations)
+    {
+        if(waypoints.length() <= 2) { Log.std->info("routebench: no waypoints"); return; }
+        vector<routequery> recorded(routequeries), queries(routequeries);
+        int recordednext = nextroutequery;
+        if(queries.empty()) loopi(1000)
+        {
+            routequery &q = queries.add();
+            q.node = 1 + rnd(waypoints.length()-1);
+            q.goal = 1 + rnd(waypoints.length()-1);
+        }
+        int numiterations = max(*iterations, 1), oldhierarchy = wphierarchy, oldmin = wphierarchymin;
+        avoidset none;
+        vector<int> path;
+        float flatcost = 0, hiercost = 0;
+        int flatfound = 0, hierfound = 0;
+        uint flatmillis = 0, coldmillis = 0, hiermillis = 0;
+
+        wphierarchy = 0;
+        loopj(numiterations)
         {
-            for(waypoint *m = &waypoints[lowest]; m > &waypoints[0]; m = &waypoints[m->prev])
-                route.add(m - &waypoints[0]); // just keep it stored backward
+            uint start = SDL_GetTicks();
+            loopv(queries) if(route(nullptr, queries[i].node, queries[i].goal, path, none) && !j) { flatfound++; flatcost += routecost(path); }
+            flatmillis += SDL_GetTicks() - start;
         }
 
-        return !route.empty();
+        wphierarchy = 1;
+        wphierarchymin = 0;
+        clearwproutes();
+        loopj(numiterations)
+        {
+            if(j == 1) coldmillis = hiermillis;
+            uint start = SDL_GetTicks();
+            loopv(queries) if(route(nullptr, queries[i].node, queries[i].goal, path, none) && !j) { hierfound++; hiercost += routecost(path); }
+            hiermillis += SDL_GetTicks() - start;
+        }
+        wphierarchy = oldhierarchy;
+        wphierarchymin = oldmin;
+        if(numiterations <= 1) coldmillis = hiermillis;
+
+        // the benchmark itself must not show up as recorded queries
+        routequeries = recorded;
+        nextroutequery = recordednext;
+
+        Log.std->info("routebench: {} waypoints, {} clusters, {} queries x {}: plain {} ms ({} found), hierarchical {} ms, first pass {} ms ({} found), cost ratio {:.3f}",
+                      waypoints.length(), wpclusters.length(), queries.length(), numiterations, flatmillis, flatfound, hiermillis, coldmillis, hierfound,
+                      flatcost > 0 ? hiercost/flatcost : 1.0f);
     }
+    COMMAND(routebench, "i");
 
     VARF(dropwaypoints, 0, 0, 1, { player1->lastnode = -1; });
 
-    int addwaypoint(const vec &o, int weight = -1)
+    int addwaypoint(const vec &o, int weight)
     {
         if(waypoints.length() > MAXWAYPOINTS) return -1;
         int n = waypoints.length();
         waypoints.add(waypoint(o, weight >= 0 ? weight : getweight(o)));
         invalidatewpcache(n);
+        wpversion++;
         return n;
     }
 
@@ -553,9 +1530,10 @@ namespace ai
         loopi(MAXWAYPOINTLINKS)
         {
             if(a.links[i] == n) return;
-            if(!a.links[i]) { a.links[i] = n; return; }
+            if(!a.links[i]) { a.links[i] = n; invalidatewproutes(&a - &waypoints[0], n); return; }
         }
         a.links[rnd(MAXWAYPOINTLINKS)] = n;
+        invalidatewproutes(&a - &waypoints[0], n);
     }
 
     string loadedwaypoints = "";
@@ -0,0 +1,261 @@
+/// Offline waypoint generation: walks the map the way a bot would and writes the resulting graph as a .wpt file.
+///
+/// Starting at the player starts and items, every waypoint tries to walk to the centres of the 8 neighbouring cells of a grid
+/// (wpgenspacing apart), climbing steps, jumping up to JUMPMAX and dropping down ledges (one way) just like the bots' physics allow.
+/// The search runs in waves: the waypoints found in one wave are explored in parallel, sorted by map region so every worker
+/// stays within its part of the octree, while the new waypoints are merged in one place so the result does not depend on timing.
+
+#include <math.h>                             // for ceilf, floorf
+#include <algorithm>                          // for max, min
+
+#include "SDL_timer.h"                        // for SDL_GetTicks
+
+#include "inexor/engine/octa.hpp"             // for insideworld
+#include "inexor/engine/world.hpp"            // for worldsize
+#include "inexor/fpsgame/ai.hpp"              // for waypoints, addwaypoint
+#include "inexor/fpsgame/entities.hpp"        // for ents
+#include "inexor/fpsgame/fps.hpp"             // for PLAYERSTART, I_SHELLS
+#include "inexor/io/Logging.hpp"              // for Log, Logger
+#include "inexor/network/SharedVar.hpp"       // for SharedVar
+#include "inexor/physics/physics.hpp"         // for collide, raycube, STAIRHEIGHT
+#include "inexor/shared/command.hpp"          // for VAR, ICOMMAND
+#include "inexor/shared/cube_hash.hpp"        // for hashtable
+#include "inexor/shared/cube_loops.hpp"       // for i, loopi, loopv
+#include "inexor/shared/cube_sort.hpp"        // for sort
+#include "inexor/shared/cube_types.hpp"       // for uint
+#include "inexor/shared/cube_vector.hpp"      // for vector
+#include "inexor/shared/ents.hpp"             // for physent, extentity
+#include "inexor/shared/geom.hpp"             // for vec
+#include "inexor/shared/tools.hpp"            // for max, min
+#include "inexor/util/jobs.hpp"               // for jobs
+
+namespace ai
+{
+    VAR(wpgenspacing, 8, 32, 128);  ///< distance between neighbouring generated waypoints
+    VAR(wpgenmaxdrop, 0, 96, 512);  ///< the highest ledge bots are sent down
+    VAR(wpgenthreads, 0, 0, inexor::util::job_system::MAXWORKERS); ///< 0 uses numcpus
+
+    enum { GEN_NONE = 0, GEN_WALK, GEN_JUMP, GEN_DROP };
+
+    /// A generated waypoint, it stands on the floor in the centre of its grid cell.
+    struct genwp
+    {
+        vec o;
+        int x, y;
+        int links[8], kinds[8]; ///< per direction, -1 if there is no link
+    };
+
+    struct gencell
+    {
+        int x, y, z;
+
+        friend uint hthash(const gencell &c) { return uint(c.x)*0x9E3779B1U ^ uint(c.y)*0x85EBCA77U ^ uint(c.z)*0xC2B2AE3DU; }
+        friend bool htcmp(const gencell &a, const gencell &b) { return a.x == b.x && a.y == b.y && a.z == b.z; }
+    };
+
+    /// What exploring one direction of a waypoint found: where the walk ended up and how it got there.
+    struct genstep
+    {
+        vec dest;
+        int kind;
+    };
+
+    static const int gendirs[8][2] = { { 1, 0 }, { 0, 1 }, { -1, 0 }, { 0, -1 }, { 1, 1 }, { -1, 1 }, { -1, -1 }, { 1, -1 } };
+
+    /// The height of the first floor below top at x, y which is not below bottom.
+    static bool genfloor(float x, float y, float top, float bottom, float &floor)
+    {
+        vec o(x, y, top);
+        if(!insideworld(o)) return false;
+        float dist = raycube(o, vec(0, 0, -1), top - bottom, RAY_CLIPMAT);
+        if(dist <= 0 || dist >= top - bottom) return false; // started inside something or fell through
+        floor = top - dist;
+        return true;
+    }
+
+    /// Whether a player fits standing on the floor at o (above the height it can step up anyway).
+    static bool genfits(const vec &o)
+    {
+        physent d;
+        d.type = ENT_AI;
+        d.o = vec(o.x, o.y, o.z + d.eyeheight);
+        d.eyeheight -= STAIRHEIGHT;
+        return !collide(&d, vec(0, 0, 0), 0, false);
+    }
+
+    /// Walk from the floor at from to the column at x, y in short steps, climbing, jumping and dropping like a bot.
+    static int genwalk(const vec &from, float x, float y, vec &dest)
+    {
+        const float stepsize = 4;
+        float dx = x - from.x, dy = y - from.y;
+        int steps = max(int(ceilf(sqrtf(dx*dx + dy*dy)/stepsize)), 1), kind = GEN_WALK;
+        vec cur = from;
+        for(int i = 1; i <= steps; i++)
+        {
+            float t = float(i)/steps, sx = from.x + dx*t, sy = from.y + dy*t, floor;
+            if(genfloor(sx, sy, cur.z + STAIRHEIGHT, cur.z - wpgenmaxdrop, floor))
+            {
+                if(floor < cur.z - STAIRHEIGHT && kind == GEN_WALK) kind = GEN_DROP;
+            }
+            else if(kind == GEN_WALK && genfloor(sx, sy, cur.z + JUMPMAX, cur.z + STAIRHEIGHT, floor)) kind = GEN_JUMP; // a wall low enough to jump up
+            else return GEN_NONE;
+            cur = vec(sx, sy, floor);
+            if(!genfits(cur)) return GEN_NONE;
+        }
+        if(clipped(cur)) return GEN_NONE;
+        dest = cur;
+        return kind;
+    }
+
+    static vector<genwp> genwps;
+    static hashtable<gencell, int> gencells;
+
+    static inline gencell gencellof(const vec &o)
+    {
+        gencell c;
+        c.x = int(floorf(o.x/wpgenspacing));
+        c.y = int(floorf(o.y/wpgenspacing));
+        c.z = int(floorf(o.z/8));
+        return c;
+    }
+
+    /// The waypoint standing in the same cell on about the same height, or a new one.
+    /// @return the index of the waypoint, or -1 if there are too many already
+    static int genwaypoint(const vec &o, vector<int> &added)
+    {
+        gencell c = gencellof(o);
+        for(int dz = -1; dz <= 1; dz++)
+        {
+            gencell n = c;
+            n.z += dz;
+            int *wp = gencells.access(n);
+            if(wp && fabs(genwps[*wp].o.z - o.z) <= 6) return *wp;
+        }
+        if(genwps.length() >= MAXWAYPOINTS - 1) return -1;
+        genwp &w = genwps.add();
+        w.o = o;
+        w.x = c.x;
+        w.y = c.y;
+        loopi(8) { w.links[i] = -1; w.kinds[i] = GEN_NONE; }
+        gencells[c] = genwps.length() - 1;
+        added.add(genwps.length() - 1);
+        return genwps.length() - 1;
+    }
+
+    static vector<int> genfrontier;
+    static vector<genstep> gensteps; ///< 8 per waypoint of the frontier
+
+    static void genexplore(int start, int end)
+    {
+        for(int i = start; i < end; i++)
+        {
+            const genwp &w = genwps[genfrontier[i]];
+            loopj(8)
+            {
+                genstep &s = gensteps[i*8 + j];
+                float x = (w.x + gendirs[j][0] + 0.5f)*wpgenspacing, y = (w.y + gendirs[j][1] + 0.5f)*wpgenspacing;
+                s.kind = genwalk(w.o, x, y, s.dest);
+            }
+        }
+    }
+
+    static bool genregioncmp(int a, int b)
+    {
+        const genwp &x = genwps[a], &y = genwps[b];
+        int rx = x.x>>4, ry = x.y>>4, sx = y.x>>4, sy = y.y>>4;
+        if(ry != sy) return ry < sy;
+        if(rx != sx) return rx < sx;
+        return a < b;
+    }
+
+    /// Pick the links every waypoint keeps: walking links in both directions first, straight ones before diagonals.
+    static int genlinkorder(const genwp &w, int dir)
+    {
+        int kind = w.kinds[dir], to = w.links[dir], order = dir < 4 ? 0 : 1;
+        if(kind != GEN_WALK) order += 4;
+        bool back = false;
+        if(to >= 0) loopi(8) if(genwps[to].links[i] == &w - genwps.getbuf()) back = true;
+        if(!back) order += 2;
+        return order;
+    }
+
+    /// Generate the waypoints of the current map, replacing the ones bots use now, and save them.
+    void genwaypoints(const char *mname)
+    {
+        if(!worldsize) return;
+        uint start = SDL_GetTicks();
+        genwps.setsize(0);
+        gencells.clear();
+        preloadmapmodels();
+
+        vector<int> added;
+        loopv(entities::ents)
+        {
+            extentity &e = *entities::ents[i];
+            switch(e.type)
+            {
+                case PLAYERSTART: case TELEPORT: case JUMPPAD: case FLAG: case BASE: break;
+                default: if(e.type < I_SHELLS || e.type > I_QUAD) continue;
+            }
+            gencell c = gencellof(e.o);
+            float floor;
+            if(!genfloor((c.x + 0.5f)*wpgenspacing, (c.y + 0.5f)*wpgenspacing, e.o.z + STAIRHEIGHT, 0, floor)) continue;
+            vec o((c.x + 0.5f)*wpgenspacing, (c.y + 0.5f)*wpgenspacing, floor);
+            if(genfits(o) && !clipped(o)) genwaypoint(o, added);
+        }
+        if(added.empty()) { Log.std->warn("genwaypoints: no player starts or items to start from"); return; }
+
+        extern SharedVar<int> numcpus;
+        int numthreads = max(wpgenthreads > 0 ? int(wpgenthreads) : int(numcpus), 1), waves = 0;
+        while(added.length())
+        {
+            waves++;
+            genfrontier.setsize(0);
+            genfrontier.put(added.getbuf(), added.length());
+            added.setsize(0);
+            genfrontier.sort(genregioncmp);
+            gensteps.setsize(0);
+            gensteps.pad(genfrontier.length()*8);
+
+            inexor::util::jobs().parallel_for(0, genfrontier.length(), 64, genexplore, numthreads);
+
+            loopv(genfrontier) loopj(8)
+            {
+                const genstep &s = gensteps[i*8 + j];
+                if(!s.kind) continue;
+                int to = genwaypoint(s.dest, added);
+                genwp &w = genwps[genfrontier[i]];
+                if(to < 0 || to == genfrontier[i]) continue;
+                w.links[j] = to;
+                w.kinds[j] = s.kind;
+            }
+        }
+
+        clearwaypoints();
+        addwaypoint(vec(0, 0, 0));
+        loopv(genwps) addwaypoint(genwps[i].o);
+        int numlinks = 0;
+        loopv(genwps)
+        {
+            const genwp &w = genwps[i];
+            int order[8], num = 0;
+            loopj(8) if(w.links[j] >= 0) order[num++] = j;
+            // insertion sort by preference, there are at most 8
+            for(int j = 1; j < num; j++)
+            {
+                int dir = order[j], k = j;
+                for(; k > 0 && genlinkorder(w, order[k-1]) > genlinkorder(w, dir); k--) order[k] = order[k-1];
+                order[k] = dir;
+            }
+            waypoint &dst = waypoints[i+1];
+            loopj(min(num, int(MAXWAYPOINTLINKS))) { dst.links[j] = w.links[order[j]] + 1; numlinks++; }
+        }
+        clearwpcache();
+
+        Log.std->info("genwaypoints: {} waypoints, {} links in {} waves on {} threads, {} ms", genwps.length(), numlinks, waves, numthreads, SDL_GetTicks() - start);
+        genwps.setsize(0);
+        gencells.clear();
+        savewaypoints(true, mname);
+    }
+    ICOMMAND(genwaypoints, "s", (char *mname), genwaypoints(mname));
+}
@@ -24,7 +24,7 @@
 #include "inexor/network/SharedVar.hpp"               // for SharedVar
 #include "inexor/network/legacy/cube_network.hpp"     // for DMF, DNF
 #include "inexor/network/legacy/game_types.hpp"       // for ::N_EXPLODE
-#include "inexor/physics/physics.hpp"                 // for raycube, avoidc...
+#include "inexor/physics/physics.hpp"                 // for raycube, finddynents, ...
 #include "inexor/shared/command.hpp"                  // for VARP, ICOMMAND
 #include "inexor/shared/cube_formatting.hpp"          // for defformatstring
 #include "inexor/shared/cube_loops.hpp"               // for i, loopi, loopv, j
@@ -557,11 +557,12 @@ namespace game
                 spawnbouncer(debrisorigin, debrisvel, owner, gun==GUN_BARREL ? BNC_BARRELDEBRIS : BNC_DEBRIS, &light);
         }
         if(!local && !m_obstacles) return;
-        int numdyn = numdynents();
-        loopi(numdyn)
+        vector<dynent *> nearby;
+        finddynents(v, guns[gun].exprad, nearby);
+        loopv(nearby)
         {
-            dynent *o = iterdynents(i);
-            if(o->o.reject(v, o->radius + guns[gun].exprad) || o==safe) continue;
+            dynent *o = nearby[i];
+            if(o==safe) continue;
             radialeffect(o, v, damage, owner, gun);
         }
         if(m_bomb && (gun==GUN_BOMB || gun==GUN_SPLINTER)) // in bomb mode projectiles hits other projectiles
@@ -687,10 +688,12 @@ namespace game
             {
                 vec halfdv = vec(dv).mul(0.5f), bo = vec(p.o).add(halfdv);
                 float br = max(fabs(halfdv.x), fabs(halfdv.y)) + 1;
-                loopj(numdynents())
+                vector<dynent *> nearby;
+                finddynents(bo, br, nearby);
+                loopvj(nearby)
                 {
-                    dynent *o = iterdynents(j);
-                    if(p.owner==o || o->o.reject(bo, o->radius + br)) continue;
+                    dynent *o = nearby[j];
+                    if(p.owner==o) continue;
                     if(projdamage(o, p, v, qdam)) { exploded = true; break; }
                 }
             }
@@ -878,10 +881,12 @@ namespace game
     {
         dynent *best = nullptr;
         bestdist = 1e16f;
-        loopi(numdynents())
+        vector<dynent *> candidates;
+        sweepdynents(from, to, 0, candidates);
+        loopv(candidates)
         {
-            dynent *o = iterdynents(i);
-            if(o==at || o->state!=CS_ALIVE) continue;
+            dynent *o = candidates[i];
+            if(o==at) continue;
             float dist;
             if(!intersect(o, from, to, dist)) continue;
             if(dist<bestdist)
@@ -1,6 +1,11 @@
 #include <stdarg.h>                                   // for va_end, va_start
 #include <algorithm>                                  // for min, max
+#include <atomic>                                     // for atomic
 #include <memory>                                     // for __shared_ptr
+#include <mutex>                                      // for unique_lock
+#include <shared_mutex>                               // for shared_lock, shared_timed_mutex
+#include <string>                                     // for string
+#include <vector>                                     // for vector
 
 #include "inexor/io/Logging.hpp"                      // for Log, Logger
 #include "inexor/io/legacy/stream.hpp"
@@ -10,6 +15,7 @@
 #include "inexor/shared/cube_tools.hpp"               // for copystring, new...
 #include "inexor/shared/cube_unicode.hpp"             // for decodeutf8, enc...
 #include "inexor/shared/tools.hpp"                    // for min, max
+#include "inexor/util/vfs.hpp"                        // for vfsindex, vfsdata
 #include "zconf.h"                                    // for Bytef, MAX_WBITS
 #include "zlib.h"                                     // for z_stream, crc32
 
@@ -31,10 +37,23 @@ struct packagedir
 };
 vector<packagedir> packagedirs;
 
+using inexor::util::vfsindex;
+using inexor::util::vfsdata;
+
+/// Everything in the package directories (and the zip archives in them), so finding a file does not probe each of them.
+/// The home directory is left out: it gets written to while running.
+static vfsindex packageindex;
+/// Entries of the package index are held while loading on any thread, rescanning it has to wait for them.
+static std::shared_timed_mutex packageindexlock;
+VAR(usepackageindex, 0, 1, 1);
+
+/// How often the file system got asked whether a file exists, to compare with the lookups in the package index.
+static std::atomic<long long> fileprobes(0);
+
 /// Append a string together but add the prefix in the field.
 char *makerelpath(const char *dir, const char *file, const char *prefix, const char *cmd)
 {
-    static string tmp;
+    static thread_local string tmp;
     if(prefix) copystring(tmp, prefix);
     else tmp[0] = '\0';
     if(file[0]=='<')
@@ -105,11 +124,11 @@ char *path(char *s)
     return s;
 }
 
-/// Returns a static string with adapted slashes according to the platforms prefered pathseperator.
-/// @warning not threadsafe!
+/// Returns a static (per thread) string with adapted slashes according to the platforms prefered pathseperator.
+/// @warning overwritten by the next call on the same thread.
 char *path(const char *s, bool copy)
 {
-    static string tmp;
+    static thread_local string tmp;
     copystring(tmp, s);
     path(tmp);
     return tmp;
@@ -121,7 +140,7 @@ const char *parentdir(const char *filename)
 {
     const char *p = filename + strlen(filename);
     while(p > filename && *p != '/' && *p != '\\') p--;
-    static string parent;
+    static thread_local string parent;
     size_t len = p-filename+1;
     copystring(parent, filename, len);
     return parent;
@@ -136,6 +155,7 @@ const char *parentdir(const char *filename)
 bool fileexists(const char *path, const char *mode)
 {
     bool exists = true;
+    fileprobes++;
     if(mode[0]=='w' || mode[0]=='a') path = parentdir(path);
 #ifdef WIN32
     if(GetFileAttributes(path[0] ? path : ".\\") == INVALID_FILE_ATTRIBUTES) exists = false;
@@ -152,7 +172,7 @@ bool createdir(const char *path)
     size_t len = strlen(path);
     if(path[len-1]==PATHDIV)
     {
-        static string strip;
+        static thread_local string strip;
         path = copystring(strip, path, len);
     }
 #ifdef WIN32
@@ -185,17 +205,62 @@ const char *addpackagedir(const char *dir)
     packagedir &pf = packagedirs.add();
     pf.dir = newstring(pdir);
     pf.dirlen = strlen(pdir);
+    int files;
+    {
+        std::unique_lock<std::shared_timed_mutex> lock(packageindexlock);
+        files = packageindex.addroot(pf.dir);
+    }
+    Log.std->info("indexed {} files in {}", files, pf.dir);
     return pf.dir;
 }
 
-/// Checks whether given file exists (and is available in the specific mode)
-/// Where Path is the filename and mode can optionally be set
-/// Available Modes are "e" (see @return) "w"/"a" for writeable files only and "d" for executeable files only
-/// @return Returns the filename of the found file (or the, if "e" is specified it returns NULL if nothing was found.
-///         Otherwise it returns the inital filename.
-const char *findfile(const char *filename, const char *mode)
+/// Scan the package directories again, e.g. after media got added to them while running.
+/// Waits for the files being loaded on other threads.
+void rescanpackages()
+{
+    std::unique_lock<std::shared_timed_mutex> lock(packageindexlock);
+    packageindex.clear();
+    loopv(packagedirs) packageindex.addroot(packagedirs[i].dir);
+    vfsindex::stats s = packageindex.getstats();
+    Log.std->info("indexed {} files in {} directories of {} package directories and {} archives ({:.1f} ms)",
+                  s.files, s.dirs, s.roots, s.archives, s.scanmillis);
+}
+COMMAND(rescanpackages, "");
+
+/// Log what the package index holds and how often it got asked.
+void vfsstats()
+{
+    vfsindex::stats s;
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(packageindexlock);
+        s = packageindex.getstats();
+    }
+    Log.std->info("package index: {} files in {} directories of {} package directories and {} archives, scanned in {:.1f} ms",
+                  s.files, s.dirs, s.roots, s.archives, s.scanmillis);
+    Log.std->info("package index: {} lookups ({} misses), {} files loaded ({} inflated), {} file system probes",
+                  s.lookups, s.misses, s.loads, s.inflated, (long long)fileprobes);
+}
+COMMAND(vfsstats, "");
+
+void vfsreport(const char *what)
 {
-    static string s;
+    static long long lastlookups = 0, lastprobes = 0;
+    vfsindex::stats s;
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(packageindexlock);
+        s = packageindex.getstats();
+    }
+    long long probes = fileprobes;
+    Log.std->info("{}: {} files looked up in the package index, {} file system probes", what, s.lookups - lastlookups, probes - lastprobes);
+    lastlookups = s.lookups;
+    lastprobes = probes;
+}
+
+/// findfile() which also hands out the entry if it got found in the package index, hold packageindexlock while using it.
+static const char *findfile(const char *filename, const char *mode, const vfsindex::entry *&entry)
+{
+    static thread_local string s;
+    entry = nullptr;
     if(homedir[0])
     {
         formatstring(s, "%s%s", homedir, filename);
@@ -216,6 +281,15 @@ const char *findfile(const char *filename, const char *mode)
         }
     }
     if(mode[0]=='w' || mode[0]=='a') return filename;
+    if(usepackageindex && mode[0]!='d' && vfsindex::indexable(filename) && !packageindex.isdir(filename))
+    {
+        // a miss in the index is a miss in every package directory
+        entry = packageindex.find(filename);
+        if(!entry) return mode[0]=='e' ? nullptr : filename;
+        if(entry->archive >= 0) return filename; // only openfile() and loadfiledata() can get at it
+        copystring(s, entry->path.c_str());
+        return s;
+    }
     loopv(packagedirs)
     {
         packagedir &pf = packagedirs[i];
@@ -226,6 +300,27 @@ const char *findfile(const char *filename, const char *mode)
     return filename;
 }
 
+/// Checks whether given file exists (and is available in the specific mode)
+/// Where Path is the filename and mode can optionally be set
+/// Available Modes are "e" (see @return) "w"/"a" for writeable files only and "d" for executeable files only
+/// @return Returns the filename of the found file (or the, if "e" is specified it returns NULL if nothing was found.
+///         Otherwise it returns the inital filename.
+const char *findfile(const char *filename, const char *mode)
+{
+    std::shared_lock<std::shared_timed_mutex> lock(packageindexlock);
+    const vfsindex::entry *entry;
+    return findfile(filename, mode, entry);
+}
+
+bool loadfiledata(const char *filename, vfsdata &data)
+{
+    std::shared_lock<std::shared_timed_mutex> lock(packageindexlock);
+    const vfsindex::entry *entry;
+    const char *found = findfile(filename, "r", entry);
+    if(entry) return packageindex.load(*entry, data);
+    return found && data.map(found);
+}
+
 /// Internal use only Use listfiles instead.
 /// @return false if dirname does not exists
 bool listdir(const char *dirname, bool rel, const char *ext, vector<char *> &files)
@@ -297,7 +392,14 @@ int listfiles(const char *dir, const char *ext, vector<char *> &files)
         formatstring(s, "%s%s", homedir, dirname);
         if(listdir(s, false, ext, files)) dirs++;
     }
-    loopv(packagedirs)
+    if(usepackageindex && vfsindex::indexable(dirname))
+    {
+        std::vector<std::string> names;
+        std::shared_lock<std::shared_timed_mutex> lock(packageindexlock);
+        if(packageindex.list(dirname, ext, names)) dirs++;
+        for(const std::string &name : names) files.add(newstring(name.c_str()));
+    }
+    else loopv(packagedirs)
     {
         packagedir &pf = packagedirs[i];
         formatstring(s, "%s%s", pf.dir, dirname);
@@ -430,6 +532,36 @@ struct filestream : stream
     }
 };
 
+/// Read only stream over a file loaded out of the package index.
+struct memstream : stream
+{
+    vfsdata data;
+    offset pos = 0;
+
+    void close() override { data.clear(); pos = 0; }
+    bool end() override { return size_t(pos) >= data.size(); }
+    offset tell() override { return pos; }
+    offset size() override { return offset(data.size()); }
+
+    bool seek(offset off, int whence) override
+    {
+        offset to = whence == SEEK_END ? offset(data.size()) + off : (whence == SEEK_CUR ? pos + off : off);
+        if(to < 0 || to > offset(data.size())) return false;
+        pos = to;
+        return true;
+    }
+
+    size_t read(void *buf, size_t len) override
+    {
+        len = min(len, data.size() - size_t(pos));
+        if(len) memcpy(buf, data.data() + pos, len);
+        pos += len;
+        return len;
+    }
+
+    int getchar() override { return size_t(pos) < data.size() ? data.data()[pos++] : -1; }
+};
+
 VAR(dbggz, 0, 0, 1);
 
 struct gzstream : stream
@@ -897,8 +1029,17 @@ struct utf8stream : stream
 
 stream *openrawfile(const char *filename, const char *mode)
 {
-    const char *found = findfile(filename, mode);
+    std::shared_lock<std::shared_timed_mutex> lock(packageindexlock);
+    const vfsindex::entry *entry;
+    const char *found = findfile(filename, mode, entry);
     if(!found) return nullptr;
+    if(entry && entry->archive >= 0)
+    {
+        if(mode[0]!='r' || strchr(mode, '+')) return nullptr;
+        memstream *mem = new memstream;
+        if(!packageindex.load(*entry, mem->data)) { delete mem; return nullptr; }
+        return mem;
+    }
     filestream *file = new filestream;
     if(!file->open(found, mode)) { delete file; return nullptr; }
     return file;
@@ -937,22 +1078,14 @@ stream *openutf8file(const char *filename, const char *mode, stream *file)
 
 char *loadfile(const char *fn, size_t *size, bool utf8)
 {
-    stream *f = openfile(fn, "rb");
-    if(!f) return nullptr;
-    size_t len = f->size();
-    if(len <= 0) { delete f; return nullptr; }
+    vfsdata data;
+    if(!loadfiledata(fn, data)) return nullptr;
+    const uchar *src = data.data();
+    size_t len = data.size();
+    if(len <= 0) return nullptr;
+    if(utf8 && len >= 3 && src[0] == 0xEF && src[1] == 0xBB && src[2] == 0xBF) { src += 3; len -= 3; }
     char *buf = new char[len+1];
-    if(!buf) { delete f; return nullptr; }
-    size_t offset = 0;
-    if(utf8 && len >= 3)
-    {
-        if(f->read(buf, 3) != 3) { delete f; delete[] buf; return nullptr; }
-        if(((uchar *)buf)[0] == 0xEF && ((uchar *)buf)[1] == 0xBB && ((uchar *)buf)[2] == 0xBF) len -= 3;
-        else offset += 3;
-    } 
-    size_t rlen = f->read(&buf[offset], len-offset);
-    delete f;
-    if(rlen != len-offset) { delete[] buf; return nullptr; }
+    memcpy(buf, src, len);
     if(utf8) len = decodeutf8((uchar *)buf, len, (uchar *)buf, len);
     buf[len] = '\0';
     if(size!=nullptr) *size = len;
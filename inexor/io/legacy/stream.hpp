@@ -19,6 +19,8 @@
 #undef putchar
 #endif
 
+namespace inexor { namespace util { class vfsdata; } }
+
 struct stream
 {
 #ifdef WIN32
@@ -92,6 +94,10 @@ extern stream *opentempfile(const char *filename, const char *mode);
 extern stream *opengzfile(const char *filename, const char *mode, stream *file = nullptr, int level = Z_BEST_COMPRESSION);
 extern stream *openutf8file(const char *filename, const char *mode, stream *file = nullptr);
 extern char *loadfile(const char *fn, size_t *size, bool utf8 = true);
+/// Load the whole file without copying it where possible (mapped, or straight out of a package archive).
+extern bool loadfiledata(const char *filename, inexor::util::vfsdata &data);
+/// Log how many files got looked up since the last report.
+extern void vfsreport(const char *what);
 extern bool listdir(const char *dir, bool rel, const char *ext, vector<char *> &files);
 extern int listfiles(const char *dir, const char *ext, vector<char *> &files);
 
@@ -195,6 +195,7 @@ struct animmodel : model
 
         void preloadBIH()
         {
+            finishtexture(tex);
             loadalphamask(tex);
         }
  
@@ -297,6 +298,7 @@ struct animmodel : model
             BIH::mesh &m = bih.add();
             m.xform = t;
             m.tex = s.tex;
+            finishtexture(s.tex);
             if(s.tex->type&Texture::ALPHA) m.flags |= BIH::MESH_ALPHA;
             if(noclip) m.flags |= BIH::MESH_NOCLIP;
             if(s.cullface) m.flags |= BIH::MESH_CULLFACE;
@@ -1145,12 +1147,13 @@ struct animmodel : model
         if(offsetpitch) m.rotate_around_y(-offsetpitch*RAD);
     }
 
-    void genBIH(vector<BIH::mesh> &bih)
+    bool genBIH(vector<BIH::mesh> &bih) override
     {
-        if(parts.empty()) return;
+        if(parts.empty()) return true;
         matrix4x3 m;
         initmatrix(m);
         parts[0]->genBIH(bih, m);
+        return true;
     }
 
     void preloadBIH() override
@@ -1433,7 +1436,7 @@ template<class MDL, class MESH> struct modelcommands
     static void setskin(char *meshname, char *tex, char *masks, float *envmapmax, float *envmapmin)
     {
         loopskins(meshname, s,
-            s.tex = textureload(makerelpath(MDL::dir, tex), 0, true, false);
+            s.tex = textureloadasync(makerelpath(MDL::dir, tex));
             if(*masks)
             {
                 s.masks = textureload(makerelpath(MDL::dir, masks), 0, true, false);
@@ -26,6 +26,13 @@ struct md5hierarchy
     int parent, flags, start;
 };
 
+/// The shader (texture) of a mesh, recorded so the model cache can apply it again.
+struct md5shader
+{
+    int nummeshes; ///< the skins the part needs, up to the mesh it is for
+    string tex;
+};
+
 struct md5 : skelmodel, skelloader<md5>
 {
     md5(const char *name) : skelmodel(name) {}
@@ -33,6 +40,15 @@ struct md5 : skelmodel, skelloader<md5>
     static const char *formatname() { return "md5"; }
     int type() const override { return MDL_MD5; }
 
+    /// Load the texture of a mesh into the last skin of the part loaded.
+    static void setmeshskin(int nummeshes, const char *texname)
+    {
+        part *p = loading->parts.last();
+        p->initskins(notexture, notexture, nummeshes);
+        skin &s = p->skins.last();
+        s.tex = textureloadasync(makerelpath(dir, texname));
+    }
+
     struct md5mesh : skelmesh
     {
         md5weight *weightinfo;
@@ -85,7 +101,7 @@ struct md5 : skelmodel, skelloader<md5>
             }
         }
 
-        void load(stream *f, char *buf, size_t bufsize)
+        void load(stream *f, char *buf, size_t bufsize, vector<md5shader> &shaders)
         {
             md5weight w;
             md5vert v;
@@ -107,12 +123,9 @@ struct md5 : skelmodel, skelloader<md5>
                     char *start = strchr(buf, '"'), *end = start ? strchr(start+1, '"') : nullptr;
                     if(start && end) 
                     {
-                        char *texname = newstring(start+1, end-(start+1));
-                        part *p = loading->parts.last();
-                        p->initskins(notexture, notexture, group->meshes.length());
-                        skin &s = p->skins.last();
-                        s.tex = textureload(makerelpath(dir, texname), 0, true, false);
-                        delete[] texname;
+                        md5shader &shader = shaders.add();
+                        shader.nummeshes = group->meshes.length();
+                        copystring(shader.tex, start+1, min(size_t(end-start), sizeof(shader.tex)));
                     }
                 }
                 else if(sscanf(buf, " numverts %d", &numverts)==1)
@@ -153,17 +166,84 @@ struct md5 : skelmodel, skelloader<md5>
 
     struct md5meshgroup : skelmeshgroup
     {
-        md5meshgroup() 
+        bool cooking; ///< only parsing into the model cache, without a model to put the skins into
+
+        md5meshgroup() : cooking(false)
         {
         }
 
+        /// Take the bones, skins and meshes from a model cache entry written by loadmesh.
+        bool loadcachedmesh(modelcachereader &r)
+        {
+            int numbones, numshaders;
+            if(!r.get(numbones) || numbones < 1 || (skel->numbones > 0 && numbones != skel->numbones)) return false;
+            vector<char *> names;
+            vector<int> parents;
+            vector<dualquat> bases;
+            loopi(numbones)
+            {
+                names.add(r.getstring());
+                r.get(parents.add());
+                r.get(bases.add());
+                if(!r.ok() || parents[i] >= numbones) { names.deletearrays(); return false; }
+            }
+            vector<md5shader> shaders;
+            if(r.get(numshaders) && numshaders >= 0) loopi(numshaders)
+            {
+                md5shader &shader = shaders.add();
+                char *tex = r.getstring();
+                if(!r.get(shader.nummeshes) || !tex) { DELETEA(tex); r.fail(); break; }
+                copystring(shader.tex, tex);
+                delete[] tex;
+            }
+            if(!r.ok() || !loadcache<md5mesh>(r)) { names.deletearrays(); return false; }
+
+            if(skel->numbones <= 0)
+            {
+                skel->numbones = numbones;
+                skel->bones = new boneinfo[skel->numbones];
+            }
+            loopi(numbones)
+            {
+                boneinfo &b = skel->bones[i];
+                if(!b.name) { b.name = names[i]; names[i] = nullptr; }
+                b.parent = parents[i];
+            }
+            names.deletearrays();
+            if(skel->shared <= 1)
+            {
+                skel->linkchildren();
+                loopi(numbones)
+                {
+                    boneinfo &b = skel->bones[i];
+                    b.base = bases[i];
+                    (b.invbase = b.base).invert();
+                }
+            }
+            if(!cooking) loopv(shaders) setmeshskin(shaders[i].nummeshes, shaders[i].tex);
+            return true;
+        }
+
         bool loadmesh(const char *filename, float smooth)
         {
+            uint start = SDL_GetTicks();
+            modelcachekey key = modelcachekeyfor("md5mesh", filename, &smooth, sizeof(smooth));
+            if(key.valid())
+            {
+                modelcachereader r(key);
+                if(r.ok() && loadcachedmesh(r))
+                {
+                    modelcachecount(true, SDL_GetTicks() - start);
+                    return true;
+                }
+            }
+
             stream *f = openfile(filename, "r");
             if(!f) return false;
 
             char buf[512];
             vector<md5joint> basejoints;
+            vector<md5shader> shaders;
             while(f->getline(buf, sizeof(buf)))
             {
                 int tmp;
@@ -225,7 +305,7 @@ struct md5 : skelmodel, skelloader<md5>
                     md5mesh *m = new md5mesh;
                     m->group = this;
                     meshes.add(m);
-                    m->load(f, buf, sizeof(buf));
+                    m->load(f, buf, sizeof(buf), shaders);
                     if(!m->numtris || !m->numverts)
                     {
                         Log.std->info("empty mesh in {}", filename);
@@ -258,14 +338,90 @@ struct md5 : skelmodel, skelloader<md5>
             sortblendcombos();
 
             delete f;
+
+            if(!cooking) loopv(shaders) setmeshskin(shaders[i].nummeshes, shaders[i].tex);
+            if(key.valid())
+            {
+                modelcachewriter w;
+                w.put(basejoints.length());
+                loopv(basejoints)
+                {
+                    w.putstring(skel->bones[i].name);
+                    w.put(skel->bones[i].parent);
+                    w.put(dualquat(basejoints[i].orient, basejoints[i].pos));
+                }
+                w.put(shaders.length());
+                loopv(shaders)
+                {
+                    w.putstring(shaders[i].tex);
+                    w.put(shaders[i].nummeshes);
+                }
+                savecache(w);
+                modelcachesave(key, w);
+            }
+            modelcachecount(false, SDL_GetTicks() - start);
             return true;
         }
 
+        /// The inputs of loading an animation besides the file: the skeleton it is applied to and the adjustments of the cfg.
+        void animcacheparams(modelcachewriter &params)
+        {
+            params.put(skel->numbones);
+            loopi(skel->numbones)
+            {
+                const boneinfo &b = skel->bones[i];
+                params.put(b.parent);
+                params.put(b.base);
+                params.put(b.invbase);
+            }
+            params.putarray(adjustments.getbuf(), adjustments.length());
+            // the frames get flipped to the same hemisphere as the first frame of the skeleton
+            if(skel->numframes) params.putbytes(skel->framebones, skel->numbones*sizeof(dualquat));
+        }
+
+        /// Append the frames of a model cache entry written by loadanim to the skeleton.
+        skelanimspec *loadcachedanim(modelcachereader &r, const char *filename)
+        {
+            int numdata;
+            dualquat *frames = r.getarray<dualquat>(numdata);
+            if(!r.finished() || !numdata || numdata%skel->numbones) { delete[] frames; return nullptr; }
+            int animframes = numdata/skel->numbones;
+            dualquat *animbones = new dualquat[(skel->numframes+animframes)*skel->numbones];
+            if(skel->framebones)
+            {
+                memcpy(animbones, skel->framebones, skel->numframes*skel->numbones*sizeof(dualquat));
+                delete[] skel->framebones;
+            }
+            memcpy(&animbones[skel->numframes*skel->numbones], frames, numdata*sizeof(dualquat));
+            delete[] frames;
+            skel->framebones = animbones;
+
+            skelanimspec *sa = &skel->addskelanim(filename);
+            sa->frame = skel->numframes;
+            sa->range = animframes;
+            skel->numframes += animframes;
+            return sa;
+        }
+
         skelanimspec *loadanim(const char *filename) override
         {
             skelanimspec *sa = skel->findskelanim(filename);
             if(sa) return sa;
 
+            uint start = SDL_GetTicks();
+            modelcachewriter params;
+            animcacheparams(params);
+            modelcachekey key = modelcachekeyfor("md5anim", filename, params.data.data(), params.data.size());
+            if(key.valid())
+            {
+                modelcachereader r(key);
+                if(r.ok() && (sa = loadcachedanim(r, filename)))
+                {
+                    modelcachecount(true, SDL_GetTicks() - start);
+                    return sa;
+                }
+            }
+
             stream *f = openfile(filename, "r");
             if(!f) return nullptr;
 
@@ -376,6 +532,13 @@ struct md5 : skelmodel, skelloader<md5>
             if(animdata) delete[] animdata;
             delete f;
 
+            if(sa && key.valid())
+            {
+                modelcachewriter w;
+                w.putarray(&skel->framebones[sa->frame*skel->numbones], sa->range*skel->numbones);
+                modelcachesave(key, w);
+            }
+            if(sa) modelcachecount(false, SDL_GetTicks() - start);
             return sa;
         }
 
@@ -389,6 +552,17 @@ struct md5 : skelmodel, skelloader<md5>
         }
     };            
 
+    /// Parse a mesh and its animations into the model cache without loading a model, safe to call on worker threads
+    /// while the main thread does not load md5 models. The animations are cooked for an unshared skeleton without adjustments.
+    static void cook(const char *meshfile, float smooth, const vector<const char *> &animfiles)
+    {
+        md5meshgroup group;
+        group.cooking = true;
+        group.shareskeleton(nullptr);
+        if(!group.loadmesh(meshfile, smooth)) return;
+        loopv(animfiles) group.loadanim(animfiles[i]);
+    }
+
     meshgroup *loadmeshes(const char *name, va_list args) override
     {
         md5meshgroup *group = new md5meshgroup;
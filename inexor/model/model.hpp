@@ -62,6 +62,9 @@ struct model
     virtual bool load() = 0;
     virtual int type() const = 0;
     virtual BIH *setBIH() { return nullptr; }
+    /// Collect the meshes setBIH() builds the BIH from, returns false if the model has no BIH.
+    /// Finishes the skins, so only on the main thread, the BIH itself may then be built anywhere.
+    virtual bool genBIH(vector<BIH::mesh> &bih) { return false; }
     virtual bool envmapped() { return false; }
     virtual bool skeletal() const { return false; }
 
@@ -0,0 +1,88 @@
+/// @file modelcache.cpp
+/// On disk cache of loaded model meshes and animations, see modelcache.hpp.
+
+#include <string>                              // for string
+
+#include "inexor/io/Logging.hpp"               // for Log, Logger
+#include "inexor/io/legacy/stream.hpp"         // for findfile, loadfiledata
+#include "inexor/model/modelcache.hpp"
+#include "inexor/network/SharedVar.hpp"        // for SharedVar
+#include "inexor/shared/command.hpp"           // for VARP, COMMAND
+#include "inexor/shared/cube_formatting.hpp"   // for copystring
+#include "inexor/util/diskcache.hpp"           // for diskcache, fnv1a
+#include "inexor/util/vfs.hpp"                 // for vfsdata
+
+using inexor::util::diskcache;
+
+/// Whether loaded meshes and animations are stored in and loaded from the cache.
+VARP(modelcache, 0, 1, 1);
+/// Megabytes the cache may use before the least recently used entries are deleted.
+VARP(modelcachesize, 0, 256, 1<<16);
+
+/// Bump whenever loading or post processing of models changes, so old entries are not used anymore.
+static const int MODELCACHE_VERSION = 2;
+
+static diskcache cache("IMDC", MODELCACHE_VERSION, ".imc");
+
+/// The cache directory in the home directory, created if it is not there.
+static std::string cachedir()
+{
+    return findfile(path("cache/models/", true), "w");
+}
+
+modelcachekey modelcachekeyfor(const char *kind, const char *file, const void *params, size_t paramlen)
+{
+    modelcachekey key;
+    if(!modelcache) return key;
+    string name;
+    copystring(name, file);
+    path(name);
+    key.desc = kind;
+    key.desc += ':';
+    key.desc += name;
+
+    unsigned long long hash = inexor::util::FNV1A_BASIS;
+    inexor::util::fnv1a(hash, key.desc.c_str(), key.desc.size() + 1);
+    inexor::util::fnv1a(hash, params, paramlen);
+    inexor::util::vfsdata data;
+    if(!loadfiledata(name, data)) return modelcachekey(); // the loader will complain
+    inexor::util::fnv1a(hash, data.data(), data.size());
+    key.hash = hash ? hash : 1;
+    return key;
+}
+
+modelcachereader::modelcachereader(const modelcachekey &key)
+{
+    if(!modelcache) return;
+    size_t len;
+    if(!cache.load(cachedir(), key, file, cur, len)) return;
+    end = cur + len;
+}
+
+void modelcachesave(const modelcachekey &key, const modelcachewriter &w)
+{
+    if(!modelcache) return;
+    cache.save(cachedir(), key, (long long)int(modelcachesize) << 20, [&](FILE *f)
+    {
+        return fwrite(w.data.data(), 1, w.data.size(), f) == w.data.size();
+    });
+}
+
+void modelcachecount(bool hit, uint millis)
+{
+    cache.count(hit, millis);
+}
+
+void modelcachereport(const char *what)
+{
+    diskcache::stats s = cache.takestats();
+    if(!s.hits && !s.misses) return;
+    Log.std->info("{}: {} model files from the model cache ({} ms), {} parsed ({} ms)", what, s.hits, s.hitmillis, s.misses, s.missmillis);
+}
+
+/// Delete every entry, to measure a cold load.
+void modelcacheclear()
+{
+    cache.clear(cachedir());
+}
+COMMAND(modelcacheclear, "");
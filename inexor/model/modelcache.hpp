@@ -0,0 +1,115 @@
+/// @file modelcache.hpp
+/// On disk cache of loaded ("cooked") model meshes and animations.
+///
+/// Text formats (md5, obj) are parsed and post processed (skinning the base pose, smoothing normals, sorting the blend combos,
+/// applying bone adjustments) on every load. The result of that gets stored in the home directory, so the next load only
+/// copies the final arrays out of a file mapped into memory.
+/// An entry is found by a hash of the contents of the source file and the parameters which change the result
+/// (smoothing angle, the adjustments of the model cfg, the skeleton an animation is made for), so editing either invalidates it.
+/// What depends on the GL state (vertex buffers, tangents for the chosen shaders) is still built on upload.
+
+#pragma once
+
+#include <stddef.h>                      // for size_t
+#include <string.h>                      // for memcpy, strlen
+#include <vector>                        // for vector
+
+#include "inexor/shared/cube_tools.hpp"  // for newstring
+#include "inexor/shared/cube_types.hpp"  // for uchar, uint
+#include "inexor/util/diskcache.hpp"     // for diskcachekey
+#include "inexor/util/mappedfile.hpp"    // for mappedfile
+
+/// Identifies a cache entry, empty if the model cache is disabled or the file could not be read.
+/// The description is what the entry is made from, e.g. "md5mesh:packages/models/mrfixit/mrfixit.md5mesh".
+typedef inexor::util::diskcachekey modelcachekey;
+
+/// Build the key for loading the file as kind, params are all other inputs which change the result.
+/// Reads the file to hash it.
+extern modelcachekey modelcachekeyfor(const char *kind, const char *file, const void *params = nullptr, size_t paramlen = 0);
+
+/// Collects an entry in memory, stored by modelcachesave.
+/// Everything is written in the byte order of the machine, the cache is not meant to be shared between machines.
+struct modelcachewriter
+{
+    std::vector<uchar> data;
+
+    void putbytes(const void *v, size_t len)
+    {
+        if(!len) return;
+        size_t pos = data.size();
+        data.resize(pos + len);
+        memcpy(&data[pos], v, len);
+    }
+    template<class T> void put(const T &v) { putbytes(&v, sizeof(T)); }
+    template<class T> void putarray(const T *v, int n) { put(n); putbytes(v, n*sizeof(T)); }
+    void putstring(const char *s)
+    {
+        int len = s ? int(strlen(s)) : -1;
+        put(len);
+        if(s) putbytes(s, len);
+    }
+};
+
+/// Reads an entry, memory mapped where the platform allows it.
+/// Once a read failed (the entry is truncated or does not match what the caller expects) all further ones fail too.
+struct modelcachereader
+{
+    /// Open the entry of key, ok() is false if there is none.
+    explicit modelcachereader(const modelcachekey &key);
+
+    bool ok() const { return cur != nullptr; }
+    /// Whether the whole entry got read, a longer one is an error as well.
+    bool finished() const { return cur && cur == end; }
+
+    /// Make all further reads fail, e.g. if what got read does not make sense.
+    void fail() { cur = nullptr; }
+
+    bool getbytes(void *v, size_t len)
+    {
+        if(!cur || size_t(end - cur) < len) { fail(); return false; }
+        if(len) memcpy(v, cur, len);
+        cur += len;
+        return true;
+    }
+    template<class T> bool get(T &v) { return getbytes(&v, sizeof(T)); }
+
+    /// Read an array written by putarray, returns nullptr if it is empty or fails. The caller owns it (delete[]).
+    template<class T> T *getarray(int &n)
+    {
+        n = 0;
+        int len;
+        if(!get(len) || len < 0 || size_t(len) > size_t(end - cur)/sizeof(T)) { fail(); return nullptr; }
+        if(!len) return nullptr;
+        T *v = new T[len];
+        getbytes(v, len*sizeof(T));
+        n = len;
+        return v;
+    }
+
+    /// Read a string written by putstring, nullptr for a null string or if it fails. The caller owns it (delete[]).
+    char *getstring()
+    {
+        int len;
+        if(!get(len) || len < -1 || (len > 0 && size_t(len) > size_t(end - cur))) { fail(); return nullptr; }
+        if(len < 0) return nullptr;
+        char *s = newstring(reinterpret_cast<const char *>(cur), len);
+        cur += len;
+        return s;
+    }
+
+  private:
+    const uchar *cur = nullptr, *end = nullptr;
+    inexor::util::mappedfile file;
+
+    modelcachereader(const modelcachereader &) = delete;
+    modelcachereader &operator=(const modelcachereader &) = delete;
+};
+
+/// Store the entry written into w under key.
+extern void modelcachesave(const modelcachekey &key, const modelcachewriter &w);
+
+/// Count the time spent on loading a mesh or animation file for the statistics, hit whether it came from the cache.
+extern void modelcachecount(bool hit, uint millis);
+
+/// Log the hits, misses and loading time since the last report (e.g. for one map load) and start counting anew.
+extern void modelcachereport(const char *what);
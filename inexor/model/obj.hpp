@@ -23,17 +23,63 @@ struct obj : vertmodel, vertloader<obj>
             }
         }
 
+        /// Take the meshes from a model cache entry written by load.
+        bool loadcache(modelcachereader &r)
+        {
+            int nummeshes;
+            vector<vertmesh *> loaded;
+            if(r.get(nummeshes) && nummeshes >= 0) loopi(nummeshes)
+            {
+                vertmesh &m = *loaded.add(new vertmesh);
+                m.group = this;
+                m.name = r.getstring();
+                int numtcverts;
+                m.verts = r.getarray<vert>(m.numverts);
+                m.tcverts = r.getarray<tcvert>(numtcverts);
+                m.tris = r.getarray<tri>(m.numtris);
+                if(numtcverts != m.numverts) r.fail();
+                loopj(m.numtris) loopk(3) if(m.tris[j].vert[k] >= m.numverts) r.fail();
+                if(!r.ok()) break;
+            }
+            if(!r.finished()) { loaded.deletecontents(); return false; }
+            loopv(loaded) meshes.add(loaded[i]);
+            return true;
+        }
+
+        void savecache(modelcachewriter &w)
+        {
+            w.put(meshes.length());
+            loopv(meshes)
+            {
+                vertmesh &m = *(vertmesh *)meshes[i];
+                w.putstring(m.name);
+                w.putarray(m.verts, m.numverts);
+                w.putarray(m.tcverts, m.numverts);
+                w.putarray(m.tris, m.numtris);
+            }
+        }
+
         bool load(const char *filename, float smooth)
         {
             int len = strlen(filename);
             if(len < 4 || strcasecmp(&filename[len-4], ".obj")) return false;
 
-            stream *file = openfile(filename, "rb");
-            if(!file) return false;
-
+            uint start = SDL_GetTicks();
+            modelcachekey key = modelcachekeyfor("obj", filename, &smooth, sizeof(smooth));
             name = newstring(filename);
-
             numframes = 1;
+            if(key.valid())
+            {
+                modelcachereader r(key);
+                if(r.ok() && loadcache(r))
+                {
+                    modelcachecount(true, SDL_GetTicks() - start);
+                    return true;
+                }
+            }
+
+            stream *file = openfile(filename, "rb");
+            if(!file) return false;
 
             vector<vec> attrib[3];
             char buf[512];
@@ -156,10 +202,24 @@ struct obj : vertmodel, vertloader<obj>
 
             delete file;
 
+            if(key.valid())
+            {
+                modelcachewriter w;
+                savecache(w);
+                modelcachesave(key, w);
+            }
+            modelcachecount(false, SDL_GetTicks() - start);
             return true;
         }
     };
 
+    /// Parse a mesh into the model cache without loading a model, safe to call on worker threads.
+    static void cook(const char *file, float smooth)
+    {
+        objmeshgroup group;
+        group.load(file, smooth);
+    }
+
     meshgroup *loadmeshes(const char *name, va_list args) override
     {
         objmeshgroup *group = new objmeshgroup;
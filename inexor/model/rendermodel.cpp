@@ -5,8 +5,10 @@
 #include <algorithm>                                  // for max, min
 #include <memory>                                     // for __shared_ptr
 #include <string>                                     // for string
+#include <vector>                                     // for vector
 
 #include "SDL_opengl.h"                               // for GL_LINE_LOOP
+#include "SDL_timer.h"                                // for SDL_GetTicks
 #include "inexor/engine/blob.hpp"                     // for flushblobs, ren...
 #include "inexor/engine/dynlight.hpp"                 // for dynlightreaching
 #include "inexor/engine/glare.hpp"                    // for glaring
@@ -44,6 +46,7 @@
 #include "inexor/texture/cubemap.hpp"                 // for cubemapload
 #include "inexor/texture/texture.hpp"                 // for textureload
 #include "inexor/ui/legacy/menus.hpp"                 // for initing
+#include "inexor/util/jobs.hpp"                       // for jobs
 #include "inexor/util/legacy_time.hpp"                // for lastmillis
 
 
@@ -64,6 +67,38 @@ VARP(gpuskel, 0, 1, 1);
 VAR(maxskelanimdata, 1, 192, 0);
 VAR(testtags, 0, 0, 1);
 
+// Skeletons cache their evaluated poses, instances in the same animation state share one.
+// Frame times can be rounded to 1/posequant of a frame and the pitch to 1/posepitchquant degrees, so more instances share one,
+// at the cost of visibly coarser animation. 0 compares them exactly.
+VAR(posequant, 0, 0, 1024);
+VAR(posepitchquant, 0, 0, 100);
+
+static int posecachehits = 0, posecachemisses = 0;
+
+ICOMMAND(posecachestats, "i", (int *reset),
+{
+    int total = posecachehits + posecachemisses;
+    Log.std->info("pose cache: {} hits, {} misses ({}% hit rate)", posecachehits, posecachemisses, total ? posecachehits*100/total : 0);
+    if(*reset) posecachehits = posecachemisses = 0;
+});
+
+// Skinning on the CPU (when gpuskel is off or the GPU has too few bones) is cut into jobs of skinchunk vertices,
+// which the render thread hands to the job system right before the model is drawn and helps with until all are done.
+
+VARP(skinthreads, 0, 0, inexor::util::job_system::MAXWORKERS); ///< threads skinning models on the CPU, 0 uses numcpus
+VAR(skinchunk, 64, 1024, 65536);
+
+/// Run work(ctx, i) for all i below numjobs on the job system and the calling thread, returns once all are done.
+static void runskinjobs(void (*work)(void *, int), void *ctx, int numjobs)
+{
+    extern SharedVar<int> numcpus;
+    int numthreads = min(skinthreads > 0 ? int(skinthreads) : int(numcpus), numjobs);
+    inexor::util::jobs().parallel_for(0, numjobs, 1, [work, ctx](int from, int to)
+    {
+        for(int i = from; i < to; i++) work(ctx, i);
+    }, max(numthreads, 1));
+}
+
 #include "inexor/model/animmodel.hpp"                 // for animmodel::part
 #include "inexor/model/ragdoll.hpp"                   // for ragdollskel
 #include "inexor/model/skelmodel.hpp"                 // for skelmodel, skel...
@@ -97,6 +132,39 @@ MODELTYPE(MDL_OBJ, obj);
 MODELTYPE(MDL_SMD, smd);
 MODELTYPE(MDL_IQM, iqm);
 
+/// Skin all frames of the stock player models (or the given ones) on the CPU, one vertex at a time and with the SIMD kernel on threads threads.
+/// Nothing is drawn, the models only get loaded if they are not yet.
+void skinbench(char *names, int *reps, int *threads, int *tangents)
+{
+    extern SharedVar<int> numcpus;
+    vector<char *> models;
+    explodelist(names[0] ? names : "player/mrfixit2 player/ironsnoutx10k", models);
+    int oldthreads = skinthreads, numreps = max(*reps, 1);
+    if(*threads > 0) skinthreads = *threads;
+    loopv(models)
+    {
+        model *m = loadmodel(models[i]);
+        if(!m || (m->type() != MDL_MD5 && m->type() != MDL_IQM && m->type() != MDL_SMD))
+        {
+            Log.std->warn("skinbench: {} is no skeletal model", models[i]);
+            continue;
+        }
+        skelmodel *sm = (skelmodel *)m;
+        uint reftime = 0, simdtime = 0;
+        int numskinned = 0;
+        float maxerr = 0;
+        loopvj(sm->parts) if(sm->parts[j]->meshes)
+        {
+            maxerr = max(maxerr, ((skelmodel::skelmeshgroup *)sm->parts[j]->meshes)->benchskin(*tangents != 0, numreps, reftime, simdtime, numskinned));
+        }
+        Log.std->info("skinbench: {}: {} vertices skinned, {} ms one by one, {} ms simd on {} threads, max error {}",
+                      models[i], numskinned, reftime, simdtime, skinthreads > 0 ? int(skinthreads) : int(numcpus), maxerr);
+    }
+    skinthreads = oldthreads;
+    models.deletearrays();
+}
+COMMAND(skinbench, "siii");
+
 #define checkmdl if(!loadingmodel) { Log.std->error("not loading a model"); return; }
 
 void mdlcullface(int *cullface)
@@ -420,21 +488,249 @@ void preloadmodel(const char *name)
     preloadmodels.add(newstring(name));
 }
 
-void flushpreloadedmodels(bool msg)
+// Preloading many models: loading a model runs its cfg, which only works on the main thread and needs the meshes right away
+// (skins, tags and animations refer to them). So the cfgs are only scanned for the mesh and animation files they load first,
+// workers parse all of these into the model cache at once and the main thread then runs the cfgs, which get their meshes
+// from the cache. Skins are decoded on the workers anyway (textureloadasync) and the BIHs get built on them afterwards.
+
+VARP(parallelmodelpreload, 0, 1, 1);
+
+/// A mesh file a model is going to load, with the animations loaded into its skeleton.
+struct cookjob
+{
+    int type;
+    std::string file;
+    float smooth;
+    std::vector<std::string> anims;
+};
+
+/// Split a cfg into commands of plain words. Commands using variables, macros or expressions are left out, only what is
+/// loaded for sure is of interest.
+static bool scancfg(const char *cfgname, std::vector<std::vector<std::string>> &cmds)
+{
+    char *buf = loadfile(path(cfgname, true), nullptr);
+    if(!buf) return false;
+    std::vector<std::string> cmd;
+    bool dynamic = false;
+    auto endcmd = [&]()
+    {
+        if(!cmd.empty() && !dynamic) cmds.push_back(cmd);
+        cmd.clear();
+        dynamic = false;
+    };
+    for(const char *p = buf; *p;)
+    {
+        if(*p == '\n' || *p == ';') { endcmd(); p++; }
+        else if(p[0] == '/' && p[1] == '/') { while(*p && *p != '\n') p++; }
+        else if(iscubespace(*p)) p++;
+        else if(*p == '"')
+        {
+            const char *start = ++p;
+            while(*p && *p != '"' && *p != '\n') { if(*p == '^') dynamic = true; p++; }
+            cmd.emplace_back(start, p);
+            if(*p == '"') p++;
+        }
+        else
+        {
+            const char *start = p;
+            for(; *p && !iscubespace(*p) && *p != ';' && *p != '"'; p++) if(strchr("$@()[]", *p)) dynamic = true;
+            cmd.emplace_back(start, p);
+        }
+    }
+    endcmd();
+    delete[] buf;
+    return true;
+}
+
+/// The smoothing the load commands pass to the mesh loaders for an angle in degrees.
+static float loadsmooth(float smooth)
+{
+    return float(double(smooth > 0 ? cos(clamp(smooth, 0.0f, 180.0f)*RAD) : 2));
+}
+
+/// Find the md5 and obj meshes (and md5 animations) model loads, from its cfg or the default files.
+static void findcookjobs(const char *name, std::vector<cookjob> &jobs)
+{
+    defformatstring(dir, "%s/%s", *modeldir, name);
+    auto addjob = [&](int type, const char *dir, const std::string &file, float smooth) -> cookjob &
+    {
+        cookjob job;
+        job.type = type;
+        job.file = path(tempformatstring("%s/%s", dir, file.c_str()), true);
+        job.smooth = smooth;
+        jobs.push_back(job);
+        return jobs.back();
+    };
+
+    std::vector<std::vector<std::string>> cmds;
+    if(scancfg(tempformatstring("%s/md5.cfg", dir), cmds))
+    {
+        string md5dir;
+        copystring(md5dir, dir);
+        cookjob *last = nullptr;
+        for(const std::vector<std::string> &cmd : cmds)
+        {
+            if(cmd[0] == "md5dir" && cmd.size() > 1) formatstring(md5dir, "%s/%s", *modeldir, cmd[1].c_str());
+            else if(cmd[0] == "md5load" && cmd.size() > 1)
+            {
+                last = &addjob(MDL_MD5, md5dir, cmd[1], loadsmooth(cmd.size() > 3 ? parsefloat(cmd[3].c_str()) : 0));
+                // a named skeleton may already have bones from another model, which the animations depend on
+                if(cmd.size() > 2 && !cmd[2].empty()) last = nullptr;
+            }
+            else if(cmd[0] == "md5anim" && cmd.size() > 2 && last) last->anims.push_back(path(tempformatstring("%s/%s", md5dir, cmd[2].c_str()), true));
+            else if(cmd[0] == "md5adjust" && last) { last->anims.clear(); last = nullptr; }
+        }
+    }
+    else
+    {
+        const char *fname = strrchr(name, '/');
+        fname = fname ? fname + 1 : name;
+        cookjob &job = addjob(MDL_MD5, dir, tempformatstring("%s.md5mesh", fname), loadsmooth(0));
+        job.anims.push_back(path(tempformatstring("%s/%s.md5anim", dir, fname), true));
+    }
+
+    cmds.clear();
+    if(scancfg(tempformatstring("%s/obj.cfg", dir), cmds))
+    {
+        string objdir;
+        copystring(objdir, dir);
+        for(const std::vector<std::string> &cmd : cmds)
+        {
+            if(cmd[0] == "objdir" && cmd.size() > 1) formatstring(objdir, "%s/%s", *modeldir, cmd[1].c_str());
+            else if(cmd[0] == "objload" && cmd.size() > 1) addjob(MDL_OBJ, objdir, cmd[1], loadsmooth(cmd.size() > 2 ? parsefloat(cmd[2].c_str()) : 0));
+        }
+    }
+    else
+    {
+        addjob(MDL_OBJ, dir, "tris.obj", loadsmooth(0));
+        defformatstring(parent, "%s/%s", *modeldir, parentdir(name));
+        addjob(MDL_OBJ, parent, "tris.obj", loadsmooth(0));
+    }
+}
+
+/// Parse the meshes of the models which are not loaded yet into the model cache on all threads.
+static void cookmodels(const vector<const char *> &names)
 {
-    loopv(preloadmodels)
+    extern SharedVar<int> modelcache;
+    if(!parallelmodelpreload || !modelcache || inexor::util::jobs().concurrency() <= 1) return;
+
+    std::vector<cookjob> jobs;
+    loopv(names) if(names[i][0] && !models.access(names[i])) findcookjobs(names[i], jobs);
+    // models share meshes, e.g. with the parent directory
+    std::sort(jobs.begin(), jobs.end(), [](const cookjob &a, const cookjob &b) { return a.file < b.file || (a.file == b.file && a.smooth < b.smooth); });
+    jobs.erase(std::unique(jobs.begin(), jobs.end(), [](const cookjob &a, const cookjob &b) { return a.file == b.file && a.smooth == b.smooth; }), jobs.end());
+
+    // the animations are cooked without adjustments, the load commands reset them the same way
+    md5::adjustments.setsize(0);
+    inexor::util::jobs().parallel_for(0, int(jobs.size()), 1, [&jobs](int from, int to)
     {
-        loadprogress = float(i+1)/preloadmodels.length();
-        model *m = loadmodel(preloadmodels[i], -1, msg);
+        for(int i = from; i < to; i++)
+        {
+            const cookjob &job = jobs[i];
+            if(job.type == MDL_OBJ) obj::cook(job.file.c_str(), job.smooth);
+            else
+            {
+                vector<const char *> anims;
+                for(const std::string &anim : job.anims) anims.add(anim.c_str());
+                md5::cook(job.file.c_str(), job.smooth, anims);
+            }
+        }
+    });
+}
 
-        if(!m) { if(msg) Log.std->warn("could not load model: {0}", preloadmodels[i]); } // TODO: LOG_N_TIMES(1)
+/// How long loading a model took on the last (pre)load, for mapmodelloadtimes.
+struct modelloadtime
+{
+    std::string name;
+    uint load, bih;
+};
+static std::vector<modelloadtime> modelloadtimes;
+
+/// Build the BIHs of the models which have none yet, the meshes are collected on the main thread and the trees built on all.
+static void preloadBIHs(const vector<model *> &ms)
+{
+    vector<model *> build;
+    std::vector<vector<BIH::mesh>> meshes;
+    meshes.reserve(ms.length());
+    loopv(ms) if(!ms[i]->bih)
+    {
+        meshes.emplace_back();
+        if(ms[i]->genBIH(meshes.back())) build.add(ms[i]);
+        else meshes.pop_back();
+    }
+    std::vector<uint> millis(build.length(), 0);
+    inexor::util::jobs().parallel_for(0, build.length(), 1, [&](int from, int to)
+    {
+        for(int i = from; i < to; i++)
+        {
+            uint start = SDL_GetTicks();
+            build[i]->bih = new BIH(meshes[i]);
+            millis[i] = SDL_GetTicks() - start;
+        }
+    });
+    loopv(ms) ms[i]->preloadBIH();
+    loopv(build) for(modelloadtime &t : modelloadtimes) if(t.name == build[i]->name) t.bih = millis[i];
+}
+
+/// Load the named models (or map models by index if names is empty), reporting the times if msg.
+static void loadmodels(const vector<const char *> &names, const vector<int> &indices, bool msg, bool bih, const char *what)
+{
+    uint start = SDL_GetTicks();
+    vector<const char *> cooknames = names;
+    loopv(indices) if(mapmodels.inrange(indices[i])) cooknames.add(mapmodels[indices[i]].name);
+    cookmodels(cooknames);
+    uint cooked = SDL_GetTicks();
+
+    modelloadtimes.clear();
+    vector<model *> loaded;
+    int num = max(names.length(), indices.length());
+    loopi(num)
+    {
+        loadprogress = float(i+1)/num;
+        uint loadstart = SDL_GetTicks();
+        model *m = nullptr;
+        if(names.length())
+        {
+            m = loadmodel(names[i], -1, msg);
+            if(!m && msg) Log.std->warn("could not load model: {0}", names[i]); // TODO: LOG_N_TIMES(1)
+        }
         else
         {
-            m->preloadmeshes();
+            mapmodelinfo *mmi = getmminfo(indices[i]);
+            if(!mmi) { if(msg) Log.std->warn("could not find map model: {0}", indices[i]); } // TODO: LOG_N_TIMES(1)
+            else if(mmi->name[0] && !loadmodel(nullptr, indices[i], msg)) { if(msg) Log.std->warn("could not load model: {0}", mmi->name); } // TODO: LOG_N_TIMES(1)
+            else m = mmi->m;
         }
+        if(!m || loaded.find(m) >= 0) continue;
+        loaded.add(m);
+        modelloadtime t = { m->name, SDL_GetTicks() - loadstart, 0 };
+        modelloadtimes.push_back(t);
     }
-    preloadmodels.deletearrays();
+    uint configured = SDL_GetTicks();
+
+    if(bih) preloadBIHs(loaded);
+    uint bihs = SDL_GetTicks();
+    loopv(loaded) loaded[i]->preloadmeshes();
     loadprogress = 0;
+
+    if(msg && loaded.length())
+        Log.std->info("{}: {} models in {} ms (parsing {} ms on {} threads, cfgs {} ms, BIHs {} ms, buffers {} ms)", what, loaded.length(), SDL_GetTicks() - start,
+                      cooked - start, inexor::util::jobs().concurrency(), configured - cooked, bihs - configured, SDL_GetTicks() - bihs);
+}
+
+/// List the models of the last preload by the time they took to load, the slowest first.
+void modelloadtimesreport()
+{
+    std::vector<modelloadtime> times = modelloadtimes;
+    std::sort(times.begin(), times.end(), [](const modelloadtime &a, const modelloadtime &b) { return a.load + a.bih > b.load + b.bih; });
+    for(const modelloadtime &t : times) Log.std->info("{}: {} ms loading, {} ms BIH", t.name, t.load, t.bih);
+}
+COMMANDN(modelloadtimes, modelloadtimesreport, "");
+
+void flushpreloadedmodels(bool msg)
+{
+    loadmodels(preloadmodels, vector<int>(), msg, false, "preloaded models");
+    preloadmodels.deletearrays();
 }
 
 void preloadusedmapmodels(bool msg, bool bih)
@@ -446,21 +742,7 @@ void preloadusedmapmodels(bool msg, bool bih)
         extentity &e = *ents[i];
         if(e.type==ET_MAPMODEL && e.attr2 >= 0 && mapmodels.find(e.attr2) < 0) mapmodels.add(e.attr2);
     }
-
-    loopv(mapmodels)
-    {
-        loadprogress = float(i+1)/mapmodels.length();
-        int mmindex = mapmodels[i];
-        mapmodelinfo *mmi = getmminfo(mmindex);
-        if(!mmi) { if(msg) Log.std->warn("could not find map model: {0}", mmindex); } // TODO: LOG_N_TIMES(1)
-        else if(mmi->name[0] && !loadmodel(nullptr, mmindex, msg)) { if(msg) Log.std->warn("could not load model: {0}", mmi->name); } // TODO: LOG_N_TIMES(1)
-        else if(mmi->m)
-        {
-            if(bih) mmi->m->preloadBIH();
-            mmi->m->preloadmeshes();
-        }
-    }
-    loadprogress = 0;
+    loadmodels(vector<const char *>(), mapmodels, msg, bih, "preloaded map models");
 }
 
 vector<std::string> missingmodels; // models that fail to load once, we will never try to load again
@@ -3,7 +3,9 @@
 
 #pragma once
 
+#include "inexor/model/modelcache.hpp"
 #include "inexor/shared/command.hpp"
+#include "inexor/shared/skinning.hpp"
 #define BONEMASK_NOT  0x8000
 #define BONEMASK_END  0xFFFF
 #define BONEMASK_BONE 0x7FFF
@@ -176,6 +178,7 @@ struct skelmodel : animmodel
 
         int voffset, eoffset, elen;
         ushort minvert, maxvert;
+        skinstream skinsrc;
 
         skelmesh() : verts(nullptr), bumpverts(nullptr), tris(nullptr), numverts(0), numtris(0), maxweights(0)
         {
@@ -341,7 +344,44 @@ struct skelmodel : animmodel
             loopi(numverts) fillvert(vdata[i], i, verts[i]);
         }
 
-        void interpverts(const dualquat * RESTRICT bdata1, const dualquat * RESTRICT bdata2, bool tangents, void * RESTRICT vdata, skin &s)
+        /// Fill the SoA copy of the vertices which interpverts() skins, after genvbo() assigned the interpindex of every vertex.
+        void genskinstream(bool tangents)
+        {
+            skinsrc.setup(numverts, tangents);
+            loopi(numverts)
+            {
+                const vert &v = verts[i];
+                skinsrc.setvert(i, v.pos, tangents ? vec4(bumpverts[i].tangent) : vec4(v.norm, 0), v.interpindex);
+            }
+        }
+
+        /// Skin the vertices [start, end) into vdata (which points at this mesh's first vertex), start must be a multiple of 4.
+        void interpverts(const dualquat * RESTRICT bdata1, const dualquat * RESTRICT bdata2, void * RESTRICT vdata, int start, int end)
+        {
+            const int blendoffset = ((skelmeshgroup *)group)->skel->numgpubones;
+            bdata2 -= blendoffset;
+            if(skinsrc.tangents) skinsrc.skin(start, end, bdata1, bdata2, blendoffset, [&](int i, const skinlanes &l)
+            {
+                vvertbump *dst = (vvertbump *)vdata + i;
+                for(int j = 0, n = min(4, end-i); j < n; j++)
+                {
+                    dst[j].pos = vec(l.pos[0][j], l.pos[1][j], l.pos[2][j]);
+                    dst[j].tangent = vec4(l.dir[0][j], l.dir[1][j], l.dir[2][j], l.dir[3][j]);
+                }
+            });
+            else skinsrc.skin(start, end, bdata1, bdata2, blendoffset, [&](int i, const skinlanes &l)
+            {
+                vvertn *dst = (vvertn *)vdata + i;
+                for(int j = 0, n = min(4, end-i); j < n; j++)
+                {
+                    dst[j].pos = vec(l.pos[0][j], l.pos[1][j], l.pos[2][j]);
+                    dst[j].norm = vec(l.dir[0][j], l.dir[1][j], l.dir[2][j]);
+                }
+            });
+        }
+
+        /// One vertex at a time, the reference for skinbench.
+        void interpvertsref(const dualquat * RESTRICT bdata1, const dualquat * RESTRICT bdata2, bool tangents, void * RESTRICT vdata)
         {
             const int blendoffset = ((skelmeshgroup *)group)->skel->numgpubones;
             bdata2 -= blendoffset;
@@ -913,6 +953,21 @@ struct skelmodel : animmodel
             loopv(antipodes) sc.bdata[antipodes[i].child].fixantipodal(sc.bdata[antipodes[i].parent]);
         }
 
+        /// The plain pose of frame, without blending between frames or pitch, for skinbench.
+        void framepose(int frame, dualquat *bdata)
+        {
+            const dualquat *fr = &framebones[frame*numbones];
+            loopi(numbones) if(bones[i].interpindex>=0)
+            {
+                const boneinfo &b = bones[i];
+                dualquat d = fr[i];
+                d.normalize();
+                if(b.interpparent<0) bdata[b.interpindex] = d;
+                else bdata[b.interpindex].mul(bdata[b.interpparent], d);
+            }
+            loopv(antipodes) bdata[antipodes[i].child].fixantipodal(bdata[antipodes[i].parent]);
+        }
+
         void initragdoll(ragdolldata &d, skelcacheentry &sc, part *p)
         {
             const dualquat *bdata = sc.bdata;
@@ -1022,6 +1077,25 @@ struct skelmodel : animmodel
             }
         }
 
+        /// Round the frame times and the pitch to the steps the pose cache tells apart, see posequant and posepitchquant.
+        static void quantizepose(const animstate *as, int numanimparts, animstate *qas, float &pitch)
+        {
+            float steps = int(posequant), pitchsteps = int(posepitchquant);
+            loopi(numanimparts)
+            {
+                animstate &q = qas[i];
+                q = as[i];
+                if(!steps) continue;
+                q.cur.t = roundf(q.cur.t*steps)/steps;
+                if(q.interp < 1)
+                {
+                    q.prev.t = roundf(q.prev.t*steps)/steps;
+                    q.interp = roundf(q.interp*steps)/steps;
+                }
+            }
+            if(pitchsteps) pitch = roundf(pitch*pitchsteps)/pitchsteps;
+        }
+
         skelcacheentry &checkskelcache(part *p, const animstate *as, float pitch, const vec &axis, const vec &forward, ragdolldata *rdata)
         {
             if(skelcache.empty()) 
@@ -1031,22 +1105,26 @@ struct skelmodel : animmodel
 
             int numanimparts = ((skelpart *)as->owner)->numanimparts;
             uchar *partmask = ((skelpart *)as->owner)->partmask;
-            skelcacheentry *sc = nullptr;
-            bool match = false;
+            animstate qas[MAXANIMPARTS];
+            quantizepose(as, numanimparts, qas, pitch);
+            as = qas;
+            // look for the same pose through the whole cache first, instances in the same state share one entry
+            skelcacheentry *sc = nullptr, *stale = nullptr;
             loopv(skelcache)
             {
                 skelcacheentry &c = skelcache[i];
                 loopj(numanimparts) if(c.as[j]!=as[j]) goto mismatch;
                 if(c.pitch != pitch || c.partmask != partmask || c.ragdoll != rdata || (rdata && c.millis < rdata->lastmove)) goto mismatch;
-                match = true;
                 sc = &c;
                 break;
             mismatch:
-                if(c.millis < lastmillis) { sc = &c; break; }
+                if(!stale && c.millis < lastmillis) stale = &c;
             }
-            if(!sc) sc = &skelcache.add();
-            if(!match)
+            if(sc) posecachehits++;
+            else
             {
+                posecachemisses++;
+                sc = stale ? stale : &skelcache.add();
                 loopi(numanimparts) sc->as[i] = as[i];
                 sc->pitch = pitch;
                 sc->partmask = partmask;
@@ -1170,6 +1248,29 @@ struct skelmodel : animmodel
 
         virtual skelanimspec *loadanim(const char *filename) { return nullptr; }
 
+        /// The vertex layout for skinning on the CPU: every blend combo gets its own dual quat and the vertices are skinned into vdata.
+        void gencpuverts(vector<ushort> &idxs, bool tangents)
+        {
+            vweights = 1;
+            loopv(blendcombos)
+            {
+                blendcombo &c = blendcombos[i];
+                c.interpindex = c.weights[1] ? skel->numgpubones + vblends++ : -1;
+            }
+
+            vertsize = tangents ? sizeof(vvertbump) : sizeof(vvertn);
+            loopv(meshes) vlen += ((skelmesh *)meshes[i])->genvbo(idxs, vlen);
+            DELETEA(vdata);
+            vdata = new uchar[vlen*vertsize];
+            #define FILLVDATA(type) do { \
+                loopv(meshes) ((skelmesh *)meshes[i])->fillverts((type *)vdata); \
+            } while(0)
+            if(tangents) FILLVDATA(vvertbump);
+            else FILLVDATA(vvertn);
+            #undef FILLVDATA
+            loopv(meshes) ((skelmesh *)meshes[i])->genskinstream(tangents);
+        }
+
         void genvbo(bool tangents, vbocacheentry &vc)
         {
             if(!vc.vbuf) glGenBuffers_(1, &vc.vbuf);
@@ -1182,26 +1283,7 @@ struct skelmodel : animmodel
             vtangents = tangents;
             vlen = 0;
             vblends = 0;
-            if(skel->numframes && !skel->usegpuskel)
-            {
-                vweights = 1;
-                loopv(blendcombos)
-                {
-                    blendcombo &c = blendcombos[i];
-                    c.interpindex = c.weights[1] ? skel->numgpubones + vblends++ : -1;
-                }
-
-                vertsize = tangents ? sizeof(vvertbump) : sizeof(vvertn);
-                loopv(meshes) vlen += ((skelmesh *)meshes[i])->genvbo(idxs, vlen);
-                DELETEA(vdata);
-                vdata = new uchar[vlen*vertsize];
-                #define FILLVDATA(type) do { \
-                    loopv(meshes) ((skelmesh *)meshes[i])->fillverts((type *)vdata); \
-                } while(0)
-                if(tangents) FILLVDATA(vvertbump);
-                else FILLVDATA(vvertn);
-                #undef FILLVDATA
-            }
+            if(skel->numframes && !skel->usegpuskel) gencpuverts(idxs, tangents);
             else
             {
                 if(skel->numframes)
@@ -1339,6 +1421,55 @@ struct skelmodel : animmodel
             delete[] remap;
         }
 
+        /// Write the meshes and blend combos as loading left them (after sortblendcombos) to a model cache entry.
+        void savecache(modelcachewriter &w)
+        {
+            w.putarray(blendcombos.getbuf(), blendcombos.length());
+            w.put(numblends);
+            w.put(meshes.length());
+            loopv(meshes)
+            {
+                skelmesh &m = *(skelmesh *)meshes[i];
+                w.putstring(m.name);
+                w.put(m.maxweights);
+                w.putarray(m.verts, m.numverts);
+                w.putarray(m.tris, m.numtris);
+            }
+        }
+
+        /// Add the meshes of a model cache entry written by savecache, as M. Nothing is added if the entry is broken.
+        template<class M> bool loadcache(modelcachereader &r)
+        {
+            int numcombos, nummeshes;
+            blendcombo *combos = r.getarray<blendcombo>(numcombos);
+            int blends[4];
+            vector<M *> loaded;
+            if(r.get(blends) && r.get(nummeshes) && nummeshes >= 0) loopi(nummeshes)
+            {
+                M *m = new M;
+                m->group = this;
+                m->name = r.getstring();
+                r.get(m->maxweights);
+                m->verts = r.getarray<vert>(m->numverts);
+                m->tris = r.getarray<tri>(m->numtris);
+                loaded.add(m);
+                loopj(m->numverts) if(m->verts[j].blend < 0 || m->verts[j].blend >= numcombos) r.fail();
+                loopj(m->numtris) loopk(3) if(m->tris[j].vert[k] >= m->numverts) r.fail();
+                if(!r.ok()) break;
+            }
+            if(!r.finished() || blendcombos.length())
+            {
+                loaded.deletecontents();
+                delete[] combos;
+                return false;
+            }
+            loopi(numcombos) blendcombos.add(combos[i]);
+            delete[] combos;
+            memcpy(numblends, blends, sizeof(numblends));
+            loopv(loaded) meshes.add(loaded[i]);
+            return true;
+        }
+
         int remapblend(int blend)
         {
             const blendcombo &c = blendcombos[blend];
@@ -1357,22 +1488,142 @@ struct skelmodel : animmodel
             }
         }
 
-        void blendbones(const skelcacheentry &sc, blendcacheentry &bc)
+        /// Blend the bones of all combos which get their own dual quat, dst holds vblends of them.
+        void blendbones(const dualquat *bdata, dualquat *dst)
         {
-            bc.nextversion();
-            if(!bc.bdata) bc.bdata = new dualquat[vblends];
-            dualquat *dst = bc.bdata - skel->numgpubones;
+            dst -= skel->numgpubones;
             bool normalize = !skel->usegpuskel || vweights<=1;
             loopv(blendcombos)
             {
                 const blendcombo &c = blendcombos[i];
                 if(c.interpindex<0) break;
                 dualquat &d = dst[c.interpindex];
-                blendbones(d, sc.bdata, c);
+                blenddualquats(d, bdata, c.interpbones, c.weights);
                 if(normalize) d.normalize();
             }
         }
 
+        void blendbones(const skelcacheentry &sc, blendcacheentry &bc)
+        {
+            bc.nextversion();
+            if(!bc.bdata) bc.bdata = new dualquat[vblends];
+            blendbones(sc.bdata, bc.bdata);
+        }
+
+        struct skinpiece
+        {
+            skelmesh *m;
+            int start, end;
+        };
+
+        /// What the skinning jobs of one draw work on, one job per piece.
+        struct skintask
+        {
+            skelmeshgroup *g;
+            const dualquat *bdata1, *bdata2;
+            vector<skinpiece> pieces;
+
+            static void run(void *ctx, int i)
+            {
+                const skintask &t = *(const skintask *)ctx;
+                const skinpiece &p = t.pieces[i];
+                p.m->interpverts(t.bdata1, t.bdata2, t.g->vdata + p.m->voffset*t.g->vertsize, p.start, p.end);
+            }
+        };
+
+        /// Skin all meshes into vdata, cut into pieces of skinchunk vertices which are spread over the skinning workers.
+        void skinverts(const dualquat *bdata1, const dualquat *bdata2)
+        {
+            static skintask task; // only ever used by the render thread
+            task.g = this;
+            task.bdata1 = bdata1;
+            task.bdata2 = bdata2;
+            task.pieces.setsize(0);
+            int chunk = max(int(skinchunk)/4, 1)*4;
+            loopv(meshes)
+            {
+                skelmesh *m = (skelmesh *)meshes[i];
+                for(int start = 0; start < m->numverts; start += chunk)
+                {
+                    skinpiece &p = task.pieces.add();
+                    p.m = m;
+                    p.start = start;
+                    p.end = min(start + chunk, m->numverts);
+                }
+            }
+            runskinjobs(skintask::run, &task, task.pieces.length());
+        }
+
+        /// Skin every frame of the skeleton on the CPU, once one vertex at a time and once like render() does, and compare the results.
+        /// The meshes are switched to CPU skinning for that, the next render() sets them up again.
+        /// @return the largest difference of a position, normal or tangent component
+        float benchskin(bool tangents, int reps, uint &reftime, uint &simdtime, int &numskinned)
+        {
+            if(!skel->numframes) return 0;
+            skel->cleanup();
+            skel->usegpuskel = false;
+            if(tangents) loopv(meshes) ((skelmesh *)meshes[i])->calctangents();
+            vector<ushort> idxs;
+            vtangents = tangents;
+            vlen = 0;
+            vblends = 0;
+            gencpuverts(idxs, tangents);
+
+            dualquat *bdata = new dualquat[skel->numinterpbones], *blended = new dualquat[max(vblends, 1)];
+            uchar *refdata = new uchar[vlen*vertsize];
+            memcpy(refdata, vdata, vlen*vertsize);
+            float maxerr = 0;
+            loopi(skel->numframes)
+            {
+                skel->framepose(i, bdata);
+
+                uint start = SDL_GetTicks();
+                loopj(reps)
+                {
+                    dualquat *dst = blended - skel->numgpubones;
+                    loopvk(blendcombos)
+                    {
+                        const blendcombo &c = blendcombos[k];
+                        if(c.interpindex<0) break;
+                        blendbones(dst[c.interpindex], bdata, c);
+                        dst[c.interpindex].normalize();
+                    }
+                    loopvk(meshes)
+                    {
+                        skelmesh &m = *(skelmesh *)meshes[k];
+                        m.interpvertsref(bdata, blended, tangents, refdata + m.voffset*vertsize);
+                    }
+                }
+                reftime += SDL_GetTicks() - start;
+
+                start = SDL_GetTicks();
+                loopj(reps)
+                {
+                    blendbones(bdata, blended);
+                    skinverts(bdata, blended);
+                }
+                simdtime += SDL_GetTicks() - start;
+                numskinned += reps*vlen;
+
+                loopj(vlen)
+                {
+                    const vvert &a = *(const vvert *)(refdata + j*vertsize), &b = *(const vvert *)(vdata + j*vertsize);
+                    loopk(3) maxerr = max(maxerr, fabs(a.pos[k] - b.pos[k]));
+                    if(tangents)
+                    {
+                        const squat &ta = ((const vvertbump &)a).tangent, &tb = ((const vvertbump &)b).tangent;
+                        maxerr = max(maxerr, max(max(abs(ta.x - tb.x), abs(ta.y - tb.y)), max(abs(ta.z - tb.z), abs(ta.w - tb.w)))/32767.0f);
+                    }
+                    else loopk(3) maxerr = max(maxerr, fabs(((const vvertn &)a).norm[k] - ((const vvertn &)b).norm[k]));
+                }
+            }
+            delete[] bdata;
+            delete[] blended;
+            delete[] refdata;
+            skel->cleanup();
+            return maxerr;
+        }
+
         void cleanup() override
         {
             loopi(MAXBLENDCACHE)
@@ -1478,11 +1729,7 @@ struct skelmodel : animmodel
                 { 
                     vc.owner = owner;
                     (animcacheentry &)vc = sc;
-                    loopv(meshes)
-                    {
-                        skelmesh &m = *(skelmesh *)meshes[i];
-                        m.interpverts(sc.bdata, bc ? bc->bdata : nullptr, tangents, vdata + m.voffset*vertsize, p->skins[i]);
-                    }
+                    skinverts(sc.bdata, bc ? bc->bdata : nullptr);
                     gle::bindvbo(vc.vbuf);
                     glBufferData_(GL_ARRAY_BUFFER, vlen*vertsize, vdata, GL_STREAM_DRAW);
                 }
@@ -1,6 +1,7 @@
 
 #pragma once
 #include "inexor/model/animmodel.hpp"
+#include "inexor/model/modelcache.hpp"
 #include "inexor/shared/geom.hpp"
 
 struct vertmodel : animmodel
@@ -1,143 +1,160 @@
 #include <boost/algorithm/clamp.hpp>      // for clamp
-#include <limits.h>                       // for INT_MAX, INT_MIN, SHRT_MAX
-#include <string.h>                       // for memcpy
-#include <algorithm>                      // for max, min, swap
+#include <float.h>                        // for FLT_MAX
+#include <string.h>                       // for memcpy, memset
+#include <algorithm>                      // for max, min, swap, nth_element
 
+#include "SDL_timer.h"                    // for SDL_GetTicks
 #include "inexor/engine/lightmap.hpp"     // for lightmapping
+#include "inexor/io/Logging.hpp"          // for Log, Logger
 #include "inexor/model/model.hpp"         // for model
-#include "inexor/model/rendermodel.hpp"   // for loadmapmodel
+#include "inexor/model/rendermodel.hpp"   // for loadmapmodel, getmminfo
 #include "inexor/physics/bih.hpp"         // for BIH::mesh, BIH, BIH::node
 #include "inexor/physics/physics.hpp"     // for ::RAY_SHADOW, ::RAY_ALPHAPOLY
+#include "inexor/shared/command.hpp"      // for COMMAND
 #include "inexor/shared/cube_loops.hpp"   // for i, loopi, k, j, loopj, loopk
 #include "inexor/shared/cube_types.hpp"   // for ushort, uchar
 #include "inexor/shared/cube_vector.hpp"  // for vector
 #include "inexor/shared/ents.hpp"         // for extentity, ::EF_NOCOLLIDE
 #include "inexor/shared/geom.hpp"         // for vec, ivec, vec::(anonymous ...
+#include "inexor/shared/simd.hpp"         // for simd4f, simdmin, simdmax
 #include "inexor/shared/tools.hpp"        // for max, min, clamp, swap
 #include "inexor/texture/texture.hpp"     // for Texture, loadalphamask
 
-bool BIH::triintersect(const mesh &m, int tidx, const vec &mo, const vec &mray, float maxdist, float &dist, int mode)
+bool BIH::alphatest(const mesh &m, int tidx, float u, float v)
 {
     const tri &t = m.tris[tidx];
-    vec a = m.getpos(t.vert[0]), b = m.getpos(t.vert[1]).sub(a), c = m.getpos(t.vert[2]).sub(a),
-        n = vec().cross(b, c), r = vec(a).sub(mo), e = vec().cross(r, mray);
-    float det = mray.dot(n), v, w, f;
-    if(det >= 0)
-    {
-        if(!(mode&RAY_SHADOW) && m.flags&MESH_CULLFACE) return false;
-        v = e.dot(c);
-        if(v < 0 || v > det) return false;
-        w = -e.dot(b);
-        if(w < 0 || v + w > det) return false;
-        f = r.dot(n)*m.scale;
-        if(f < 0 || f > maxdist*det || !det) return false;
-    }
-    else
-    {
-        v = e.dot(c);
-        if(v > 0 || v < det) return false;
-        w = -e.dot(b);
-        if(w > 0 || v + w < det) return false;
-        f = r.dot(n)*m.scale;
-        if(f > 0 || f < maxdist*det) return false;
-    }
-    float invdet = 1/det;
-    if(m.flags&MESH_ALPHA && (mode&RAY_ALPHAPOLY)==RAY_ALPHAPOLY && (m.tex->alphamask || (lightmapping <= 1 && loadalphamask(m.tex))))
+    vec2 at = m.gettc(t.vert[0]), bt = m.gettc(t.vert[1]).sub(at).mul(u), ct = m.gettc(t.vert[2]).sub(at).mul(v);
+    at.add(bt).add(ct);
+    int si = clamp(int(m.tex->xs * at.x), 0, m.tex->xs-1),
+        ti = clamp(int(m.tex->ys * at.y), 0, m.tex->ys-1);
+    return (m.tex->alphamask[ti*((m.tex->xs+7)/8) + si/8] & (1<<(si%8))) != 0;
+}
+
+/// Intersects the ray with all triangles of the packet at once and returns the closest hit within maxdist.
+bool BIH::packetintersect(const mesh &m, const tripacket &p, const vec &mo, const vec &mray, float maxdist, float &dist, int mode)
+{
+    simd4f ax = simd4f::load(p.a[0]), ay = simd4f::load(p.a[1]), az = simd4f::load(p.a[2]),
+           bx = simd4f::load(p.b[0]), by = simd4f::load(p.b[1]), bz = simd4f::load(p.b[2]),
+           cx = simd4f::load(p.c[0]), cy = simd4f::load(p.c[1]), cz = simd4f::load(p.c[2]),
+           dx(mray.x), dy(mray.y), dz(mray.z);
+    // n = b x c, r = a - o, e = r x ray
+    simd4f nx = by*cz - bz*cy, ny = bz*cx - bx*cz, nz = bx*cy - by*cx,
+           rx = ax - simd4f(mo.x), ry = ay - simd4f(mo.y), rz = az - simd4f(mo.z),
+           ex = ry*dz - rz*dy, ey = rz*dx - rx*dz, ez = rx*dy - ry*dx,
+           det = dx*nx + dy*ny + dz*nz,
+           v = ex*cx + ey*cy + ez*cz,
+           w = simd4f(0.0f) - (ex*bx + ey*by + ez*bz),
+           f = (rx*nx + ry*ny + rz*nz)*simd4f(m.scale);
+    // fold the det < 0 case onto the det > 0 one, so both sides get tested in a single pass
+    simd4f adet = simdabs(det), av = simdxorsign(v, det), aw = simdxorsign(w, det), af = simdxorsign(f, det), zero(0.0f);
+    simd4f valid = (det != zero) & (av >= zero) & (aw >= zero) & (av + aw <= adet) & (af >= zero) & (af <= simd4f(maxdist)*adet);
+    if(!(mode&RAY_SHADOW) && m.flags&MESH_CULLFACE) valid = valid & (det < zero);
+    int mask = simdmovemask(valid);
+    if(!mask) return false;
+
+    bool alpha = m.flags&MESH_ALPHA && (mode&RAY_ALPHAPOLY)==RAY_ALPHAPOLY && (m.tex->alphamask || (lightmapping <= 1 && loadalphamask(m.tex)));
+    float dets[LEAF_TRIS], vs[LEAF_TRIS], ws[LEAF_TRIS], fs[LEAF_TRIS];
+    det.store(dets);
+    v.store(vs);
+    w.store(ws);
+    f.store(fs);
+    bool hit = false;
+    loopi(LEAF_TRIS) if(mask&(1<<i))
     {
-        vec2 at = m.gettc(t.vert[0]), bt = m.gettc(t.vert[1]).sub(at).mul(v*invdet), ct = m.gettc(t.vert[2]).sub(at).mul(w*invdet);
-        at.add(bt).add(ct);
-        int si = clamp(int(m.tex->xs * at.x), 0, m.tex->xs-1),
-            ti = clamp(int(m.tex->ys * at.y), 0, m.tex->ys-1);
-        if(!(m.tex->alphamask[ti*((m.tex->xs+7)/8) + si/8] & (1<<(si%8)))) return false;
+        float invdet = 1/dets[i], t = fs[i]*invdet;
+        if(hit && t >= dist) continue;
+        if(alpha && !alphatest(m, p.tris[i], vs[i]*invdet, ws[i]*invdet)) continue;
+        dist = t;
+        hit = true;
+        if(mode&RAY_SHADOW) break;
     }
-    dist = f*invdet;
-    return true;
+    return hit;
 }
 
 struct traversestate
 {
-    BIH::node *node;
-    float tmin, tmax;
+    uint child;
+    float tnear;
 };
 
-inline bool BIH::traverse(const mesh &m, const vec &o, const vec &ray, const vec &invray, float maxdist, float &dist, int mode, node *curnode, float tmin, float tmax)
+bool BIH::traverse(const mesh &m, const vec &o, const vec &ray, const vec &invray, float maxdist, float &dist, int mode, uint root, float tmin, float tmax)
 {
-    traversestate stack[128];
+    traversestate stack[192];
     int stacksize = 0;
-    ivec order(ray.x>0 ? 0 : 1, ray.y>0 ? 0 : 1, ray.z>0 ? 0 : 1);
     vec mo = m.invxform.transform(o), mray = m.invxformnorm.transform(ray);
+    simd4f ox(o.x), oy(o.y), oz(o.z), ix(invray.x), iy(invray.y), iz(invray.z);
+    bool hit = false;
+    uint cur = root;
+    float curnear = tmin;
     for(;;)
     {
-        int axis = curnode->axis();
-        int nearidx = order[axis], faridx = nearidx^1;
-        float nearsplit = (curnode->split[nearidx] - o[axis])*invray[axis],
-              farsplit = (curnode->split[faridx] - o[axis])*invray[axis];
-
-        if(nearsplit <= tmin)
-        {
-            if(farsplit < tmax)
-            {
-                if(!curnode->isleaf(faridx))
-                {
-                    curnode += curnode->childindex(faridx);
-                    tmin = max(tmin, farsplit);
-                    continue;
-                }
-                else if(triintersect(m, curnode->childindex(faridx), mo, mray, maxdist, dist, mode)) return true;
-            }
-        }
-        else if(curnode->isleaf(nearidx))
+        if(curnear <= tmax)
         {
-            if(triintersect(m, curnode->childindex(nearidx), mo, mray, maxdist, dist, mode)) return true;
-            if(farsplit < tmax)
+            if(cur&node::LEAF)
             {
-                if(!curnode->isleaf(faridx))
+                if(packetintersect(m, m.packets[cur&~node::LEAF], mo, mray, maxdist, dist, mode))
                 {
-                    curnode += curnode->childindex(faridx);
-                    tmin = max(tmin, farsplit);
-                    continue;
+                    if(mode&RAY_SHADOW) return true;
+                    hit = true;
+                    maxdist = dist;
+                    tmax = min(tmax, dist);
                 }
-                else if(triintersect(m, curnode->childindex(faridx), mo, mray, maxdist, dist, mode)) return true;
             }
-        }
-        else
-        {
-            if(farsplit < tmax)
+            else
             {
-                if(!curnode->isleaf(faridx))
+                const node &n = m.nodes[cur];
+                simd4f x1 = (simd4f::load(n.bbmin[0]) - ox)*ix, x2 = (simd4f::load(n.bbmax[0]) - ox)*ix,
+                       y1 = (simd4f::load(n.bbmin[1]) - oy)*iy, y2 = (simd4f::load(n.bbmax[1]) - oy)*iy,
+                       z1 = (simd4f::load(n.bbmin[2]) - oz)*iz, z2 = (simd4f::load(n.bbmax[2]) - oz)*iz,
+                       tnear = simdmax(simdmax(simdmin(x1, x2), simdmin(y1, y2)), simdmax(simdmin(z1, z2), simd4f(tmin))),
+                       tfar = simdmin(simdmin(simdmax(x1, x2), simdmax(y1, y2)), simdmin(simdmax(z1, z2), simd4f(tmax)));
+                int mask = simdmovemask(tnear <= tfar);
+                if(mask)
                 {
-                    if(stacksize < int(sizeof(stack)/sizeof(stack[0])))
+                    // sort the hit children front to back, continue with the nearest one and push the others
+                    float nears[NODE_WIDTH];
+                    tnear.store(nears);
+                    traversestate hits[NODE_WIDTH];
+                    int numhits = 0;
+                    loopi(NODE_WIDTH) if(mask&(1<<i) && !n.isunused(i))
+                    {
+                        int j = numhits++;
+                        for(; j > 0 && hits[j-1].tnear > nears[i]; j--) hits[j] = hits[j-1];
+                        hits[j].child = n.child[i];
+                        hits[j].tnear = nears[i];
+                    }
+                    for(int i = numhits-1; i > 0; i--)
                     {
-                        traversestate &save = stack[stacksize++];
-                        save.node = curnode + curnode->childindex(faridx);
-                        save.tmin = max(tmin, farsplit);
-                        save.tmax = tmax;
+                        if(stacksize < int(sizeof(stack)/sizeof(stack[0]))) stack[stacksize++] = hits[i];
+                        else if(traverse(m, o, ray, invray, maxdist, dist, mode, hits[i].child, tmin, tmax))
+                        {
+                            if(mode&RAY_SHADOW) return true;
+                            hit = true;
+                            maxdist = dist;
+                            tmax = min(tmax, dist);
+                        }
                     }
-                    else
+                    if(numhits > 0)
                     {
-                        if(traverse(m, o, ray, invray, maxdist, dist, mode, curnode + curnode->childindex(nearidx), tmin, min(tmax, nearsplit))) return true;
-                        curnode += curnode->childindex(faridx);
-                        tmin = max(tmin, farsplit);
+                        cur = hits[0].child;
+                        curnear = hits[0].tnear;
                         continue;
                     }
                 }
-                else if(triintersect(m, curnode->childindex(faridx), mo, mray, maxdist, dist, mode)) return true;
             }
-            curnode += curnode->childindex(nearidx);
-            tmax = min(tmax, nearsplit);
-            continue;
         }
-        if(stacksize <= 0) return false;
+        if(stacksize <= 0) return hit;
         traversestate &restore = stack[--stacksize];
-        curnode = restore.node;
-        tmin = restore.tmin;
-        tmax = restore.tmax;
+        cur = restore.child;
+        curnear = restore.tnear;
     }
 }
 
-inline bool BIH::traverse(const vec &o, const vec &ray, float maxdist, float &dist, int mode)
+/// Returns the closest hit within maxdist, or any hit for RAY_SHADOW rays.
+bool BIH::traverse(const vec &o, const vec &ray, float maxdist, float &dist, int mode)
 {
     vec invray(ray.x ? 1/ray.x : 1e16f, ray.y ? 1/ray.y : 1e16f, ray.z ? 1/ray.z : 1e16f);
+    bool hit = false;
     loopi(nummeshes)
     {
         mesh &m = meshes[i];
@@ -153,99 +170,191 @@ inline bool BIH::traverse(const vec &o, const vec &ray, float maxdist, float &di
         t2 = (m.bbmax.z - o.z)*invray.z;
         if(invray.z > 0) { tmin = max(tmin, t1); tmax = min(tmax, t2); } else { tmin = max(tmin, t2); tmax = min(tmax, t1); }
         tmax = min(tmax, maxdist);
-        if(tmin < tmax && traverse(m, o, ray, invray, maxdist, dist, mode, m.nodes, tmin, tmax)) return true;
+        if(tmin < tmax && traverse(m, o, ray, invray, maxdist, dist, mode, 0, tmin, tmax))
+        {
+            if(mode&RAY_SHADOW) return true;
+            hit = true;
+            maxdist = dist;
+        }
     }
-    return false;
+    return hit;
 }
 
-void BIH::build(mesh &m, ushort *indices, int numindices, const ivec &vmin, const ivec &vmax)
+static inline float bbarea(const vec &bbmin, const vec &bbmax)
 {
-    int axis = 2;
-    loopk(2) if(vmax[k] - vmin[k] > vmax[axis] - vmin[axis]) axis = k;
+    vec e = vec(bbmax).sub(bbmin);
+    return e.x*e.y + e.y*e.z + e.z*e.x;
+}
 
-    ivec leftmin, leftmax, rightmin, rightmax;
-    int splitleft, splitright;
-    int left, right;
-    loopk(3)
+static void calcbounds(const BIH::mesh &m, const ushort *indices, int numindices, vec &bbmin, vec &bbmax)
+{
+    bbmin = vec(FLT_MAX, FLT_MAX, FLT_MAX);
+    bbmax = vec(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    loopi(numindices)
     {
-        leftmin = rightmin = ivec(INT_MAX, INT_MAX, INT_MAX);
-        leftmax = rightmax = ivec(INT_MIN, INT_MIN, INT_MIN);
-        int split = (vmax[axis] + vmin[axis])/2;
-        for(left = 0, right = numindices, splitleft = SHRT_MIN, splitright = SHRT_MAX; left < right;)
+        const BIH::tribb &bb = m.tribbs[indices[i]];
+        bbmin.min(bb.bbmin);
+        bbmax.max(bb.bbmax);
+    }
+}
+
+enum { SAH_BINS = 16, SAH_MAXDEPTH = 48 };
+
+/// Partitions the triangles into two halves using the binned surface area heuristic and returns the size of the left one.
+int BIH::splitsah(const mesh &m, ushort *indices, int numindices, int depth)
+{
+    vec cmin(FLT_MAX, FLT_MAX, FLT_MAX), cmax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    loopi(numindices)
+    {
+        vec c = m.tribbs[indices[i]].center();
+        cmin.min(c);
+        cmax.max(c);
+    }
+
+    int bestaxis = -1, bestsplit = 0;
+    float bestcost = FLT_MAX;
+    // degenerate SAH splits can get arbitrarily deep, so just cut at the median below a certain depth
+    if(depth < SAH_MAXDEPTH) loopk(3)
+    {
+        float extent = cmax[k] - cmin[k];
+        if(extent <= 0) continue;
+        float binscale = SAH_BINS/extent;
+        int counts[SAH_BINS];
+        vec binmin[SAH_BINS], binmax[SAH_BINS];
+        loopi(SAH_BINS)
         {
-            const tribb &tri = m.tribbs[indices[left]];
-            ivec trimin = ivec(tri.center).sub(ivec(tri.radius)),
-                 trimax = ivec(tri.center).add(ivec(tri.radius));
-            int amin = trimin[axis], amax = trimax[axis];
-            if(max(split - amin, 0) > max(amax - split, 0))
-            {
-                ++left;
-                splitleft = max(splitleft, amax);
-                leftmin.min(trimin);
-                leftmax.max(trimax);
-            }
-            else
+            counts[i] = 0;
+            binmin[i] = vec(FLT_MAX, FLT_MAX, FLT_MAX);
+            binmax[i] = vec(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        }
+        loopi(numindices)
+        {
+            const tribb &bb = m.tribbs[indices[i]];
+            int bin = clamp(int((bb.center()[k] - cmin[k])*binscale), 0, SAH_BINS-1);
+            counts[bin]++;
+            binmin[bin].min(bb.bbmin);
+            binmax[bin].max(bb.bbmax);
+        }
+        float leftarea[SAH_BINS];
+        int leftcount[SAH_BINS];
+        vec lmin(FLT_MAX, FLT_MAX, FLT_MAX), lmax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        int lcount = 0;
+        loopi(SAH_BINS-1)
+        {
+            lcount += counts[i];
+            lmin.min(binmin[i]);
+            lmax.max(binmax[i]);
+            leftcount[i] = lcount;
+            leftarea[i] = lcount ? bbarea(lmin, lmax) : 0;
+        }
+        vec rmin(FLT_MAX, FLT_MAX, FLT_MAX), rmax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        int rcount = 0;
+        for(int i = SAH_BINS-1; i > 0; i--)
+        {
+            rcount += counts[i];
+            rmin.min(binmin[i]);
+            rmax.max(binmax[i]);
+            if(!rcount || !leftcount[i-1]) continue;
+            float cost = leftarea[i-1]*leftcount[i-1] + bbarea(rmin, rmax)*rcount;
+            if(cost < bestcost)
             {
-                --right;
-                swap(indices[left], indices[right]);
-                splitright = min(splitright, amin);
-                rightmin.min(trimin);
-                rightmax.max(trimax);
+                bestcost = cost;
+                bestaxis = k;
+                bestsplit = i;
             }
         }
-        if(left > 0 && right < numindices) break;
-        axis = (axis+1)%3;
     }
 
-    if(!left || right==numindices)
+    if(bestaxis < 0)
     {
-        leftmin = rightmin = ivec(INT_MAX, INT_MAX, INT_MAX);
-        leftmax = rightmax = ivec(INT_MIN, INT_MIN, INT_MIN);
-        left = right = numindices/2;
-        splitleft = SHRT_MIN;
-        splitright = SHRT_MAX;
-        loopi(numindices)
+        int axis = 0;
+        loopk(3) if(cmax[k] - cmin[k] > cmax[axis] - cmin[axis]) axis = k;
+        const tribb *tribbs = m.tribbs;
+        std::nth_element(indices, indices + numindices/2, indices + numindices,
+            [tribbs, axis](ushort a, ushort b) { return tribbs[a].center()[axis] < tribbs[b].center()[axis]; });
+        return numindices/2;
+    }
+
+    float binscale = SAH_BINS/(cmax[bestaxis] - cmin[bestaxis]);
+    int left = 0, right = numindices;
+    while(left < right)
+    {
+        const tribb &bb = m.tribbs[indices[left]];
+        int bin = clamp(int((bb.center()[bestaxis] - cmin[bestaxis])*binscale), 0, SAH_BINS-1);
+        if(bin < bestsplit) ++left;
+        else swap(indices[left], indices[--right]);
+    }
+    return left;
+}
+
+void BIH::buildleaf(mesh &m, node &parent, int which, const ushort *indices, int numindices)
+{
+    int offset = m.numpackets++;
+    tripacket &p = m.packets[offset];
+    memset(&p, 0, sizeof(p));
+    p.numtris = numindices;
+    loopi(numindices)
+    {
+        const tri &t = m.tris[indices[i]];
+        vec a = m.getpos(t.vert[0]), b = m.getpos(t.vert[1]).sub(a), c = m.getpos(t.vert[2]).sub(a);
+        loopk(3)
         {
-            const tribb &tri = m.tribbs[indices[i]];
-            ivec trimin = ivec(tri.center).sub(ivec(tri.radius)),
-                 trimax = ivec(tri.center).add(ivec(tri.radius));
-            if(i < left)
-            {
-                splitleft = max(splitleft, trimax[axis]);
-                leftmin.min(trimin);
-                leftmax.max(trimax);
-            }
-            else
-            {
-                splitright = min(splitright, trimin[axis]);
-                rightmin.min(trimin);
-                rightmax.max(trimax);
-            }
+            p.a[k][i] = a[k];
+            p.b[k][i] = b[k];
+            p.c[k][i] = c[k];
         }
+        p.tris[i] = indices[i];
     }
+    parent.child[which] = node::LEAF | offset;
+}
 
+/// Builds a 4-wide node by repeatedly splitting the child with the largest surface area until all slots are used.
+int BIH::build(mesh &m, ushort *indices, int numindices, int depth)
+{
     int offset = m.numnodes++;
-    node &curnode = m.nodes[offset];
-    curnode.split[0] = short(splitleft);
-    curnode.split[1] = short(splitright);
 
-    if(left==1) curnode.child[0] = (axis<<14) | indices[0];
-    else
+    int start[NODE_WIDTH], count[NODE_WIDTH], numchildren = 1;
+    vec cmin[NODE_WIDTH], cmax[NODE_WIDTH];
+    start[0] = 0;
+    count[0] = numindices;
+    calcbounds(m, indices, numindices, cmin[0], cmax[0]);
+    while(numchildren < NODE_WIDTH)
     {
-        curnode.child[0] = (axis<<14) | (m.numnodes - offset);
-        build(m, indices, left, leftmin, leftmax);
+        int best = -1;
+        float bestarea = -1;
+        loopi(numchildren) if(count[i] > LEAF_TRIS)
+        {
+            float area = bbarea(cmin[i], cmax[i]);
+            if(area > bestarea) { best = i; bestarea = area; }
+        }
+        if(best < 0) break;
+        int left = splitsah(m, &indices[start[best]], count[best], depth);
+        int n = numchildren++;
+        start[n] = start[best] + left;
+        count[n] = count[best] - left;
+        count[best] = left;
+        calcbounds(m, &indices[start[best]], count[best], cmin[best], cmax[best]);
+        calcbounds(m, &indices[start[n]], count[n], cmin[n], cmax[n]);
     }
 
-    if(numindices-right==1) curnode.child[1] = (1<<15) | (left==1 ? 1<<14 : 0) | indices[right];
-    else
+    node &curnode = m.nodes[offset];
+    loopi(NODE_WIDTH)
     {
-        curnode.child[1] = (left==1 ? 1<<14 : 0) | (m.numnodes - offset);
-        build(m, &indices[right], numindices-right, rightmin, rightmax);
+        if(i >= numchildren)
+        {
+            loopk(3) { curnode.bbmin[k][i] = FLT_MAX; curnode.bbmax[k][i] = -FLT_MAX; }
+            curnode.child[i] = node::EMPTY;
+            continue;
+        }
+        loopk(3) { curnode.bbmin[k][i] = cmin[i][k]; curnode.bbmax[k][i] = cmax[i][k]; }
+        if(count[i] <= LEAF_TRIS) buildleaf(m, curnode, i, &indices[start[i]], count[i]);
+        else curnode.child[i] = build(m, &indices[start[i]], count[i], depth+1);
     }
+    return offset;
 }
 
 BIH::BIH(vector<mesh> &buildmeshes)
-  : meshes(nullptr), nummeshes(0), nodes(nullptr), numnodes(0), tribbs(nullptr), numtris(0), bbmin(1e16f, 1e16f, 1e16f), bbmax(-1e16f, -1e16f, -1e16f), center(0, 0, 0), radius(0), entradius(0)
+  : meshes(nullptr), nummeshes(0), nodes(nullptr), numnodes(0), packets(nullptr), numpackets(0), numtris(0), bbmin(1e16f, 1e16f, 1e16f), bbmax(-1e16f, -1e16f, -1e16f), center(0, 0, 0), radius(0), entradius(0)
 {
     if(buildmeshes.empty()) return;
     loopv(buildmeshes) numtris += buildmeshes[i].numtris;
@@ -254,8 +363,7 @@ BIH::BIH(vector<mesh> &buildmeshes)
     nummeshes = buildmeshes.length();
     meshes = new mesh[nummeshes];
     memcpy(meshes, buildmeshes.getbuf(), sizeof(mesh)*buildmeshes.length());
-    tribbs = new tribb[numtris];
-    tribb *dsttri = tribbs;
+    tribb *tribbs = new tribb[numtris], *dsttri = tribbs;
     loopi(nummeshes)
     {
         mesh &m = meshes[i];
@@ -272,14 +380,11 @@ BIH::BIH(vector<mesh> &buildmeshes)
         loopj(m.numtris)
         {
             vec s0 = m.getpos(srctri->vert[0]), s1 = m.getpos(srctri->vert[1]), s2 = m.getpos(srctri->vert[2]),
-                v0 = m.xform.transform(s0), v1 = m.xform.transform(s1), v2 = m.xform.transform(s2),
-                vmin = vec(v0).min(v1).min(v2),
-                vmax = vec(v0).max(v1).max(v2);
-            mmin.min(vmin);
-            mmax.max(vmax);
-            ivec imin = ivec::floor(vmin), imax = ivec::ceil(vmax);
-            dsttri->center = svec(ivec(imin).add(imax).div(2));
-            dsttri->radius = svec(ivec(imax).sub(imin).add(1).div(2));
+                v0 = m.xform.transform(s0), v1 = m.xform.transform(s1), v2 = m.xform.transform(s2);
+            dsttri->bbmin = vec(v0).min(v1).min(v2);
+            dsttri->bbmax = vec(v0).max(v1).max(v2);
+            mmin.min(dsttri->bbmin);
+            mmax.max(dsttri->bbmax);
             ++srctri;
             ++dsttri;
         }
@@ -293,26 +398,47 @@ BIH::BIH(vector<mesh> &buildmeshes)
     radius = vec(bbmax).sub(bbmin).mul(0.5f).magnitude();
     entradius = max(bbmin.squaredlen(), bbmax.squaredlen());
 
-    nodes = new node[numtris];
-    node *curnode = nodes;
+    // every node but a lone root has at least two children, so neither array can outgrow the triangle count
+    node *buildnodes = new node[numtris];
+    tripacket *buildpackets = new tripacket[numtris];
     ushort *indices = new ushort[numtris];
     loopi(nummeshes)
     {
         mesh &m = meshes[i];
-        m.nodes = curnode;
+        m.nodes = &buildnodes[numnodes];
+        m.packets = &buildpackets[numpackets];
         loopj(m.numtris) indices[j] = j;
-        build(m, indices, m.numtris, ivec::floor(m.bbmin), ivec::ceil(m.bbmax));
-        curnode += m.numnodes;
+        build(m, indices, m.numtris);
+        numnodes += m.numnodes;
+        numpackets += m.numpackets;
+        m.tribbs = nullptr;
     }
     delete[] indices;
-    numnodes = int(curnode - nodes);
+    delete[] tribbs;
+
+    nodes = new node[numnodes];
+    memcpy(nodes, buildnodes, numnodes*sizeof(node));
+    packets = new tripacket[numpackets];
+    memcpy(packets, buildpackets, numpackets*sizeof(tripacket));
+    delete[] buildnodes;
+    delete[] buildpackets;
+    node *curnode = nodes;
+    tripacket *curpacket = packets;
+    loopi(nummeshes)
+    {
+        mesh &m = meshes[i];
+        m.nodes = curnode;
+        m.packets = curpacket;
+        curnode += m.numnodes;
+        curpacket += m.numpackets;
+    }
 }
 
 BIH::~BIH()
 {
     delete[] meshes;
     delete[] nodes;
-    delete[] tribbs;
+    delete[] packets;
 }
 
 bool mmintersect(const extentity &e, const vec &o, const vec &ray, float maxdist, int mode, float &dist)
@@ -329,7 +455,7 @@ bool mmintersect(const extentity &e, const vec &o, const vec &ray, float maxdist
     float v = mo.dot(mray), inside = m->bih->entradius - mo.squaredlen();
     if((inside < 0 && v > 0) || inside + v*v < 0) return false;
     int yaw = e.attr1;
-    if(yaw != 0) 
+    if(yaw != 0)
     {
         const vec2 &rot = sincosmod360(-yaw);
         mo.rotate_around_z(rot);
@@ -338,3 +464,32 @@ bool mmintersect(const extentity &e, const vec &o, const vec &ray, float maxdist
     return m->bih->traverse(mo, mray, maxdist ? maxdist : 1e16f, dist, mode);
 }
 
+/// Shoots deterministic rays at every loaded mapmodel and reports the traversal throughput.
+void bihbench(int *numrays)
+{
+    int rays = *numrays > 0 ? *numrays : 10000, nummodels = 0, numtris = 0, hits = 0, shadowhits = 0;
+    uint seed = 1;
+    auto benchrnd = [&seed]() { seed = seed*1103515245U + 12345U; return ((seed>>8)&0xFFFF)/float(0xFFFF); };
+    Uint32 elapsed = 0;
+    for(int i = 0; getmminfo(i); i++)
+    {
+        model *m = loadmapmodel(i);
+        if(!m || (!m->bih && !m->setBIH()) || !m->bih->numtris) continue;
+        BIH *b = m->bih;
+        nummodels++;
+        numtris += b->numtris;
+        Uint32 start = SDL_GetTicks();
+        loopj(rays)
+        {
+            vec o = vec(benchrnd()*2-1, benchrnd()*2-1, benchrnd()*2-1).rescale(2*b->radius).add(b->center),
+                target = vec(benchrnd(), benchrnd(), benchrnd()).mul(vec(b->bbmax).sub(b->bbmin)).add(b->bbmin),
+                ray = target.sub(o).normalize();
+            float dist;
+            if(b->traverse(o, ray, 1e16f, dist, RAY_POLY)) hits++;
+            if(b->traverse(o, ray, 1e16f, dist, RAY_ALPHAPOLY|RAY_SHADOW)) shadowhits++;
+        }
+        elapsed += SDL_GetTicks() - start;
+    }
+    Log.std->info("bihbench: {} mapmodels ({} tris), {} rays each: {} ms, {} hits, {} shadow hits", nummodels, numtris, 2*rays, elapsed, hits, shadowhits);
+}
+COMMAND(bihbench, "i");
@@ -1,39 +1,30 @@
-// bih.h - Bounding interval hierarchy
-// architecture for high performance ray tracing
-// and k-dimensional trees
+// bih.h - 4-wide bounding volume hierarchy built by the surface area heuristic
+// used for ray tests against mapmodels (collision, shadows, lightmapping).
+// Still called BIH, since it replaced the former bounding interval hierarchy.
 
 #pragma once
 
-#include <stdlib.h>                       // for abs
-
 #include "inexor/shared/cube_types.hpp"   // for ushort, uchar
 #include "inexor/shared/cube_vector.hpp"  // for vector
-#include "inexor/shared/geom.hpp"         // for svec, ivec, ivec::(anonymou...
+#include "inexor/shared/geom.hpp"         // for vec, matrix4x3, matrix3
 
 struct Texture;
 struct extentity;
 
 struct BIH
 {
+    enum { NODE_WIDTH = 4, LEAF_TRIS = 4 };
+
+    /// 4-wide node built by the surface area heuristic.
+    /// The bounds of all children are stored as SoA so they can be tested against a ray at once.
     struct node
     {
-        short split[2];
-        ushort child[2];
-
-        int axis() const
-        {
-            return child[0]>>14;
-        }
-
-        int childindex(int which) const
-        {
-            return child[which]&0x3FFF;
-        }
-
-        bool isleaf(int which) const
-        {
-            return (child[1]&(1<<(14+which)))!=0;
-        }
+        enum { EMPTY = 0xFFFFFFFFU, LEAF = 1U<<31 };
+
+        float bbmin[3][NODE_WIDTH], bbmax[3][NODE_WIDTH];
+        uint child[NODE_WIDTH]; ///< node index, LEAF|packet index or EMPTY
+
+        bool isunused(int which) const { return child[which]==EMPTY; }
     };
 
     struct tri
@@ -41,16 +32,20 @@ struct BIH
         ushort vert[3];
     };
 
+    /// Up to LEAF_TRIS triangles in model space which get intersected together.
+    /// Unused lanes have degenerate (zero) edges and never hit.
+    struct tripacket
+    {
+        float a[3][LEAF_TRIS], b[3][LEAF_TRIS], c[3][LEAF_TRIS]; ///< first vertex and the two edges from it
+        ushort tris[LEAF_TRIS];
+        int numtris;
+    };
+
     struct tribb
     {
-        svec center, radius;
-
-        bool outside(const ivec &bo, const ivec &br) const
-        {
-            return abs(bo.x - center.x) > br.x + radius.x ||
-                   abs(bo.y - center.y) > br.y + radius.y ||
-                   abs(bo.z - center.z) > br.z + radius.z;
-        }
+        vec bbmin, bbmax;
+
+        vec center() const { return vec(bbmin).add(bbmax).mul(0.5f); }
     };
 
     enum { MESH_NOCLIP = 1<<0, MESH_ALPHA = 1<<1, MESH_CULLFACE = 1<<2 };
@@ -62,8 +57,10 @@ struct BIH
         float scale, invscale;
         node *nodes;
         int numnodes;
+        tripacket *packets;
+        int numpackets;
         const tri *tris;
-        const tribb *tribbs;
+        const tribb *tribbs; ///< only set while the tree gets built
         int numtris;
         const uchar *pos, *tc;
         int posstride, tcstride;
@@ -71,7 +68,7 @@ struct BIH
         int flags;
         vec bbmin, bbmax;
 
-        mesh() : numnodes(0), numtris(0), tex(nullptr), flags(0) {}
+        mesh() : numnodes(0), numpackets(0), tribbs(nullptr), numtris(0), tex(nullptr), flags(0) {}
 
         vec getpos(int i) const { return *(const vec *)(pos + i*posstride); }
         vec2 gettc(int i) const { return *(const vec2 *)(tc + i*tcstride); }
@@ -81,7 +78,8 @@ struct BIH
     int nummeshes;
     node *nodes;
     int numnodes;
-    tribb *tribbs;
+    tripacket *packets;
+    int numpackets;
     int numtris;
     vec bbmin, bbmax, center;
     float radius, entradius;
@@ -90,14 +88,14 @@ struct BIH
 
     ~BIH();
 
-    void build(mesh &m, ushort *indices, int numindices, const ivec &vmin, const ivec &vmax);
+    int build(mesh &m, ushort *indices, int numindices, int depth = 0);
+    void buildleaf(mesh &m, node &parent, int which, const ushort *indices, int numindices);
+    int splitsah(const mesh &m, ushort *indices, int numindices, int depth);
 
     bool traverse(const vec &o, const vec &ray, float maxdist, float &dist, int mode);
-    bool traverse(const mesh &m, const vec &o, const vec &ray, const vec &invray, float maxdist, float &dist, int mode, node *curnode, float tmin, float tmax);
-    bool triintersect(const mesh &m, int tidx, const vec &mo, const vec &mray, float maxdist, float &dist, int mode);
-    
-    void preload();
+    bool traverse(const mesh &m, const vec &o, const vec &ray, const vec &invray, float maxdist, float &dist, int mode, uint root, float tmin, float tmax);
+    bool packetintersect(const mesh &m, const tripacket &p, const vec &mo, const vec &mray, float maxdist, float &dist, int mode);
+    bool alphatest(const mesh &m, int tidx, float u, float v);
 };
 
 extern bool mmintersect(const extentity &e, const vec &o, const vec &ray, float maxdist, int mode, float &dist);
-
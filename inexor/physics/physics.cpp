@@ -8,8 +8,11 @@
 #include <stdio.h>                                    // for printf, NULL
 #include <string.h>                                   // for memset
 #include <algorithm>                                  // for min, max
+#include <atomic>                                     // for atomic
 #include <memory>                                     // for __shared_ptr
 
+#include "SDL_timer.h"                                // for SDL_GetTicks
+
 #include "inexor/engine/material.hpp"                 // for ::MATF_VOLUME
 #include "inexor/engine/octa.hpp"                     // for insideworld
 #include "inexor/engine/octree.hpp"                   // for clipplanes, cube
@@ -27,6 +30,7 @@
 #include "inexor/physics/bih.hpp"                     // for mmintersect
 #include "inexor/physics/mpr.hpp"                     // for EntOBB, EntCapsule
 #include "inexor/physics/physics.hpp"
+#include "inexor/shared/broadphase.hpp"               // for spatialhash
 #include "inexor/shared/command.hpp"                  // for ICOMMAND, FVAR
 #include "inexor/shared/cube_loops.hpp"               // for i, loopi, loopv
 #include "inexor/shared/cube_types.hpp"               // for uint, RAD, ushort
@@ -34,32 +38,91 @@
 #include "inexor/shared/ents.hpp"                     // for physent, dynent
 #include "inexor/shared/geom.hpp"                     // for vec, vec::(anon...
 #include "inexor/shared/tools.hpp"                    // for min, max, rnd
+#include "inexor/util/jobs.hpp"                       // for jobs
 #include "inexor/util/legacy_time.hpp"                // for scaletime, last...
 
 const int MAXCLIPPLANES = 1024;
-static clipplanes clipcache[MAXCLIPPLANES];
-static int clipcacheversion = -2;
 
-static inline clipplanes &getclipplanes(const cube &c, const ivec &o, int size, bool collide = true, int offset = 0)
+/// Bumped by resetclipplanes() whenever the geometry changed, every clip cache drops its planes when it sees a new value.
+static std::atomic<int> clipgeneration(0);
+
+/// A direct mapped cache of the clip planes of the cubes recently used in collision and ray queries.
+/// A cache may only be used by one thread at a time, but any number of caches can be used concurrently,
+/// the octree itself is only read.
+struct clipcache
 {
-    clipplanes &p = clipcache[int(&c - worldroot)&(MAXCLIPPLANES-1)];
-    if(p.owner != &c || p.version != clipcacheversion+offset) 
+    clipplanes planes[MAXCLIPPLANES];
+    int version, generation;
+
+    clipcache() : version(0), generation(-1) { memset(planes, 0, sizeof(planes)); }
+
+    /// Invalidate all entries (without touching them unless the version wraps).
+    void reset()
     {
-        p.owner = &c;
-        p.version = clipcacheversion+offset;
-        genclipplanes(c, o, size, p, collide);
+        version += 2;
+        if(version <= 0)
+        {
+            memset(planes, 0, sizeof(planes));
+            version = 2;
+        }
     }
-    return p;
+
+    /// Called once at the start of every query, so no lookup sees planes from before the last geometry change.
+    clipcache &sync()
+    {
+        int cur = clipgeneration.load(std::memory_order_acquire);
+        if(cur != generation)
+        {
+            generation = cur;
+            reset();
+        }
+        return *this;
+    }
+
+    /// Ray queries and collision use different planes for the same cube, which is what offset tells apart.
+    clipplanes &get(const cube &c, const ivec &o, int size, bool collide = true, int offset = 0)
+    {
+        clipplanes &p = planes[int(&c - worldroot)&(MAXCLIPPLANES-1)];
+        if(p.owner != &c || p.version != version+offset)
+        {
+            p.owner = &c;
+            p.version = version+offset;
+            genclipplanes(c, o, size, p, collide);
+        }
+        return p;
+    }
+};
+
+clipcache *newclipcache() { return new clipcache; }
+
+void freeclipcache(clipcache *&cache) { DELETEP(cache); }
+
+void resetclipcache(clipcache *cache) { cache->reset(); }
+
+/// The cache used by the query functions which take no explicit one.
+/// Every thread gets its own, so physics can step bodies in parallel without any locking.
+static clipcache &threadclipcache()
+{
+    static thread_local struct threadcache
+    {
+        clipcache *cache;
+
+        threadcache() : cache(nullptr) {}
+        ~threadcache() { DELETEP(cache); }
+    } cur;
+    if(!cur.cache) cur.cache = new clipcache;
+    return cur.cache->sync();
 }
 
+/// Must only be called while no other thread runs queries, since the octree changed anyway.
 void resetclipplanes()
 {
-    clipcacheversion += 2;
-    if(!clipcacheversion)
-    {
-        memset(clipcache, 0, sizeof(clipcache));
-        clipcacheversion = 2;
-    }
+    clipgeneration.fetch_add(1, std::memory_order_release);
+}
+
+int geometrygeneration()
+{
+    return clipgeneration.load(std::memory_order_acquire);
 }
 
 /////////////////////////  ray - cube collision ///////////////////////////////////////////////
@@ -129,7 +192,7 @@ bool pointincube(const clipplanes &p, const vec &v)
          else if(v[i] < p.o[i]-p.r[i] || v[i] > p.o[i]+p.r[i]) exit; \
     }
 
-vec hitsurface;
+static thread_local vec hitsurface;
 
 static inline bool raycubeintersect(const clipplanes &p, const cube &c, const vec &v, const vec &ray, const vec &invray, float &dist)
 {
@@ -144,8 +207,8 @@ static inline bool raycubeintersect(const clipplanes &p, const cube &c, const ve
 }
 
 extern void entselectionbox(const entity &e, vec &eo, vec &es);
-float hitentdist;
-int hitent, hitorient;
+static thread_local float hitentdist;
+static thread_local int hitent, hitorient;
 
 static float disttoent(octaentities *oc, const vec &o, const vec &ray, float radius, int mode, extentity *t)
 {
@@ -299,10 +362,12 @@ static float shadowent(octaentities *oc, const vec &o, const vec &ray, float rad
             diff >>= 1; \
         } while(diff);
 
-float raycube(const vec &o, const vec &ray, float radius, int mode, int size, extentity *t)
+float raycube(clipcache *cache, const vec &o, const vec &ray, float radius, int mode, int size, extentity *t)
 {
     if(ray.iszero()) return 0;
 
+    clipcache &cc = cache->sync();
+
     INITRAYCUBE;
     CHECKINSIDEWORLD;
 
@@ -329,7 +394,7 @@ float raycube(const vec &o, const vec &ray, float radius, int mode, int size, ex
 
         if(!isempty(c))
         {
-            const clipplanes &p = getclipplanes(c, lo, lsize, false, 1);
+            const clipplanes &p = cc.get(c, lo, lsize, false, 1);
             float f = 0;
             if(raycubeintersect(p, c, v, ray, invray, f) && (dist+f>0 || !(mode&RAY_SKIPFIRST)))
                 return min(dent, dist+f);
@@ -343,64 +408,16 @@ float raycube(const vec &o, const vec &ray, float radius, int mode, int size, ex
     }
 }
 
-// optimized version for lightmap shadowing... every cycle here counts!!!
-float shadowray(const vec &o, const vec &ray, float radius, int mode, extentity *t)
+float raycube(const vec &o, const vec &ray, float radius, int mode, int size, extentity *t)
 {
-    INITRAYCUBE;
-    CHECKINSIDEWORLD;
-
-    int side = O_BOTTOM, x = int(v.x), y = int(v.y), z = int(v.z);
-    for(;;)
-    {
-        DOWNOCTREE(shadowent, );
-
-        cube &c = *lc;
-        ivec lo(x&(~0<<lshift), y&(~0<<lshift), z&(~0<<lshift));
-
-        if(!isempty(c) && !(c.material&MAT_ALPHA))
-        {
-            if(isentirelysolid(c)) return c.texture[side]==DEFAULT_SKY && mode&RAY_SKIPSKY ? radius : dist;
-            const clipplanes &p = getclipplanes(c, lo, 1<<lshift, false, 1);
-            INTERSECTPLANES(side = p.side[i], goto nextcube);
-            INTERSECTBOX(side = (i<<1) + 1 - lsizemask[i], goto nextcube);
-            if(exitdist >= 0) return c.texture[side]==DEFAULT_SKY && mode&RAY_SKIPSKY ? radius : dist+max(enterdist+0.1f, 0.0f);
-        }
-
-    nextcube:
-        FINDCLOSEST(side = O_RIGHT - lsizemask.x, side = O_FRONT - lsizemask.y, side = O_TOP - lsizemask.z);
-
-        if(dist>=radius) return dist;
-
-        UPOCTREE(return radius);
-    }
+    return raycube(&threadclipcache(), o, ray, radius, mode, size, t);
 }
 
-// thread safe version
-
-struct ShadowRayCache
+// optimized version for lightmap shadowing... every cycle here counts!!!
+float shadowray(clipcache *cache, const vec &o, const vec &ray, float radius, int mode, extentity *t)
 {
-    clipplanes clipcache[MAXCLIPPLANES];
-    int version;
-
-    ShadowRayCache() : version(-1) {}
-};
-
-ShadowRayCache *newshadowraycache() { return new ShadowRayCache; }
+    clipcache &cc = cache->sync();
 
-void freeshadowraycache(ShadowRayCache *&cache) { delete cache; cache = nullptr; }
-
-void resetshadowraycache(ShadowRayCache *cache) 
-{ 
-    cache->version++;
-    if(!cache->version)
-    {
-        memset(cache->clipcache, 0, sizeof(cache->clipcache));
-        cache->version = 1;
-    }
-}
-
-float shadowray(ShadowRayCache *cache, const vec &o, const vec &ray, float radius, int mode, extentity *t)
-{
     INITRAYCUBE;
     CHECKINSIDEWORLD;
 
@@ -415,8 +432,7 @@ float shadowray(ShadowRayCache *cache, const vec &o, const vec &ray, float radiu
         if(!isempty(c) && !(c.material&MAT_ALPHA))
         {
             if(isentirelysolid(c)) return c.texture[side]==DEFAULT_SKY && mode&RAY_SKIPSKY ? radius : dist;
-            clipplanes &p = cache->clipcache[int(&c - worldroot)&(MAXCLIPPLANES-1)];
-            if(p.owner != &c || p.version != cache->version) { p.owner = &c; p.version = cache->version; genclipplanes(c, lo, 1<<lshift, p, false); }
+            const clipplanes &p = cc.get(c, lo, 1<<lshift, false, 1);
             INTERSECTPLANES(side = p.side[i], goto nextcube);
             INTERSECTBOX(side = (i<<1) + 1 - lsizemask[i], goto nextcube);
             if(exitdist >= 0) return c.texture[side]==DEFAULT_SKY && mode&RAY_SKIPSKY ? radius : dist+max(enterdist+0.1f, 0.0f);
@@ -431,6 +447,11 @@ float shadowray(ShadowRayCache *cache, const vec &o, const vec &ray, float radiu
     }
 }
 
+float shadowray(const vec &o, const vec &ray, float radius, int mode, extentity *t)
+{
+    return shadowray(&threadclipcache(), o, ray, radius, mode, t);
+}
+
 float rayent(const vec &o, const vec &ray, float radius, int mode, int size, int &orient, int &ent)
 {
     hitent = -1;
@@ -479,11 +500,12 @@ float rayfloor(const vec &o, vec &floor, int mode, float radius)
 /////////////////////////  entity collision  ///////////////////////////////////////////////
 
 // info about collisions
-bool collideinside; // whether an internal collision happened
-physent *collideplayer; // whether the collection hit a player
-vec collidewall; // just the normal vectors.
+// info about collisions, per thread so bodies can be moved in parallel (see moveplayers())
+thread_local bool collideinside; // whether an internal collision happened
+thread_local physent *collideplayer; // whether the collection hit a player
+thread_local vec collidewall; // just the normal vectors.
 
-const float STAIRHEIGHT = 4.1f;
+extern const float STAIRHEIGHT = 4.1f;
 const float FLOORZ = 0.867f;
 const float SLOPEZ = 0.5f;
 const float WALLZ = 0.2f;
@@ -584,75 +606,146 @@ bool ellipsecollide(physent *d, const vec &dir, const vec &o, const vec &center,
     return false;
 }
 
-#define DYNENTCACHESIZE 1024
+static spatialhash<physent> dynentgrid;
+static bool dynentgriddirty = true, dynentgridfrozen = false;
+
+/// Game callbacks raised while moving a body, see moveplayers().
+struct physevent
+{
+    enum { TRIGGER = 0, SUICIDE, COLLIDE };
+
+    int type;
+    physent *d, *o;
+    vec dir;
+    bool local;
+    int floorlevel, waterlevel, material;
+};
+
+/// While a batch is stepped on several threads the game callbacks are queued here and run afterwards on the main thread.
+static thread_local vector<physevent> *physevents = nullptr;
+static bool dropphysevents = false;
 
-static uint dynentframe = 0;
+static void physicstrigger(physent *d, bool local, int floorlevel, int waterlevel, int material = 0)
+{
+    if(dropphysevents) return;
+    if(!physevents) { game::physicstrigger(d, local, floorlevel, waterlevel, material); return; }
+    physevent &e = physevents->add();
+    e.type = physevent::TRIGGER;
+    e.d = d;
+    e.local = local;
+    e.floorlevel = floorlevel;
+    e.waterlevel = waterlevel;
+    e.material = material;
+}
 
-static struct dynentcacheentry
+static void physsuicide(physent *d)
 {
-    int x, y;
-    uint frame;
-    vector<physent *> dynents;
-} dynentcache[DYNENTCACHESIZE];
+    if(dropphysevents) return;
+    if(!physevents) { game::suicide(d); return; }
+    physevent &e = physevents->add();
+    e.type = physevent::SUICIDE;
+    e.d = d;
+}
+
+static void dynentcollide(physent *d, physent *o, const vec &dir)
+{
+    if(dropphysevents) return;
+    if(!physevents) { game::dynentcollide(d, o, dir); return; }
+    physevent &e = physevents->add();
+    e.type = physevent::COLLIDE;
+    e.d = d;
+    e.o = o;
+    e.dir = dir;
+}
 
+static void runphysevents(const vector<physevent> &events)
+{
+    loopv(events)
+    {
+        const physevent &e = events[i];
+        switch(e.type)
+        {
+            case physevent::TRIGGER: physicstrigger(e.d, e.local, e.floorlevel, e.waterlevel, e.material); break;
+            case physevent::SUICIDE: physsuicide(e.d); break;
+            case physevent::COLLIDE: dynentcollide(e.d, e.o, e.dir); break;
+        }
+    }
+}
+
+/// Invalidate the broadphase, it gets rebuilt from game::iterdynents() by the next query.
+/// Needs to be called once per physics frame and whenever dynents are deleted.
 void cleardynentcache()
 {
-    dynentframe++;
-    if(!dynentframe || dynentframe == 1) loopi(DYNENTCACHESIZE) dynentcache[i].frame = 0;
-    if(!dynentframe) dynentframe = 1;
+    dynentgriddirty = true;
 }
 
 VARF(dynentsize, 4, 7, 12, cleardynentcache());
 
-#define DYNENTHASH(x, y) (((((x)^(y))<<5) + (((x)^(y))>>5)) & (DYNENTCACHESIZE - 1))
-
-const vector<physent *> &checkdynentcache(int x, int y)
+static void checkdynentgrid()
 {
-    dynentcacheentry &dec = dynentcache[DYNENTHASH(x, y)];
-    if(dec.x == x && dec.y == y && dec.frame == dynentframe) return dec.dynents;
-    dec.x = x;
-    dec.y = y;
-    dec.frame = dynentframe;
-    dec.dynents.shrink(0);
-    int numdyns = game::numdynents(), dsize = 1<<dynentsize, dx = x<<dynentsize, dy = y<<dynentsize;
+    if(!dynentgriddirty) return;
+    dynentgriddirty = false;
+    if(dynentgrid.cellbits != dynentsize) dynentgrid.setcellbits(dynentsize);
+    else dynentgrid.clear();
+    int numdyns = game::numdynents();
     loopi(numdyns)
     {
         dynent *d = game::iterdynents(i);
-        if(d->state != CS_ALIVE ||
-           d->o.x+d->radius <= dx || d->o.x-d->radius >= dx+dsize ||
-           d->o.y+d->radius <= dy || d->o.y-d->radius >= dy+dsize)
-            continue;
-        dec.dynents.add(d);
+        if(d->state == CS_ALIVE) dynentgrid.add(d, d->o, d->radius);
     }
-    return dec.dynents;
 }
 
-#define loopdynentcache(curx, cury, o, radius) \
-    for(int curx = max(int(o.x-radius), 0)>>dynentsize, endx = min(int(o.x+radius), worldsize-1)>>dynentsize; curx <= endx; curx++) \
-    for(int cury = max(int(o.y-radius), 0)>>dynentsize, endy = min(int(o.y+radius), worldsize-1)>>dynentsize; cury <= endy; cury++)
-
 void updatedynentcache(physent *d)
 {
-    loopdynentcache(x, y, d->o, d->radius)
+    if(dynentgriddirty || dynentgridfrozen) return;
+    if(!dynentgrid.move(d, d->o, d->radius) && d->state == CS_ALIVE && d->type != ENT_CAMERA && d->type != ENT_BOUNCE)
     {
-        dynentcacheentry &dec = dynentcache[DYNENTHASH(x, y)];
-        if(dec.x != x || dec.y != y || dec.frame != dynentframe || dec.dynents.find(d) >= 0) continue;
-        dec.dynents.add(d);
+        // newly (re)spawned entities are not in the grid yet
+        int numdyns = game::numdynents();
+        loopi(numdyns) if(game::iterdynents(i) == d) { dynentgrid.add(d, d->o, d->radius); break; }
     }
 }
 
-bool overlapsdynent(const vec &o, float radius)
+/// Move every dynent to where it is now. Not everything which moves them goes through updatedynentcache(): positions from the network,
+/// respawns and teleports set the position directly. Collisions are fine with that (the mover updates itself before it collides),
+/// but hits are tested right away against everybody, so the weapon queries sync first.
+static void syncdynentgrid()
 {
-    loopdynentcache(x, y, o, radius)
+    if(dynentgriddirty) { checkdynentgrid(); return; }
+    if(dynentgridfrozen) return;
+    int numdyns = game::numdynents();
+    loopi(numdyns)
     {
-        const vector<physent *> &dynents = checkdynentcache(x, y);
-        loopv(dynents)
-        {
-            physent *d = dynents[i];
-            if(o.dist(d->o)-d->radius < radius) return true;
-        }
+        dynent *d = game::iterdynents(i);
+        if(d->state == CS_ALIVE && !dynentgrid.move(d, d->o, d->radius)) dynentgrid.add(d, d->o, d->radius);
     }
-    return false;
+}
+
+void finddynents(const vec &o, float radius, vector<dynent *> &ents)
+{
+    syncdynentgrid();
+    dynentgrid.query(o, radius, [&](physent *d)
+    {
+        if(d->state == CS_ALIVE && !d->o.reject(o, radius + d->radius)) ents.add((dynent *)d);
+        return false;
+    });
+}
+
+void sweepdynents(const vec &from, const vec &to, float radius, vector<dynent *> &ents)
+{
+    syncdynentgrid();
+    vector<physent *> candidates;
+    dynentgrid.sweep(from, to, radius, candidates);
+    loopv(candidates) if(candidates[i]->state == CS_ALIVE) ents.add((dynent *)candidates[i]);
+}
+
+bool overlapsdynent(const vec &o, float radius)
+{
+    checkdynentgrid();
+    return dynentgrid.query(o, radius, [&](physent *d)
+    {
+        return d->state == CS_ALIVE && o.dist(d->o)-d->radius < radius;
+    }) != nullptr;
 }
 
 template<class E, class O>
@@ -674,38 +767,26 @@ static inline bool plcollide(physent *d, const vec &dir, physent *o)
 bool plcollide(physent *d, const vec &dir)    // collide with player or monster
 {
     if(d->type==ENT_CAMERA || d->state!=CS_ALIVE) return false;
-    loopdynentcache(x, y, d->o, d->radius)
+    checkdynentgrid();
+    physent *o = dynentgrid.query(d->o, d->radius, [&](physent *o)
     {
-        const vector<physent *> &dynents = checkdynentcache(x, y);
-        loopv(dynents)
+        if(o==d || o->state!=CS_ALIVE || d->o.reject(o->o, d->radius+o->radius)) return false;
+        switch(d->collidetype)
         {
-            physent *o = dynents[i];
-            if(o==d || d->o.reject(o->o, d->radius+o->radius)) continue;
-            switch(d->collidetype)
-            {
-                case COLLIDE_ELLIPSE:
-                case COLLIDE_ELLIPSE_PRECISE:
-                    if(o->collidetype == COLLIDE_OBB)
-                    {
-                        if(!ellipseboxcollide(d, dir, o->o, vec(0, 0, 0), o->yaw, o->xradius, o->yradius, o->aboveeye, o->eyeheight)) continue;
-                    }
-                    else if(!ellipsecollide(d, dir, o->o, vec(0, 0, 0), o->yaw, o->xradius, o->yradius, o->aboveeye, o->eyeheight)) continue;
-                    break;
-                case COLLIDE_OBB:
-                    if(o->collidetype == COLLIDE_OBB)
-                    {
-                        if(!plcollide<mpr::EntOBB, mpr::EntOBB>(d, dir, o)) continue;
-                    }
-                    else if(!plcollide<mpr::EntOBB, mpr::EntCylinder>(d, dir, o)) continue;
-                    break;
-                default: continue;
-            }
-            collideplayer = o;
-            game::dynentcollide(d, o, collidewall);
-            return true;
+            case COLLIDE_ELLIPSE:
+            case COLLIDE_ELLIPSE_PRECISE:
+                if(o->collidetype == COLLIDE_OBB) return ellipseboxcollide(d, dir, o->o, vec(0, 0, 0), o->yaw, o->xradius, o->yradius, o->aboveeye, o->eyeheight);
+                return ellipsecollide(d, dir, o->o, vec(0, 0, 0), o->yaw, o->xradius, o->yradius, o->aboveeye, o->eyeheight);
+            case COLLIDE_OBB:
+                if(o->collidetype == COLLIDE_OBB) return plcollide<mpr::EntOBB, mpr::EntOBB>(d, dir, o);
+                return plcollide<mpr::EntOBB, mpr::EntCylinder>(d, dir, o);
+            default: return false;
         }
-    }
-    return false;
+    });
+    if(!o) return false;
+    collideplayer = o;
+    dynentcollide(d, o, collidewall);
+    return true;
 }
 
 void rotatebb(vec &center, vec &radius, int yaw)
@@ -842,9 +923,9 @@ static inline bool clampcollide(const clipplanes &p, const E &entvol, const plan
 }
     
 template<class E>
-static bool fuzzycollideplanes(physent *d, const vec &dir, float cutoff, const cube &c, const ivec &co, int size) // collide with deformed cube geometry
+static bool fuzzycollideplanes(clipcache &cc, physent *d, const vec &dir, float cutoff, const cube &c, const ivec &co, int size) // collide with deformed cube geometry
 {
-    const clipplanes &p = getclipplanes(c, co, size);
+    const clipplanes &p = cc.get(c, co, size);
 
     if(fabs(d->o.x - p.o.x) > p.r.x + d->radius || fabs(d->o.y - p.o.y) > p.r.y + d->radius ||
        d->o.z + d->aboveeye < p.o.z - p.r.z || d->o.z - d->eyeheight > p.o.z + p.r.z)
@@ -923,9 +1004,9 @@ static bool cubecollidesolid(physent *d, const vec &dir, float cutoff, const cub
 }
 
 template<class E>
-static bool cubecollideplanes(physent *d, const vec &dir, float cutoff, const cube &c, const ivec &co, int size) // collide with deformed cube geometry
+static bool cubecollideplanes(clipcache &cc, physent *d, const vec &dir, float cutoff, const cube &c, const ivec &co, int size) // collide with deformed cube geometry
 {
-    const clipplanes &p = getclipplanes(c, co, size);
+    const clipplanes &p = cc.get(c, co, size);
 
     if(fabs(d->o.x - p.o.x) > p.r.x + d->radius || fabs(d->o.y - p.o.y) > p.r.y + d->radius ||
        d->o.z + d->aboveeye < p.o.z - p.r.z || d->o.z - d->eyeheight > p.o.z + p.r.z)
@@ -975,24 +1056,24 @@ static bool cubecollideplanes(physent *d, const vec &dir, float cutoff, const cu
     return true;
 }
 
-static inline bool cubecollide(physent *d, const vec &dir, float cutoff, const cube &c, const ivec &co, int size, bool solid)
+static inline bool cubecollide(clipcache &cc, physent *d, const vec &dir, float cutoff, const cube &c, const ivec &co, int size, bool solid)
 {
     switch(d->collidetype)
     {
     case COLLIDE_OBB:
         if(isentirelysolid(c) || solid) return cubecollidesolid<mpr::EntOBB>(d, dir, cutoff, c, co, size);
-        else return cubecollideplanes<mpr::EntOBB>(d, dir, cutoff, c, co, size);
+        else return cubecollideplanes<mpr::EntOBB>(cc, d, dir, cutoff, c, co, size);
     case COLLIDE_ELLIPSE:
         if(isentirelysolid(c) || solid) return fuzzycollidesolid<mpr::EntCapsule>(d, dir, cutoff, c, co, size);
-        else return fuzzycollideplanes<mpr::EntCapsule>(d, dir, cutoff, c, co, size);
+        else return fuzzycollideplanes<mpr::EntCapsule>(cc, d, dir, cutoff, c, co, size);
     case COLLIDE_ELLIPSE_PRECISE:
         if(isentirelysolid(c) || solid) return cubecollidesolid<mpr::EntCapsule>(d, dir, cutoff, c, co, size);
-        else return cubecollideplanes<mpr::EntCapsule>(d, dir, cutoff, c, co, size);
+        else return cubecollideplanes<mpr::EntCapsule>(cc, d, dir, cutoff, c, co, size);
     default: return false;
     }
 }
 
-static inline bool octacollide(physent *d, const vec &dir, float cutoff, const ivec &bo, const ivec &bs, const cube *c, const ivec &cor, int size) // collide with octants
+static inline bool octacollide(clipcache &cc, physent *d, const vec &dir, float cutoff, const ivec &bo, const ivec &bs, const cube *c, const ivec &cor, int size) // collide with octants
 {
     loopoctabox(cor, size, bo, bs)
     {
@@ -1000,7 +1081,7 @@ static inline bool octacollide(physent *d, const vec &dir, float cutoff, const i
         ivec o(i, cor, size);
         if(c[i].children)
         {
-            if(octacollide(d, dir, cutoff, bo, bs, c[i].children, o, size>>1)) return true;
+            if(octacollide(cc, d, dir, cutoff, bo, bs, c[i].children, o, size>>1)) return true;
         }
         else
         {
@@ -1012,18 +1093,18 @@ static inline bool octacollide(physent *d, const vec &dir, float cutoff, const i
                 case MAT_CLIP: if(isclipped(c[i].material&MATF_VOLUME) || d->type<ENT_CAMERA) solid = true; break;
             }
             if(!solid && isempty(c[i])) continue;
-            if(cubecollide(d, dir, cutoff, c[i], o, size, solid)) return true;
+            if(cubecollide(cc, d, dir, cutoff, c[i], o, size, solid)) return true;
         }
     }
     return false;
 }
 
-static inline bool octacollide(physent *d, const vec &dir, float cutoff, const ivec &bo, const ivec &bs)
+static inline bool octacollide(clipcache &cc, physent *d, const vec &dir, float cutoff, const ivec &bo, const ivec &bs)
 {
     int diff = (bo.x^bs.x) | (bo.y^bs.y) | (bo.z^bs.z),
         scale = worldscale-1;
     if(diff&~((1<<scale)-1) || uint(bo.x|bo.y|bo.z|bs.x|bs.y|bs.z) >= uint(worldsize))
-       return octacollide(d, dir, cutoff, bo, bs, worldroot, ivec(0, 0, 0), worldsize>>1);
+       return octacollide(cc, d, dir, cutoff, bo, bs, worldroot, ivec(0, 0, 0), worldsize>>1);
     const cube *c = &worldroot[octastep(bo.x, bo.y, bo.z, scale)];
     if(c->ext && c->ext->ents && mmcollide(d, dir, *c->ext->ents)) return true;
     scale--;
@@ -1033,7 +1114,7 @@ static inline bool octacollide(physent *d, const vec &dir, float cutoff, const i
         if(c->ext && c->ext->ents && mmcollide(d, dir, *c->ext->ents)) return true;
         scale--;
     }
-    if(c->children) return octacollide(d, dir, cutoff, bo, bs, c->children, ivec(bo).mask(~((2<<scale)-1)), 1<<scale);
+    if(c->children) return octacollide(cc, d, dir, cutoff, bo, bs, c->children, ivec(bo).mask(~((2<<scale)-1)), 1<<scale);
     bool solid = false;
     switch(c->material&MATF_CLIP)
     {
@@ -1043,11 +1124,11 @@ static inline bool octacollide(physent *d, const vec &dir, float cutoff, const i
     }
     if(!solid && isempty(*c)) return false;
     int csize = 2<<scale, cmask = ~(csize-1);
-    return cubecollide(d, dir, cutoff, *c, ivec(bo).mask(cmask), csize, solid);
+    return cubecollide(cc, d, dir, cutoff, *c, ivec(bo).mask(cmask), csize, solid);
 }
 
 // all collision happens here
-bool collide(physent *d, const vec &dir, float cutoff, bool playercol)
+bool collide(clipcache *cache, physent *d, const vec &dir, float cutoff, bool playercol)
 {
     collideinside = false;
     collideplayer = nullptr;
@@ -1055,7 +1136,12 @@ bool collide(physent *d, const vec &dir, float cutoff, bool playercol)
     ivec bo(int(d->o.x-d->radius), int(d->o.y-d->radius), int(d->o.z-d->eyeheight)),
          bs(int(d->o.x+d->radius), int(d->o.y+d->radius), int(d->o.z+d->aboveeye));
     bs.add(1);  // guard space for rounding errors
-    return octacollide(d, dir, cutoff, bo, bs) || (playercol && plcollide(d, dir));
+    return octacollide(cache->sync(), d, dir, cutoff, bo, bs) || (playercol && plcollide(d, dir));
+}
+
+bool collide(physent *d, const vec &dir, float cutoff, bool playercol)
+{
+    return collide(&threadclipcache(), d, dir, cutoff, playercol);
 }
 
 void recalcdir(physent *d, const vec &oldvel, vec &dir)
@@ -1609,7 +1695,7 @@ void modifyvelocity(physent *pl, bool local, bool water, bool floating, int curt
             pl->vel.z = max(pl->vel.z, JUMPVEL); // physics impulse upwards
             if(water) { pl->vel.x /= 8.0f; pl->vel.y /= 8.0f; } // dampen velocity change even harder, gives correct water feel
 
-            game::physicstrigger(pl, local, 1, 0);
+            physicstrigger(pl, local, 1, 0);
         }
     }
     if(!floating && pl->physstate == PHYS_FALL) pl->timeinair += curtime;
@@ -1719,7 +1805,7 @@ bool moveplayer(physent *pl, int moveres, bool local, int curtime)
         loopi(moveres) if(!move(pl, d) && ++collisions<5) i--; // discrete steps collision detection & sliding
         if(timeinair > 800 && !pl->timeinair && !water) // if we land after long time must have been a high jump, make thud sound
         {
-            game::physicstrigger(pl, local, -1, 0);
+            physicstrigger(pl, local, -1, 0);
         }
     }
 
@@ -1737,11 +1823,11 @@ bool moveplayer(physent *pl, int moveres, bool local, int curtime)
         material = lookupmaterial(vec(pl->o.x, pl->o.y, pl->o.z + (pl->aboveeye - pl->eyeheight)/2));
         water = isliquid(material&MATF_VOLUME);
     }
-    if(!pl->inwater && water) game::physicstrigger(pl, local, 0, -1, material&MATF_VOLUME);
-    else if(pl->inwater && !water) game::physicstrigger(pl, local, 0, 1, pl->inwater);
+    if(!pl->inwater && water) physicstrigger(pl, local, 0, -1, material&MATF_VOLUME);
+    else if(pl->inwater && !water) physicstrigger(pl, local, 0, 1, pl->inwater);
     pl->inwater = water ? material&MATF_VOLUME : MAT_AIR;
 
-    if(pl->state==CS_ALIVE && (pl->o.z < 0 || material&MAT_DEATH)) game::suicide(pl);
+    if(pl->state==CS_ALIVE && (pl->o.z < 0 || material&MAT_DEATH)) physsuicide(pl);
 
     return true;
 }
@@ -1784,6 +1870,7 @@ void moveplayer(physent *pl, int moveres, bool local)
     }
 
     if(local) pl->o = pl->newpos;
+    if(pl->state==CS_ALIVE) updatedynentcache(pl); // the game may have placed it since the last step
     loopi(physsteps-1) moveplayer(pl, moveres, local, physframetime);
     if(local) pl->deltapos = pl->o;
     moveplayer(pl, moveres, local, physframetime);
@@ -1792,6 +1879,7 @@ void moveplayer(physent *pl, int moveres, bool local)
         pl->newpos = pl->o;
         pl->deltapos.sub(pl->newpos);
         interppos(pl);
+        if(pl->state==CS_ALIVE) updatedynentcache(pl);
     }
 }
 
@@ -1817,6 +1905,324 @@ bool bounce(physent *d, float elasticity, float waterfric, float grav)
     return hitplayer;
 }
 
+/////////////////////////  batched physics  ///////////////////////////////////////////////
+//
+// Bodies which can not touch each other within a physics frame are independent, so we split the batch into islands
+// of bodies whose swept bounds overlap and step the islands on several threads.
+// Inside an island the bodies are stepped in batch order, just like the sequential path does, and the broadphase
+// reports bodies in a fixed order, so the results are bit-identical to calling moveplayer() for each body in turn.
+// While the workers run, the broadphase is frozen with every body covering its swept bounds and the game callbacks
+// are queued per body and run afterwards in batch order.
+
+VARP(physthreads, 0, 0, inexor::util::job_system::MAXWORKERS);
+VAR(physbatchmin, 2, 8, 1024); // smaller batches are not worth waking the workers for
+
+/// upper bound of how far d can get within this physics frame, see moveplayer()
+static float physmovebound(physent *d, int moveres)
+{
+    float secs = physframetime/1000.0f,
+          speed = max(d->vel.magnitude(), d->maxspeed*max(1.3f*1.3f, d==player ? floatspeed/100.0f : 1.0f)) + JUMPVEL,
+          fall = d->falling.magnitude(),
+          dist = 0;
+    loopi(physsteps)
+    {
+        fall += GRAVITY*secs;
+        dist += (speed + fall)*secs;
+    }
+    // every collision may add another sub step, slides and steps only ever shorten the move
+    return dist*(moveres+4)/moveres + STAIRHEIGHT + 1;
+}
+
+struct physbatchbody
+{
+    physent *d;
+    int moveres;
+    bool local;
+    int island;
+    vector<physevent> events;
+};
+
+static vector<physbatchbody> physbodies;
+static vector<int> physislands, physislandstart; // body indices grouped by island, and where each island starts
+
+static int findisland(int i)
+{
+    while(physbodies[i].island != i) i = physbodies[i].island = physbodies[physbodies[i].island].island;
+    return i;
+}
+
+static void buildislands()
+{
+    static vector<ivec4> bounds;
+    bounds.setsize(0);
+    loopv(physbodies)
+    {
+        physbatchbody &b = physbodies[i];
+        b.island = i;
+        ivec4 &r = bounds.add();
+        if(b.d->state != CS_ALIVE) { r = ivec4(1, 1, 0, 0); continue; } // not in the broadphase, nobody collides with it
+        // it is seen at its current position until its turn comes, then anywhere its move can take it
+        const vec &start = b.local ? b.d->newpos : b.d->o;
+        float reach = b.d->radius + physmovebound(b.d, b.moveres);
+        vec bbmin = vec(start).sub(reach).min(vec(b.d->o).sub(b.d->radius)),
+            bbmax = vec(start).add(reach).max(vec(b.d->o).add(b.d->radius)),
+            center = vec(bbmin).add(bbmax).mul(0.5f);
+        float radius = max(bbmax.x - center.x, bbmax.y - center.y);
+        dynentgrid.move(b.d, center, radius);
+        dynentgrid.cellrange(center, radius, r.x, r.y, r.z, r.w);
+    }
+    loopv(physbodies) if(bounds[i].x <= bounds[i].z) for(int j = i+1; j < physbodies.length(); j++)
+    {
+        const ivec4 &r = bounds[i], &t = bounds[j];
+        if(t.x > t.z || r.z < t.x || r.x > t.z || r.w < t.y || r.y > t.w) continue;
+        int a = findisland(i), b = findisland(j);
+        if(a != b) physbodies[max(a, b)].island = min(a, b);
+    }
+    physislands.setsize(0);
+    physislandstart.setsize(0);
+    loopv(physbodies) if(findisland(i) == i)
+    {
+        physislandstart.add(physislands.length());
+        for(int j = i; j < physbodies.length(); j++) if(findisland(j) == i) physislands.add(j);
+    }
+    physislandstart.add(physislands.length());
+}
+
+static void moveisland(int island)
+{
+    for(int i = physislandstart[island]; i < physislandstart[island+1]; i++)
+    {
+        physbatchbody &b = physbodies[physislands[i]];
+        physevents = &b.events;
+        moveplayer(b.d, b.moveres, b.local);
+    }
+    physevents = nullptr;
+}
+
+void preloadmapmodels()
+{
+    const vector<extentity *> &mapents = entities::getents();
+    loopv(mapents) if(mapents[i]->type == ET_MAPMODEL)
+    {
+        model *m = loadmapmodel(mapents[i]->attr2);
+        // the collision box gets calculated on first use, workers must only read it
+        vec center, radius;
+        if(m) m->collisionbox(center, radius);
+    }
+}
+
+static void moveplayers(physbatchent *ents, int numents, int numthreads)
+{
+    // bring the broadphase up to date first, so no body sees another one at a stale position, no matter in which order they move
+    checkdynentgrid();
+    loopi(numents) if(ents[i].d->state==CS_ALIVE) updatedynentcache(ents[i].d);
+    if(physsteps <= 0 || numthreads <= 1 || numents < physbatchmin)
+    {
+        loopi(numents) moveplayer(ents[i].d, ents[i].moveres, ents[i].local);
+        return;
+    }
+
+    preloadmapmodels();
+
+    physbodies.shrink(0);
+    loopi(numents)
+    {
+        physbatchbody &b = physbodies.add();
+        b.d = ents[i].d;
+        b.moveres = ents[i].moveres;
+        b.local = ents[i].local;
+    }
+    buildislands();
+    dynentgridfrozen = true;
+    inexor::util::jobs().parallel_for(0, physislandstart.length()-1, 1, [](int from, int to)
+    {
+        for(int island = from; island < to; island++) moveisland(island);
+    }, numthreads);
+    dynentgridfrozen = false;
+
+    loopv(physbodies)
+    {
+        physbatchbody &b = physbodies[i];
+        if(b.d->state==CS_ALIVE) updatedynentcache(b.d);
+        runphysevents(b.events);
+    }
+}
+
+void moveplayers(physbatchent *ents, int numents)
+{
+    extern SharedVar<int> numcpus;
+    moveplayers(ents, numents, physthreads > 0 ? physthreads : numcpus);
+}
+
+/// Step all players and bots through the same frame once one by one and once batched and compare the results bit by bit.
+void physbatchtest(int *frames, int *threads)
+{
+    vector<physbatchent> batch;
+    loopi(game::numdynents())
+    {
+        dynent *d = game::iterdynents(i);
+        if(d->type == ENT_PLAYER || d->type == ENT_AI) batch.add(physbatchent(d, 10, true));
+    }
+    if(batch.empty()) { Log.std->info("physbatchtest: no players"); return; }
+    extern SharedVar<int> numcpus;
+    int numframes = max(*frames, 1), numthreads = *threads > 0 ? *threads : max(int(numcpus), 2),
+        oldsteps = physsteps, oldbatchmin = physbatchmin;
+    if(physsteps <= 0) physsteps = 1;
+    physbatchmin = 2;
+    dropphysevents = true;
+
+    vector<physent> start, scalar;
+    loopv(batch) start.add(*batch[i].d);
+    uint scalarmillis = SDL_GetTicks();
+    loopi(numframes)
+    {
+        cleardynentcache();
+        moveplayers(batch.getbuf(), batch.length(), 1);
+        loopvj(batch) scalar.add(*batch[j].d);
+    }
+    scalarmillis = SDL_GetTicks() - scalarmillis;
+
+    loopv(batch) *(physent *)batch[i].d = start[i];
+    int mismatches = 0;
+    uint batchmillis = SDL_GetTicks();
+    loopi(numframes)
+    {
+        cleardynentcache();
+        moveplayers(batch.getbuf(), batch.length(), numthreads);
+        loopvj(batch)
+        {
+            const physent &a = scalar[i*batch.length() + j], &b = *batch[j].d;
+            if(memcmp(&a.o, &b.o, sizeof(vec)) || memcmp(&a.vel, &b.vel, sizeof(vec)) || memcmp(&a.falling, &b.falling, sizeof(vec)) ||
+               memcmp(&a.floor, &b.floor, sizeof(vec)) || memcmp(&a.newpos, &b.newpos, sizeof(vec)) || memcmp(&a.deltapos, &b.deltapos, sizeof(vec)) ||
+               memcmp(&a.roll, &b.roll, sizeof(float)) || a.timeinair != b.timeinair || a.physstate != b.physstate ||
+               a.inwater != b.inwater || a.blocked != b.blocked)
+                mismatches++;
+        }
+    }
+    batchmillis = SDL_GetTicks() - batchmillis;
+
+    loopv(batch) *(physent *)batch[i].d = start[i];
+    cleardynentcache();
+    dropphysevents = false;
+    physsteps = oldsteps;
+    physbatchmin = oldbatchmin;
+    Log.std->info("physbatchtest: {} bodies, {} frames, {} islands: {} mismatches, sequential {} ms, batched on {} threads {} ms",
+                  batch.length(), numframes, physislandstart.length()-1, mismatches, scalarmillis, numthreads, batchmillis);
+}
+COMMAND(physbatchtest, "ii");
+
+/// One random probe of the clip cache stress test and what the queries returned for it.
+struct clipprobe
+{
+    vec o, ray;
+};
+
+struct clipresult
+{
+    float raydist, shadowdist;
+    bool collided;
+    vec wall;
+};
+
+struct clipstressworker
+{
+    const vector<clipprobe> *probes;
+    int rounds;
+    clipcache *cache; ///< nullptr: use the thread's own cache
+    vector<clipresult> results;
+};
+
+static void runclipprobes(clipstressworker &w)
+{
+    physent d;
+    d.type = ENT_BOUNCE;
+    d.collidetype = COLLIDE_ELLIPSE;
+    d.radius = d.xradius = d.yradius = 4;
+    d.eyeheight = 14;
+    d.aboveeye = 1;
+    w.results.setsize(0);
+    loopj(w.rounds) loopv(*w.probes)
+    {
+        const clipprobe &p = (*w.probes)[i];
+        clipresult &r = w.results.add();
+        d.o = p.o;
+        if(w.cache)
+        {
+            r.raydist = raycube(w.cache, p.o, p.ray, 0, RAY_CLIPMAT|RAY_POLY);
+            r.shadowdist = shadowray(w.cache, p.o, p.ray, 1e16f, RAY_SHADOW|RAY_POLY);
+            r.collided = collide(w.cache, &d, p.ray, 0, false);
+        }
+        else
+        {
+            r.raydist = raycube(p.o, p.ray, 0, RAY_CLIPMAT|RAY_POLY);
+            r.shadowdist = shadowray(p.o, p.ray, 1e16f, RAY_SHADOW|RAY_POLY);
+            r.collided = collide(&d, p.ray, 0, false);
+        }
+        r.wall = collidewall;
+    }
+}
+
+/// Run the same random ray and collision queries against the loaded map on the main thread and on many threads at once,
+/// half of them with their own explicit cache and half with the implicit per thread one, and compare all results.
+void clipstresstest(int *threads, int *queries, int *rounds)
+{
+    extern SharedVar<int> numcpus;
+    int numthreads = *threads > 0 ? *threads : max(int(numcpus), 2), numqueries = *queries > 0 ? *queries : 10000, numrounds = max(*rounds, 1);
+    preloadmapmodels();
+
+    vector<clipprobe> probes;
+    loopi(numqueries)
+    {
+        clipprobe &p = probes.add();
+        p.o = vec(rndscale(worldsize), rndscale(worldsize), rndscale(worldsize));
+        p.ray = vec(rndscale(2)-1, rndscale(2)-1, rndscale(2)-1);
+        if(p.ray.iszero()) p.ray = vec(0, 0, -1);
+        p.ray.normalize();
+    }
+
+    clipstressworker ref;
+    ref.probes = &probes;
+    ref.rounds = numrounds;
+    ref.cache = newclipcache();
+    uint refmillis = SDL_GetTicks();
+    runclipprobes(ref);
+    refmillis = SDL_GetTicks() - refmillis;
+
+    vector<clipstressworker> workers;
+    workers.growbuf(numthreads); // never reallocate, the tasks hold pointers into it
+    loopi(numthreads)
+    {
+        clipstressworker &w = workers.add();
+        w.probes = &probes;
+        w.rounds = numrounds;
+        w.cache = i&1 ? newclipcache() : nullptr;
+    }
+    uint millis = SDL_GetTicks();
+    inexor::util::jobs().parallel_for(0, workers.length(), 1, [&workers](int from, int to)
+    {
+        for(int i = from; i < to; i++) runclipprobes(workers[i]);
+    }, numthreads);
+    millis = SDL_GetTicks() - millis;
+
+    int mismatches = 0;
+    loopv(workers)
+    {
+        clipstressworker &w = workers[i];
+        loopvj(w.results)
+        {
+            const clipresult &a = ref.results[j], &b = w.results[j];
+            if(memcmp(&a.raydist, &b.raydist, sizeof(float)) || memcmp(&a.shadowdist, &b.shadowdist, sizeof(float)) ||
+               a.collided != b.collided || memcmp(&a.wall, &b.wall, sizeof(vec)))
+                mismatches++;
+        }
+        freeclipcache(w.cache);
+    }
+    freeclipcache(ref.cache);
+    Log.std->info("clipstresstest: {} queries x {} rounds on {} threads: {} mismatches, single thread {} ms, all threads {} ms",
+                  numqueries, numrounds, numthreads, mismatches, refmillis, millis);
+}
+COMMAND(clipstresstest, "iii");
+
 void updatephysstate(physent *d)
 {
     if(d->physstate == PHYS_FALL) return;
@@ -1916,17 +2322,13 @@ bool moveplatform(physent *p, const vec &dir)
 
     static vector<platforment> ents;
     ents.setsize(0);
-    for(int x = int(max(p->o.x-p->radius-PLATFORMBORDER, 0.0f))>>dynentsize, ex = int(min(p->o.x+p->radius+PLATFORMBORDER, worldsize-1.0f))>>dynentsize; x <= ex; x++)
-    for(int y = int(max(p->o.y-p->radius-PLATFORMBORDER, 0.0f))>>dynentsize, ey = int(min(p->o.y+p->radius+PLATFORMBORDER, worldsize-1.0f))>>dynentsize; y <= ey; y++)
+    checkdynentgrid();
+    dynentgrid.query(p->o, p->radius+PLATFORMBORDER, [&](physent *d)
     {
-        const vector<physent *> &dynents = checkdynentcache(x, y);
-        loopv(dynents)
-        {
-            physent *d = dynents[i];
-            if(p==d || d->o.z-d->eyeheight < p->o.z+p->aboveeye || p->o.reject(d->o, p->radius+PLATFORMBORDER+d->radius) || ents.find(d) >= 0) continue;
-            ents.add(d);
-        }
-    }
+        if(p==d || d->o.z-d->eyeheight < p->o.z+p->aboveeye || p->o.reject(d->o, p->radius+PLATFORMBORDER+d->radius)) return false;
+        ents.add(d);
+        return false;
+    });
     static vector<platforment *> passengers, colliders;
     passengers.setsize(0);
     colliders.setsize(0);
@@ -1,6 +1,7 @@
 #pragma once
 
-#include "inexor/shared/geom.hpp"  // for vec
+#include "inexor/shared/cube_vector.hpp"  // for vector
+#include "inexor/shared/geom.hpp"         // for vec
 
 struct clipplanes;
 struct dynent;
@@ -9,34 +10,71 @@ struct extentity;
 struct physent;
 struct vec;
 
+/// The highest step a player walks up without jumping.
+extern const float STAIRHEIGHT;
+extern const float JUMPVEL;
+extern const float GRAVITY;
+
 extern bool pointincube(const clipplanes &p, const vec &v);
 extern bool overlapsdynent(const vec &o, float radius);
 extern void rotatebb(vec &center, vec &radius, int yaw);
-extern float shadowray(const vec &o, const vec &ray, float radius, int mode, extentity *t = nullptr);
-struct ShadowRayCache;
 
-extern ShadowRayCache *newshadowraycache();
-extern void freeshadowraycache(ShadowRayCache *&cache);
-extern void resetshadowraycache(ShadowRayCache *cache);
-extern float shadowray(ShadowRayCache *cache, const vec &o, const vec &ray, float radius, int mode, extentity *t = nullptr);
+/// Collision and ray queries cache the clip planes of the cubes they touched.
+/// The query functions without a cache argument use a cache private to the calling thread,
+/// so they may be called from any thread as long as nobody modifies the world meanwhile.
+/// Pass a cache explicitly if a worker wants to keep its planes across tasks (e.g. one per lightmap worker).
+/// One cache must never be used by two threads at the same time.
+struct clipcache;
+
+extern clipcache *newclipcache();
+extern void freeclipcache(clipcache *&cache);
+/// Drop everything this cache remembers, resetclipplanes() does this for all caches.
+extern void resetclipcache(clipcache *cache);
+
+extern float shadowray(const vec &o, const vec &ray, float radius, int mode, extentity *t = nullptr);
+extern float shadowray(clipcache *cache, const vec &o, const vec &ray, float radius, int mode, extentity *t = nullptr);
 
 enum { RAY_BB = 1, RAY_POLY = 3, RAY_ALPHAPOLY = 7, RAY_ENTS = 9, RAY_CLIPMAT = 16, RAY_SKIPFIRST = 32, RAY_EDITMAT = 64, RAY_SHADOW = 128, RAY_PASS = 256, RAY_SKIPSKY = 512 };
 
 extern float raycube   (const vec &o, const vec &ray,     float radius = 0, int mode = RAY_CLIPMAT, int size = 0, extentity *t = nullptr);
+extern float raycube   (clipcache *cache, const vec &o, const vec &ray, float radius = 0, int mode = RAY_CLIPMAT, int size = 0, extentity *t = nullptr);
 extern float raycubepos(const vec &o, const vec &ray, vec &hit, float radius = 0, int mode = RAY_CLIPMAT, int size = 0);
 extern float rayfloor  (const vec &o, vec &floor, int mode = 0, float radius = 0);
 extern bool  raycubelos(const vec &o, const vec &dest, vec &hitpos);
 
+/// Changes whenever the geometry changed (see resetclipplanes()), so results of ray queries can be kept until then.
+extern int geometrygeneration();
+/// Worker threads must not load models: make sure all mapmodels a collision or ray query might hit are there,
+/// with their collision boxes calculated.
+extern void preloadmapmodels();
 
-extern vec collidewall;
-extern bool collideinside;
-extern physent *collideplayer;
+
+extern thread_local vec collidewall;
+extern thread_local bool collideinside;
+extern thread_local physent *collideplayer;
 
 extern void moveplayer(physent *pl, int moveres, bool local);
 extern bool moveplayer(physent *pl, int moveres, bool local, int curtime);
+
+/// The arguments of one moveplayer() call.
+struct physbatchent
+{
+    physent *d;
+    int moveres;
+    bool local;
+
+    physbatchent() {}
+    physbatchent(physent *d, int moveres, bool local) : d(d), moveres(moveres), local(local) {}
+};
+
+/// Step several bodies through the current physics frame, like calling moveplayer() for each of them in order.
+/// Bodies which can not touch each other are moved in parallel (see physthreads), the results are the same.
+/// The game callbacks (physicstrigger, suicide, dynentcollide) run after all bodies moved.
+extern void moveplayers(physbatchent *ents, int numents);
 extern bool ellipseboxcollide(physent *d, const vec &dir, const vec &o, const vec &center, float yaw, float xr, float yr, float hi, float lo);
 extern bool ellipsecollide(physent *d, const vec &dir, const vec &o, const vec &center, float yaw, float xr, float yr, float hi, float lo);
 extern bool collide(physent *d, const vec &dir = vec(0, 0, 0), float cutoff = 0.0f, bool playercol = true);
+extern bool collide(clipcache *cache, physent *d, const vec &dir = vec(0, 0, 0), float cutoff = 0.0f, bool playercol = true);
 extern bool bounce(physent *d, float secs, float elasticity, float waterfric, float grav);
 extern bool bounce(physent *d, float elasticity, float waterfric, float grav);
 extern void avoidcollision(physent *d, const vec &dir, physent *obstacle, float space);
@@ -51,6 +89,10 @@ extern bool moveplatform(physent *p, const vec &dir);
 extern void updatephysstate(physent *d);
 extern void cleardynentcache();
 extern void updatedynentcache(physent *d);
+/// all living dynents within radius of o (box test, candidates for exact tests), at where they are now
+extern void finddynents(const vec &o, float radius, vector<dynent *> &ents);
+/// all living dynents whose broadphase cells touch the segment from -> to swept by radius, at where they are now
+extern void sweepdynents(const vec &from, const vec &to, float radius, vector<dynent *> &ents);
 extern bool entinmap(dynent *d, bool avoidplayers = false);
 extern void findplayerspawn(dynent *d, int forceent = -1, int tag = 0);
 
@@ -0,0 +1,287 @@
+/// @file broadphase.hpp
+/// Uniform grid broadphase for moving entities (players, bots, movables, ...).
+///
+/// Entities are bucketed into the square cells (of size 1<<cellbits) which their bounding circle overlaps.
+/// Only the horizontal position is used, since our maps are mostly flat compared to their extent.
+/// The cells are stored in an open addressing hash table, so the grid has no bounds and costs nothing for empty space.
+///
+/// Usage: add() all entities once per frame after clear(), call move() whenever one of them changed its position
+/// and remove() before one is deleted. Moving an entity only links it into the cells it newly overlaps,
+/// the stale links into its old cells are skipped by the queries (and dropped on the next clear()).
+/// The queries never modify the grid, so any number of threads may query it concurrently as long as nobody updates it.
+/// This file does not depend on the engine, so both the client and the server can use it.
+
+#pragma once
+
+#include <math.h>                          // for floorf, fabs
+#include <algorithm>                       // for max, min, swap
+
+#include "inexor/shared/cube_hash.hpp"     // for hashtable
+#include "inexor/shared/cube_loops.hpp"    // for loopi
+#include "inexor/shared/cube_sort.hpp"     // for insertionsort
+#include "inexor/shared/cube_types.hpp"    // for uint
+#include "inexor/shared/cube_vector.hpp"   // for vector
+#include "inexor/shared/geom.hpp"          // for vec
+
+template<class T> struct spatialhash
+{
+    struct entkey
+    {
+        T *e;
+
+        entkey(T *e = nullptr) : e(e) {}
+
+        friend uint hthash(const entkey &k) { size_t p = size_t(k.e); return uint(p>>4) ^ uint(p>>20); }
+        friend bool htcmp(const entkey &x, const entkey &y) { return x.e == y.e; }
+    };
+
+    struct proxy
+    {
+        T *ent;
+        int x1, y1, x2, y2; ///< the inclusive cell range this entity overlaps, empty if it was removed
+    };
+
+    struct link
+    {
+        int proxy, next;
+    };
+
+    struct cell
+    {
+        int x, y, first;
+        uint gen;
+    };
+
+    int cellbits;
+    uint gen;
+    int numcells;
+    vector<cell> cells;
+    vector<proxy> proxies;
+    vector<link> links;
+    hashtable<entkey, int> index;
+
+    spatialhash(int cellbits = 7) : cellbits(cellbits), gen(1), numcells(0)
+    {
+        cells.growbuf(1024);
+        cells.advance(1024);
+        loopv(cells) cells[i].gen = 0;
+    }
+
+    /// Forget all entities.
+    void clear()
+    {
+        if(!++gen)
+        {
+            loopv(cells) cells[i].gen = 0;
+            gen = 1;
+        }
+        numcells = 0;
+        proxies.setsize(0);
+        links.setsize(0);
+        index.clear();
+    }
+
+    void setcellbits(int bits)
+    {
+        cellbits = bits;
+        clear();
+    }
+
+    int length() const { return proxies.length(); }
+
+    void cellrange(const vec &o, float radius, int &x1, int &y1, int &x2, int &y2) const
+    {
+        x1 = int(floorf(o.x - radius))>>cellbits;
+        y1 = int(floorf(o.y - radius))>>cellbits;
+        x2 = int(floorf(o.x + radius))>>cellbits;
+        y2 = int(floorf(o.y + radius))>>cellbits;
+    }
+
+    static uint cellhash(int x, int y)
+    {
+        uint h = uint(x)*0x9E3779B1U ^ uint(y)*0x85EBCA77U;
+        return h ^ (h>>15);
+    }
+
+    const cell *findcell(int x, int y) const
+    {
+        int mask = cells.length()-1;
+        for(uint h = cellhash(x, y);; h++)
+        {
+            const cell &c = cells[h&mask];
+            if(c.gen != gen) return nullptr;
+            if(c.x == x && c.y == y) return &c;
+        }
+    }
+
+    cell &insertcell(int x, int y)
+    {
+        if(2*(numcells+1) > cells.length())
+        {
+            vector<cell> old;
+            old.move(cells);
+            cells.growbuf(2*old.length());
+            cells.advance(2*old.length());
+            loopv(cells) cells[i].gen = 0;
+            int mask = cells.length()-1;
+            loopv(old) if(old[i].gen == gen)
+            {
+                uint h = cellhash(old[i].x, old[i].y);
+                while(cells[h&mask].gen == gen) h++;
+                cells[h&mask] = old[i];
+            }
+        }
+        int mask = cells.length()-1;
+        for(uint h = cellhash(x, y);; h++)
+        {
+            cell &c = cells[h&mask];
+            if(c.gen != gen)
+            {
+                c.x = x;
+                c.y = y;
+                c.first = -1;
+                c.gen = gen;
+                numcells++;
+                return c;
+            }
+            if(c.x == x && c.y == y) return c;
+        }
+    }
+
+    void linkcell(int p, int x, int y, bool unique = false)
+    {
+        cell &c = insertcell(x, y);
+        if(unique) for(int l = c.first; l >= 0; l = links[l].next) if(links[l].proxy == p) return; // moved back into an old cell
+        link &l = links.add();
+        l.proxy = p;
+        l.next = c.first;
+        c.first = links.length()-1;
+    }
+
+    /// Insert a new entity; it must not be in the grid yet.
+    void add(T *e, const vec &o, float radius)
+    {
+        int p = proxies.length();
+        index[entkey(e)] = p;
+        proxy &n = proxies.add();
+        n.ent = e;
+        cellrange(o, radius, n.x1, n.y1, n.x2, n.y2);
+        for(int y = n.y1; y <= n.y2; y++) for(int x = n.x1; x <= n.x2; x++) linkcell(p, x, y);
+    }
+
+    /// Update the position of an entity which is in the grid.
+    /// @return false if the entity was not added before.
+    bool move(T *e, const vec &o, float radius)
+    {
+        int *p = index.access(entkey(e));
+        if(!p) return false;
+        int x1, y1, x2, y2;
+        cellrange(o, radius, x1, y1, x2, y2);
+        proxy &n = proxies[*p];
+        if(x1 == n.x1 && y1 == n.y1 && x2 == n.x2 && y2 == n.y2) return true;
+        for(int y = y1; y <= y2; y++) for(int x = x1; x <= x2; x++)
+        {
+            if(x >= n.x1 && x <= n.x2 && y >= n.y1 && y <= n.y2) continue; // already linked
+            linkcell(*p, x, y, true);
+        }
+        n.x1 = x1; n.y1 = y1; n.x2 = x2; n.y2 = y2;
+        return true;
+    }
+
+    void remove(T *e)
+    {
+        int *p = index.access(entkey(e));
+        if(!p) return;
+        proxy &n = proxies[*p];
+        n.ent = nullptr;
+        n.x1 = n.y1 = 1;
+        n.x2 = n.y2 = 0;
+        index.remove(entkey(e));
+    }
+
+    /// Call f(e) once for every entity whose cells overlap the square around o.
+    /// Entities are reported in the order they were added, independent of how they moved since, so results are reproducible.
+    /// If f returns true the query stops and returns that entity.
+    template<class F> T *query(const vec &o, float radius, F f) const
+    {
+        enum { MAXFOUND = 64 };
+        int qx1, qy1, qx2, qy2, found[MAXFOUND], numfound = 0;
+        bool overflow = false;
+        cellrange(o, radius, qx1, qy1, qx2, qy2);
+        if((qx2-qx1+1)*(qy2-qy1+1) <= proxies.length()) // else cheaper to look at all entities than at all cells
+        {
+            for(int y = qy1; y <= qy2 && !overflow; y++) for(int x = qx1; x <= qx2; x++)
+            {
+                const cell *c = findcell(x, y);
+                if(!c) continue;
+                for(int l = c->first; l >= 0; l = links[l].next)
+                {
+                    const proxy &p = proxies[links[l].proxy];
+                    if(x < p.x1 || x > p.x2 || y < p.y1 || y > p.y2) continue; // stale link, the entity moved away
+                    if(x != std::max(qx1, p.x1) || y != std::max(qy1, p.y1)) continue; // only report it in the first cell we share
+                    if(numfound >= MAXFOUND) { overflow = true; break; }
+                    found[numfound++] = links[l].proxy;
+                }
+                if(overflow) break;
+            }
+            if(!overflow)
+            {
+                insertionsort(found, numfound);
+                loopi(numfound) if(f(proxies[found[i]].ent)) return proxies[found[i]].ent;
+                return nullptr;
+            }
+        }
+        loopv(proxies)
+        {
+            const proxy &p = proxies[i];
+            if(!p.ent || p.x2 < qx1 || p.x1 > qx2 || p.y2 < qy1 || p.y1 > qy2) continue;
+            if(f(p.ent)) return p.ent;
+        }
+        return nullptr;
+    }
+
+    void query(const vec &o, float radius, vector<T *> &result) const
+    {
+        query(o, radius, [&result](T *e) { result.add(e); return false; });
+    }
+
+    /// Add all entities whose cells overlap the segment from -> to swept by radius to result (without duplicates).
+    /// Only the cells along the segment are visited, so use this instead of a box query for long rays and fast projectiles.
+    void sweep(const vec &from, const vec &to, float radius, vector<T *> &result) const
+    {
+        int start = result.length();
+        float dx = to.x - from.x, dy = to.y - from.y;
+        int ry1 = int(floorf(std::min(from.y, to.y) - radius))>>cellbits,
+            ry2 = int(floorf(std::max(from.y, to.y) + radius))>>cellbits;
+        for(int y = ry1; y <= ry2; y++)
+        {
+            // the part of the segment which is within radius of this row of cells
+            float t1 = 0, t2 = 1;
+            if(fabs(dy) > 1e-6f)
+            {
+                t1 = (float(y*(1<<cellbits)) - radius - from.y)/dy;
+                t2 = (float((y+1)*(1<<cellbits)) + radius - from.y)/dy;
+                if(t1 > t2) std::swap(t1, t2);
+                t1 = std::max(t1, 0.0f);
+                t2 = std::min(t2, 1.0f);
+                if(t1 > t2) continue;
+            }
+            float sx1 = from.x + dx*t1, sx2 = from.x + dx*t2;
+            if(sx1 > sx2) std::swap(sx1, sx2);
+            int rx1 = int(floorf(sx1 - radius))>>cellbits, rx2 = int(floorf(sx2 + radius))>>cellbits;
+            for(int x = rx1; x <= rx2; x++)
+            {
+                const cell *c = findcell(x, y);
+                if(!c) continue;
+                for(int l = c->first; l >= 0; l = links[l].next)
+                {
+                    const proxy &p = proxies[links[l].proxy];
+                    if(x < p.x1 || x > p.x2 || y < p.y1 || y > p.y2) continue;
+                    bool dup = false;
+                    for(int i = start; i < result.length(); i++) if(result[i] == p.ent) { dup = true; break; }
+                    if(!dup) result.add(p.ent);
+                }
+            }
+        }
+    }
+};
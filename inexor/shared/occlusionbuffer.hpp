@@ -0,0 +1,202 @@
+/// @file occlusionbuffer.hpp
+/// Software occlusion culling: a small depth buffer on the CPU into which big occluders are rasterized,
+/// and against which bounding boxes are tested before anything is sent to the GPU.
+///
+/// The buffer stores 1/w per pixel (0 means nothing was drawn there), which is linear in screen space and grows towards the camera.
+/// Occluders are convex quads (usually faces of solid cubes), which are binned into horizontal bands of BANDHEIGHT rows as they are added.
+/// Every band only writes its own rows, so the bands can be rasterized by as many threads as there are bands.
+/// Pixels are covered if their centre is, the box test looks one pixel beyond the box to make up for that.
+/// Usage: setup(), addbox()/addquad() all occluders, rasterband() every band (or raster()), then isoccluded() as often as needed.
+/// This file does not depend on the engine or on OpenGL, so it can be tested and benchmarked without a window.
+
+#pragma once
+
+#include <math.h>                          // for floorf, ceilf, fabs
+#include <string.h>                        // for memset
+#include <algorithm>                       // for max, min
+
+#include "inexor/shared/cube_loops.hpp"    // for loopi, loopj
+#include "inexor/shared/cube_vector.hpp"   // for vector
+#include "inexor/shared/geom.hpp"          // for vec, vec4, matrix4
+#include "inexor/shared/simd.hpp"          // for simd4f
+
+struct occlusionbuffer
+{
+    enum { BANDHEIGHT = 16, MAXBANDS = 64 };
+
+    /// A convex quad in screen space: 4 edge functions which are >= 0 inside and the plane of its depth.
+    struct quad
+    {
+        float ea[4], eb[4], ec[4];
+        float za, zb, zc, maxz;
+        int x1, y1, x2, y2; ///< the pixels it may cover, x2 and y2 exclusive
+    };
+
+    int width, height;
+    matrix4 viewproj;
+    vec camera;
+    vector<float> depth;
+    vector<quad> quads;
+    vector<int> bins[MAXBANDS];
+
+    occlusionbuffer() : width(0), height(0), camera(0, 0, 0) {}
+
+    /// Start a new frame: size is in pixels, the width is rounded up to a multiple of 4 and the height to at most MAXBANDS bands.
+    void setup(const matrix4 &vp, const vec &cam, int w, int h)
+    {
+        viewproj = vp;
+        camera = cam;
+        width = std::max((w + 3)&~3, 4);
+        height = std::max(std::min(h, int(MAXBANDS*BANDHEIGHT)), 1);
+        depth.setsize(0);
+        memset(depth.pad(width*height), 0, width*height*sizeof(float));
+        quads.setsize(0);
+        loopi(MAXBANDS) bins[i].setsize(0);
+    }
+
+    int numbands() const { return (height + BANDHEIGHT - 1)/BANDHEIGHT; }
+
+    /// Project p to pixel coordinates and 1/w. @return false if it is too close to or behind the camera.
+    bool project(const vec &p, float &x, float &y, float &z) const
+    {
+        vec4 c;
+        viewproj.transform(p, c);
+        if(c.w < 1e-2f) return false;
+        z = 1/c.w;
+        x = (c.x*z + 1)*0.5f*width;
+        y = (c.y*z + 1)*0.5f*height;
+        return true;
+    }
+
+    /// Add the convex quad v (in any winding) as an occluder. @return false if it was dropped, e.g. because it crosses the near plane.
+    bool addquad(const vec v[4])
+    {
+        float x[4], y[4], z[4];
+        loopi(4) if(!project(v[i], x[i], y[i], z[i])) return false;
+
+        float area = 0;
+        loopi(4) area += x[i]*y[(i+1)&3] - x[(i+1)&3]*y[i];
+        if(fabs(area) < 1e-3f) return false;
+        float flip = area < 0 ? -1 : 1;
+
+        quad q;
+        float minx = x[0], maxx = x[0], miny = y[0], maxy = y[0];
+        q.maxz = z[0];
+        loopi(4)
+        {
+            int j = (i+1)&3;
+            q.ea[i] = flip*(y[i] - y[j]);
+            q.eb[i] = flip*(x[j] - x[i]);
+            q.ec[i] = -(q.ea[i]*x[i] + q.eb[i]*y[i]);
+            minx = std::min(minx, x[i]); maxx = std::max(maxx, x[i]);
+            miny = std::min(miny, y[i]); maxy = std::max(maxy, y[i]);
+            q.maxz = std::max(q.maxz, z[i]);
+        }
+        q.x1 = std::max(int(floorf(minx)), 0);
+        q.y1 = std::max(int(floorf(miny)), 0);
+        q.x2 = std::min(int(ceilf(maxx)), width);
+        q.y2 = std::min(int(ceilf(maxy)), height);
+        if(q.x1 >= q.x2 || q.y1 >= q.y2) return false;
+
+        // the depth plane from whichever half of the quad is less degenerate
+        int a = 0, b = 1, c = 2;
+        float d = (x[1]-x[0])*(y[2]-y[0]) - (x[2]-x[0])*(y[1]-y[0]),
+              d2 = (x[2]-x[0])*(y[3]-y[0]) - (x[3]-x[0])*(y[2]-y[0]);
+        if(fabs(d2) > fabs(d)) { b = 2; c = 3; d = d2; }
+        q.za = ((z[b]-z[a])*(y[c]-y[a]) - (z[c]-z[a])*(y[b]-y[a]))/d;
+        q.zb = ((x[b]-x[a])*(z[c]-z[a]) - (x[c]-x[a])*(z[b]-z[a]))/d;
+        q.zc = z[a] - q.za*x[a] - q.zb*y[a];
+
+        int n = quads.length();
+        quads.add(q);
+        for(int band = q.y1/BANDHEIGHT, last = (q.y2-1)/BANDHEIGHT; band <= last; band++) bins[band].add(n);
+        return true;
+    }
+
+    /// Add the faces of a box which are selected by faces (1<<O_LEFT, ... like the octree) and face the camera.
+    /// @return the number of quads added
+    int addbox(const vec &bbmin, const vec &bbmax, int faces = 0x3F)
+    {
+        int added = 0;
+        loopi(6) if(faces&(1<<i))
+        {
+            int dim = i>>1;
+            bool pos = (i&1) != 0;
+            if(pos ? camera[dim] <= bbmax[dim] : camera[dim] >= bbmin[dim]) continue; // back face
+            int r = (dim+1)%3, c = (dim+2)%3;
+            vec v[4];
+            loopj(4)
+            {
+                v[j][dim] = pos ? bbmax[dim] : bbmin[dim];
+                v[j][r] = j == 1 || j == 2 ? bbmax[r] : bbmin[r];
+                v[j][c] = j >= 2 ? bbmax[c] : bbmin[c];
+            }
+            if(addquad(v)) added++;
+        }
+        return added;
+    }
+
+    /// Draw all quads touching band into the depth buffer, different bands may be drawn at the same time.
+    void rasterband(int band)
+    {
+        const vector<int> &bin = bins[band];
+        int by1 = band*BANDHEIGHT, by2 = std::min(by1 + BANDHEIGHT, height);
+        const simd4f lanes(0.5f, 1.5f, 2.5f, 3.5f), zero(0.0f);
+        loopv(bin)
+        {
+            const quad &q = quads[bin[i]];
+            simd4f ea[4], eb[4], ec[4];
+            loopj(4) { ea[j] = simd4f(q.ea[j]); eb[j] = simd4f(q.eb[j]); ec[j] = simd4f(q.ec[j]); }
+            simd4f za(q.za), zb(q.zb), zc(q.zc), maxz(q.maxz);
+            for(int y = std::max(q.y1, by1), y2 = std::min(q.y2, by2); y < y2; y++)
+            {
+                simd4f py(y + 0.5f), rowz = zb*py + zc, rowe[4];
+                loopj(4) rowe[j] = eb[j]*py + ec[j];
+                float *row = &depth[y*width];
+                for(int x = q.x1&~3; x < q.x2; x += 4)
+                {
+                    simd4f px = simd4f(float(x)) + lanes,
+                           inside = (ea[0]*px + rowe[0] >= zero) & (ea[1]*px + rowe[1] >= zero) &
+                                    (ea[2]*px + rowe[2] >= zero) & (ea[3]*px + rowe[3] >= zero);
+                    if(!simdmovemask(inside)) continue;
+                    simd4f z = simdmin(za*px + rowz, maxz), d = simd4f::load(&row[x]);
+                    simdselect(inside, d, simdmax(d, z)).store(&row[x]);
+                }
+            }
+        }
+    }
+
+    void raster()
+    {
+        loopi(numbands()) rasterband(i);
+    }
+
+    /// Whether the box is completely hidden behind what was drawn, only call this once all bands are rasterized.
+    bool isoccluded(const vec &bbmin, const vec &bbmax) const
+    {
+        float minx = 1e16f, miny = 1e16f, maxx = -1e16f, maxy = -1e16f, maxz = 0;
+        loopi(8)
+        {
+            vec p(i&1 ? bbmax.x : bbmin.x, i&2 ? bbmax.y : bbmin.y, i&4 ? bbmax.z : bbmin.z);
+            float x, y, z;
+            if(!project(p, x, y, z)) return false;
+            minx = std::min(minx, x); maxx = std::max(maxx, x);
+            miny = std::min(miny, y); maxy = std::max(maxy, y);
+            maxz = std::max(maxz, z);
+        }
+        int x1 = std::max(int(floorf(minx)) - 1, 0), y1 = std::max(int(floorf(miny)) - 1, 0),
+            x2 = std::min(int(ceilf(maxx)) + 1, width), y2 = std::min(int(ceilf(maxy)) + 1, height);
+        if(x1 >= x2 || y1 >= y2) return false; // off screen, leave that to the frustum
+        const simd4f lanes(0, 1, 2, 3), fx1((float)x1), fx2((float)x2), boxz(maxz*1.0001f);
+        for(int y = y1; y < y2; y++)
+        {
+            const float *row = &depth[y*width];
+            for(int x = x1&~3; x < x2; x += 4)
+            {
+                simd4f px = simd4f(float(x)) + lanes;
+                if(simdmovemask((simd4f::load(&row[x]) <= boxz) & (px >= fx1) & (px < fx2))) return false;
+            }
+        }
+        return true;
+    }
+};
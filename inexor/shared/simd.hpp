@@ -0,0 +1,166 @@
+/// @file simd.hpp
+/// Thin 4-wide float vector abstraction for our SIMD code paths (e.g. the BIH traversal).
+///
+/// On x86 we map it onto SSE2 (which is part of our baseline, see compile_flags_and_defs.cmake),
+/// everywhere else (or when INEXOR_SIMD_SCALAR is defined) a plain scalar implementation is used which produces the same results.
+/// Keep the interface small: if you need an operation which is not here, add both implementations.
+
+#pragma once
+
+#include <math.h>                        // for sqrtf
+#include <string.h>                      // for memcpy
+
+#include "inexor/shared/cube_loops.hpp"  // for loopi
+#include "inexor/shared/cube_types.hpp"  // for uint
+
+#if !defined(INEXOR_SIMD_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define INEXOR_SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+
+/// 4 float lanes.
+/// Comparisons return lane masks (all bits set or cleared), which can be combined with the bitwise
+/// operators and turned into a 4 bit integer with movemask().
+struct simd4f
+{
+#ifdef INEXOR_SIMD_SSE2
+    __m128 v;
+
+    simd4f() {}
+    simd4f(__m128 v) : v(v) {}
+    explicit simd4f(float f) : v(_mm_set1_ps(f)) {}
+    simd4f(float a, float b, float c, float d) : v(_mm_setr_ps(a, b, c, d)) {}
+
+    static simd4f load(const float *p) { return _mm_loadu_ps(p); }
+    void store(float *p) const { _mm_storeu_ps(p, v); }
+
+    float operator[](int i) const { float f[4]; store(f); return f[i]; }
+#else
+    float v[4];
+
+    simd4f() {}
+    explicit simd4f(float f) { v[0] = v[1] = v[2] = v[3] = f; }
+    simd4f(float a, float b, float c, float d) { v[0] = a; v[1] = b; v[2] = c; v[3] = d; }
+
+    static simd4f load(const float *p) { simd4f r; memcpy(r.v, p, sizeof(r.v)); return r; }
+    void store(float *p) const { memcpy(p, v, sizeof(v)); }
+
+    float operator[](int i) const { return v[i]; }
+#endif
+};
+
+#ifdef INEXOR_SIMD_SSE2
+
+static inline simd4f operator+(const simd4f &a, const simd4f &b) { return _mm_add_ps(a.v, b.v); }
+static inline simd4f operator-(const simd4f &a, const simd4f &b) { return _mm_sub_ps(a.v, b.v); }
+static inline simd4f operator*(const simd4f &a, const simd4f &b) { return _mm_mul_ps(a.v, b.v); }
+static inline simd4f operator/(const simd4f &a, const simd4f &b) { return _mm_div_ps(a.v, b.v); }
+static inline simd4f operator&(const simd4f &a, const simd4f &b) { return _mm_and_ps(a.v, b.v); }
+static inline simd4f operator|(const simd4f &a, const simd4f &b) { return _mm_or_ps(a.v, b.v); }
+static inline simd4f operator^(const simd4f &a, const simd4f &b) { return _mm_xor_ps(a.v, b.v); }
+static inline simd4f operator<(const simd4f &a, const simd4f &b) { return _mm_cmplt_ps(a.v, b.v); }
+static inline simd4f operator<=(const simd4f &a, const simd4f &b) { return _mm_cmple_ps(a.v, b.v); }
+static inline simd4f operator>(const simd4f &a, const simd4f &b) { return _mm_cmpgt_ps(a.v, b.v); }
+static inline simd4f operator>=(const simd4f &a, const simd4f &b) { return _mm_cmpge_ps(a.v, b.v); }
+static inline simd4f operator!=(const simd4f &a, const simd4f &b) { return _mm_cmpneq_ps(a.v, b.v); }
+
+static inline simd4f simdmin(const simd4f &a, const simd4f &b) { return _mm_min_ps(a.v, b.v); }
+static inline simd4f simdmax(const simd4f &a, const simd4f &b) { return _mm_max_ps(a.v, b.v); }
+static inline simd4f simdsqrt(const simd4f &a) { return _mm_sqrt_ps(a.v); }
+/// a & ~mask | b & mask
+static inline simd4f simdselect(const simd4f &mask, const simd4f &a, const simd4f &b) { return _mm_or_ps(_mm_andnot_ps(mask.v, a.v), _mm_and_ps(mask.v, b.v)); }
+/// the sign bits of all 4 lanes, lane 0 in bit 0
+static inline int simdmovemask(const simd4f &a) { return _mm_movemask_ps(a.v); }
+static inline simd4f simdsignmask() { return _mm_castsi128_ps(_mm_set1_epi32(int(0x80000000))); }
+/// turn 4 rows into 4 columns: afterwards a holds the first lanes of a, b, c and d and so on
+static inline void simdtranspose(simd4f &a, simd4f &b, simd4f &c, simd4f &d) { _MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v); }
+
+#else
+
+#define SIMD4F_OP(op, expr) \
+    static inline simd4f operator op(const simd4f &a, const simd4f &b) \
+    { \
+        simd4f r; \
+        loopi(4) r.v[i] = (expr); \
+        return r; \
+    }
+#define SIMD4F_BITOP(op) \
+    static inline simd4f operator op(const simd4f &a, const simd4f &b) \
+    { \
+        simd4f r; \
+        uint x[4], y[4]; \
+        memcpy(x, a.v, sizeof(x)); memcpy(y, b.v, sizeof(y)); \
+        loopi(4) x[i] = x[i] op y[i]; \
+        memcpy(r.v, x, sizeof(x)); \
+        return r; \
+    }
+#define SIMD4F_CMP(op) \
+    static inline simd4f operator op(const simd4f &a, const simd4f &b) \
+    { \
+        simd4f r; \
+        uint x[4]; \
+        loopi(4) x[i] = a.v[i] op b.v[i] ? 0xFFFFFFFFU : 0; \
+        memcpy(r.v, x, sizeof(x)); \
+        return r; \
+    }
+
+SIMD4F_OP(+, a.v[i] + b.v[i])
+SIMD4F_OP(-, a.v[i] - b.v[i])
+SIMD4F_OP(*, a.v[i] * b.v[i])
+SIMD4F_OP(/, a.v[i] / b.v[i])
+SIMD4F_BITOP(&)
+SIMD4F_BITOP(|)
+SIMD4F_BITOP(^)
+SIMD4F_CMP(<)
+SIMD4F_CMP(<=)
+SIMD4F_CMP(>)
+SIMD4F_CMP(>=)
+SIMD4F_CMP(!=)
+
+#undef SIMD4F_OP
+#undef SIMD4F_BITOP
+#undef SIMD4F_CMP
+
+// same NaN behaviour as minps/maxps: the second operand is returned if either is NaN
+static inline simd4f simdmin(const simd4f &a, const simd4f &b) { simd4f r; loopi(4) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return r; }
+static inline simd4f simdmax(const simd4f &a, const simd4f &b) { simd4f r; loopi(4) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return r; }
+static inline simd4f simdsqrt(const simd4f &a) { simd4f r; loopi(4) r.v[i] = sqrtf(a.v[i]); return r; }
+
+static inline simd4f simdselect(const simd4f &mask, const simd4f &a, const simd4f &b)
+{
+    simd4f r;
+    uint m[4], x[4], y[4];
+    memcpy(m, mask.v, sizeof(m)); memcpy(x, a.v, sizeof(x)); memcpy(y, b.v, sizeof(y));
+    loopi(4) x[i] = (x[i]&~m[i]) | (y[i]&m[i]);
+    memcpy(r.v, x, sizeof(x));
+    return r;
+}
+
+static inline int simdmovemask(const simd4f &a)
+{
+    uint x[4];
+    memcpy(x, a.v, sizeof(x));
+    return int((x[0]>>31) | ((x[1]>>31)<<1) | ((x[2]>>31)<<2) | ((x[3]>>31)<<3));
+}
+
+static inline simd4f simdsignmask()
+{
+    simd4f r;
+    uint x[4] = { 0x80000000U, 0x80000000U, 0x80000000U, 0x80000000U };
+    memcpy(r.v, x, sizeof(x));
+    return r;
+}
+
+static inline void simdtranspose(simd4f &a, simd4f &b, simd4f &c, simd4f &d)
+{
+    simd4f *rows[4] = { &a, &b, &c, &d };
+    float m[4][4];
+    loopi(4) rows[i]->store(m[i]);
+    loopi(4) *rows[i] = simd4f(m[0][i], m[1][i], m[2][i], m[3][i]);
+}
+
+#endif
+
+/// flip the sign of a in all lanes where s is negative: folds both branches of a sign dependent comparison into one
+static inline simd4f simdxorsign(const simd4f &a, const simd4f &s) { return a ^ (s & simdsignmask()); }
+static inline simd4f simdabs(const simd4f &a) { return simdxorsign(a, a); }
@@ -0,0 +1,135 @@
+/// @file skinning.hpp
+/// Dual quaternion skinning on the CPU, used by skeletal models when the GPU can not skin them (see skelmodel).
+///
+/// The source vertices of a mesh are kept in a skinstream as one array per component (structure of arrays),
+/// so 4 vertices are transformed at once with simd4f and only the 4 bone dual quaternions have to be gathered and transposed.
+/// The results match dualquat::transform(), dualquat::transformnormal() and quat::mul() up to rounding.
+/// This file does not depend on the engine or on OpenGL, so it can be tested and benchmarked without a window.
+
+#pragma once
+
+#include <math.h>                          // for sqrtf
+#include <string.h>                        // for memset
+#include <algorithm>                       // for min
+
+#include "inexor/shared/cube_loops.hpp"    // for loopi, loopj
+#include "inexor/shared/cube_vector.hpp"   // for vector
+#include "inexor/shared/geom.hpp"          // for dualquat, quat, vec, vec4
+#include "inexor/shared/simd.hpp"          // for simd4f
+
+/// The skinned vertices [i, i+4) of a skinstream, one array per component.
+struct skinlanes
+{
+    float pos[3][4];
+    float dir[4][4]; ///< the normal, or the tangent quaternion if the stream has tangents
+};
+
+struct skinstream
+{
+    int numverts;
+    bool tangents;
+    vector<float> pos[3], dir[4]; ///< padded to a multiple of 4 vertices, dir[3] is only used for tangents
+    vector<int> bones;            ///< the dual quaternion which moves each vertex
+
+    skinstream() : numverts(0), tangents(false) {}
+
+    void setup(int n, bool t)
+    {
+        numverts = n;
+        tangents = t;
+        int padded = (n + 3)&~3;
+        loopi(3) { pos[i].setsize(0); memset(pos[i].pad(padded), 0, padded*sizeof(float)); }
+        loopi(4) { dir[i].setsize(0); if(i < 3 || t) memset(dir[i].pad(padded), 0, padded*sizeof(float)); }
+        bones.setsize(0);
+        memset(bones.pad(padded), 0, padded*sizeof(int));
+    }
+
+    /// For tangents the sign of d.w is the sign of the bitangent, see animmodel::fixqtangent().
+    void setvert(int i, const vec &p, const vec4 &d, int bone)
+    {
+        loopj(3) { pos[j][i] = p[j]; dir[j][i] = d[j]; }
+        if(tangents) dir[3][i] = d.w;
+        bones[i] = bone;
+    }
+
+    /// Skin the vertices [start, end), start must be a multiple of 4.
+    /// Bones below split are taken from bdata1, all others from bdata2 (which is indexed with the bone number as well).
+    /// out(i, lanes) is called for every 4 vertices starting at i, lanes at or beyond end have to be ignored.
+    template<class F> void skin(int start, int end, const dualquat *bdata1, const dualquat *bdata2, int split, F out) const
+    {
+        const float bias = -1.5f/65535, biasscale = sqrtf(1 - bias*bias);
+        const simd4f zero(0.0f), two(2.0f), vbias(bias), vbiasscale(biasscale), sign = simdsignmask();
+        skinlanes lanes;
+        for(int i = start; i < end; i += 4)
+        {
+            simd4f rx, ry, rz, rw, dx, dy, dz, dw;
+            {
+                const dualquat *b[4];
+                loopj(4)
+                {
+                    int bone = bones[std::min(i+j, end-1)];
+                    b[j] = &(bone < split ? bdata1 : bdata2)[bone];
+                }
+                rx = simd4f::load(&b[0]->real.x); ry = simd4f::load(&b[1]->real.x); rz = simd4f::load(&b[2]->real.x); rw = simd4f::load(&b[3]->real.x);
+                dx = simd4f::load(&b[0]->dual.x); dy = simd4f::load(&b[1]->dual.x); dz = simd4f::load(&b[2]->dual.x); dw = simd4f::load(&b[3]->dual.x);
+                simdtranspose(rx, ry, rz, rw);
+                simdtranspose(dx, dy, dz, dw);
+            }
+
+            simd4f vx = simd4f::load(&pos[0][i]), vy = simd4f::load(&pos[1][i]), vz = simd4f::load(&pos[2][i]),
+                   tx = ry*vz - rz*vy + vx*rw + dx,
+                   ty = rz*vx - rx*vz + vy*rw + dy,
+                   tz = rx*vy - ry*vx + vz*rw + dz;
+            ((ry*tz - rz*ty + dx*rw - rx*dw)*two + vx).store(lanes.pos[0]);
+            ((rz*tx - rx*tz + dy*rw - ry*dw)*two + vy).store(lanes.pos[1]);
+            ((rx*ty - ry*tx + dz*rw - rz*dw)*two + vz).store(lanes.pos[2]);
+
+            simd4f nx = simd4f::load(&dir[0][i]), ny = simd4f::load(&dir[1][i]), nz = simd4f::load(&dir[2][i]);
+            if(tangents)
+            {
+                simd4f nw = simd4f::load(&dir[3][i]),
+                       qx = rw*nx + rx*nw + ry*nz - rz*ny,
+                       qy = rw*ny - rx*nz + ry*nw + rz*nx,
+                       qz = rw*nz + rx*ny - ry*nx + rz*nw,
+                       qw = rw*nw - rx*nx - ry*ny - rz*nz,
+                       negbt = nw < zero,
+                       flip = simdselect(negbt, qw < zero, qw >= zero) & sign;
+                qx = qx ^ flip; qy = qy ^ flip; qz = qz ^ flip; qw = qw ^ flip;
+                simd4f clamp = negbt & (qw > vbias), scale = simdselect(clamp, simd4f(1.0f), vbiasscale);
+                (qx*scale).store(lanes.dir[0]);
+                (qy*scale).store(lanes.dir[1]);
+                (qz*scale).store(lanes.dir[2]);
+                simdselect(clamp, qw, vbias).store(lanes.dir[3]);
+            }
+            else
+            {
+                simd4f cx = ry*nz - rz*ny + nx*rw,
+                       cy = rz*nx - rx*nz + ny*rw,
+                       cz = rx*ny - ry*nx + nz*rw;
+                ((ry*cz - rz*cy)*two + nx).store(lanes.dir[0]);
+                ((rz*cx - rx*cz)*two + ny).store(lanes.dir[1]);
+                ((rx*cy - ry*cx)*two + nz).store(lanes.dir[2]);
+            }
+            out(i, lanes);
+        }
+    }
+};
+
+/// d = the weighted sum of up to 4 bones, like dualquat::accumulate() does, the bones with a weight of 0 are skipped.
+static inline void blenddualquats(dualquat &d, const dualquat *bdata, const uchar *bones, const float *weights)
+{
+    const dualquat &first = bdata[bones[0]];
+    simd4f k(weights[0]), real = simd4f::load(&first.real.x)*k, dual = simd4f::load(&first.dual.x)*k;
+    for(int i = 1; i < 4 && weights[i]; i++)
+    {
+        const dualquat &b = bdata[bones[i]];
+        float r[4];
+        real.store(r);
+        float w = r[0]*b.real.x + r[1]*b.real.y + r[2]*b.real.z + r[3]*b.real.w < 0 ? -weights[i] : weights[i];
+        k = simd4f(w);
+        real = real + simd4f::load(&b.real.x)*k;
+        dual = dual + simd4f::load(&b.dual.x)*k;
+    }
+    real.store(&d.real.x);
+    dual.store(&d.dual.x);
+}
@@ -1,16 +1,19 @@
-// sound.cpp: basic positional sound using sdl_mixer
+// sound.cpp: basic positional sound, mixed by our own mixer (util/mixer.hpp) on the SDL audio thread
 
 #include <boost/algorithm/clamp.hpp>                  // for clamp
-#include <string.h>                                   // for strcmp
+#include <string.h>                                   // for strcmp, memset
 #include <algorithm>                                  // for max, min
 #include <memory>                                     // for __shared_ptr
 #include <string>                                     // for string
 
+#include "SDL_audio.h"                                // for SDL_OpenAudioDevice, SDL_AudioSpec
+
 #include "inexor/engine/renderbackground.hpp"         // for renderprogress
 #include "inexor/engine/rendergl.hpp"                 // for camera1
 #include "inexor/fpsgame/entities.hpp"                // for getents
 #include "inexor/io/Logging.hpp"                      // for Log, Logger
 #include "inexor/io/filesystem/mediadirs.hpp"         // for getmediapath
+#include "inexor/io/legacy/stream.hpp"                // for findfile, loadfiledata
 #include "inexor/shared/command.hpp"                  // for COMMAND, intret
 #include "inexor/shared/cube_hash.hpp"                // for hashnameset
 #include "inexor/shared/cube_loops.hpp"               // for i, loopv, j, k
@@ -25,29 +28,53 @@
 #include "inexor/ui/legacy/menus.hpp"                 // for initwarning
 #include "inexor/ui/screen/ScreenManager.hpp"         // for ScreenManager
 #include "inexor/util/legacy_time.hpp"                // for totalmillis
+#include "inexor/util/mixer.hpp"                      // for softmixer, attenuate
+#include "inexor/util/samplecache.hpp"                // for samplecache, pcmsample
+#include "inexor/util/vfs.hpp"                        // for vfsdata
 
 
 using namespace inexor::filesystem;
 using namespace inexor::rendering::screen;
 
-// #define MAXVOL MIX_MAX_VOLUME  // TODO Sound refractoring
-#define MAXVOL 100
-
 namespace inexor {
 namespace sound {
 
 bool nosound = true;
 
+using inexor::util::pcmsample;
+
+/// The decoded samples of all sounds, game and map sounds playing the same file share them.
+static inexor::util::samplecache *pcmcache = nullptr;
+
+/// Sound files may also come out of package archives, so they get read through the package index.
+static bool readsound(const std::string &file, inexor::util::vfsdata &data)
+{
+    return loadfiledata(file.c_str(), data);
+}
+
+using inexor::util::softmixer;
+
+/// Mixes the channels, it only gets commands from here and runs on the audio thread of SDL.
+static softmixer *mixer = nullptr;
+static SDL_AudioDeviceID audiodevice = 0;
+
 struct soundsample
 {
     char *name;
-    //Mix_Chunk *chunk;  // TODO Sound refractoring
+    std::string file; ///< where the sound was found, empty until the first load
+    int nextext;      ///< the extension to try next if file can not be decoded
+    bool missing;     ///< no file or one which could not be decoded, only complain once
 
-    soundsample() : name(nullptr)/*, chunk(NULL)*/ {}  // TODO Sound refractoring
+    soundsample() : name(nullptr), nextext(0), missing(false) {}
     ~soundsample() { DELETEA(name); }
 
-    void cleanup() { /*if(chunk) { Mix_FreeChunk(chunk); chunk = NULL; } */}  // TODO Sound refractoring
+    void cleanup() { file.clear(); nextext = 0; missing = false; }
+    /// Find the file of the sound, false if there is none or it failed to load.
+    bool resolve(bool msg);
+    /// Start loading the sound in the background, returns false if it can not be loaded.
     bool load(bool msg = false);
+    /// The decoded sound, nullptr while it is still loading. Never blocks.
+    std::shared_ptr<const pcmsample> get();
 };
 
 struct soundslot
@@ -79,7 +106,10 @@ struct soundchannel
     vec loc;
     soundslot *slot;
     extentity *ent;
-    int radius, volume, pan, flags;
+    std::shared_ptr<const pcmsample> pcm; ///< keeps the sample from being evicted from the cache while it plays
+    unsigned serial;                      ///< tells the reports of the mixer about this sound from earlier ones on the channel
+    int radius, flags;
+    float gainl, gainr;
     bool dirty;
 
     soundchannel(int id) : id(id) { reset(); }
@@ -93,9 +123,10 @@ struct soundchannel
         clearloc();
         slot = nullptr;
         ent = nullptr;
+        pcm.reset();
+        serial = 0;
         radius = 0;
-        volume = -1;
-        pan = -1;
+        gainl = gainr = -1;
         flags = 0;
         dirty = false;
     }
@@ -127,72 +158,137 @@ void freechannel(int n)
     if(!channels.inrange(n) || !channels[n].inuse) return;
     soundchannel &chan = channels[n];
     chan.inuse = false;
+    chan.pcm.reset();
     if(chan.ent) chan.ent->flags &= ~EF_SOUND;
 }
 
 void syncchannel(soundchannel &chan)
 {
     if(!chan.dirty) return;
-    //if(!Mix_FadingChannel(chan.id)) Mix_Volume(chan.id, chan.volume);
-    //Mix_SetPanning(chan.id, 255-chan.pan, chan.pan);  // TODO Sound refractoring
+    if(mixer) mixer->setgain(chan.id, chan.gainl, chan.gainr);
     chan.dirty = false;
 }
 
+/// Stop what the mixer plays on the channel, fading it out over fade milliseconds.
+static void haltchannel(int n, int fade = 0)
+{
+    if(mixer) mixer->stop(n, fade);
+}
+
 void stopchannels()
 {
     loopv(channels)
     {
         soundchannel &chan = channels[i];
         if(!chan.inuse) continue;
-        //Mix_HaltChannel(i);  // TODO Sound refractoring
+        haltchannel(i);
         freechannel(i);
     }
 }
 
 VARFP(soundvol, 0, 255, 255, if(!soundvol) { stopchannels(); });
-VARF(soundchans, 1, 32, 128, initwarning("sound configuration", INIT_RESET, CHANGE_SOUND));
+/// How many sounds get mixed, the least audible ones beyond that only keep their time running.
+VARF(soundchans, 1, 32, 128, { if(mixer) mixer->setmaxmixed(soundchans); });
+/// How many sounds may play at once, audible or not.
+VARFP(soundvoices, 1, 128, 256, initwarning("sound configuration", INIT_RESET, CHANGE_SOUND));
 VARF(soundfreq, 0, 44100, 44100, initwarning("sound configuration", INIT_RESET, CHANGE_SOUND));
 VARF(soundbufferlen, 128, 1024, 4096, initwarning("sound configuration", INIT_RESET, CHANGE_SOUND));
+/// Megabytes the decoded sounds may use before the least recently played ones are dropped.
+VARFP(soundcachesize, 0, 64, 1024, { if(pcmcache) pcmcache->setlimit(size_t(soundcachesize) << 20); });
+
+/// The callback of the audio device, runs on its own thread.
+static void SDLCALL mixaudio(void *udata, Uint8 *stream, int len)
+{
+    static_cast<softmixer *>(udata)->mix(reinterpret_cast<short *>(stream), len/(2*sizeof(short)));
+}
+
+static void closeaudio()
+{
+    // waits for the callback to return
+    if(audiodevice) { SDL_CloseAudioDevice(audiodevice); audiodevice = 0; }
+    DELETEP(mixer);
+}
 
 void initsound()
 {
-    // TODO Sound refractoring
-    //if(Mix_OpenAudio(soundfreq, MIX_DEFAULT_FORMAT, 2, soundbufferlen)<0)
-    //{
-    //    nosound = true;
-    //    Log.std->error("sound init failed (SDL_mixer): {}", Mix_GetError());
-    //    return;
-    //}
-    //Mix_AllocateChannels(soundchans);
-    maxchannels = soundchans;
+    int freq = soundfreq ? soundfreq : 44100;
+    mixer = new softmixer(freq, soundchans, soundbufferlen);
+    SDL_AudioSpec want, have;
+    memset(&want, 0, sizeof(want));
+    want.freq = freq;
+    want.format = AUDIO_S16SYS;
+    want.channels = 2;
+    want.samples = soundbufferlen;
+    want.callback = mixaudio;
+    want.userdata = mixer;
+    // SDL converts if the device wants another format, the mixer always gets what it asked for
+    audiodevice = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
+    if(!audiodevice)
+    {
+        nosound = true;
+        Log.std->error("sound init failed (SDL): {}", SDL_GetError());
+        DELETEP(mixer);
+        return;
+    }
+    if(!pcmcache) pcmcache = new inexor::util::samplecache(freq, size_t(soundcachesize) << 20, readsound);
+    else pcmcache->setfreq(freq);
+    maxchannels = min(int(soundvoices), int(softmixer::MAXVOICES));
+    SDL_PauseAudioDevice(audiodevice, 0);
     nosound = false;
 }
 
-// TODO Sound refractoring
-//static Mix_Chunk *loadwav(const char *name)
-//{
-//    Mix_Chunk *c = Mix_LoadWAV(findfile(name, "rb"));
-//    return c;
-//}
+/// Log what mixing cost so far, e.g. run with SDL_AUDIODRIVER=dummy to measure it without a sound card.
+void soundmixstats()
+{
+    if(!mixer) return;
+    softmixer::stats s = mixer->getstats();
+    if(!s.frames) return;
+    double audiomillis = s.frames*1000.0/mixer->getfreq();
+    Log.std->info("sound mixer: {} blocks, {:.0f} ms of audio mixed in {:.1f} ms ({:.2f}% of the time)",
+                  s.blocks, audiomillis, s.mixmillis, 100*s.mixmillis/audiomillis);
+    Log.std->info("sound mixer: {:.1f} voices mixed and {:.1f} virtual on average, at most {} playing and {} mixed",
+                  double(s.mixedframes)/s.frames, double(s.virtualframes)/s.frames, s.peakvoices, s.peakmixed);
+}
+COMMAND(soundmixstats, "");
 
-bool soundsample::load(bool msg)
+bool soundsample::resolve(bool msg)
 {
-    //if(chunk) return true;  // TODO Sound refractoring
-    if(!name[0]) return false;
-
-    static const char * const exts[] = {"", ".ogg", ".flac", ".wav"};
-    std::string filename;
-    loopi(sizeof(exts) / sizeof(exts[0]))
+    if(!pcmcache || missing || !name[0]) return false;
+    // an existing file which fails to decode (only wave files can be decoded for now) falls back to the next extension
+    while(file.empty() || pcmcache->failed(file))
     {
-        getmediapath(filename, name, DIR_SOUND);
-        filename += exts[i]; //append the extension
-        if(msg && !i) renderprogress(0, filename.c_str());
-        //chunk = loadwav(filename.c_str());  // TODO Sound refractoring
-        //if(chunk) return true; // TODO Sound refractoring
+        if(!file.empty()) Log.std->warn("could not decode sound: {}", file);
+        file.clear();
+        // looked up here so a missing file is known right away, only reading and decoding it happens on the workers
+        static const char * const exts[] = {"", ".ogg", ".flac", ".wav"};
+        std::string filename;
+        for(; nextext < int(sizeof(exts) / sizeof(exts[0])) && file.empty(); nextext++)
+        {
+            getmediapath(filename, name, DIR_SOUND);
+            filename += exts[nextext]; //append the extension
+            if(msg && !nextext) renderprogress(0, filename.c_str());
+            if(findfile(filename.c_str(), "e")) file = filename;
+        }
+        if(file.empty())
+        {
+            Log.std->warn("failed to load sound: {}", filename.empty() ? name : filename);
+            missing = true;
+            return false;
+        }
     }
+    return true;
+}
 
-    Log.std->warn("failed to load sound: {}", filename); // TODO: LOG_N_TIMES(1)
-    return false;
+bool soundsample::load(bool msg)
+{
+    if(!resolve(msg)) return false;
+    pcmcache->request(file);
+    return true;
+}
+
+std::shared_ptr<const pcmsample> soundsample::get()
+{
+    return resolve(false) ? pcmcache->request(file) : nullptr;
 }
 
 static hashnameset<soundsample> samples;
@@ -200,8 +296,21 @@ static hashnameset<soundsample> samples;
 static void cleanupsamples()
 {
     enumerate(samples, soundsample, s, s.cleanup());
+    if(pcmcache) pcmcache->clear();
 }
 
+/// Log how many sounds were loaded and how long it took from asking for them until they could be played.
+void soundcachestats()
+{
+    if(!pcmcache) return;
+    inexor::util::samplecache::stats s = pcmcache->getstats();
+    int loaded = s.loads + s.shared;
+    Log.std->info("sound cache: {} requests, {} hits, {} files decoded, {} shared, {} failed, {} evicted, {} KB",
+                  s.requests, s.hits, s.loads, s.shared, s.failures, s.evictions, s.bytes >> 10);
+    if(loaded) Log.std->info("sound load latency: {:.1f} ms average, {:.1f} ms max", s.totallatency/loaded, s.maxlatency);
+}
+COMMAND(soundcachestats, "");
+
 static struct soundtype
 {
     vector<soundslot> slots;
@@ -275,7 +384,7 @@ static struct soundtype
             soundchannel &chan = channels[i];
             if(chan.inuse && slots.inbuf(chan.slot))
             {
-                //Mix_HaltChannel(i); // TODO Sound refractoring
+                haltchannel(i);
                 freechannel(i);
             }
         }
@@ -335,7 +444,7 @@ void clear_sound()
     gamesounds.clear();
     mapsounds.clear();
     samples.clear();
-    //Mix_CloseAudio();  // TODO Sound refractoring
+    closeaudio();
     resetchannels();
 }
 
@@ -343,7 +452,7 @@ void stopmapsounds()
 {
     loopv(channels) if(channels[i].inuse && channels[i].ent)
     {
-     //   Mix_HaltChannel(i);  // TODO Sound refractoring
+        haltchannel(i);
         freechannel(i);
     }
 }
@@ -361,7 +470,7 @@ void stopmapsound(extentity *e)
         soundchannel &chan = channels[i];
         if(chan.inuse && chan.ent == e)
         {
-     //       Mix_HaltChannel(i);  // TODO Sound refractoring
+            haltchannel(i);
             freechannel(i);
         }
     }
@@ -386,57 +495,82 @@ VAR(stereo, 0, 1, 1);
 
 VARP(maxsoundradius, 0, 340, 10000);
 
-bool updatechannel(soundchannel &chan)
+/// Recompute the gains of the channels from the listener position, all of them in one batch.
+/// Marks the ones which changed dirty and returns how many did.
+static int updatechannels(soundchannel **chans, int n)
 {
-    if(!chan.slot) return false;
-    int vol = soundvol, pan = 255 / 2;
-    if(chan.hasloc())
+    static vector<float> rx, ry, dist, inner, radius, gainl, gainr;
+    rx.setsize(0); ry.setsize(0); dist.setsize(0); inner.setsize(0); radius.setsize(0);
+    loopi(n)
     {
-        vec v;
-        float dist = chan.loc.dist(camera1->o, v);
-        int rad = maxsoundradius;
-        if(chan.ent)
+        soundchannel &chan = *chans[i];
+        float x = 0, y = 0, d = 0, in = 0, rad = 0;
+        if(chan.hasloc())
         {
-            rad = chan.ent->attr2;
-            if(chan.ent->attr3)
+            vec v;
+            d = chan.loc.dist(camera1->o, v);
+            rad = maxsoundradius;
+            if(chan.ent)
             {
-                rad -= chan.ent->attr3;
-                dist -= chan.ent->attr3;
+                rad = chan.ent->attr2;
+                in = chan.ent->attr3;
             }
-        }
-        else if(chan.radius > 0) rad = maxsoundradius ? min(maxsoundradius, chan.radius) : chan.radius;
-        if(rad > 0) vol -= int(clamp(dist/rad, 0.0f, 1.0f)*soundvol); // simple mono distance attenuation
-        if(stereo && (v.x != 0 || v.y != 0) && dist>0)
-        {
+            else if(chan.radius > 0) rad = maxsoundradius ? min(int(maxsoundradius), chan.radius) : chan.radius;
             v.rotate_around_z(-camera1->yaw*RAD);
-            pan = int(255.9f*(0.5f - 0.5f*v.x/v.magnitude2())); // range is from 0 (left) to 255 (right)
+            x = v.x;
+            y = v.y;
         }
+        rx.add(x); ry.add(y); dist.add(d); inner.add(in); radius.add(rad);
     }
-    vol = (vol*MAXVOL*chan.slot->volume)/255/255;
-    vol = min(vol, MAXVOL);
-    if(vol == chan.volume && pan == chan.pan) return false;
-    chan.volume = vol;
-    chan.pan = pan;
-    chan.dirty = true;
-    return true;
+    gainl.setsize(0); gainr.setsize(0);
+    gainl.pad(n); gainr.pad(n);
+    inexor::util::attenuate(n, rx.getbuf(), ry.getbuf(), dist.getbuf(), inner.getbuf(), radius.getbuf(), stereo != 0,
+                            gainl.getbuf(), gainr.getbuf());
+
+    int changed = 0;
+    loopi(n)
+    {
+        soundchannel &chan = *chans[i];
+        float vol = min(1.0f, soundvol/255.0f*chan.slot->volume/255.0f);
+        float l = gainl[i]*vol, r = gainr[i]*vol;
+        if(l == chan.gainl && r == chan.gainr) continue;
+        chan.gainl = l;
+        chan.gainr = r;
+        chan.dirty = true;
+        changed++;
+    }
+    return changed;
+}
+
+bool updatechannel(soundchannel &chan)
+{
+    if(!chan.slot) return false;
+    soundchannel *p = &chan;
+    return updatechannels(&p, 1) > 0;
 }
 
+/// Free the channels whose sounds the mixer finished, the samples they played are released here and not on the audio thread.
 void reclaimchannels()
 {
-    loopv(channels)
+    if(!mixer) return;
+    softmixer::event e;
+    while(mixer->finished(e))
     {
-        soundchannel &chan = channels[i];
-        //if(chan.inuse && !Mix_Playing(i)) freechannel(i); // TODO Sound refractoring
+        if(channels.inrange(e.voice) && channels[e.voice].inuse && channels[e.voice].serial == e.serial) freechannel(e.voice);
     }
 }
 
 void syncchannels()
 {
+    static vector<soundchannel *> located;
+    located.setsize(0);
     loopv(channels)
     {
         soundchannel &chan = channels[i];
-        if(chan.inuse && chan.hasloc() && updatechannel(chan)) syncchannel(chan);
+        if(chan.inuse && chan.hasloc() && chan.slot) located.add(&chan);
     }
+    if(located.empty() || !updatechannels(located.getbuf(), located.length())) return;
+    loopv(located) syncchannel(*located[i]);
 }
 
 void updatesounds()
@@ -498,7 +632,7 @@ int playsound(int n, const vec *loc, extentity *ent, int flags, int loops, int f
         {
             if(channels.inrange(chanid) && sounds.playing(channels[chanid], config))
             {
-                //Mix_HaltChannel(chanid); // TODO Sound refractoring
+                haltchannel(chanid);
                 freechannel(chanid);
             }
             return -1;
@@ -533,38 +667,39 @@ int playsound(int n, const vec *loc, extentity *ent, int flags, int loops, int f
     if(fade < 0) return -1;
 
     soundslot &slot = sounds.slots[config.chooseslot()];
-    // if(!slot.sample->chunk && !slot.sample->load())  // TODO Sound refractoring
-    {
-        return -1;
-    }
+    // a sound which is still loading is skipped rather than waited for
+    std::shared_ptr<const pcmsample> pcm = slot.sample->get();
+    if(!pcm) return -1;
 
     if(dbgsound) Log.std->debug("sound: {}", slot.sample->name);
 
     chanid = -1;
     loopv(channels) if(!channels[i].inuse) { chanid = i; break; }
     if(chanid < 0 && channels.length() < maxchannels) chanid = channels.length();
-    if(chanid < 0) loopv(channels) if(!channels[i].volume) {/* Mix_HaltChannel(i); */freechannel(i); chanid = i; break; } // TODO Sound refractoring
+    if(chanid < 0) loopv(channels) if(!channels[i].gainl && !channels[i].gainr) { haltchannel(i); freechannel(i); chanid = i; break; }
     if(chanid < 0) return -1;
 
+    static unsigned lastserial = 0;
     soundchannel &chan = newchannel(chanid, &slot, loc, ent, flags, radius);
+    chan.pcm = pcm;
+    chan.serial = ++lastserial;
     updatechannel(chan);
-    int playing = -1;
-    //if(fade)  // TODO Sound refractoring
-    //{
-    //    Mix_Volume(chanid, chan.volume);
-    //    playing = expire >= 0 ? Mix_FadeInChannelTimed(chanid, slot.sample->chunk, loops, fade, expire) : Mix_FadeInChannel(chanid, slot.sample->chunk, loops, fade);
-    //}
-    //else playing = expire >= 0 ? Mix_PlayChannelTimed(chanid, slot.sample->chunk, loops, expire) : Mix_PlayChannel(chanid, slot.sample->chunk, loops);
-    if(playing >= 0) syncchannel(chan);
-    else freechannel(chanid);
-    return playing;
+    chan.dirty = false;
+    // own sounds (without a location) are heard over the others, ambient map sounds give way first
+    float priority = !chan.hasloc() ? 2.0f : (ent ? 0.5f : 1.0f);
+    if(!mixer || !mixer->play(chanid, chan.serial, pcm, chan.gainl, chan.gainr, priority, loops, fade, expire))
+    {
+        freechannel(chanid);
+        return -1;
+    }
+    return chanid;
 }
 
 void stopsounds()
 {
     loopv(channels) if(channels[i].inuse)
     {
-        //Mix_HaltChannel(i);
+        haltchannel(i);
         freechannel(i);
     }
 }
@@ -573,11 +708,9 @@ bool stopsound(int n, int chanid, int fade)
 {
     if(!gamesounds.configs.inrange(n) || !channels.inrange(chanid) || !channels[chanid].inuse || !gamesounds.playing(channels[chanid], gamesounds.configs[n])) return false;
     if(dbgsound) Log.std->debug("stopsound: {}", channels[chanid].slot->sample->name);
-    //if(!fade || !Mix_FadeOutChannel(chanid, fade)) // TODO Sound refractoring
-    {
-        //Mix_HaltChannel(chanid); // TODO Sound refractoring
-        freechannel(chanid);
-    }
+    haltchannel(chanid, fade);
+    // a fading channel is freed once the mixer reports it finished
+    if(!fade) freechannel(chanid);
     return true;
 }
 
@@ -597,8 +730,10 @@ void resetsound()
     clearchanges(CHANGE_SOUND);
     if(!nosound)
     {
+        stopchannels();
         cleanupsamples();
     }
+    closeaudio();
     initsound();
     resetchannels();
     if(nosound)
@@ -0,0 +1,210 @@
+#include <math.h>                             // for log10, sqrt
+#include <stdlib.h>                           // for abs
+#include <algorithm>                          // for min, max
+#include <chrono>                             // for steady_clock, duration
+#include <iostream>                           // for cout
+#include <random>                             // for mt19937
+#include <thread>                             // for thread
+#include <vector>                             // for vector
+
+#include "gtest/gtest-message.h"              // for Message
+#include "gtest/gtest-test-part.h"            // for TestPartResult
+#include "gtest/gtest.h"                      // for Test, TestInfo (ptr only)
+#include "inexor/util/blockcompression.hpp"   // for compressimage, decodebc1
+#include "inexor/util/jobs.hpp"               // for job_system
+
+using namespace std;
+using namespace inexor::util;
+
+typedef unsigned char uchar;
+
+// Test images with 4 bytes per pixel, which look a bit like textures: smooth gradients with some noise on top.
+static vector<uchar> makeimage(int w, int h, unsigned seed, bool alpha)
+{
+    mt19937 rng(seed);
+    vector<uchar> img(w*h*4);
+    for(int y = 0; y < h; y++) for(int x = 0; x < w; x++)
+    {
+        uchar *p = &img[(y*w + x)*4];
+        int noise = int(rng()%16) - 8;
+        p[0] = uchar(min(max(x*255/w + noise, 0), 255));
+        p[1] = uchar(min(max(y*255/h + noise, 0), 255));
+        p[2] = uchar(min(max((x + y)*127/(w + h) + 64 + noise, 0), 255));
+        p[3] = alpha ? uchar((x/4 + y/4)%2 ? 255 - (x*y)%64 : (x*y)%64) : 255;
+    }
+    return img;
+}
+
+// Unit normals pointing mostly up, stored as 0..255.
+static vector<uchar> makenormals(int w, int h)
+{
+    vector<uchar> img(w*h*4);
+    for(int y = 0; y < h; y++) for(int x = 0; x < w; x++)
+    {
+        float nx = 0.4f*sinf(x*0.2f), ny = 0.4f*cosf(y*0.15f), nz = sqrtf(1 - nx*nx - ny*ny);
+        uchar *p = &img[(y*w + x)*4];
+        p[0] = uchar((nx*0.5f + 0.5f)*255 + 0.5f);
+        p[1] = uchar((ny*0.5f + 0.5f)*255 + 0.5f);
+        p[2] = uchar((nz*0.5f + 0.5f)*255 + 0.5f);
+        p[3] = 255;
+    }
+    return img;
+}
+
+typedef void (*blockdecoder)(const uchar *, uchar *);
+
+// Decode all blocks of an image compressed with compressimage() back into 4 bytes per pixel.
+static vector<uchar> decodeimage(const vector<uchar> &blocks, int w, int h, int blocksize, blockdecoder decode)
+{
+    vector<uchar> img(w*h*4);
+    int bw = (w + 3)/4;
+    for(int by = 0; by < (h + 3)/4; by++) for(int bx = 0; bx < bw; bx++)
+    {
+        uchar rgba[64];
+        decode(&blocks[(by*bw + bx)*blocksize], rgba);
+        for(int y = 0; y < 4 && by*4 + y < h; y++) for(int x = 0; x < 4 && bx*4 + x < w; x++)
+            for(int c = 0; c < 4; c++) img[((by*4 + y)*w + bx*4 + x)*4 + c] = rgba[(y*4 + x)*4 + c];
+    }
+    return img;
+}
+
+// Peak signal to noise ratio of the given channels in dB.
+static double psnr(const vector<uchar> &a, const vector<uchar> &b, int firstchannel, int numchannels)
+{
+    double sum = 0;
+    size_t n = 0;
+    for(size_t i = 0; i < a.size(); i += 4) for(int c = firstchannel; c < firstchannel + numchannels; c++, n++)
+    {
+        double d = double(a[i + c]) - double(b[i + c]);
+        sum += d*d;
+    }
+    if(sum == 0) return 99;
+    return 10*log10(255.0*255.0/(sum/n));
+}
+
+static vector<uchar> compress(bcformat f, const vector<uchar> &img, int w, int h, job_system &js)
+{
+    vector<uchar> blocks(((w + 3)/4)*((h + 3)/4)*bcblocksize(f));
+    compressimage(f, img.data(), w, h, 4, w*4, blocks.data(), &js);
+    return blocks;
+}
+
+TEST(BlockCompression, DecodersMatchTheFormat) {
+    // color0 = pure red, color1 = pure blue in 565, 4 color mode as color0 > color1, indices 0 1 2 3 in every row
+    const uchar block[8] = { 0x00, 0xF8, 0x1F, 0x00, 0xE4, 0xE4, 0xE4, 0xE4 };
+    uchar rgba[64];
+    decodebc1(block, rgba);
+    EXPECT_EQ(rgba[0], 255); EXPECT_EQ(rgba[2], 0);   // red
+    EXPECT_EQ(rgba[4], 0); EXPECT_EQ(rgba[6], 255);   // blue
+    EXPECT_EQ(rgba[8], 170); EXPECT_EQ(rgba[10], 85); // two thirds red
+    EXPECT_EQ(rgba[12], 85); EXPECT_EQ(rgba[14], 170);
+    for(int i = 0; i < 16; i++) EXPECT_EQ(rgba[i*4 + 3], 255);
+
+    // swapped endpoints mean 3 colors: the average and transparent black
+    const uchar threecolor[8] = { 0x1F, 0x00, 0x00, 0xF8, 0xE4, 0xE4, 0xE4, 0xE4 };
+    decodebc1(threecolor, rgba);
+    EXPECT_EQ(rgba[8], 127); EXPECT_EQ(rgba[10], 127);
+    EXPECT_EQ(rgba[12], 0); EXPECT_EQ(rgba[13], 0); EXPECT_EQ(rgba[14], 0); EXPECT_EQ(rgba[15], 0);
+
+    // alpha endpoints 255 and 0 with 8 values, every pixel uses index 1 (binary 001 repeated)
+    uchar bc3[16] = { 255, 0, 0x49, 0x92, 0x24, 0x49, 0x92, 0x24 };
+    for(int i = 8; i < 16; i++) bc3[i] = block[i - 8];
+    decodebc3(bc3, rgba);
+    for(int i = 0; i < 16; i++) EXPECT_EQ(rgba[i*4 + 3], 0);
+
+    // explicit 4 bit alpha: 0xF is 255, 0x8 is 136
+    uchar bc2[16] = { 0x8F, 0x8F, 0x8F, 0x8F, 0x8F, 0x8F, 0x8F, 0x8F };
+    for(int i = 8; i < 16; i++) bc2[i] = block[i - 8];
+    decodebc2(bc2, rgba);
+    EXPECT_EQ(rgba[3], 255);
+    EXPECT_EQ(rgba[7], 136);
+}
+
+TEST(BlockCompression, SolidBlocksAreExact) {
+    uchar rgba[64], block[16], out[64];
+    // colors which 565 can represent exactly
+    const uchar colors[][3] = { { 0, 0, 0 }, { 255, 255, 255 }, { 255, 0, 0 }, { 131, 130, 131 } };
+    for(auto &c : colors) {
+        for(int i = 0; i < 16; i++) { rgba[i*4] = c[0]; rgba[i*4 + 1] = c[1]; rgba[i*4 + 2] = c[2]; rgba[i*4 + 3] = 200; }
+        encodebc1(rgba, block);
+        decodebc1(block, out);
+        for(int i = 0; i < 16; i++) for(int j = 0; j < 3; j++) EXPECT_EQ(out[i*4 + j], rgba[i*4 + j]);
+        encodebc3(rgba, block);
+        decodebc3(block, out);
+        for(int i = 0; i < 64; i++) EXPECT_EQ(out[i], rgba[i]);
+    }
+}
+
+TEST(BlockCompression, RoundTripQuality) {
+    job_system js;
+    js.start(2);
+    const int w = 133, h = 67; // not a multiple of the block size
+    vector<uchar> img = makeimage(w, h, 1, false), alphaimg = makeimage(w, h, 2, true), normals = makenormals(w, h);
+
+    vector<uchar> bc1 = decodeimage(compress(BC1, img, w, h, js), w, h, 8, decodebc1);
+    EXPECT_GT(psnr(img, bc1, 0, 3), 33.0);
+
+    vector<uchar> bc3 = decodeimage(compress(BC3, alphaimg, w, h, js), w, h, 16, decodebc3);
+    EXPECT_GT(psnr(alphaimg, bc3, 0, 3), 33.0);
+    EXPECT_GT(psnr(alphaimg, bc3, 3, 1), 38.0);
+
+    vector<uchar> bc5 = decodeimage(compress(BC5, normals, w, h, js), w, h, 16, decodebc5);
+    EXPECT_GT(psnr(normals, bc5, 0, 2), 40.0);
+    EXPECT_GT(psnr(normals, bc5, 2, 1), 35.0); // z is reconstructed
+
+    // BC1A keeps the 1 bit alpha exactly
+    vector<uchar> bc1a = decodeimage(compress(BC1A, alphaimg, w, h, js), w, h, 8, decodebc1);
+    for(size_t i = 0; i < alphaimg.size(); i += 4) {
+        EXPECT_EQ(bc1a[i + 3], alphaimg[i + 3] < 128 ? 0 : 255);
+        if(bc1a[i + 3]) { EXPECT_LE(abs(int(bc1a[i]) - int(alphaimg[i])), 40); }
+    }
+    cout << "[ bc       ] psnr bc1 " << psnr(img, bc1, 0, 3) << " dB, bc3 " << psnr(alphaimg, bc3, 0, 3) << "/" << psnr(alphaimg, bc3, 3, 1)
+         << " dB, bc5 " << psnr(normals, bc5, 0, 2) << " dB" << endl;
+}
+
+TEST(BlockCompression, ThreadsDoNotChangeTheResult) {
+    const int w = 256, h = 256;
+    vector<uchar> img = makeimage(w, h, 3, true);
+    for(bcformat f : { BC1, BC1A, BC3, BC5 }) {
+        job_system single;
+        vector<uchar> expected = compress(f, img, w, h, single);
+        for(int n : { 1, 3 }) {
+            job_system js;
+            js.start(n);
+            EXPECT_EQ(compress(f, img, w, h, js), expected) << "format " << f << ", workers " << n;
+        }
+    }
+}
+
+TEST(BlockCompression, MipmapChain) {
+    job_system js;
+    const int w = 64, h = 16;
+    vector<uchar> img = makeimage(w, h, 4, false), out;
+    int levels = compressmipmaps(BC1, img.data(), w, h, 4, w*4, out, &js);
+    EXPECT_EQ(levels, 7); // 64x16 down to 1x1
+    size_t expected = 0;
+    for(int lw = w, lh = h; ; lw = max(lw/2, 1), lh = max(lh/2, 1)) {
+        expected += ((lw + 3)/4)*((lh + 3)/4)*8;
+        if(lw == 1 && lh == 1) break;
+    }
+    EXPECT_EQ(out.size(), expected);
+
+    // the box filter keeps flat colors
+    vector<uchar> flat(8*8*3, 77), half(4*4*3);
+    halveimage(flat.data(), 8, 8, 3, 8*3, half.data());
+    for(uchar c : half) EXPECT_EQ(c, 77);
+}
+
+// Not a correctness test: how fast the encoder is on this machine.
+TEST(BlockCompression, Benchmark) {
+    const int w = 1024, h = 1024;
+    vector<uchar> img = makeimage(w, h, 5, true);
+    for(bcformat f : { BC1, BC3, BC5 }) {
+        job_system js;
+        js.start(max(int(thread::hardware_concurrency()) - 1, 0));
+        auto start = chrono::steady_clock::now();
+        compress(f, img, w, h, js);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << "[ bc       ] format " << f << ": " << ms << " ms for 1024x1024 on " << js.concurrency() << " threads" << endl;
+    }
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>                            // for FILE, fopen, fwrite
+#include <time.h>                             // for time, time_t
+#include <functional>                         // for function
+#include <string>                             // for string
+#include <thread>                             // for thread
+#include <vector>                             // for vector
+
+#include <boost/filesystem/operations.hpp>    // for remove_all, directory_iterator, last_write_time
+#include <boost/filesystem/path.hpp>          // for path
+
+#include "gtest/gtest-message.h"              // for Message
+#include "gtest/gtest-test-part.h"            // for TestPartResult
+#include "gtest/gtest.h"                      // for Test, TestInfo (ptr only)
+#include "inexor/util/diskcache.hpp"          // for diskcache, diskcachekey
+#include "inexor/util/mappedfile.hpp"         // for mappedfile
+
+using namespace std;
+using namespace inexor::util;
+namespace bfs = boost::filesystem;
+
+static diskcachekey makekey(const string &desc)
+{
+    diskcachekey key;
+    key.desc = desc;
+    key.hash = FNV1A_BASIS;
+    fnv1a(key.hash, desc.data(), desc.size());
+    return key;
+}
+
+static function<bool(FILE *)> writes(const string &data)
+{
+    return [data](FILE *f) { return fwrite(data.data(), 1, data.size(), f) == data.size(); };
+}
+
+static string loaded(diskcache &cache, const string &dir, const diskcachekey &key)
+{
+    mappedfile file;
+    const unsigned char *data;
+    size_t len;
+    if(!cache.load(dir, key, file, data, len)) return "<none>";
+    return string((const char *)data, len);
+}
+
+static int countentries(const string &dir)
+{
+    int n = 0;
+    for(bfs::directory_iterator it(dir), end; it != end; ++it) n++;
+    return n;
+}
+
+class DiskCache : public ::testing::Test
+{
+protected:
+    string dir;
+
+    void SetUp() override
+    {
+        dir = (bfs::temp_directory_path() / bfs::unique_path("diskcachetest%%%%%%%%")).string();
+        bfs::create_directory(dir);
+        dir += '/';
+    }
+
+    void TearDown() override
+    {
+        bfs::remove_all(dir);
+    }
+};
+
+TEST(FNV1a, MatchesKnownHashes) {
+    unsigned long long hash = FNV1A_BASIS;
+    EXPECT_EQ(hash, 0xcbf29ce484222325ULL);
+    fnv1a(hash, "a", 1);
+    EXPECT_EQ(hash, 0xaf63dc4c8601ec8cULL);
+    hash = FNV1A_BASIS;
+    fnv1a(hash, "foobar", 6);
+    EXPECT_EQ(hash, 0x85944171f73967e8ULL);
+}
+
+TEST_F(DiskCache, StoresAndLoadsEntries) {
+    diskcache cache("TEST", 1, ".tst");
+    diskcachekey key = makekey("a:first"), other = makekey("a:second");
+    EXPECT_EQ(loaded(cache, dir, key), "<none>");
+    cache.save(dir, key, 1<<20, writes("first data"));
+    cache.save(dir, other, 1<<20, writes(""));
+    EXPECT_EQ(loaded(cache, dir, key), "first data");
+    EXPECT_EQ(loaded(cache, dir, other), "");
+    // replacing an entry
+    cache.save(dir, key, 1<<20, writes("again"));
+    EXPECT_EQ(loaded(cache, dir, key), "again");
+    EXPECT_EQ(countentries(dir), 2); // no temporary files left behind
+    EXPECT_EQ(loaded(cache, dir, diskcachekey()), "<none>");
+}
+
+TEST_F(DiskCache, RejectsOtherEntries) {
+    diskcache cache("TEST", 1, ".tst");
+    diskcachekey key = makekey("a:first");
+    cache.save(dir, key, 1<<20, writes("data"));
+
+    // the same hash with another description, like a collision
+    diskcachekey collision = key;
+    collision.desc = "a:other!";
+    EXPECT_EQ(loaded(cache, dir, collision), "<none>");
+    collision.desc = "a:longer one";
+    EXPECT_EQ(loaded(cache, dir, collision), "<none>");
+
+    diskcache newer("TEST", 2, ".tst"), othermagic("ABCD", 1, ".tst");
+    EXPECT_EQ(loaded(newer, dir, key), "<none>");
+    EXPECT_EQ(loaded(othermagic, dir, key), "<none>");
+
+    // a failed write does not replace the entry
+    cache.save(dir, key, 1<<20, [](FILE *f) { fwrite("half", 1, 4, f); return false; });
+    EXPECT_EQ(loaded(cache, dir, key), "data");
+    EXPECT_EQ(countentries(dir), 1);
+}
+
+TEST_F(DiskCache, EvictsLeastRecentlyUsed) {
+    diskcache cache("TEST", 1, ".tst");
+    string data(1000, 'x');
+    vector<diskcachekey> keys;
+    for(int i = 0; i < 10; i++)
+    {
+        keys.push_back(makekey("entry " + to_string(i)));
+        cache.save(dir, keys.back(), 1<<20, writes(data));
+    }
+    // the eviction goes by the modification time, which only has seconds on some file systems
+    time_t now = time(nullptr);
+    for(bfs::directory_iterator it(dir), end; it != end; ++it) bfs::last_write_time(it->path(), now - 1000);
+    // loading marks them as used
+    for(int i = 5; i < 10; i++) EXPECT_EQ(loaded(cache, dir, keys[i]), data);
+
+    // a file of another kind in the same directory is left alone
+    FILE *f = fopen((dir + "other.bin").c_str(), "wb");
+    ASSERT_TRUE(f != nullptr);
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+
+    // 11 entries of a bit more than 1 kB with a limit of 9 kB: evicted down to 6.75 kB, the oldest first
+    keys.push_back(makekey("entry 10"));
+    cache.save(dir, keys.back(), 9000, writes(data));
+    for(int i = 0; i < 5; i++) EXPECT_EQ(loaded(cache, dir, keys[i]), "<none>") << i;
+    for(int i = 5; i < 11; i++) EXPECT_EQ(loaded(cache, dir, keys[i]), data) << i;
+    EXPECT_TRUE(bfs::exists(dir + "other.bin"));
+
+    cache.clear(dir);
+    for(const diskcachekey &key : keys) EXPECT_EQ(loaded(cache, dir, key), "<none>");
+    EXPECT_EQ(countentries(dir), 1);
+}
+
+TEST_F(DiskCache, SavesFromSeveralThreads) {
+    diskcache cache("TEST", 1, ".tst");
+    diskcachekey key = makekey("shared");
+    string data(100000, 'y');
+    vector<thread> threads;
+    for(int i = 0; i < 8; i++) threads.emplace_back([&] { for(int j = 0; j < 10; j++) cache.save(dir, key, 1<<30, writes(data)); });
+    // whatever gets loaded meanwhile is a whole entry
+    for(int i = 0; i < 100; i++)
+    {
+        string got = loaded(cache, dir, key);
+        if(got != "<none>") ASSERT_EQ(got, data);
+    }
+    for(thread &t : threads) t.join();
+    EXPECT_EQ(loaded(cache, dir, key), data);
+}
+
+TEST(DiskCacheStats, CountsSinceTheLastCall) {
+    diskcache cache("TEST", 1, ".tst");
+    cache.count(true, 5);
+    cache.count(true, 7);
+    cache.count(false, 100);
+    diskcache::stats s = cache.takestats();
+    EXPECT_EQ(s.hits, 2);
+    EXPECT_EQ(s.hitmillis, 12u);
+    EXPECT_EQ(s.misses, 1);
+    EXPECT_EQ(s.missmillis, 100u);
+    s = cache.takestats();
+    EXPECT_EQ(s.hits + s.misses, 0);
+}
@@ -0,0 +1,160 @@
+#include <stdlib.h>                           // for abs
+#include <chrono>                             // for steady_clock, duration
+#include <functional>                         // for function
+#include <iostream>                           // for cout
+#include <random>                             // for mt19937
+#include <vector>                             // for vector
+
+#include "gtest/gtest-message.h"              // for Message
+#include "gtest/gtest-test-part.h"            // for TestPartResult
+#include "gtest/gtest.h"                      // for Test, TestInfo (ptr only)
+#include "inexor/util/imagekernels.hpp"       // for setimagesimd, halvetexture
+
+using namespace std;
+using namespace inexor::util;
+
+typedef unsigned char uchar;
+
+/// Resets the SIMD level when the test ends.
+struct simdlevel
+{
+    simdlevel(int level) { setimagesimd(level); }
+    ~simdlevel() { setimagesimd(IMAGESIMD_MAX); }
+};
+
+static vector<uchar> noise(size_t size, unsigned seed)
+{
+    mt19937 rng(seed);
+    vector<uchar> data(size);
+    for(uchar &c : data) c = uchar(rng());
+    // some runs of extreme values, which are where rounding and saturation go wrong
+    for(size_t i = 0; i + 8 < size; i += 97) for(int j = 0; j < 8; j++) data[i + j] = i%2 ? 255 : 0;
+    return data;
+}
+
+/// Run fn for every SIMD level this machine has and compare its output with the scalar one.
+static void comparelevels(const function<vector<uchar>()> &fn, int tolerance, const char *what)
+{
+    vector<uchar> expected;
+    {
+        simdlevel l(IMAGESIMD_SCALAR);
+        expected = fn();
+    }
+    for(int level = IMAGESIMD_SCALAR + 1; level <= bestimagesimd(); level++)
+    {
+        simdlevel l(level);
+        vector<uchar> result = fn();
+        ASSERT_EQ(result.size(), expected.size());
+        int worst = 0;
+        for(size_t i = 0; i < result.size(); i++) worst = max(worst, abs(int(result[i]) - int(expected[i])));
+        EXPECT_LE(worst, tolerance) << what << " with " << imagesimdname(level);
+    }
+}
+
+// Sizes which are no multiple of any vector width, and ones which are.
+static const int sizes[][2] = { { 2, 2 }, { 6, 4 }, { 38, 10 }, { 64, 64 }, { 130, 34 } };
+
+TEST(ImageKernels, Halve) {
+    for(auto &size : sizes) for(int bpp = 1; bpp <= 4; bpp++) {
+        int w = size[0], h = size[1], pitch = w*bpp + 3;
+        vector<uchar> src = noise(pitch*h, w*bpp);
+        comparelevels([&]() {
+            vector<uchar> dst((w/2)*(h/2)*bpp);
+            halvetexture(src.data(), w, h, bpp, pitch, dst.data());
+            return dst;
+        }, 0, "halvetexture");
+    }
+}
+
+TEST(ImageKernels, Blur) {
+    for(auto &size : sizes) for(int bpp = 3; bpp <= 4; bpp++) for(int n = 1; n <= 2; n++) for(int margin = 0; margin <= 1; margin++) {
+        int w = size[0] + 2*margin, h = size[1] + 2*margin;
+        vector<uchar> src = noise(w*h*bpp, w + n);
+        comparelevels([&]() {
+            vector<uchar> dst((w - 2*margin)*(h - 2*margin)*bpp);
+            blurtexture(n, bpp, w, h, dst.data(), src.data(), margin);
+            return dst;
+        }, 0, "blurtexture");
+        if(bpp == 3) comparelevels([&]() {
+            vector<uchar> dst((w - 2*margin)*(h - 2*margin)*bpp);
+            blurtexture(n, bpp, w, h, dst.data(), src.data(), margin, true);
+            return dst;
+        }, 0, "blurnormals");
+    }
+}
+
+TEST(ImageKernels, Premultiply) {
+    for(auto &size : sizes) for(int bpp = 2; bpp <= 4; bpp += 2) {
+        int w = size[0], h = size[1], pitch = w*bpp + 1;
+        vector<uchar> src = noise(pitch*h, h);
+        comparelevels([&]() {
+            vector<uchar> data = src;
+            premultiply(data.data(), w, h, bpp, pitch);
+            return data;
+        }, 0, "premultiply");
+    }
+    // exact for every color and alpha
+    vector<uchar> all(256*256*2);
+    for(int i = 0; i < 256*256; i++) { all[i*2] = uchar(i&0xFF); all[i*2 + 1] = uchar(i>>8); }
+    premultiply(all.data(), 256*256, 1, 2, 256*256*2);
+    for(int i = 0; i < 256*256; i++) ASSERT_EQ(all[i*2], ((i&0xFF)*(i>>8))/255);
+}
+
+TEST(ImageKernels, Mad) {
+    const float muls[][3] = { { 1, 1, 1 }, { 0.5f, 1.7f, -0.3f }, { 2, 2, 2 } }, adds[][3] = { { 0, 0, 0 }, { 0.1f, -0.25f, 0.7f }, { -0.5f, 0, 0.01f } };
+    for(auto &size : sizes) for(int bpp = 1; bpp <= 4; bpp++) for(int i = 0; i < 3; i++) {
+        int w = size[0], h = size[1], pitch = w*bpp;
+        vector<uchar> src = noise(pitch*h, bpp);
+        // the float math is the same, but a compiler with fast math may reorder it
+        comparelevels([&]() {
+            vector<uchar> data = src;
+            madtexture(data.data(), w, h, bpp, pitch, muls[i], adds[i]);
+            return data;
+        }, 1, "madtexture");
+    }
+}
+
+TEST(ImageKernels, NormalMap) {
+    for(auto &size : sizes) for(int bpp = 1; bpp <= 4; bpp += 3) for(int emphasis = 1; emphasis <= 4; emphasis *= 2) {
+        int w = size[0], h = size[1], pitch = w*bpp + 2;
+        vector<uchar> src = noise(pitch*h, w);
+        comparelevels([&]() {
+            vector<uchar> dst(w*h*3);
+            normalmap(src.data(), w, h, bpp, pitch, dst.data(), emphasis);
+            return dst;
+        }, 1, "normalmap");
+    }
+}
+
+TEST(ImageKernels, Levels) {
+    EXPECT_EQ(setimagesimd(-1), IMAGESIMD_SCALAR);
+    EXPECT_EQ(setimagesimd(IMAGESIMD_MAX + 1), bestimagesimd());
+    EXPECT_EQ(imagesimd(), bestimagesimd());
+}
+
+// Not a correctness test: how fast the kernels are on this machine with every level.
+TEST(ImageKernels, Benchmark) {
+    const float mul[3] = { 0.5f, 1.5f, 1 }, add[3] = { 0.1f, 0, -0.1f };
+    for(int size : { 256, 1024, 2048 }) {
+        vector<uchar> src = noise(size*size*4, size), dst(size*size*4);
+        struct kernel { const char *name; function<void()> fn; } kernels[] = {
+            { "halve rgb", [&]() { halvetexture(src.data(), size, size, 3, size*3, dst.data()); } },
+            { "halve rgba", [&]() { halvetexture(src.data(), size, size, 4, size*4, dst.data()); } },
+            { "blur 5x5 rgb", [&]() { blurtexture(2, 3, size, size, dst.data(), src.data()); } },
+            { "blur normals", [&]() { blurtexture(1, 3, size, size, dst.data(), src.data(), 0, true); } },
+            { "premultiply", [&]() { dst = src; premultiply(dst.data(), size, size, 4, size*4); } },
+            { "mad rgb", [&]() { dst = src; madtexture(dst.data(), size, size, 3, size*3, mul, add); } },
+            { "normalmap", [&]() { normalmap(src.data(), size, size, 1, size, dst.data(), 2); } },
+        };
+        for(auto &k : kernels) {
+            cout << "[ image    ] " << size << "x" << size << " " << k.name << ":";
+            for(int level = IMAGESIMD_SCALAR; level <= bestimagesimd(); level++) {
+                simdlevel l(level);
+                auto start = chrono::steady_clock::now();
+                k.fn();
+                cout << " " << imagesimdname(level) << " " << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms";
+            }
+            cout << endl;
+        }
+    }
+}
@@ -0,0 +1,201 @@
+#include <time.h>                             // for clock
+#include <atomic>                             // for atomic
+#include <chrono>                             // for steady_clock, duration
+#include <iostream>                           // for cout
+#include <mutex>                              // for mutex, lock_guard
+#include <thread>                             // for this_thread
+#include <vector>                             // for vector
+
+#include "gtest/gtest-message.h"              // for Message
+#include "gtest/gtest-test-part.h"            // for TestPartResult
+#include "gtest/gtest.h"                      // for Test, TestInfo (ptr only)
+#include "inexor/util/jobs.hpp"               // for job_system, task_ptr
+
+using namespace std;
+using namespace inexor::util;
+
+// The worker counts every test runs with, 0 means the caller does everything itself.
+static const int workercounts[] = { 0, 1, 3, 8 };
+
+TEST(JobSystem, ParallelForCoversEverythingOnce) {
+    for(int n : workercounts) {
+        job_system js;
+        js.start(n);
+        for(int grain : { 1, 7, 64, 5000 }) {
+            vector<atomic<int>> hits(4321);
+            for(auto &h : hits) h = 0;
+            js.parallel_for(0, int(hits.size()), grain, [&](int from, int to) {
+                EXPECT_LE(to - from, grain);
+                for(int i = from; i < to; i++) hits[i]++;
+            });
+            for(auto &h : hits) EXPECT_EQ(h.load(), 1) << "workers " << n << ", grain " << grain;
+        }
+        // empty ranges do not call anything
+        js.parallel_for(5, 5, 1, [&](int, int) { ADD_FAILURE(); });
+    }
+}
+
+TEST(JobSystem, ParallelForRespectsMaxThreads) {
+    job_system js;
+    js.start(8);
+    atomic<int> running(0), most(0);
+    js.parallel_for(0, 256, 1, [&](int, int) {
+        int now = ++running;
+        for(int m = most; now > m && !most.compare_exchange_weak(m, now);) {}
+        this_thread::sleep_for(chrono::microseconds(200));
+        running--;
+    }, 2);
+    EXPECT_LE(most.load(), 2);
+}
+
+TEST(JobSystem, ParallelReduceIsDeterministic) {
+    vector<float> values(100000);
+    for(size_t i = 0; i < values.size(); i++) values[i] = 1.0f/float(i + 1);
+    auto sum = [&](job_system &js) {
+        return js.parallel_reduce(0, int(values.size()), 333, 0.0f,
+            [&](int from, int to) { float s = 0; for(int i = from; i < to; i++) s += values[i]; return s; },
+            [](float a, float b) { return a + b; });
+    };
+    job_system single;
+    float expected = sum(single);
+    for(int n : workercounts) {
+        job_system js;
+        js.start(n);
+        for(int rep = 0; rep < 5; rep++) EXPECT_EQ(sum(js), expected) << "workers " << n;
+    }
+}
+
+TEST(JobSystem, DependenciesRunFirst) {
+    for(int n : workercounts) {
+        job_system js;
+        js.start(n);
+        mutex m;
+        vector<int> order;
+        auto note = [&](int i) { lock_guard<mutex> lock(m); order.push_back(i); };
+        task_ptr a = js.spawn([&] { this_thread::sleep_for(chrono::milliseconds(2)); note(0); });
+        task_ptr b = js.spawn([&] { note(1); }, { a });
+        task_ptr c = js.spawn([&] { note(2); }, { a, nullptr });
+        task_ptr d = js.spawn([&] { note(3); }, { b, c });
+        js.wait(d);
+        ASSERT_EQ(order.size(), 4u);
+        EXPECT_EQ(order[0], 0);
+        EXPECT_EQ(order[3], 3);
+        EXPECT_TRUE(a->done() && b->done() && c->done());
+
+        // a chain keeps its order, like the frames of the movie encoder
+        order.clear();
+        task_ptr last;
+        for(int i = 0; i < 50; i++) last = js.spawn([&, i] { note(i); }, { last });
+        js.wait(last);
+        ASSERT_EQ(order.size(), 50u);
+        for(int i = 0; i < 50; i++) EXPECT_EQ(order[i], i);
+    }
+}
+
+TEST(JobSystem, NestedWaitsDoNotDeadlock) {
+    for(int n : workercounts) {
+        job_system js;
+        js.start(n);
+        atomic<int> leaves(0);
+        vector<task_ptr> outer;
+        for(int i = 0; i < 16; i++) outer.push_back(js.spawn([&] {
+            // every task waits for tasks it spawned itself, which only works if waiting runs them
+            js.parallel_for(0, 64, 4, [&](int from, int to) { leaves += to - from; });
+        }));
+        js.wait(outer);
+        EXPECT_EQ(leaves.load(), 16*64);
+    }
+}
+
+TEST(JobSystem, BackgroundTasksRun) {
+    for(int n : workercounts) {
+        job_system js;
+        js.start(n);
+        atomic<int> done(0);
+        vector<task_ptr> tasks;
+        for(int i = 0; i < 8; i++) tasks.push_back(js.spawn([&] { done++; }, {}, true));
+        js.wait(tasks);
+        EXPECT_EQ(done.load(), 8);
+    }
+}
+
+TEST(JobSystem, StopFinishesQueuedWork) {
+    atomic<int> done(0);
+    {
+        job_system js;
+        js.start(4);
+        for(int i = 0; i < 100; i++) js.spawn([&] { done++; });
+        js.start(2); // the surplus workers leave their queued tasks to the others
+        for(int i = 0; i < 100; i++) js.spawn([&] { done++; });
+        js.start(0);
+        for(int i = 0; i < 100; i++) js.spawn([&] { done++; });
+    }
+    EXPECT_EQ(done.load(), 300);
+}
+
+TEST(JobSystem, ResizingDoesNotWaitForBusyWorkers) {
+    job_system js;
+    js.start(4);
+    atomic<bool> release(false);
+    atomic<int> blocked(0);
+    vector<task_ptr> blockers;
+    for(int i = 0; i < 2; i++) blockers.push_back(js.spawn([&] { blocked++; while(!release) this_thread::yield(); }, {}, true));
+    while(blocked < 2) this_thread::yield();
+
+    auto start = chrono::steady_clock::now();
+    for(int n : { 1, 0, 6, 2 }) {
+        js.start(n);
+        EXPECT_EQ(js.numworkers(), n);
+        atomic<int> sum(0);
+        js.parallel_for(0, 1000, 10, [&](int from, int to) { for(int i = from; i < to; i++) sum += i; });
+        EXPECT_EQ(sum.load(), 999*1000/2);
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    EXPECT_LT(ms, 1000.0);
+    EXPECT_FALSE(blockers[0]->done());
+
+    release = true;
+    js.wait(blockers);
+}
+
+TEST(JobSystem, WaitingSleeps) {
+    job_system js;
+    js.start(1);
+    atomic<bool> started(false);
+    task_ptr slow = js.spawn([&] { started = true; this_thread::sleep_for(chrono::milliseconds(200)); });
+    while(!started) this_thread::yield();
+    // the process time, spinning in wait() would use up most of the 200 ms
+    clock_t cpu = clock();
+    js.wait(slow);
+    EXPECT_LT(1000.0*(clock() - cpu)/CLOCKS_PER_SEC, 50.0);
+}
+
+TEST(JobSystem, Topology) {
+    cpu_topology t = detect_cpu_topology();
+    EXPECT_GE(t.logical, 1);
+    EXPECT_GE(t.cores, 1);
+    EXPECT_GE(t.packages, 1);
+    EXPECT_LE(t.cores, t.logical);
+    EXPECT_LE(t.packages, t.cores);
+}
+
+// Not a correctness test: prints how parallel_for scales on this machine, with chunks small enough for the queueing to matter.
+TEST(JobSystem, Benchmark) {
+    cpu_topology t = detect_cpu_topology();
+    vector<float> data(1<<22);
+    for(size_t i = 0; i < data.size(); i++) data[i] = float(i%1000);
+    double basetime = 0;
+    for(int n = 0; n < t.logical; n = n ? n*2 : 1) {
+        job_system js;
+        js.start(n);
+        auto start = chrono::steady_clock::now();
+        double sum = 0;
+        for(int rep = 0; rep < 10; rep++) sum += js.parallel_reduce(0, int(data.size()), 4096, 0.0,
+            [&](int from, int to) { double s = 0; for(int i = from; i < to; i++) s += data[i]*data[i]; return s; },
+            [](double a, double b) { return a + b; });
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        if(!n) basetime = ms;
+        cout << "[ jobs     ] " << n << " workers: " << ms << " ms, speedup " << basetime/ms << " (" << sum << ")" << endl;
+    }
+    cout << "[ jobs     ] " << t.logical << " logical cpus, " << t.cores << " cores, " << t.packages << " packages" << endl;
+}
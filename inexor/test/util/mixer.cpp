@@ -0,0 +1,249 @@
+#include <chrono>                             // for steady_clock, duration
+#include <iostream>                           // for cout
+#include <memory>                             // for shared_ptr, make_shared
+#include <thread>                             // for thread
+#include <vector>                             // for vector
+
+#include "gtest/gtest-message.h"              // for Message
+#include "gtest/gtest-test-part.h"            // for TestPartResult
+#include "gtest/gtest.h"                      // for Test, TestInfo (ptr only)
+#include "inexor/util/mixer.hpp"              // for softmixer, spscqueue
+
+using namespace std;
+using namespace inexor::util;
+
+static shared_ptr<const pcmsample> makesample(int channels, int freq, const vector<short> &data)
+{
+    auto s = make_shared<pcmsample>();
+    s->channels = channels;
+    s->freq = freq;
+    s->data = data;
+    return s;
+}
+
+// Samples counting up from first, so the position of a voice can be read from the output.
+static shared_ptr<const pcmsample> makeramp(int frames, int first = 0)
+{
+    vector<short> data(frames);
+    for(int i = 0; i < frames; i++) data[i] = short(first + i);
+    return makesample(1, 44100, data);
+}
+
+static vector<short> mixframes(softmixer &m, int frames)
+{
+    vector<short> out(frames*2);
+    m.mix(out.data(), frames);
+    return out;
+}
+
+TEST(Mixer, QueueKeepsOrderAndLimit) {
+    spscqueue<int, 4> q;
+    for(int i = 0; i < 4; i++) EXPECT_TRUE(q.push(i));
+    EXPECT_FALSE(q.push(4));
+    int v;
+    for(int i = 0; i < 4; i++) { ASSERT_TRUE(q.pop(v)); EXPECT_EQ(v, i); }
+    EXPECT_FALSE(q.pop(v));
+
+    // one thread pushing, one popping
+    spscqueue<int, 16> shared;
+    const int count = 10000;
+    thread producer([&] { for(int i = 0; i < count; i++) while(!shared.push(i)) this_thread::yield(); });
+    int expected = 0;
+    while(expected < count)
+    {
+        if(shared.pop(v)) { ASSERT_EQ(v, expected); expected++; }
+        else this_thread::yield();
+    }
+    producer.join();
+}
+
+TEST(Mixer, MixesMonoAndStereo) {
+    // odd lengths, so the vector loops and their tails both get used
+    for(int frames : { 3, 8, 13 }) {
+        softmixer m(44100, 8);
+        vector<short> mono(frames), stereo(frames*2);
+        for(int i = 0; i < frames; i++) {
+            mono[i] = short(100*i - 500);
+            stereo[2*i] = short(40*i);
+            stereo[2*i + 1] = short(-80*i);
+        }
+        m.play(0, 1, makesample(1, 44100, mono), 1.0f, 0.5f);
+        m.play(1, 2, makesample(2, 44100, stereo), 0.5f, 0.25f);
+        vector<short> out = mixframes(m, frames);
+        for(int i = 0; i < frames; i++) {
+            EXPECT_EQ(out[2*i], short(mono[i] + stereo[2*i]/2)) << frames << " frames, frame " << i;
+            EXPECT_EQ(out[2*i + 1], short(mono[i]/2 + stereo[2*i + 1]/4)) << frames << " frames, frame " << i;
+        }
+    }
+}
+
+TEST(Mixer, Saturates) {
+    softmixer m(44100, 8);
+    m.play(0, 1, makesample(1, 44100, vector<short>(16, 30000)), 1.0f, 1.0f);
+    m.play(1, 2, makesample(1, 44100, vector<short>(16, 30000)), 1.0f, 1.0f);
+    m.play(2, 3, makesample(1, 44100, vector<short>(16, -30000)), 0.0f, 4.0f);
+    vector<short> out = mixframes(m, 16);
+    for(int i = 0; i < 16; i++) {
+        EXPECT_EQ(out[2*i], 32767);
+        EXPECT_EQ(out[2*i + 1], -32768);
+    }
+}
+
+TEST(Mixer, Resamples) {
+    for(int channels : { 1, 2 }) {
+        softmixer m(44100, 8);
+        vector<short> data;
+        for(int i = 0; i < 8; i++) for(int c = 0; c < channels; c++) data.push_back(short(1000*i*(c ? -1 : 1)));
+        m.play(0, 1, makesample(channels, 22050, data), 1.0f, 1.0f);
+        vector<short> out = mixframes(m, 20);
+        for(int i = 0; i < 20; i++) {
+            // halfway frames interpolate, beyond the end it stopped
+            int expected = i < 15 ? 500*i : (i < 16 ? 7000 : 0);
+            EXPECT_EQ(out[2*i], expected) << channels << " channels, frame " << i;
+            EXPECT_EQ(out[2*i + 1], channels > 1 ? -expected : expected) << channels << " channels, frame " << i;
+        }
+    }
+}
+
+TEST(Mixer, LoopsAndReportsFinished) {
+    softmixer m(44100, 8);
+    auto s = makesample(1, 44100, { 1, 2, 3 });
+    m.play(5, 42, s, 1.0f, 1.0f, 1, 1);
+    vector<short> out = mixframes(m, 8);
+    short expected[8] = { 1, 2, 3, 1, 2, 3, 0, 0 };
+    for(int i = 0; i < 8; i++) EXPECT_EQ(out[2*i], expected[i]);
+
+    softmixer::event e;
+    ASSERT_TRUE(m.finished(e));
+    EXPECT_EQ(e.voice, 5);
+    EXPECT_EQ(e.serial, 42u);
+    EXPECT_EQ(e.pcm, s);
+    EXPECT_FALSE(m.finished(e));
+
+    // forever until stopped, expiring after 5 frames
+    m.play(0, 1, s, 1.0f, 1.0f, 1, -1);
+    m.play(1, 2, s, 1.0f, 1.0f, 1, -1, 0, 0);
+    mixframes(m, 100);
+    ASSERT_TRUE(m.finished(e));
+    EXPECT_EQ(e.voice, 1);
+    EXPECT_FALSE(m.finished(e));
+    m.stop(0);
+    mixframes(m, 100);
+    ASSERT_TRUE(m.finished(e));
+    EXPECT_EQ(e.voice, 0);
+}
+
+TEST(Mixer, NeverFreesSamplesOnTheAudioThread) {
+    // the game thread does not take the reports for a while, more pile up than the queue holds
+    softmixer m(44100, 8);
+    const int plays = 1024 + softmixer::MAXVOICES + 50;
+    vector<weak_ptr<const pcmsample>> samples;
+    for(int i = 0; i < plays; i++) {
+        auto s = makesample(1, 44100, vector<short>(100, 1));
+        samples.push_back(s);
+        ASSERT_TRUE(m.play(0, i, s, 1.0f, 1.0f)); // replaces the one before
+        mixframes(m, 1);
+    }
+    for(auto &s : samples) EXPECT_FALSE(s.expired());
+
+    m.stop(0);
+    softmixer::event e;
+    int reports = 0;
+    for(int i = 0; i < 4; i++) {
+        while(m.finished(e)) { EXPECT_EQ(e.serial, unsigned(reports)); reports++; }
+        mixframes(m, 10);
+    }
+    EXPECT_EQ(reports, plays);
+}
+
+TEST(Mixer, MixesLongBlocksInPieces) {
+    softmixer m(44100, 8, 16);
+    auto s = makeramp(100, 1);
+    m.play(0, 1, s, 1.0f, 1.0f);
+    vector<short> out = mixframes(m, 120);
+    for(int i = 0; i < 120; i++) EXPECT_EQ(out[2*i], i < 100 ? i + 1 : 0) << "frame " << i;
+}
+
+TEST(Mixer, FadesAndRampsGain) {
+    softmixer m(1000, 8);
+    m.play(0, 1, makesample(1, 1000, vector<short>(1000, 1000)), 1.0f, 1.0f, 1, 0, 100);
+    vector<short> out = mixframes(m, 100);
+    EXPECT_EQ(out[0], 0);
+    EXPECT_NEAR(out[2*50], 500, 2);
+    EXPECT_NEAR(out[2*99], 990, 2);
+
+    // gain changes spread over the next block
+    m.setgain(0, 0.0f, 0.0f);
+    out = mixframes(m, 100);
+    EXPECT_NEAR(out[0], 1000, 2);
+    EXPECT_NEAR(out[2*50], 500, 2);
+    out = mixframes(m, 10);
+    EXPECT_EQ(out[0], 0);
+}
+
+TEST(Mixer, VirtualVoicesKeepTime) {
+    softmixer m(44100, 1);
+    m.play(0, 1, makesample(1, 44100, vector<short>(1000, 100)), 1.0f, 1.0f);
+    m.play(1, 2, makeramp(1000, 1), 0.5f, 0.5f);
+    vector<short> out = mixframes(m, 100);
+    // only the louder one is mixed
+    for(int i = 0; i < 100; i++) EXPECT_EQ(out[2*i], 100);
+
+    // once the loud voice is gone (ramping out in the next block) the quiet one fades in, then plays where it would have been
+    m.stop(0);
+    mixframes(m, 100);
+    mixframes(m, 100);
+    out = mixframes(m, 100);
+    for(int i = 0; i < 100; i++) EXPECT_NEAR(out[2*i], (301 + i)/2.0f, 1) << "frame " << i;
+
+    softmixer::stats s = m.getstats();
+    EXPECT_EQ(s.peakmixed, 1);
+    EXPECT_EQ(s.peakvoices, 2);
+    EXPECT_EQ(s.virtualframes, 100 + 100);
+}
+
+TEST(Mixer, PriorityDecidesWhoIsMixed) {
+    softmixer m(44100, 1);
+    m.play(0, 1, makesample(1, 44100, vector<short>(100, 100)), 1.0f, 1.0f, 1);
+    m.play(1, 2, makesample(1, 44100, vector<short>(100, 200)), 0.5f, 0.5f, 4);
+    vector<short> out = mixframes(m, 10);
+    EXPECT_EQ(out[0], 100);
+}
+
+TEST(Mixer, Attenuates) {
+    // in front, at the inner radius, halfway, beyond the radius, to the left, to the right, without a radius
+    float rx[] = { 0, 0, 0, 0, 10, -10, 0 }, ry[] = { 10, 10, 60, 200, 0, 0, 1000 }, dist[] = { 10, 10, 60, 200, 10, 10, 1000 };
+    float inner[] = { 0, 20, 10, 0, 0, 0, 0 }, radius[] = { 100, 100, 110, 100, 100, 100, 0 };
+    float gl[7], gr[7];
+    attenuate(7, rx, ry, dist, inner, radius, true, gl, gr);
+    EXPECT_FLOAT_EQ(gl[0], 0.45f);
+    EXPECT_FLOAT_EQ(gr[0], 0.45f);
+    EXPECT_FLOAT_EQ(gl[1], 0.5f);
+    EXPECT_FLOAT_EQ(gl[2] + gr[2], 0.5f);
+    EXPECT_FLOAT_EQ(gl[3] + gr[3], 0.0f);
+    EXPECT_FLOAT_EQ(gl[4], 0.9f);
+    EXPECT_FLOAT_EQ(gr[4], 0.0f);
+    EXPECT_FLOAT_EQ(gl[5], 0.0f);
+    EXPECT_FLOAT_EQ(gr[5], 0.9f);
+    EXPECT_FLOAT_EQ(gl[6], 0.5f);
+
+    attenuate(7, rx, ry, dist, inner, radius, false, gl, gr);
+    EXPECT_FLOAT_EQ(gl[4], 0.45f);
+    EXPECT_FLOAT_EQ(gr[4], 0.45f);
+}
+
+TEST(Mixer, Throughput) {
+    // what a second of 64 voices costs, half of them resampled
+    const int freq = 44100, block = 1024, voices = 64;
+    softmixer m(freq, 32);
+    auto native = makeramp(freq/2), other = makesample(2, 22050, vector<short>(freq, 1000));
+    for(int i = 0; i < voices; i++) m.play(i, i, i&1 ? other : native, 0.1f + 0.01f*i, 0.1f, 1, -1);
+    vector<short> out(block*2);
+    auto start = chrono::steady_clock::now();
+    for(int done = 0; done < freq; done += block) m.mix(out.data(), block);
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    softmixer::stats s = m.getstats();
+    cout << "[ mixer    ] " << voices << " voices (" << s.peakmixed << " mixed): " << ms << " ms per second of audio" << endl;
+    EXPECT_EQ(s.peakmixed, 32);
+    EXPECT_LT(ms, 1000.0);
+}
@@ -0,0 +1,170 @@
+#include <math.h>                             // for fabs
+#include <random>                             // for mt19937, uniform_real_distribution
+
+#include "gtest/gtest-message.h"              // for Message
+#include "gtest/gtest-test-part.h"            // for TestPartResult
+#include "gtest/gtest.h"                      // for Test, TestInfo (ptr only)
+#include "inexor/shared/geom.hpp"             // for vec, matrix4
+#include "inexor/shared/occlusionbuffer.hpp"  // for occlusionbuffer
+
+using namespace std;
+
+static const int WIDTH = 256, HEIGHT = 128;
+
+// The camera at the origin looking along +y with z up, set up like setcammatrix() and the main projection do it.
+static void setupbuffer(occlusionbuffer &buf)
+{
+    matrix4 cam(vec(-1, 0, 0), vec(0, 0, 1), vec(0, -1, 0)), proj, vp;
+    proj.perspective(90, float(WIDTH)/HEIGHT, 1, 4096);
+    vp.muld(proj, cam);
+    buf.setup(vp, vec(0, 0, 0), WIDTH, HEIGHT);
+}
+
+// A rectangle across the view direction at distance y.
+static bool addwall(occlusionbuffer &buf, float x1, float z1, float x2, float z2, float y)
+{
+    const vec v[4] = { vec(x1, y, z1), vec(x2, y, z1), vec(x2, y, z2), vec(x1, y, z2) };
+    return buf.addquad(v);
+}
+
+// Which side of the edge from a to b p is on, in screen space.
+static double edge(double ax, double ay, double bx, double by, double px, double py)
+{
+    return (bx - ax)*(py - ay) - (by - ay)*(px - ax);
+}
+
+TEST(OcclusionBuffer, RasterizesTriangles) {
+    occlusionbuffer buf;
+    setupbuffer(buf);
+    // a triangle is a quad with two corners in the same place
+    const vec v[4] = { vec(-60, 100, -30), vec(50, 120, -20), vec(-10, 80, 35), vec(-10, 80, 35) };
+    ASSERT_TRUE(buf.addquad(v));
+    buf.raster();
+
+    float x[3], y[3], z[3];
+    for(int i = 0; i < 3; i++) ASSERT_TRUE(buf.project(v[i], x[i], y[i], z[i]));
+    double area = edge(x[0], y[0], x[1], y[1], x[2], y[2]);
+    int covered = 0;
+    for(int py = 0; py < buf.height; py++) for(int px = 0; px < buf.width; px++)
+    {
+        double cx = px + 0.5, cy = py + 0.5,
+               w0 = edge(x[1], y[1], x[2], y[2], cx, cy)/area,
+               w1 = edge(x[2], y[2], x[0], y[0], cx, cy)/area,
+               w2 = edge(x[0], y[0], x[1], y[1], cx, cy)/area;
+        if(fabs(w0) < 1e-4 || fabs(w1) < 1e-4 || fabs(w2) < 1e-4) continue; // right on an edge, either way is fine
+        float d = buf.depth[py*buf.width + px];
+        if(w0 < 0 || w1 < 0 || w2 < 0) { EXPECT_EQ(d, 0) << px << " " << py; continue; }
+        // 1/w is linear in screen space, so it is the barycentric mix of the corners
+        EXPECT_NEAR(d, w0*z[0] + w1*z[1] + w2*z[2], 1e-5) << px << " " << py;
+        covered++;
+    }
+    EXPECT_NEAR(covered, fabs(area)/2, fabs(area)/20);
+}
+
+TEST(OcclusionBuffer, NearerOccludersWin) {
+    occlusionbuffer buf;
+    setupbuffer(buf);
+    ASSERT_TRUE(addwall(buf, -1000, -1000, 1000, 1000, 200));
+    ASSERT_TRUE(addwall(buf, -10, -10, 10, 10, 50));
+    buf.raster();
+    EXPECT_FLOAT_EQ(buf.depth[(HEIGHT/2)*WIDTH + WIDTH/2], 1.0f/50);
+    EXPECT_FLOAT_EQ(buf.depth[0], 1.0f/200);
+}
+
+TEST(OcclusionBuffer, CullsBoxesBehindOccluders) {
+    occlusionbuffer buf;
+    setupbuffer(buf);
+    ASSERT_TRUE(addwall(buf, -1000, -1000, 1000, 1000, 100));
+    buf.raster();
+    EXPECT_TRUE(buf.isoccluded(vec(-20, 200, -20), vec(20, 240, 20)));
+    EXPECT_TRUE(buf.isoccluded(vec(-1000, 101, -1000), vec(1000, 110, 1000)));
+    EXPECT_FALSE(buf.isoccluded(vec(-20, 40, -20), vec(20, 60, 20)));  // in front
+    EXPECT_FALSE(buf.isoccluded(vec(-20, 90, -20), vec(20, 110, 20))); // sticks through
+}
+
+TEST(OcclusionBuffer, KeepsPartlyVisibleBoxes) {
+    occlusionbuffer buf;
+    setupbuffer(buf);
+    ASSERT_TRUE(addwall(buf, -1000, -1000, 0, 1000, 100)); // the left half of the screen
+    buf.raster();
+    EXPECT_TRUE(buf.isoccluded(vec(-40, 200, -10), vec(-20, 220, 10)));
+    EXPECT_FALSE(buf.isoccluded(vec(-40, 200, -10), vec(1, 220, 10)));
+    // just beyond the edge of the wall, between the centres of the edge pixels
+    for(float x = -0.5f; x <= 0.5f; x += 0.05f)
+        EXPECT_FALSE(buf.isoccluded(vec(-20, 200, -10), vec(x, 200.5f, 10))) << x;
+    // nothing drawn at all
+    EXPECT_FALSE(buf.isoccluded(vec(20, 200, -10), vec(40, 220, 10)));
+}
+
+TEST(OcclusionBuffer, KeepsBoxesAtTheNearPlane) {
+    occlusionbuffer buf;
+    setupbuffer(buf);
+    ASSERT_TRUE(addwall(buf, -1000, -1000, 1000, 1000, 100));
+    buf.raster();
+    // everything else of them is behind the wall, but the camera is inside or right next to them
+    EXPECT_FALSE(buf.isoccluded(vec(-5, -5, -5), vec(5, 500, 5)));
+    EXPECT_FALSE(buf.isoccluded(vec(-5, 0, -5), vec(5, 500, 5)));
+    EXPECT_FALSE(buf.isoccluded(vec(-5, 0.001f, -5), vec(5, 500, 5)));
+    EXPECT_FALSE(buf.isoccluded(vec(-500, -50, -500), vec(500, 300, 500)));
+    // occluders crossing the near plane are dropped instead of drawn wrong
+    occlusionbuffer near;
+    setupbuffer(near);
+    const vec v[4] = { vec(-100, -10, -1), vec(100, -10, -1), vec(100, 300, -1), vec(-100, 300, -1) };
+    EXPECT_FALSE(near.addquad(v));
+}
+
+// Whether the segment from the camera to p passes through the convex quad q.
+static bool hidden(const vec q[4], const vec &p)
+{
+    vec n;
+    n.cross(vec(q[1]).sub(q[0]), vec(q[2]).sub(q[0]));
+    float np = n.dot(p);
+    if(fabs(np) < 1e-6f) return false;
+    float t = n.dot(q[0])/np; // where the ray from the origin hits the plane
+    if(t <= 0 || t >= 1) return false;
+    vec hit = vec(p).mul(t);
+    for(int i = 0; i < 4; i++)
+    {
+        vec e;
+        e.cross(vec(q[(i+1)&3]).sub(q[i]), vec(hit).sub(q[i]));
+        if(e.dot(n) < 0) return false;
+    }
+    return true;
+}
+
+TEST(OcclusionBuffer, IsConservative) {
+    mt19937 rng(1234);
+    uniform_real_distribution<float> unit(-1, 1);
+    int occluded = 0;
+    for(int i = 0; i < 20000; i++)
+    {
+        occlusionbuffer buf;
+        setupbuffer(buf);
+        // a rectangle somewhere in front of the camera, in any orientation
+        float dist = 20 + 100*(unit(rng) + 1);
+        vec c(unit(rng)*dist, dist, unit(rng)*dist/2), a(unit(rng), unit(rng), unit(rng)), b;
+        if(a.iszero()) continue;
+        a.normalize();
+        b.orthogonal(a);
+        b.normalize();
+        a.mul(dist*(0.2f + (unit(rng) + 1)));
+        b.mul(dist*(0.2f + (unit(rng) + 1)));
+        const vec q[4] = { vec(c).sub(a).sub(b), vec(c).add(a).sub(b), vec(c).add(a).add(b), vec(c).sub(a).add(b) };
+        if(!buf.addquad(q)) continue;
+        buf.raster();
+
+        // a box anywhere near or behind it, some of them reaching the camera
+        vec center = vec(c).mul(1 + unit(rng)), size(fabs(unit(rng)), fabs(unit(rng)), fabs(unit(rng)));
+        size.mul(dist/4);
+        vec bbmin = vec(center).sub(size), bbmax = vec(center).add(size);
+        if(!buf.isoccluded(bbmin, bbmax)) continue;
+        occluded++;
+        // the box is convex, so it is hidden if all of its corners are
+        for(int j = 0; j < 8; j++)
+        {
+            vec p(j&1 ? bbmax.x : bbmin.x, j&2 ? bbmax.y : bbmin.y, j&4 ? bbmax.z : bbmin.z);
+            ASSERT_TRUE(hidden(q, p)) << "case " << i << ", corner " << j;
+        }
+    }
+    EXPECT_GT(occluded, 200);
+}
@@ -0,0 +1,222 @@
+#include <string.h>                           // for memcpy
+#include <atomic>                             // for atomic
+#include <chrono>                             // for steady_clock, milliseconds
+#include <map>                                // for map
+#include <memory>                             // for shared_ptr
+#include <string>                             // for string
+#include <thread>                             // for sleep_for
+#include <vector>                             // for vector
+
+#include "gtest/gtest-message.h"              // for Message
+#include "gtest/gtest-test-part.h"            // for TestPartResult
+#include "gtest/gtest.h"                      // for Test, TestInfo (ptr only)
+#include "inexor/util/samplecache.hpp"        // for samplecache, pcmsample
+#include "inexor/util/vfs.hpp"                // for vfsdata
+
+using namespace std;
+using namespace inexor::util;
+
+typedef vector<unsigned char> bytes;
+
+static void put(bytes &b, const void *v, size_t len) { b.insert(b.end(), (const unsigned char *)v, (const unsigned char *)v + len); }
+static void put16(bytes &b, unsigned v) { unsigned char c[2] = { (unsigned char)v, (unsigned char)(v >> 8) }; put(b, c, 2); }
+static void put32(bytes &b, unsigned v) { put16(b, v & 0xFFFF); put16(b, v >> 16); }
+
+// A RIFF WAVE file around the raw sample data.
+static bytes makewav(int format, int channels, int freq, int bits, const bytes &samples)
+{
+    bytes b;
+    put(b, "RIFF", 4);
+    put32(b, unsigned(4 + 8 + 16 + 8 + samples.size()));
+    put(b, "WAVE", 4);
+    put(b, "fmt ", 4);
+    put32(b, 16);
+    put16(b, format);
+    put16(b, channels);
+    put32(b, freq);
+    put32(b, freq*channels*bits/8);
+    put16(b, channels*bits/8);
+    put16(b, bits);
+    put(b, "data", 4);
+    put32(b, unsigned(samples.size()));
+    b.insert(b.end(), samples.begin(), samples.end());
+    return b;
+}
+
+static bytes makewav16(int channels, int freq, const vector<short> &samples)
+{
+    bytes raw;
+    for(short s : samples) put16(raw, (unsigned short)s);
+    return makewav(1, channels, freq, 16, raw);
+}
+
+// Serves files from memory, optionally slowly, and counts the reads.
+struct memoryfiles
+{
+    map<string, bytes> files;
+    atomic<int> reads{0};
+    int delay = 0;
+
+    samplecache::reader reader()
+    {
+        return [this](const string &file, vfsdata &data)
+        {
+            reads++;
+            if(delay) this_thread::sleep_for(chrono::milliseconds(delay));
+            auto it = files.find(file);
+            if(it == files.end()) return false;
+            data.copy(it->second.data(), it->second.size());
+            return true;
+        };
+    }
+};
+
+TEST(SampleCache, DecodesWaveFormats) {
+    pcmsample s;
+    bytes w16 = makewav16(2, 22050, { 1, -2, 300, -400 });
+    ASSERT_TRUE(decodewav(w16.data(), w16.size(), s));
+    EXPECT_EQ(s.channels, 2);
+    EXPECT_EQ(s.freq, 22050);
+    EXPECT_EQ(s.frames(), 2);
+    EXPECT_EQ(s.data, vector<short>({ 1, -2, 300, -400 }));
+
+    bytes u8 = makewav(1, 1, 8000, 8, { 0, 128, 255 });
+    ASSERT_TRUE(decodewav(u8.data(), u8.size(), s));
+    EXPECT_EQ(s.data, vector<short>({ -32768, 0, 127 << 8 }));
+
+    bytes raw24 = { 0x00, 0x34, 0x12, 0x00, 0x00, 0x80 };
+    bytes w24 = makewav(1, 1, 8000, 24, raw24);
+    ASSERT_TRUE(decodewav(w24.data(), w24.size(), s));
+    EXPECT_EQ(s.data, vector<short>({ 0x1234, -32768 }));
+
+    bytes rawf;
+    for(float f : { 0.0f, 1.0f, -2.0f })
+    {
+        unsigned u;
+        memcpy(&u, &f, 4);
+        put32(rawf, u);
+    }
+    bytes wf = makewav(3, 1, 8000, 32, rawf);
+    ASSERT_TRUE(decodewav(wf.data(), wf.size(), s));
+    EXPECT_EQ(s.data, vector<short>({ 0, 32767, -32767 }));
+
+    // more than two channels keep the first two
+    bytes w4 = makewav16(4, 8000, { 1, 2, 3, 4, 5, 6, 7, 8 });
+    ASSERT_TRUE(decodewav(w4.data(), w4.size(), s));
+    EXPECT_EQ(s.channels, 2);
+    EXPECT_EQ(s.data, vector<short>({ 1, 2, 5, 6 }));
+
+    bytes junk = { 'O', 'g', 'g', 'S', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    EXPECT_FALSE(decodewav(junk.data(), junk.size(), s));
+    bytes adpcm = makewav(2, 1, 8000, 4, { 0, 0 });
+    EXPECT_FALSE(decodewav(adpcm.data(), adpcm.size(), s));
+}
+
+TEST(SampleCache, ResamplesLinearly) {
+    pcmsample s;
+    s.channels = 1;
+    s.freq = 11025;
+    s.data = { 0, 100, 200, 300 };
+    resamplepcm(s, 22050);
+    EXPECT_EQ(s.freq, 22050);
+    EXPECT_EQ(s.data, vector<short>({ 0, 50, 100, 150, 200, 250, 300, 300 }));
+
+    resamplepcm(s, 11025);
+    EXPECT_EQ(s.data, vector<short>({ 0, 100, 200, 300 }));
+}
+
+TEST(SampleCache, LoadsAtTheOutputRate) {
+    memoryfiles fs;
+    fs.files["a.wav"] = makewav16(1, 22050, vector<short>(100, 7));
+    samplecache cache(44100, 1<<20, fs.reader());
+    shared_ptr<const pcmsample> a = cache.load("a.wav");
+    ASSERT_TRUE(a != nullptr);
+    EXPECT_EQ(a->freq, 44100);
+    EXPECT_EQ(a->frames(), 200);
+    EXPECT_EQ(cache.request("a.wav"), a);
+    EXPECT_EQ(fs.reads.load(), 1);
+}
+
+TEST(SampleCache, SharesIdenticalFiles) {
+    memoryfiles fs;
+    fs.files["game/hit.wav"] = fs.files["map/hit.wav"] = makewav16(1, 44100, vector<short>(1000, 1));
+    fs.files["other.wav"] = makewav16(1, 44100, vector<short>(1000, 2));
+    samplecache cache(44100, 1<<20, fs.reader());
+    shared_ptr<const pcmsample> a = cache.load("game/hit.wav"), b = cache.load("map/hit.wav"), c = cache.load("other.wav");
+    ASSERT_TRUE(a && b && c);
+    EXPECT_EQ(a, b);
+    EXPECT_NE(a, c);
+    samplecache::stats s = cache.getstats();
+    EXPECT_EQ(s.loads, 2);
+    EXPECT_EQ(s.shared, 1);
+    EXPECT_EQ(s.bytes, a->bytes() + c->bytes());
+    EXPECT_EQ(fs.reads.load(), 4); // the first file got read again to compare it with the second
+}
+
+TEST(SampleCache, EvictsLeastRecentlyUsed) {
+    memoryfiles fs;
+    for(int i = 0; i < 4; i++) fs.files[to_string(i)] = makewav16(1, 44100, vector<short>(500, short(i)));
+    // room for three samples of 1000 bytes
+    samplecache cache(44100, 3000, fs.reader());
+    cache.load("0");
+    cache.load("1");
+    shared_ptr<const pcmsample> playing = cache.load("2");
+    cache.load("0"); // "1" is the least recently used now
+    cache.load("3");
+    EXPECT_EQ(cache.getstats().evictions, 1);
+    int reads = fs.reads;
+    cache.load("0");
+    cache.load("3");
+    EXPECT_EQ(fs.reads.load(), reads);
+    cache.load("1");
+    EXPECT_EQ(fs.reads.load(), reads + 1);
+
+    // a sample which is still held (playing) is never dropped
+    cache.setlimit(0);
+    EXPECT_EQ(cache.getstats().bytes, playing->bytes());
+    EXPECT_EQ(cache.request("2"), playing);
+}
+
+TEST(SampleCache, RequestNeverBlocks) {
+    memoryfiles fs;
+    fs.delay = 200;
+    fs.files["slow.wav"] = makewav16(1, 44100, vector<short>(100));
+    samplecache cache(44100, 1<<20, fs.reader());
+    auto start = chrono::steady_clock::now();
+    EXPECT_TRUE(cache.request("slow.wav") == nullptr);
+    EXPECT_TRUE(cache.request("slow.wav") == nullptr);
+    double millis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    EXPECT_LT(millis, 100.0);
+
+    ASSERT_TRUE(cache.load("slow.wav") != nullptr);
+    samplecache::stats s = cache.getstats();
+    EXPECT_EQ(s.loads, 1);
+    EXPECT_GE(s.maxlatency, 150.0);
+    EXPECT_GE(s.totallatency, s.maxlatency);
+    EXPECT_EQ(fs.reads.load(), 1);
+}
+
+TEST(SampleCache, RemembersFailures) {
+    memoryfiles fs;
+    fs.files["music.ogg"] = { 'O', 'g', 'g', 'S' };
+    samplecache cache(44100, 1<<20, fs.reader());
+    EXPECT_TRUE(cache.load("music.ogg") == nullptr);
+    EXPECT_TRUE(cache.load("missing.wav") == nullptr);
+    EXPECT_TRUE(cache.failed("music.ogg"));
+    EXPECT_TRUE(cache.failed("missing.wav"));
+    EXPECT_EQ(cache.getstats().failures, 2);
+    EXPECT_EQ(fs.reads.load(), 2);
+
+    cache.clear();
+    EXPECT_FALSE(cache.failed("music.ogg"));
+}
+
+TEST(SampleCache, ChangingTheRateDropsEverything) {
+    memoryfiles fs;
+    fs.files["a.wav"] = makewav16(1, 44100, vector<short>(100));
+    samplecache cache(44100, 1<<20, fs.reader());
+    EXPECT_EQ(cache.load("a.wav")->frames(), 100);
+    cache.setfreq(22050);
+    EXPECT_EQ(cache.getstats().bytes, 0u);
+    EXPECT_EQ(cache.load("a.wav")->frames(), 50);
+}
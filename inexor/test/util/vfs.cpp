@@ -0,0 +1,270 @@
+#include <stdio.h>                            // for FILE, fopen, fwrite
+#include <stdlib.h>                           // for mkdtemp
+#include <string.h>                           // for memcmp, memset
+#include <algorithm>                          // for find, sort
+#include <string>                             // for string
+#include <vector>                             // for vector
+#include <zlib.h>                             // for deflate, crc32
+
+#ifdef WIN32
+#include <direct.h>                           // for _mkdir, _rmdir
+#include <windows.h>                          // for GetTempPath
+#else
+#include <sys/stat.h>                         // for mkdir
+#include <unistd.h>                           // for rmdir
+#endif
+
+#include "gtest/gtest-message.h"              // for Message
+#include "gtest/gtest-test-part.h"            // for TestPartResult
+#include "gtest/gtest.h"                      // for Test, TestInfo (ptr only)
+#include "inexor/util/vfs.hpp"                // for vfsindex, vfsdata
+
+using namespace std;
+using namespace inexor::util;
+
+typedef vector<unsigned char> bytes;
+
+static void put(bytes &b, const void *v, size_t len) { b.insert(b.end(), (const unsigned char *)v, (const unsigned char *)v + len); }
+static void put16(bytes &b, unsigned v) { unsigned char c[2] = { (unsigned char)v, (unsigned char)(v >> 8) }; put(b, c, 2); }
+static void put32(bytes &b, unsigned v) { put16(b, v & 0xFFFF); put16(b, v >> 16); }
+
+static vector<string> created; // to clean up, in the order they were made
+
+static string makedir(const string &dir)
+{
+#ifdef WIN32
+    _mkdir(dir.c_str());
+#else
+    mkdir(dir.c_str(), 0777);
+#endif
+    created.push_back(dir);
+    return dir + "/";
+}
+
+static void removedir(const string &dir)
+{
+#ifdef WIN32
+    _rmdir(dir.c_str());
+#else
+    rmdir(dir.c_str());
+#endif
+}
+
+static string maketempdir()
+{
+#ifdef WIN32
+    char tmp[MAX_PATH];
+    GetTempPathA(MAX_PATH, tmp);
+    return makedir(string(tmp) + "vfstest" + to_string(GetCurrentProcessId()));
+#else
+    char tmp[] = "/tmp/vfstestXXXXXX";
+    created.push_back(mkdtemp(tmp));
+    return created.back() + "/";
+#endif
+}
+
+static void writefile(const string &name, const bytes &data)
+{
+    FILE *f = fopen(name.c_str(), "wb");
+    ASSERT_TRUE(f != nullptr) << name;
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+    created.push_back(name);
+}
+
+static bytes text(const string &s) { return bytes(s.begin(), s.end()); }
+
+struct zipentry
+{
+    string name;
+    bytes data;
+    bool deflated;
+};
+
+// A zip archive with a central directory, written the way common zip tools do it.
+static bytes makezip(const vector<zipentry> &entries)
+{
+    bytes zip, cd;
+    for(const zipentry &e : entries)
+    {
+        bytes packed = e.data;
+        if(e.deflated)
+        {
+            packed.resize(compressBound(uLong(e.data.size())) + 64);
+            z_stream zs;
+            memset(&zs, 0, sizeof(zs));
+            deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+            zs.next_in = const_cast<Bytef *>(e.data.data());
+            zs.avail_in = uInt(e.data.size());
+            zs.next_out = packed.data();
+            zs.avail_out = uInt(packed.size());
+            deflate(&zs, Z_FINISH);
+            packed.resize(zs.total_out);
+            deflateEnd(&zs);
+        }
+        unsigned crc = unsigned(crc32(0, e.data.data(), uInt(e.data.size())));
+        unsigned local = unsigned(zip.size());
+        put(zip, "PK\3\4", 4);
+        put16(zip, 20); put16(zip, 0); put16(zip, e.deflated ? 8 : 0); put32(zip, 0);
+        put32(zip, crc); put32(zip, unsigned(packed.size())); put32(zip, unsigned(e.data.size()));
+        put16(zip, unsigned(e.name.size())); put16(zip, 4);
+        put(zip, e.name.data(), e.name.size());
+        put32(zip, 0xDEADBEEF); // an extra field, so the data offset has to come from the local header
+        put(zip, packed.data(), packed.size());
+
+        put(cd, "PK\1\2", 4);
+        put16(cd, 20); put16(cd, 20); put16(cd, 0); put16(cd, e.deflated ? 8 : 0); put32(cd, 0);
+        put32(cd, crc); put32(cd, unsigned(packed.size())); put32(cd, unsigned(e.data.size()));
+        put16(cd, unsigned(e.name.size())); put16(cd, 0); put16(cd, 0); put16(cd, 0); put16(cd, 0); put32(cd, 0);
+        put32(cd, local);
+        put(cd, e.name.data(), e.name.size());
+    }
+    unsigned cdoffset = unsigned(zip.size());
+    put(zip, cd.data(), cd.size());
+    put(zip, "PK\5\6", 4);
+    put16(zip, 0); put16(zip, 0); put16(zip, unsigned(entries.size())); put16(zip, unsigned(entries.size()));
+    put32(zip, unsigned(cd.size())); put32(zip, cdoffset);
+    put16(zip, 7);
+    put(zip, "comment", 7);
+    return zip;
+}
+
+static string contents(const vfsdata &d) { return string((const char *)d.data(), d.size()); }
+
+class Vfs : public ::testing::Test
+{
+protected:
+    string first, second;
+    vfsindex index;
+
+    void SetUp() override
+    {
+        first = maketempdir();
+        second = maketempdir();
+        makedir(first + "data");
+        makedir(first + "data/sub");
+        makedir(first + "empty");
+        makedir(second + "data");
+        writefile(first + "data/a.cfg", text("first a"));
+        writefile(first + "data/sub/b.cfg", text("first b"));
+        writefile(first + "data/zero.cfg", bytes());
+        writefile(second + "data/a.cfg", text("second a"));
+        writefile(second + "data/c.cfg", text("second c"));
+        writefile(second + "readme.txt", text("readme"));
+
+        bytes big;
+        for(int i = 0; i < 10000; i++) big.push_back((unsigned char)('a' + i%7));
+        writefile(second + "pack.zip", makezip({
+            { "data/c.cfg", text("zipped c"), false },       // the loose file wins
+            { "data/d.cfg", text("stored d"), false },
+            { "models/big.obj", big, true },
+            { "models/empty.obj", bytes(), true },
+            { "models/", bytes(), false },
+            { "../outside.cfg", text("evil"), false },
+        }));
+        ASSERT_GT(index.addroot(first.c_str()), 0);
+        ASSERT_GT(index.addroot(second.c_str()), 0);
+    }
+
+    void TearDown() override
+    {
+        index.clear();
+        for(auto it = created.rbegin(); it != created.rend(); ++it) if(remove(it->c_str())) removedir(*it);
+        created.clear();
+    }
+};
+
+TEST_F(Vfs, FindsFilesByPriority) {
+    vfsdata d;
+    ASSERT_TRUE(index.load("data/a.cfg", d));
+    EXPECT_EQ(contents(d), "first a");
+    ASSERT_TRUE(index.load("./data//sub/b.cfg", d));
+    EXPECT_EQ(contents(d), "first b");
+    ASSERT_TRUE(index.load("data\\c.cfg", d));
+    EXPECT_EQ(contents(d), "second c");
+    EXPECT_TRUE(d.iszerocopy());
+    ASSERT_TRUE(index.load("data/zero.cfg", d));
+    EXPECT_EQ(d.size(), 0u);
+
+    const vfsindex::entry *e = index.find("data/a.cfg");
+    ASSERT_TRUE(e != nullptr);
+    EXPECT_EQ(e->root, 0);
+    EXPECT_EQ(e->archive, -1);
+    EXPECT_EQ(e->path, first + "data/a.cfg");
+
+    EXPECT_EQ(index.find("data/missing.cfg"), nullptr);
+    EXPECT_EQ(index.find("data"), nullptr);
+    EXPECT_TRUE(index.isdir("data/sub"));
+    EXPECT_TRUE(index.isdir("models"));
+    EXPECT_FALSE(index.isdir("data/a.cfg"));
+}
+
+TEST_F(Vfs, RejectsNamesOutsideTheRoots) {
+    EXPECT_FALSE(vfsindex::indexable("../data/a.cfg"));
+    EXPECT_FALSE(vfsindex::indexable("data/../../a.cfg"));
+    EXPECT_FALSE(vfsindex::indexable("/etc/passwd"));
+    EXPECT_FALSE(vfsindex::indexable("c:\\autoexec.bat"));
+    EXPECT_FALSE(vfsindex::indexable("<mad:0/0/0>textures/a.png"));
+    EXPECT_TRUE(vfsindex::indexable("data/a.cfg"));
+    EXPECT_EQ(index.find("../outside.cfg"), nullptr);
+    EXPECT_EQ(index.find("outside.cfg"), nullptr);
+}
+
+TEST_F(Vfs, ReadsArchives) {
+    vfsdata d;
+    ASSERT_TRUE(index.load("data/d.cfg", d));
+    EXPECT_EQ(contents(d), "stored d");
+    EXPECT_TRUE(d.iszerocopy());
+    const vfsindex::entry *e = index.find("data/d.cfg");
+    ASSERT_TRUE(e != nullptr);
+    EXPECT_EQ(e->root, 1);
+    EXPECT_EQ(index.archivename(*e), second + "pack.zip");
+
+    ASSERT_TRUE(index.load("models/big.obj", d));
+    ASSERT_EQ(d.size(), 10000u);
+    EXPECT_FALSE(d.iszerocopy());
+    for(int i = 0; i < 10000; i++) ASSERT_EQ(d.data()[i], (unsigned char)('a' + i%7)) << i;
+
+    vfsdata empty; // one which never had a buffer
+    ASSERT_TRUE(index.load("models/empty.obj", empty));
+    EXPECT_EQ(empty.size(), 0u);
+
+    // the data stays valid after the index forgot the archive
+    ASSERT_TRUE(index.load("data/d.cfg", d));
+    index.clear();
+    EXPECT_EQ(contents(d), "stored d");
+    EXPECT_EQ(index.find("data/d.cfg"), nullptr);
+}
+
+TEST_F(Vfs, ListsDirectories) {
+    vector<string> files;
+    ASSERT_TRUE(index.list("data", "cfg", files));
+    sort(files.begin(), files.end());
+    EXPECT_EQ(files, vector<string>({ "a", "c", "d", "zero" }));
+
+    files.clear();
+    ASSERT_TRUE(index.list("data/", nullptr, files));
+    sort(files.begin(), files.end());
+    EXPECT_EQ(files, vector<string>({ ".", "..", "a.cfg", "c.cfg", "d.cfg", "sub", "zero.cfg" }));
+
+    files.clear();
+    ASSERT_TRUE(index.list("", nullptr, files));
+    for(const char *name : { "data", "empty", "models", "readme.txt", "pack.zip" })
+        EXPECT_NE(find(files.begin(), files.end(), name), files.end()) << name;
+
+    files.clear();
+    EXPECT_TRUE(index.list("empty", "cfg", files));
+    EXPECT_TRUE(files.empty());
+    EXPECT_FALSE(index.list("nothere", nullptr, files));
+}
+
+TEST_F(Vfs, CountsLookups) {
+    index.find("data/a.cfg");
+    index.find("data/nothere.cfg");
+    vfsindex::stats s = index.getstats();
+    EXPECT_EQ(s.roots, 2);
+    EXPECT_EQ(s.archives, 1);
+    EXPECT_EQ(s.files, 9); // 6 loose ones (the zip among them) and 3 out of the zip
+    EXPECT_EQ(s.lookups, 2);
+    EXPECT_EQ(s.misses, 1);
+}
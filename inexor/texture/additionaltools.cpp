@@ -1,30 +1,28 @@
 /// @file additionaltools.cpp
 /// additional texture generation tools provided by the engine.
 
-#include <SDL_opengl.h>                       // for GL_COMPRESSED_RGB_S3TC_...
-#include <string.h>                           // for memcpy, memset, strlen
-#include <algorithm>                          // for max
+#include <string.h>                           // for memcpy, memmove, strlen
+#include <strings.h>                          // for strcasecmp
 #include <memory>                             // for __shared_ptr
+#include <vector>                             // for vector
 
-#include "SDL_opengl.h"                       // for glGetTexLevelParameteriv
-#include "inexor/engine/glexts.hpp"           // for glGetCompressedTexImage_
-#include "inexor/engine/rendergl.hpp"         // for hasS3TC
 #include "inexor/io/Logging.hpp"              // for Log, Logger, log_manager
 #include "inexor/io/legacy/stream.hpp"        // for stream, openfile, path
-#include "inexor/network/SharedVar.hpp"       // for SharedVar
 #include "inexor/shared/cube_endian.hpp"      // for lilswap
 #include "inexor/shared/cube_formatting.hpp"  // for concatstring, defformat...
 #include "inexor/shared/cube_tools.hpp"       // for copystring
 #include "inexor/shared/cube_types.hpp"       // for uchar, uint, string
 #include "inexor/shared/geom.hpp"             // for bvec, vec
-#include "inexor/shared/tools.hpp"            // for max
 #include "inexor/texture/compressedtex.hpp"   // for DDSURFACEDESC2, DDSURFA...
 #include "inexor/texture/image.hpp"           // for ImageData
 #include "inexor/texture/macros.hpp"          // for dst, src, read2writetex
 #include "inexor/texture/savetexture.hpp"     // for guessimageformat, savei...
 //#include "inexor/texture/additionaltools.hpp"
-#include "inexor/texture/texsettings.hpp"     // for usetexcompress
-#include "inexor/texture/texture.hpp"         // for loadimage, gettexture
+#include "inexor/texture/slot.hpp"            // for texturedata
+#include "inexor/texture/texture.hpp"         // for loadimage
+#include "inexor/util/blockcompression.hpp"   // for compressmipmaps, bcformat
+
+using namespace inexor::util;
 
 void flipnormalmapy(char *destfile, char *normalfile) // jpg/png /tga-> tga
 {
@@ -50,97 +48,52 @@ void mergenormalmaps(char *heightfile, char *normalfile) // jpg/png/tga + tga ->
     saveimage(normalfile, guessimageformat(normalfile, IMG_TGA), d);
 }
 
-void gendds(char *infile, char *outfile)
+/// Write a DDS file of the image (and its <commands>) compressed on the CPU, so this works without S3TC support of the driver.
+/// format is one of dxt1, dxt1a, dxt5 or bc5 (for normal maps), by default dxt5 is used for images with alpha and dxt1 otherwise.
+void gendds(char *infile, char *outfile, char *format)
 {
-    if(!hasS3TC || usetexcompress <= 1) { Log.std->error("OpenGL driver does not support S3TC texture compression"); return; }
-
-    glHint(GL_TEXTURE_COMPRESSION_HINT, GL_NICEST);
-
-    defformatstring(cfile, "<compress>%s", infile);
-    extern void reloadtex(char *name);
-    Texture *t = gettexture(cfile);
-    if(t) reloadtex(cfile);
-    t = textureload(cfile);
-    if(t == notexture) { Log.std->error("failed loading {}", infile); return; }
-
-    glBindTexture(GL_TEXTURE_2D, t->id);
-    GLint compressed = 0, format = 0, width = 0, height = 0;
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    ImageData s;
+    if(!texturedata(s, infile) || s.compressed) { Log.std->error("failed loading {}", infile); return; }
 
-    if(!compressed) { Log.std->error("failed compressing {}", infile); return; }
-    int fourcc = 0;
-    switch(format)
-    {
-    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: fourcc = FOURCC_DXT1; Log.std->info("compressed as DXT1"); break;
-    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: fourcc = FOURCC_DXT1; Log.std->info("compressed as DXT1a"); break;
-    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: fourcc = FOURCC_DXT3; Log.std->info("compressed as DXT3"); break;
-    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: fourcc = FOURCC_DXT5; Log.std->info("compressed as DXT5"); break;
-    default:
-        Log.std->error("failed compressing {0}: unknown format: {1:#x}", infile, format); break;
-        return;
-    }
+    bool alpha = s.bpp == 2 || s.bpp == 4;
+    bcformat bc = alpha ? BC3 : BC1;
+    if(!strcasecmp(format, "dxt1")) bc = BC1;
+    else if(!strcasecmp(format, "dxt1a")) bc = BC1A;
+    else if(!strcasecmp(format, "dxt5")) bc = BC3;
+    else if(!strcasecmp(format, "bc5") || !strcasecmp(format, "ati2")) bc = BC5;
+    else if(format[0]) { Log.std->error("unknown DDS format: {}", format); return; }
 
     if(!outfile[0])
     {
         static string buf;
         copystring(buf, infile);
+        if(buf[0] == '<')
+        {
+            char *file = strrchr(buf, '>');
+            if(file) memmove(buf, file + 1, strlen(file));
+        }
         int len = strlen(buf);
         if(len > 4 && buf[len - 4] == '.') memcpy(&buf[len - 4], ".dds", 4);
         else concatstring(buf, ".dds");
         outfile = buf;
     }
 
+    std::vector<uchar> data;
+    int levels = compressmipmaps(bc, s.data, s.w, s.h, s.bpp, s.pitch, data);
+
     stream *f = openfile(path(outfile, true), "wb");
     if(!f) { Log.std->error("failed writing to {}", outfile); return; }
 
-    int csize = 0;
-    for(int lw = width, lh = height, level = 0;;)
-    {
-        GLint size = 0;
-        glGetTexLevelParameteriv(GL_TEXTURE_2D, level++, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
-        csize += size;
-        if(max(lw, lh) <= 1) break;
-        if(lw > 1) lw /= 2;
-        if(lh > 1) lh /= 2;
-    }
-
+    static const uint fourccs[] = { FOURCC_DXT1, FOURCC_DXT1, FOURCC_DXT5, FOURCC_ATI2 };
     DDSURFACEDESC2 d;
-    memset(&d, 0, sizeof(d));
-    d.dwSize = sizeof(DDSURFACEDESC2);
-    d.dwWidth = width;
-    d.dwHeight = height;
-    d.dwLinearSize = csize;
-    d.dwFlags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE | DDSD_MIPMAPCOUNT;
-    d.ddsCaps.dwCaps = DDSCAPS_TEXTURE | DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
-    d.ddpfPixelFormat.dwSize = sizeof(DDPIXELFORMAT);
-    d.ddpfPixelFormat.dwFlags = DDPF_FOURCC | (format != GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? DDPF_ALPHAPIXELS : 0);
-    d.ddpfPixelFormat.dwFourCC = fourcc;
-
-    uchar *data = new uchar[csize], *dst = data;
-    for(int lw = width, lh = height;;)
-    {
-        GLint size;
-        glGetTexLevelParameteriv(GL_TEXTURE_2D, d.dwMipMapCount, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
-        glGetCompressedTexImage_(GL_TEXTURE_2D, d.dwMipMapCount++, dst);
-        dst += size;
-        if(max(lw, lh) <= 1) break;
-        if(lw > 1) lw /= 2;
-        if(lh > 1) lh /= 2;
-    }
-
+    initddsheader(d, fourccs[bc], bc == BC1A || bc == BC3, s.w, s.h, levels, int(data.size()));
     lilswap((uint *)&d, sizeof(d) / sizeof(uint));
 
     f->write("DDS ", 4);
     f->write(&d, sizeof(d));
-    f->write(data, csize);
+    f->write(data.data(), data.size());
     delete f;
 
-    delete[] data;
-
-    Log.std->info("wrote DDS file {}", outfile);
-
-    setuptexcompress();
+    static const char * const names[] = { "DXT1", "DXT1a", "DXT5", "BC5" };
+    Log.std->info("wrote DDS file {} ({}, {} x {}, {} mipmaps)", outfile, names[bc], s.w, s.h, levels);
 }
@@ -3,5 +3,5 @@
 
 extern void flipnormalmapy(char *destfile, char *normalfile);
 extern void mergenormalmaps(char *heightfile, char *normalfile);
-extern void gendds(char *infile, char *outfile);
+extern void gendds(char *infile, char *outfile, char *format);
 
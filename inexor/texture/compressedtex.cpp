@@ -14,129 +14,37 @@
 #include "inexor/shared/command.hpp"                  // for VAR
 #include "inexor/shared/cube_endian.hpp"              // for lilswap
 #include "inexor/shared/cube_loops.hpp"               // for loop
-#include "inexor/shared/geom.hpp"                     // for bvec, bvec4
 #include "inexor/shared/tools.hpp"                    // for min
 #include "inexor/texture/compressedtex.hpp"
 #include "inexor/texture/image.hpp"                   // for ImageData
+#include "inexor/util/blockcompression.hpp"           // for decodebc1, decodebc2
 
-VAR(dbgdds, 0, 0, 1);
-
-#define DECODEDDS(name, dbpp, initblock, writeval, nextval) \
-static void name(ImageData &s) \
-{ \
-    ImageData d(s.w, s.h, dbpp); \
-    uchar *dst = d.data; \
-    const uchar *src = s.data; \
-    for(int by = 0; by < s.h; by += s.align) \
-        { \
-        for(int bx = 0; bx < s.w; bx += s.align, src += s.bpp) \
-                { \
-            int maxy = min(d.h - by, s.align), maxx = min(d.w - bx, s.align); \
-            initblock; \
-            loop(y, maxy) \
-            { \
-                int x; \
-                for(x = 0; x < maxx; ++x) \
-                                { \
-                    writeval; \
-                    nextval; \
-                    dst += d.bpp; \
-                                }  \
-                for(; x < s.align; ++x) { nextval; } \
-                dst += d.pitch - maxx*d.bpp; \
-            } \
-            dst += maxx*d.bpp - maxy*d.pitch; \
-                } \
-        dst += (s.align-1)*d.pitch; \
-        } \
-    s.replace(d); \
-}
+using namespace inexor::util;
 
-DECODEDDS(decodedxt1, s.compressed == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ? 4 : 3,
-    ushort color0 = lilswap(*(const ushort *)src);
-ushort color1 = lilswap(*(const ushort *)&src[2]);
-uint bits = lilswap(*(const uint *)&src[4]);
-bvec4 rgba[4];
-rgba[0] = bvec4(bvec::from565(color0), 0xFF);
-rgba[1] = bvec4(bvec::from565(color1), 0xFF);
-if(color0 > color1)
-{
-    rgba[2].lerp(rgba[0], rgba[1], 2, 1, 3);
-    rgba[3].lerp(rgba[0], rgba[1], 1, 2, 3);
-}
-else
-{
-    rgba[2].lerp(rgba[0], rgba[1], 1, 1, 2);
-    rgba[3] = bvec4(0, 0, 0, 0);
-}
-,
-memcpy(dst, rgba[bits & 3].v, d.bpp);
-,
-bits >>= 2;
-);
-
-DECODEDDS(decodedxt3, 4,
-    ullong alpha = lilswap(*(const ullong *)src);
-ushort color0 = lilswap(*(const ushort *)&src[8]);
-ushort color1 = lilswap(*(const ushort *)&src[10]);
-uint bits = lilswap(*(const uint *)&src[12]);
-bvec rgb[4];
-rgb[0] = bvec::from565(color0);
-rgb[1] = bvec::from565(color1);
-rgb[2].lerp(rgb[0], rgb[1], 2, 1, 3);
-rgb[3].lerp(rgb[0], rgb[1], 1, 2, 3);
-,
-memcpy(dst, rgb[bits & 3].v, 3);
-dst[3] = ((alpha & 0xF) * 1088 + 32) >> 6;
-,
-bits >>= 2;
-alpha >>= 4;
-);
+VAR(dbgdds, 0, 0, 1);
 
-static inline void decodealpha(uchar alpha0, uchar alpha1, uchar alpha[8])
+/// Replace the blocks of s with an uncompressed image of dbpp bytes per pixel, decode turns one block into 16 rgba pixels.
+static void decodeblocks(ImageData &s, int dbpp, void (*decode)(const uchar *, uchar *))
 {
-    alpha[0] = alpha0;
-    alpha[1] = alpha1;
-    if(alpha0 > alpha1)
+    ImageData d(s.w, s.h, dbpp);
+    const uchar *src = s.data;
+    uchar rgba[16*4];
+    for(int by = 0; by < s.h; by += s.align)
     {
-        alpha[2] = (6 * alpha0 + alpha1) / 7;
-        alpha[3] = (5 * alpha0 + 2 * alpha1) / 7;
-        alpha[4] = (4 * alpha0 + 3 * alpha1) / 7;
-        alpha[5] = (3 * alpha0 + 4 * alpha1) / 7;
-        alpha[6] = (2 * alpha0 + 5 * alpha1) / 7;
-        alpha[7] = (alpha0 + 6 * alpha1) / 7;
-    }
-    else
-    {
-        alpha[2] = (4 * alpha0 + alpha1) / 5;
-        alpha[3] = (3 * alpha0 + 2 * alpha1) / 5;
-        alpha[4] = (2 * alpha0 + 3 * alpha1) / 5;
-        alpha[5] = (alpha0 + 4 * alpha1) / 5;
-        alpha[6] = 0;
-        alpha[7] = 0xFF;
+        for(int bx = 0; bx < s.w; bx += s.align, src += s.bpp)
+        {
+            decode(src, rgba);
+            int maxy = min(d.h - by, s.align), maxx = min(d.w - bx, s.align);
+            loop(y, maxy)
+            {
+                uchar *dst = &d.data[(by + y)*d.pitch + bx*d.bpp];
+                loop(x, maxx) memcpy(&dst[x*d.bpp], &rgba[(y*4 + x)*4], d.bpp);
+            }
+        }
     }
+    s.replace(d);
 }
 
-DECODEDDS(decodedxt5, 4,
-    uchar alpha[8];
-decodealpha(src[0], src[1], alpha);
-ullong alphabits = lilswap(*(const ushort *)&src[2]) + ((ullong)lilswap(*(const uint *)&src[4]) << 16);
-ushort color0 = lilswap(*(const ushort *)&src[8]);
-ushort color1 = lilswap(*(const ushort *)&src[10]);
-uint bits = lilswap(*(const uint *)&src[12]);
-bvec rgb[4];
-rgb[0] = bvec::from565(color0);
-rgb[1] = bvec::from565(color1);
-rgb[2].lerp(rgb[0], rgb[1], 2, 1, 3);
-rgb[3].lerp(rgb[0], rgb[1], 1, 2, 3);
-,
-memcpy(dst, rgb[bits & 3].v, 3);
-dst[3] = alpha[alphabits & 7];
-,
-bits >>= 2;
-alphabits >>= 3;
-);
-
 bool loaddds(const char *filename, ImageData &image, int force)
 {
     stream *f = openfile(filename, "rb");
@@ -164,6 +72,10 @@ bool loaddds(const char *filename, ImageData &image, int force)
         case FOURCC_DXT5:
             if((supported = hasS3TC) || force) format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
             break;
+        case FOURCC_ATI2:
+            // the shaders want the z of normals in blue, so these always get decoded
+            if(force) format = GL_COMPRESSED_RG_RGTC2;
+            break;
         }
     }
     if(!format || (!supported && !force)) { delete f; return false; }
@@ -174,7 +86,8 @@ bool loaddds(const char *filename, ImageData &image, int force)
     case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
     case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: bpp = 8; break;
     case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
-    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: bpp = 16; break;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    case GL_COMPRESSED_RG_RGTC2: bpp = 16; break;
     }
     image.setdata(nullptr, d.dwWidth, d.dwHeight, bpp, !supported || force > 0 ? 1 : d.dwMipMapCount, 4, format);
     size_t size = image.calcsize();
@@ -184,13 +97,16 @@ bool loaddds(const char *filename, ImageData &image, int force)
     {
     case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
     case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
-        decodedxt1(image);
+        decodeblocks(image, format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ? 4 : 3, decodebc1);
         break;
     case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
-        decodedxt3(image);
+        decodeblocks(image, 4, decodebc2);
         break;
     case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
-        decodedxt5(image);
+        decodeblocks(image, 4, decodebc3);
+        break;
+    case GL_COMPRESSED_RG_RGTC2:
+        decodeblocks(image, 3, decodebc5);
         break;
     }
     return true;
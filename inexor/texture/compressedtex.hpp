@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include <string.h>                      // for memset
+
 #include "inexor/shared/cube_types.hpp"  // for uint, ushort
 
 struct ImageData;
@@ -41,7 +43,8 @@ enum
     FOURCC_DXT2 = 0x32545844,
     FOURCC_DXT3 = 0x33545844,
     FOURCC_DXT4 = 0x34545844,
-    FOURCC_DXT5 = 0x35545844
+    FOURCC_DXT5 = 0x35545844,
+    FOURCC_ATI2 = 0x32495441
 };
 
 struct DDCOLORKEY { uint dwColorSpaceLowValue, dwColorSpaceHighValue; };
@@ -70,3 +73,18 @@ struct DDSURFACEDESC2
     uint dwTextureStage;
 };
 
+/// Fill the header of a DDS file with levels mipmaps of size bytes in total, in the byte order of the machine.
+inline void initddsheader(DDSURFACEDESC2 &d, uint fourcc, bool alpha, int w, int h, int levels, int size)
+{
+    memset(&d, 0, sizeof(d));
+    d.dwSize = sizeof(DDSURFACEDESC2);
+    d.dwWidth = w;
+    d.dwHeight = h;
+    d.dwLinearSize = size;
+    d.dwMipMapCount = levels;
+    d.dwFlags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE | DDSD_MIPMAPCOUNT;
+    d.ddsCaps.dwCaps = DDSCAPS_TEXTURE | DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+    d.ddpfPixelFormat.dwSize = sizeof(DDPIXELFORMAT);
+    d.ddpfPixelFormat.dwFlags = DDPF_FOURCC | (alpha ? DDPF_ALPHAPIXELS : 0);
+    d.ddpfPixelFormat.dwFourCC = fourcc;
+}
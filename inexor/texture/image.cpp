@@ -8,28 +8,21 @@
 
 #include "SDL_opengl.h"                    // for GLenum, GL_TEXTURE_CUBE_MAP
 #include "inexor/network/SharedVar.hpp"    // for SharedVar, min
+#include "inexor/shared/command.hpp"       // for VARF
 #include "inexor/shared/cube_endian.hpp"   // for lilswap
 #include "inexor/shared/geom.hpp"          // for vec, vec::(anonymous union...
 #include "inexor/texture/image.hpp"
 #include "inexor/texture/macros.hpp"       // for dst, src, readwritetex
 #include "inexor/texture/texsettings.hpp"  // for texreduce, maxtexsize, hwc...
+#include "inexor/util/imagekernels.hpp"    // for halvetexture, blurtexture
 
 using boost::algorithm::clamp;
 using std::min;
 using std::max;
 using std::swap;
 
-template<int BPP> static void halvetexture(uchar *src, uint sw, uint sh, uint stride, uchar *dst)
-{
-    for(uchar *yend = &src[sh*stride]; src < yend;)
-    {
-        for(uchar *xend = &src[sw*BPP], *xsrc = src; xsrc < xend; xsrc += 2*BPP, dst += BPP)
-        {
-            loopi(BPP) dst[i] = (uint(xsrc[i]) + uint(xsrc[i+BPP]) + uint(xsrc[stride+i]) + uint(xsrc[stride+i+BPP]))>>2;
-        }
-        src += 2*stride;
-    }
-}
+/// Use SIMD for texture processing: 0 = off, 1 = SSE2, 2 = AVX2 (as far as the CPU supports it).
+VARF(texsimd, 0, 2, 2, inexor::util::setimagesimd(texsimd));
 
 template<int BPP> static void shifttexture(uchar *src, uint sw, uint sh, uint stride, uchar *dst, uint dw, uint dh)
 {
@@ -104,13 +97,7 @@ void scaletexture(uchar *src, uint sw, uint sh, uint bpp, uint pitch, uchar *dst
 {
     if(sw == dw*2 && sh == dh*2)
     {
-        switch(bpp)
-        {
-            case 1: return halvetexture<1>(src, sw, sh, pitch, dst);
-            case 2: return halvetexture<2>(src, sw, sh, pitch, dst);
-            case 3: return halvetexture<3>(src, sw, sh, pitch, dst);
-            case 4: return halvetexture<4>(src, sw, sh, pitch, dst);
-        }
+        return inexor::util::halvetexture(src, sw, sh, bpp, pitch, dst);
     }
     else if(sw < dw || sh < dh || sw&(sw-1) || sh&(sh-1) || dw&(dw-1) || dh&(dh-1))
     {
@@ -172,6 +159,17 @@ static inline void reorienttexture(uchar *src, int sw, int sh, int bpp, int stri
     if(flipx) { dst += (sw - 1)*stridex; stridex = -stridex; }
     if(flipy) { dst += (sh - 1)*stridey; stridey = -stridey; }
     uchar *srcrow = src;
+    if(!flipx && !swapxy && !(normals && flipy))
+    {
+        // whole rows stay together
+        loopi(sh)
+        {
+            memcpy(dst, srcrow, sw*bpp);
+            srcrow += stride;
+            dst += stridey;
+        }
+        return;
+    }
     loopi(sh)
     {
         for(uchar *curdst = dst, *src = srcrow, *end = &srcrow[sw*bpp]; src < end;)
@@ -333,10 +331,7 @@ void texoffset(ImageData &s, int xoffset, int yoffset)
 
 void texmad(ImageData &s, const vec &mul, const vec &add)
 {
-    int maxk = min(int(s.bpp), 3);
-    writetex(s,
-        loopk(maxk) dst[k] = uchar(clamp(dst[k] * mul[k] + 255 * add[k], 0.0f, 255.0f));
-    );
+    inexor::util::madtexture(s.data, s.w, s.h, s.bpp, s.pitch, mul.v, add.v);
 }
 
 void texcolorify(ImageData &s, const vec &color, vec weights)
@@ -404,22 +399,7 @@ void texgrey(ImageData &s)
 
 void texpremul(ImageData &s)
 {
-    switch(s.bpp)
-    {
-    case 2:
-        writetex(s,
-            dst[0] = uchar((uint(dst[0])*uint(dst[1])) / 255);
-        );
-        break;
-    case 4:
-        writetex(s,
-            uint alpha = dst[3];
-        dst[0] = uchar((uint(dst[0])*alpha) / 255);
-        dst[1] = uchar((uint(dst[1])*alpha) / 255);
-        dst[2] = uchar((uint(dst[2])*alpha) / 255);
-        );
-        break;
-    }
+    inexor::util::premultiply(s.data, s.w, s.h, s.bpp, s.pitch);
 }
 
 void texagrad(ImageData &s, float x2, float y2, float x1, float y1)
@@ -470,116 +450,18 @@ void texflip(ImageData &s)
 void texnormal(ImageData &s, int emphasis)
 {
     ImageData d(s.w, s.h, 3);
-    uchar *src = s.data, *dst = d.data;
-    loop(y, s.h) loop(x, s.w)
-    {
-        vec normal(0.0f, 0.0f, 255.0f / emphasis);
-        normal.x += src[y*s.pitch + ((x + s.w - 1) % s.w)*s.bpp];
-        normal.x -= src[y*s.pitch + ((x + 1) % s.w)*s.bpp];
-        normal.y += src[((y + s.h - 1) % s.h)*s.pitch + x*s.bpp];
-        normal.y -= src[((y + 1) % s.h)*s.pitch + x*s.bpp];
-        normal.normalize();
-        *dst++ = uchar(127.5f + normal.x*127.5f);
-        *dst++ = uchar(127.5f + normal.y*127.5f);
-        *dst++ = uchar(127.5f + normal.z*127.5f);
-    }
+    inexor::util::normalmap(s.data, s.w, s.h, s.bpp, s.pitch, d.data, emphasis);
     s.replace(d);
 }
 
-template<int n, int bpp, bool normals>
-static void blurtexture(int w, int h, uchar *dst, const uchar *src, int margin)
-{
-    static const int weights3x3[9] =
-    {
-        0x10, 0x20, 0x10,
-        0x20, 0x40, 0x20,
-        0x10, 0x20, 0x10
-    };
-    static const int weights5x5[25] =
-    {
-        0x05, 0x05, 0x09, 0x05, 0x05,
-        0x05, 0x0A, 0x14, 0x0A, 0x05,
-        0x09, 0x14, 0x28, 0x14, 0x09,
-        0x05, 0x0A, 0x14, 0x0A, 0x05,
-        0x05, 0x05, 0x09, 0x05, 0x05
-    };
-    const int *mat = n > 1 ? weights5x5 : weights3x3;
-    int mstride = 2 * n + 1,
-        mstartoffset = n*(mstride + 1),
-        stride = bpp*w,
-        startoffset = n*bpp,
-        nextoffset1 = stride + mstride*bpp,
-        nextoffset2 = stride - mstride*bpp;
-    src += margin*(stride + bpp);
-    for(int y = margin; y < h - margin; y++)
-    {
-        for(int x = margin; x < w - margin; x++)
-        {
-            int dr = 0, dg = 0, db = 0;
-            const uchar *p = src - startoffset;
-            const int *m = mat + mstartoffset;
-            for(int t = y; t >= y - n; t--, p -= nextoffset1, m -= mstride)
-            {
-                if(t < 0) p += stride;
-                int a = 0;
-                if(n > 1) { a += m[-2]; if(x >= 2) { dr += p[0] * a; dg += p[1] * a; db += p[2] * a; a = 0; } p += bpp; }
-                a += m[-1]; if(x >= 1) { dr += p[0] * a; dg += p[1] * a; db += p[2] * a; a = 0; } p += bpp;
-                int cr = p[0], cg = p[1], cb = p[2]; a += m[0]; dr += cr * a; dg += cg * a; db += cb * a; p += bpp;
-                if(x + 1 < w) { cr = p[0]; cg = p[1]; cb = p[2]; } dr += cr * m[1]; dg += cg * m[1]; db += cb * m[1]; p += bpp;
-                if(n > 1) { if(x + 2 < w) { cr = p[0]; cg = p[1]; cb = p[2]; } dr += cr * m[2]; dg += cg * m[2]; db += cb * m[2]; p += bpp; }
-            }
-            p = src - startoffset + stride;
-            m = mat + mstartoffset + mstride;
-            for(int t = y + 1; t <= y + n; t++, p += nextoffset2, m += mstride)
-            {
-                if(t >= h) p -= stride;
-                int a = 0;
-                if(n > 1) { a += m[-2]; if(x >= 2) { dr += p[0] * a; dg += p[1] * a; db += p[2] * a; a = 0; } p += bpp; }
-                a += m[-1]; if(x >= 1) { dr += p[0] * a; dg += p[1] * a; db += p[2] * a; a = 0; } p += bpp;
-                int cr = p[0], cg = p[1], cb = p[2]; a += m[0]; dr += cr * a; dg += cg * a; db += cb * a; p += bpp;
-                if(x + 1 < w) { cr = p[0]; cg = p[1]; cb = p[2]; } dr += cr * m[1]; dg += cg * m[1]; db += cb * m[1]; p += bpp;
-                if(n > 1) { if(x + 2 < w) { cr = p[0]; cg = p[1]; cb = p[2]; } dr += cr * m[2]; dg += cg * m[2]; db += cb * m[2]; p += bpp; }
-            }
-            if(normals)
-            {
-                vec v(dr - 0x7F80, dg - 0x7F80, db - 0x7F80);
-                float mag = 127.5f / v.magnitude();
-                dst[0] = uchar(v.x*mag + 127.5f);
-                dst[1] = uchar(v.y*mag + 127.5f);
-                dst[2] = uchar(v.z*mag + 127.5f);
-            }
-            else
-            {
-                dst[0] = dr >> 8;
-                dst[1] = dg >> 8;
-                dst[2] = db >> 8;
-            }
-            if(bpp > 3) dst[3] = src[3];
-            dst += bpp;
-            src += bpp;
-        }
-        src += 2 * margin*bpp;
-    }
-}
-
 void blurtexture(int n, int bpp, int w, int h, uchar *dst, const uchar *src, int margin)
 {
-    switch((clamp(n, 1, 2) << 4) | bpp)
-    {
-    case 0x13: blurtexture<1, 3, false>(w, h, dst, src, margin); break;
-    case 0x23: blurtexture<2, 3, false>(w, h, dst, src, margin); break;
-    case 0x14: blurtexture<1, 4, false>(w, h, dst, src, margin); break;
-    case 0x24: blurtexture<2, 4, false>(w, h, dst, src, margin); break;
-    }
+    inexor::util::blurtexture(n, bpp, w, h, dst, src, margin);
 }
 
 void blurnormals(int n, int w, int h, bvec *dst, const bvec *src, int margin)
 {
-    switch(clamp(n, 1, 2))
-    {
-    case 1: blurtexture<1, 3, true>(w, h, dst->v, src->v, margin); break;
-    case 2: blurtexture<2, 3, true>(w, h, dst->v, src->v, margin); break;
-    }
+    inexor::util::blurtexture(n, 3, w, h, dst->v, src->v, margin, true);
 }
 
 void texblur(ImageData &s, int n, int r)
@@ -7,8 +7,10 @@
 #include <stdlib.h>                                   // for atoi
 #include <string.h>                                   // for memcmp, memcpy
 #include <algorithm>                                  // for min, swap, max
-#include <memory>                                     // for __shared_ptr
+#include <memory>                                     // for unique_ptr
+#include <vector>                                     // for vector
 
+#include "SDL_timer.h"                                // for SDL_GetTicks
 #include "inexor/client/network.hpp"                  // for multiplayer
 #include "inexor/engine/material.hpp"                 // for ::MATF_INDEX
 #include "inexor/engine/octa.hpp"                     // for visibletris
@@ -31,7 +33,9 @@
 #include "inexor/texture/image.hpp"                   // for ImageData, scal...
 #include "inexor/texture/macros.hpp"                  // for dst, src, readw...
 #include "inexor/texture/slot.hpp"
+#include "inexor/texture/texcache.hpp"                // for texcachekeyfor, texc...
 #include "inexor/texture/texture.hpp"                 // for ::TEX_DIFFUSE
+#include "inexor/util/jobs.hpp"                       // for jobs, task_ptr
 
 using namespace inexor::filesystem;
 
@@ -665,6 +669,52 @@ Slot::Tex *Slot::findtexture(int type)
 }
 
 
+Slot::Tex *Slot::findcombined(int index)
+{
+    if(sts[index].type != TEX_DIFFUSE && sts[index].type != TEX_NORMAL) return nullptr;
+    loopv(sts) if(sts[i].combined == index) return &sts[i]; // only one combination
+    return nullptr;
+}
+
+bool Slot::decodetexture(Slot::Tex &t, Slot::Tex *partner, ImageData &ts, int &compress, bool msg)
+{
+    uint start = SDL_GetTicks();
+    vector<const char *> names;
+    vector<int> types;
+    names.add(t.name);
+    types.add(t.type);
+    if(partner)
+    {
+        names.add(partner->name);
+        types.add(partner->type);
+    }
+    texcachekey key = texcachekeyfor(names, types);
+    compress = 0;
+    if(texcacheload(key, ts, compress))
+    {
+        texcachecount(true, SDL_GetTicks() - start);
+        return true;
+    }
+
+    if(!texturedata(ts, nullptr, &t, msg, &compress)) return false;
+    if(partner && !ts.compressed)
+    {
+        ImageData as;
+        if(texturedata(as, nullptr, partner, msg))
+        {
+            if(as.w != ts.w || as.h != ts.h) scaleimage(as, ts.w, ts.h);
+            switch(partner->type)
+            {
+                case TEX_SPEC: mergespec(ts, as); break;
+                case TEX_DEPTH: mergedepth(ts, as); break;
+            }
+        }
+    }
+    texcachesave(key, ts, compress);
+    texcachecount(false, SDL_GetTicks() - start);
+    return true;
+}
+
 void Slot::combinetextures(int index, Slot::Tex &t, bool msg, bool forceload)
 {
     vector<char> key;
@@ -676,28 +726,73 @@ void Slot::combinetextures(int index, Slot::Tex &t, bool msg, bool forceload)
     if(t.t) return;
     int compress = 0;
     ImageData ts;
-    if(!texturedata(ts, nullptr, &t, msg, &compress)) { t.t = notexture; return; }
-    switch(t.type)
+    if(!decodetexture(t, findcombined(index), ts, compress, msg)) { t.t = notexture; return; }
+    t.t = newtexture( t.t, key.getbuf(), ts, 0, true, true, true, compress);
+}
+
+/// A texture of a slot which loadslots() decodes on the job system.
+/// The workers get copies of the textures, since the main thread goes on combining the next ones of the slot meanwhile.
+struct slotdecode
+{
+    Slot::Tex tex, partner;
+    bool haspartner;
+    int compress;
+    vector<char> key;
+    bool ok;
+    ImageData d;
+    inexor::util::task_ptr task;
+    vector<Slot::Tex *> users; ///< all textures of the list with the same key
+};
+
+void loadslots(const vector<Slot *> &list)
+{
+    // everything touching the slots, the registry or OpenGL stays on this thread, the workers only fill in slotdecode::d
+    std::vector<std::unique_ptr<slotdecode>> decodes;
+    loopv(list)
     {
-        case TEX_DIFFUSE:
-        case TEX_NORMAL:
-            if(!ts.compressed) loopv(sts)
-            {
-                Slot::Tex &a = sts[i];
-                if(a.combined != index) continue;
-                ImageData as;
-                if(!texturedata(as, nullptr, &a, msg)) continue;
-                if(as.w != ts.w || as.h != ts.h) scaleimage(as, ts.w, ts.h);
-                switch(a.type)
-                {
-                    case TEX_SPEC: mergespec(ts, as); break;
-                    case TEX_DEPTH: mergedepth(ts, as); break;
-                }
-                break; // only one combination
-            }
-            break;
+        Slot &s = *list[i];
+        if(s.loaded) continue;
+        linkslotshader(s);
+        loopvj(s.sts)
+        {
+            Slot::Tex &t = s.sts[j];
+            if(t.combined >= 0) continue;
+            if(t.type == TEX_ENVMAP) { t.t = cubemapload(t.name); continue; }
+            vector<char> key;
+            int texmask = 0;
+            gencombinedname(key, texmask, s, t, j, false);
+            t.t = gettexture(key.getbuf());
+            if(t.t) continue;
+            slotdecode *pending = nullptr;
+            for(auto &d : decodes) if(!strcmp(d->key.getbuf(), key.getbuf())) { pending = d.get(); break; }
+            if(pending) { pending->users.add(&t); continue; }
+
+            slotdecode *d = new slotdecode;
+            d->tex = t;
+            Slot::Tex *partner = s.findcombined(j);
+            d->haspartner = partner != nullptr;
+            if(partner) d->partner = *partner;
+            d->compress = 0;
+            d->key.move(key);
+            d->ok = false;
+            d->users.add(&t);
+            decodes.emplace_back(d);
+            d->task = inexor::util::jobs().spawn([d] { d->ok = Slot::decodetexture(d->tex, d->haspartner ? &d->partner : nullptr, d->d, d->compress, false); });
+        }
+        s.loaded = true;
+    }
+
+    loopi(int(decodes.size()))
+    {
+        slotdecode &d = *decodes[i];
+        inexor::util::jobs().wait(d.task);
+        renderprogress(float(i + 1)/decodes.size(), d.tex.name);
+        Texture *tex = notexture;
+        if(d.ok) tex = newtexture(nullptr, d.key.getbuf(), d.d, 0, true, true, true, d.compress);
+        else Log.std->warn("could not load texture {}", d.tex.name);
+        loopvj(d.users) d.users[j]->t = tex;
+        decodes[i].reset(); // frees the image data
     }
-    t.t = newtexture( t.t, key.getbuf(), ts, 0, true, true, true, compress);
 }
 
 MSlot &lookupmaterialslot(int index, bool load)
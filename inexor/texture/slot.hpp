@@ -129,6 +129,11 @@ class Slot
     /// @param msg show progress bar
     /// @param forceload
     void combinetextures(int index, Slot::Tex &t, bool msg = true, bool forceload = false);
+    /// The texture gencombinedname() merged into the one at index, nullptr if there is none.
+    Slot::Tex *findcombined(int index);
+    /// The CPU half of combinetextures(): read t and merge partner (see findcombined()) into ts.
+    /// Only touches its arguments, so with copies of the textures and msg false it is safe to run on a worker.
+    static bool decodetexture(Slot::Tex &t, Slot::Tex *partner, ImageData &ts, int &compress, bool msg);
 
     Slot &load(bool msg, bool forceload);
     Texture *loadthumbnail();
@@ -168,6 +173,9 @@ extern void texturereset(int first, int num = 0);
 
 extern MSlot &lookupmaterialslot(int slot, bool load = true);
 extern Slot &lookupslot(int slot, bool load = true);
+/// Load all slots of the list which are not loaded yet at once, decoding their textures on the job system.
+/// Only the uploads happen on this thread, in list order.
+extern void loadslots(const vector<Slot *> &list);
 extern VSlot &lookupvslot(int slot, bool load = true);
 extern VSlot *emptyvslot(Slot &owner);
 
@@ -0,0 +1,145 @@
+/// @file texcache.cpp
+/// On disk cache of processed textures, see texcache.hpp.
+
+#include <string.h>                            // for strrchr, strstr, memcpy
+#include <string>                              // for string
+#include <vector>                              // for vector
+
+#include "inexor/io/Logging.hpp"               // for Log, Logger
+#include "inexor/io/legacy/stream.hpp"         // for stream, openfile, findfile
+#include "inexor/network/SharedVar.hpp"        // for SharedVar
+#include "inexor/shared/command.hpp"           // for VARP, COMMAND
+#include "inexor/shared/cube_formatting.hpp"   // for defformatstring
+#include "inexor/shared/cube_loops.hpp"        // for loopv
+#include "inexor/shared/cube_unicode.hpp"      // for iscubespace
+#include "inexor/texture/image.hpp"            // for ImageData
+#include "inexor/texture/texcache.hpp"
+#include "inexor/util/diskcache.hpp"           // for diskcache, fnv1a
+#include "inexor/util/mappedfile.hpp"          // for mappedfile
+
+using inexor::util::diskcache;
+
+/// Whether processed textures are stored in and loaded from the cache.
+VARP(texcache, 0, 1, 1);
+/// Megabytes the cache may use before the least recently used entries are deleted.
+VARP(texcachesize, 0, 512, 1<<16);
+
+/// Bump whenever the processing of textures changes, so old entries are not used anymore.
+static const int TEXCACHE_VERSION = 2;
+
+static diskcache cache("ITXC", TEXCACHE_VERSION, ".itc");
+
+/// What an entry holds after the description, followed by the rows of pixels.
+struct texcacheimage
+{
+    int w, h, bpp, compress;
+};
+
+/// The cache directory in the home directory, created if it is not there.
+static std::string cachedir()
+{
+    return findfile(path("cache/textures/", true), "w");
+}
+
+/// Add the normalized description of an image to desc and return the file it reads, nullptr if it can not be cached.
+static const char *describeimage(std::string &desc, const char *name, int type, string &file)
+{
+    const char *cmdsend = name[0] == '<' ? strrchr(name, '>') : nullptr;
+    if(name[0] == '<' && !cmdsend) return nullptr;
+    const char *filename = cmdsend ? cmdsend + 1 : name;
+    copystring(file, filename);
+    path(file);
+    size_t len = strlen(file);
+    if(len >= 4 && !strcasecmp(file + len - 4, ".dds")) return nullptr;
+
+    std::string cmds;
+    if(cmdsend) for(const char *c = name; c <= cmdsend; c++) if(!iscubespace(*c)) cmds += *c;
+    // these do not produce processed images or read other files than the one named
+    if(strstr(cmds.c_str(), "<dds") || strstr(cmds.c_str(), "<stub") || strstr(cmds.c_str(), "<thumbnail")) return nullptr;
+
+    defformatstring(typestr, "%d:", type);
+    desc += typestr;
+    desc += cmds;
+    desc += file;
+    desc += '\n';
+    return file;
+}
+
+texcachekey texcachekeyfor(const vector<const char *> &names, const vector<int> &types)
+{
+    texcachekey key;
+    if(!texcache) return key;
+    std::vector<std::string> files;
+    loopv(names)
+    {
+        string file;
+        if(!describeimage(key.desc, names[i], types.inrange(i) ? types[i] : 0, file)) return texcachekey();
+        files.push_back(file);
+    }
+
+    unsigned long long hash = inexor::util::FNV1A_BASIS;
+    inexor::util::fnv1a(hash, key.desc.c_str(), key.desc.size());
+    static const size_t CHUNK = 1<<16;
+    std::vector<uchar> buf(CHUNK);
+    for(const std::string &file : files)
+    {
+        stream *f = openfile(file.c_str(), "rb");
+        if(!f) return texcachekey(); // texturedata() will complain
+        for(size_t len; (len = f->read(buf.data(), CHUNK)) > 0;) inexor::util::fnv1a(hash, buf.data(), len);
+        delete f;
+    }
+    key.hash = hash ? hash : 1;
+    return key;
+}
+
+bool texcacheload(const texcachekey &key, ImageData &d, int &compress)
+{
+    if(!texcache) return false;
+    inexor::util::mappedfile file;
+    const uchar *data;
+    size_t len;
+    if(!cache.load(cachedir(), key, file, data, len)) return false;
+
+    texcacheimage img;
+    if(len < sizeof(img)) return false;
+    memcpy(&img, data, sizeof(img));
+    if(img.w <= 0 || img.h <= 0 || img.w > (1<<13) || img.h > (1<<13) || img.bpp < 1 || img.bpp > 4 ||
+       len - sizeof(img) != size_t(img.w)*img.h*img.bpp)
+        return false;
+    d.setdata(nullptr, img.w, img.h, img.bpp);
+    memcpy(d.data, data + sizeof(img), len - sizeof(img));
+    compress = img.compress;
+    return true;
+}
+
+void texcachesave(const texcachekey &key, const ImageData &d, int compress)
+{
+    if(!texcache || !d.data || d.compressed) return;
+    texcacheimage img = { d.w, d.h, d.bpp, compress };
+    cache.save(cachedir(), key, (long long)int(texcachesize) << 20, [&](FILE *f)
+    {
+        if(fwrite(&img, 1, sizeof(img), f) != sizeof(img)) return false;
+        // the rows of an SDL surface may be padded, entries are not
+        for(int y = 0; y < d.h; y++) if(fwrite(d.data + y*d.pitch, 1, d.w*d.bpp, f) != size_t(d.w*d.bpp)) return false;
+        return true;
+    });
+}
+
+void texcachecount(bool hit, uint millis)
+{
+    cache.count(hit, millis);
+}
+
+void texcachereport(const char *what)
+{
+    diskcache::stats s = cache.takestats();
+    if(!s.hits && !s.misses) return;
+    Log.std->info("{}: {} textures from the texture cache ({} ms), {} decoded ({} ms)", what, s.hits, s.hitmillis, s.misses, s.missmillis);
+}
+
+/// Delete every entry, to measure a cold load.
+void texcacheclear()
+{
+    cache.clear(cachedir());
+}
+COMMAND(texcacheclear, "");
@@ -0,0 +1,36 @@
+/// @file texcache.hpp
+/// On disk cache of processed textures.
+///
+/// Textures get stored in the home directory as they are right before the upload: decoded, with their commands (<mad>, <normal>, <blur>..)
+/// applied and combined from several images (diffuse + spec, normal + depth), so the next load skips decoding and processing.
+/// DDS files are loaded quickly anyway and are not cached.
+/// An entry is found by a hash of the normalized texture description and the contents of every file it reads,
+/// so editing an image invalidates it. The least recently used entries are evicted when the cache grows beyond texcachesize.
+
+#pragma once
+
+#include "inexor/shared/cube_types.hpp"  // for uint
+#include "inexor/shared/cube_vector.hpp" // for vector
+#include "inexor/util/diskcache.hpp"     // for diskcachekey
+
+struct ImageData;
+
+/// Identifies a cache entry, empty if the texture can not be cached (e.g. dds files, which are loaded quickly anyway).
+/// The description holds the normalized descriptions of all images the texture is made of.
+typedef inexor::util::diskcachekey texcachekey;
+
+/// Build the key for a texture made of the images named (like texture slots do: "<cmds>file") and their types.
+/// Reads the files to hash them, safe to call on worker threads.
+extern texcachekey texcachekeyfor(const vector<const char *> &names, const vector<int> &types);
+
+/// Fill d and compress from the cache, returns false if there is no (valid) entry.
+extern bool texcacheload(const texcachekey &key, ImageData &d, int &compress);
+
+/// Store the processed image, compressed images are not stored.
+extern void texcachesave(const texcachekey &key, const ImageData &d, int compress);
+
+/// Count the time spent on decoding a texture for the statistics, hit whether it came from the cache.
+extern void texcachecount(bool hit, uint millis);
+
+/// Log the hits, misses and decoding time since the last report (e.g. for one map load) and start counting anew.
+extern void texcachereport(const char *what);
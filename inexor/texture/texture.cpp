@@ -15,6 +15,7 @@
 
 #include "SDL_pixels.h"                               // for SDL_PixelFormat
 #include "SDL_surface.h"                              // for SDL_FreeSurface
+#include "SDL_timer.h"                                // for SDL_GetTicks
 #include "inexor/engine/glexts.hpp"                   // for glCompressedTex...
 #include "inexor/engine/renderbackground.hpp"         // for loadprogress
 #include "inexor/engine/rendergl.hpp"                 // for hasAF
@@ -34,12 +35,14 @@
 #include "inexor/texture/format.hpp"                  // for compressedformat
 #include "inexor/texture/image.hpp"                   // for ImageData, resi...
 #include "inexor/texture/slot.hpp"                    // for Slot::Tex, clea...
+#include "inexor/texture/texcache.hpp"                // for texcachekeyfor, texc...
 #include "inexor/texture/texsettings.hpp"             // for bilinear, maxte...
 #include "inexor/texture/texture.hpp"
+#include "inexor/util/jobs.hpp"                       // for jobs, task_ptr
 
 // We need to specify the commands here, bc. completely "unused" (and cubescript only functions are) source files get ignored in modules.. (BUG)
 
-COMMAND(gendds, "ss");
+COMMAND(gendds, "sss");
 COMMAND(flipnormalmapy, "ss");
 COMMAND(mergenormalmaps, "ss");
 
@@ -368,7 +371,7 @@ bool texturedata(ImageData &d, const char *tname, Slot::Tex *tex, bool msg, int
         }
         else file = tex->name;
 
-        static string pname; //todo threadsafe?
+        string pname;
         formatstring(pname, "%s", file);
         file = path(pname);
     }
@@ -517,6 +520,108 @@ Texture *textureload(const char *name, int clamp, bool mipit, bool msg, bool thr
     return notexture;
 }
 
+/// Whether textureloadasync() decodes on the job system or just calls textureload().
+VARP(asynctextures, 0, 1, 1);
+/// Milliseconds per frame uploadtextures() may spend on putting decoded textures on the GPU, at least one gets uploaded per frame.
+VARP(texuploadbudget, 0, 2, 100);
+
+/// A texture decoded by a worker, waiting for uploadtextures().
+struct texupload
+{
+    Texture *t;
+    string name;
+    int clamp, compress;
+    bool mipit, ok;
+    ImageData d;
+    inexor::util::task_ptr task;
+};
+static vector<texupload *> texuploads;
+
+/// The work of a worker for textureloadasync(), going through the texture cache.
+static void decodeupload(texupload *u)
+{
+    uint start = SDL_GetTicks();
+    vector<const char *> names;
+    vector<int> types;
+    names.add(u->name);
+    types.add(TEX_DIFFUSE);
+    texcachekey key = texcachekeyfor(names, types);
+    bool hit = texcacheload(key, u->d, u->compress);
+    if(hit) u->ok = true;
+    else
+    {
+        // texturedata() with msg off only touches thread local state
+        u->ok = texturedata(u->d, u->name, nullptr, false, &u->compress);
+        if(u->ok) texcachesave(key, u->d, u->compress);
+    }
+    texcachecount(hit, SDL_GetTicks() - start);
+}
+
+Texture *textureloadasync(const char *name, int clamp, bool mipit)
+{
+    Texture *t = gettexture(name);
+    if(t) return t;
+    if(!asynctextures || !notexture) return textureload(name, clamp, mipit, false);
+
+    t = registertexture(name);
+    t->type = Texture::IMAGE | Texture::PLACEHOLDER;
+    t->clamp = clamp;
+    t->mipmap = mipit;
+    t->canreduce = false;
+    t->id = notexture->id;
+    t->w = notexture->w;
+    t->h = notexture->h;
+    t->xs = notexture->xs;
+    t->ys = notexture->ys;
+    t->bpp = notexture->bpp;
+
+    texupload *u = new texupload;
+    u->t = t;
+    copystring(u->name, name);
+    u->clamp = clamp;
+    u->compress = 0;
+    u->mipit = mipit;
+    u->ok = false;
+    u->task = inexor::util::jobs().spawn([u] { decodeupload(u); });
+    texuploads.add(u);
+    return t;
+}
+
+/// Put a decoded texture on the GPU in place of its placeholder, unless it got reloaded meanwhile.
+static void finishupload(texupload *u)
+{
+    inexor::util::jobs().wait(u->task);
+    if(!(u->t->type&Texture::PLACEHOLDER)) return;
+    if(u->ok) newtexture(u->t, nullptr, u->d, u->clamp, u->mipit, false, false, u->compress);
+    else Log.std->warn("could not load texture {}", u->name);
+}
+
+void uploadtextures(bool all)
+{
+    uint start = SDL_GetTicks();
+    for(int i = 0; i < texuploads.length();)
+    {
+        texupload *u = texuploads[i];
+        if(!all && !u->task->done()) { i++; continue; }
+        finishupload(u);
+        texuploads.remove(i);
+        delete u;
+        if(!all && SDL_GetTicks() - start >= uint(texuploadbudget)) break;
+    }
+}
+
+void finishtexture(Texture *t)
+{
+    if(!(t->type&Texture::PLACEHOLDER)) return;
+    loopv(texuploads) if(texuploads[i]->t == t)
+    {
+        texupload *u = texuploads.remove(i);
+        finishupload(u);
+        delete u;
+        break;
+    }
+}
+
 bool settexture(const char *name, int clamp)
 {
     Texture *t = textureload(name, clamp, true, false);
@@ -528,12 +633,14 @@ bool settexture(const char *name, int clamp)
 void cleanuptexture(Texture *t)
 {
     DELETEA(t->alphamask);
-    if(t->id) { glDeleteTextures(1, &t->id); t->id = 0; }
+    if(t->id && !(t->type&Texture::PLACEHOLDER)) glDeleteTextures(1, &t->id); // placeholders only borrow the id of notexture
+    t->id = 0;
     if(t->type&Texture::TRANSIENT) textures.erase(t->name);
 }
 
 void cleanuptextures()
 {
+    uploadtextures(true);
     clearenvmaps();
     cleanupslots();
     cleanupvslots();
@@ -558,6 +665,13 @@ bool reloadtexture(const char *name)
 bool reloadtexture(Texture &tex)
 {
     if(tex.id) return true;
+    if(tex.type&Texture::PLACEHOLDER)
+    {
+        // it could not be loaded, so it shows notexture again
+        if(!notexture->id) reloadtexture(*notexture);
+        tex.id = notexture->id;
+        return true;
+    }
     switch(tex.type&Texture::TYPE)
     {
         case Texture::IMAGE:
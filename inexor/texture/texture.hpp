@@ -36,6 +36,7 @@ struct Texture
         TRANSIENT = 1 << 9,
         COMPRESSED = 1 << 10,
         ALPHA = 1 << 11,
+        PLACEHOLDER = 1 << 12, ///< not loaded yet (or failed to), shows the GPU texture of notexture
         FLAGS = 0xFF00
     };
 
@@ -70,6 +71,14 @@ extern void setuptexcompress();
 ///        with registertexture.
 extern Texture *textureload(const char *name, int clamp = 0, bool mipit = true, bool msg = true, bool threadsafe = false);
 
+/// Like textureload(), but the image gets decoded and processed on the job system, notexture is shown until uploadtextures() is done with it.
+/// Failing to load only shows up as a warning later on, so use textureload() if you need to fall back to another file.
+extern Texture *textureloadasync(const char *name, int clamp = 0, bool mipit = true);
+/// Upload the textures decoded for textureloadasync() to the GPU, each frame within texuploadbudget or all of them at once.
+extern void uploadtextures(bool all = false);
+/// Finish loading t right now if it is still a placeholder, for everything which needs to know its size or alpha channel.
+extern void finishtexture(Texture *t);
+
 extern Texture *newtexture(Texture *t, const char *rname, ImageData &s, int clamp = 0, bool mipit = true, bool canreduce = false, bool transient = false, int compress = 0);
 
 extern bool loadimage(const char *filename, ImageData &image);
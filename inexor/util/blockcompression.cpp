@@ -0,0 +1,456 @@
+#include "inexor/util/blockcompression.hpp"
+
+#include <math.h>                        // for sqrtf, fabsf
+#include <string.h>                      // for memset
+
+#include <algorithm>                     // for min, max, swap
+
+#include "inexor/shared/cube_loops.hpp"  // for loopi, loopj, loopk
+#include "inexor/shared/cube_types.hpp"  // for uchar, ushort, uint
+#include "inexor/shared/simd.hpp"        // for simd4f
+#include "inexor/util/jobs.hpp"          // for job_system, jobs
+
+namespace inexor {
+namespace util {
+
+// 5 and 6 bit channels are expanded exactly like bvec::from565() does it, so the palettes match what decodedxt1() used to produce
+static inline int expand5(int c) { return (c*527 + 15) >> 6; }
+static inline int expand6(int c) { return (c*259 + 35) >> 6; }
+
+static inline ushort getushort(const uchar *p) { return ushort(p[0] | (p[1] << 8)); }
+static inline uint getuint(const uchar *p) { return uint(p[0]) | (uint(p[1]) << 8) | (uint(p[2]) << 16) | (uint(p[3]) << 24); }
+static inline void putushort(uchar *p, ushort v) { p[0] = uchar(v); p[1] = uchar(v >> 8); }
+static inline void putuint(uchar *p, uint v) { loopi(4) p[i] = uchar(v >> (8*i)); }
+
+/// The colors a color block decodes to. Without fourcolor the third is the average and the fourth transparent black.
+static void colorpalette(ushort c0, ushort c1, bool fourcolor, int pal[4][3])
+{
+    int a[3] = { expand5((c0 >> 11) & 0x1F), expand6((c0 >> 5) & 0x3F), expand5(c0 & 0x1F) },
+        b[3] = { expand5((c1 >> 11) & 0x1F), expand6((c1 >> 5) & 0x3F), expand5(c1 & 0x1F) };
+    loopi(3)
+    {
+        pal[0][i] = a[i];
+        pal[1][i] = b[i];
+        pal[2][i] = fourcolor ? (2*a[i] + b[i])/3 : (a[i] + b[i])/2;
+        pal[3][i] = fourcolor ? (a[i] + 2*b[i])/3 : 0;
+    }
+}
+
+/// The 8 values of an alpha (or BC5 channel) block, 6 interpolated ones plus 0 and 255 if a0 <= a1.
+static void alphapalette(int a0, int a1, int pal[8])
+{
+    pal[0] = a0;
+    pal[1] = a1;
+    if(a0 > a1) loopi(6) pal[i+2] = ((6-i)*a0 + (i+1)*a1)/7;
+    else
+    {
+        loopi(4) pal[i+2] = ((4-i)*a0 + (i+1)*a1)/5;
+        pal[6] = 0;
+        pal[7] = 0xFF;
+    }
+}
+
+static void decodecolors(const uchar *src, uchar *rgba, bool alwaysfourcolor)
+{
+    ushort c0 = getushort(src), c1 = getushort(src + 2);
+    uint bits = getuint(src + 4);
+    bool fourcolor = alwaysfourcolor || c0 > c1;
+    int pal[4][3];
+    colorpalette(c0, c1, fourcolor, pal);
+    loopi(16)
+    {
+        int k = (bits >> (2*i)) & 3;
+        loopj(3) rgba[4*i + j] = uchar(pal[k][j]);
+        rgba[4*i + 3] = !fourcolor && k == 3 ? 0 : 0xFF;
+    }
+}
+
+/// Decode an alpha block into every stride'th byte of dst.
+static void decodealphablock(const uchar *src, uchar *dst, int stride)
+{
+    int pal[8];
+    alphapalette(src[0], src[1], pal);
+    unsigned long long bits = 0;
+    loopi(6) bits |= (unsigned long long)src[2 + i] << (8*i);
+    loopi(16) dst[i*stride] = uchar(pal[(bits >> (3*i)) & 7]);
+}
+
+void decodebc1(const uchar *src, uchar *rgba)
+{
+    decodecolors(src, rgba, false);
+}
+
+void decodebc2(const uchar *src, uchar *rgba)
+{
+    decodecolors(src + 8, rgba, true);
+    loopi(16)
+    {
+        int a = (src[i/2] >> (4*(i&1))) & 0xF;
+        rgba[4*i + 3] = uchar((a*1088 + 32) >> 6);
+    }
+}
+
+void decodebc3(const uchar *src, uchar *rgba)
+{
+    decodecolors(src + 8, rgba, true);
+    decodealphablock(src, rgba + 3, 4);
+}
+
+void decodebc5(const uchar *src, uchar *rgba)
+{
+    decodealphablock(src, rgba, 4);
+    decodealphablock(src + 8, rgba + 1, 4);
+    loopi(16)
+    {
+        float x = rgba[4*i]*(2.0f/255) - 1, y = rgba[4*i + 1]*(2.0f/255) - 1, z = sqrtf(std::max(1 - x*x - y*y, 0.0f));
+        rgba[4*i + 2] = uchar(std::min(int((z*0.5f + 0.5f)*255 + 0.5f), 255));
+        rgba[4*i + 3] = 0xFF;
+    }
+}
+
+/// The pixels of a block as floats, one array per channel so 4 pixels are compared to a palette color at once.
+struct blockpixels
+{
+    float c[3][16];
+    float weight[16]; ///< 0 for pixels which do not matter (transparent in BC1A)
+};
+
+/// Find the closest of the first numcolors palette colors for every pixel.
+/// @return the summed squared error
+static float fitindices(const blockpixels &p, const int pal[4][3], int numcolors, int *indices)
+{
+    simd4f palr[4], palg[4], palb[4];
+    loopk(numcolors)
+    {
+        palr[k] = simd4f(float(pal[k][0]));
+        palg[k] = simd4f(float(pal[k][1]));
+        palb[k] = simd4f(float(pal[k][2]));
+    }
+    simd4f total(0.0f);
+    for(int i = 0; i < 16; i += 4)
+    {
+        simd4f r = simd4f::load(&p.c[0][i]), g = simd4f::load(&p.c[1][i]), b = simd4f::load(&p.c[2][i]),
+               best(1e30f), bestindex(0.0f);
+        loopk(numcolors)
+        {
+            simd4f dr = r - palr[k], dg = g - palg[k], db = b - palb[k],
+                   dist = dr*dr + dg*dg + db*db,
+                   closer = dist < best;
+            best = simdselect(closer, best, dist);
+            bestindex = simdselect(closer, bestindex, simd4f(float(k)));
+        }
+        total = total + best*simd4f::load(&p.weight[i]);
+        float idx[4];
+        bestindex.store(idx);
+        loopj(4) indices[i + j] = int(idx[j]);
+    }
+    float sum[4];
+    total.store(sum);
+    return sum[0] + sum[1] + sum[2] + sum[3];
+}
+
+static ushort quantize565(const float *c)
+{
+    int r = std::min(std::max(int(c[0]*(31.0f/255) + 0.5f), 0), 31),
+        g = std::min(std::max(int(c[1]*(63.0f/255) + 0.5f), 0), 63),
+        b = std::min(std::max(int(c[2]*(31.0f/255) + 0.5f), 0), 31);
+    return ushort((r << 11) | (g << 5) | b);
+}
+
+struct colorfit
+{
+    float error;
+    ushort c0, c1;
+    int indices[16];
+};
+
+enum { FIT_ANY = 0, FIT_THREECOLOR, FIT_FOURCOLOR };
+
+static void tryorder(const blockpixels &p, ushort c0, ushort c1, bool fourcolor, colorfit &best)
+{
+    int pal[4][3], indices[16];
+    colorpalette(c0, c1, fourcolor, pal);
+    float error = fitindices(p, pal, fourcolor ? 4 : 3, indices);
+    if(error >= best.error) return;
+    best.error = error;
+    best.c0 = c0;
+    best.c1 = c1;
+    memcpy(best.indices, indices, sizeof(indices));
+}
+
+/// Quantize the endpoints and keep them if they beat best.
+/// BC1 decodes c0 > c1 with 4 colors and otherwise with 3 (plus transparent), the color block of BC3 always has 4.
+static void tryendpoints(const blockpixels &p, const float *e0, const float *e1, int mode, colorfit &best)
+{
+    ushort q0 = quantize565(e0), q1 = quantize565(e1), lo = std::min(q0, q1), hi = std::max(q0, q1);
+    switch(mode)
+    {
+        case FIT_ANY:
+            tryorder(p, hi, lo, hi != lo, best);
+            tryorder(p, lo, hi, false, best);
+            break;
+        case FIT_THREECOLOR:
+            tryorder(p, lo, hi, false, best);
+            break;
+        case FIT_FOURCOLOR:
+            tryorder(p, q0, q1, true, best);
+            break;
+    }
+}
+
+/// Fit the endpoints along the principal axis of the colors, then improve them with least squares for the chosen indices.
+static void encodecolors(const uchar *rgba, uchar *dst, int mode, bool punchthrough)
+{
+    blockpixels p;
+    float used = 0, mean[3] = { 0, 0, 0 };
+    uint transparent = 0;
+    loopi(16)
+    {
+        loopj(3) p.c[j][i] = rgba[4*i + j];
+        p.weight[i] = punchthrough && rgba[4*i + 3] < 128 ? 0.0f : 1.0f;
+        if(!p.weight[i]) { transparent |= 1 << i; continue; }
+        used++;
+        loopj(3) mean[j] += p.c[j][i];
+    }
+
+    colorfit best;
+    best.error = 1e30f;
+    best.c0 = best.c1 = 0;
+    loopi(16) best.indices[i] = 0;
+    if(used > 0)
+    {
+        loopj(3) mean[j] /= used;
+        float cov[6] = { 0, 0, 0, 0, 0, 0 }, lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+        loopi(16) if(p.weight[i])
+        {
+            float d[3] = { p.c[0][i] - mean[0], p.c[1][i] - mean[1], p.c[2][i] - mean[2] };
+            cov[0] += d[0]*d[0]; cov[1] += d[0]*d[1]; cov[2] += d[0]*d[2];
+            cov[3] += d[1]*d[1]; cov[4] += d[1]*d[2]; cov[5] += d[2]*d[2];
+            loopj(3) { lo[j] = std::min(lo[j], p.c[j][i]); hi[j] = std::max(hi[j], p.c[j][i]); }
+        }
+        // the principal axis by power iteration, starting from the diagonal of the bounding box
+        float axis[3] = { hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2] };
+        loopk(8)
+        {
+            float n[3] = { cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2],
+                           cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2],
+                           cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2] };
+            float m = std::max(fabsf(n[0]), std::max(fabsf(n[1]), fabsf(n[2])));
+            if(m < 1e-6f) break;
+            loopj(3) axis[j] = n[j]/m;
+        }
+        float len = sqrtf(axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+        float e0[3], e1[3];
+        if(len < 1e-6f) loopj(3) e0[j] = e1[j] = mean[j]; // a single color
+        else
+        {
+            loopj(3) axis[j] /= len;
+            float tmin = 1e30f, tmax = -1e30f;
+            loopi(16) if(p.weight[i])
+            {
+                float t = (p.c[0][i] - mean[0])*axis[0] + (p.c[1][i] - mean[1])*axis[1] + (p.c[2][i] - mean[2])*axis[2];
+                tmin = std::min(tmin, t);
+                tmax = std::max(tmax, t);
+            }
+            loopj(3)
+            {
+                e0[j] = mean[j] + axis[j]*tmax;
+                e1[j] = mean[j] + axis[j]*tmin;
+            }
+        }
+        tryendpoints(p, e0, e1, mode, best);
+
+        // least squares endpoints for the indices we got, as long as that improves the block
+        loopk(2)
+        {
+            bool fourcolor = mode == FIT_FOURCOLOR || best.c0 > best.c1;
+            static const float fourweights[4] = { 1, 0, 2/3.0f, 1/3.0f }, threeweights[4] = { 1, 0, 0.5f, 0 };
+            const float *weights = fourcolor ? fourweights : threeweights;
+            float aa = 0, ab = 0, bb = 0, ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+            loopi(16) if(p.weight[i])
+            {
+                float a = weights[best.indices[i]], b = 1 - a;
+                aa += a*a;
+                ab += a*b;
+                bb += b*b;
+                loopj(3)
+                {
+                    ax[j] += a*p.c[j][i];
+                    bx[j] += b*p.c[j][i];
+                }
+            }
+            float det = aa*bb - ab*ab;
+            if(fabsf(det) < 1e-6f) break;
+            float olderror = best.error;
+            loopj(3)
+            {
+                e0[j] = (ax[j]*bb - bx[j]*ab)/det;
+                e1[j] = (bx[j]*aa - ax[j]*ab)/det;
+            }
+            tryendpoints(p, e0, e1, mode, best);
+            if(best.error >= olderror) break;
+        }
+    }
+    else
+    {
+        // nothing but transparent pixels
+        best.c0 = best.c1 = 0;
+    }
+
+    uint bits = 0;
+    loopi(16) bits |= uint(transparent&(1 << i) ? 3 : best.indices[i]) << (2*i);
+    putushort(dst, best.c0);
+    putushort(dst + 2, best.c1);
+    putuint(dst + 4, bits);
+}
+
+/// Encode every stride'th byte of values as an alpha block, trying both the 8 value and the 6 value (plus 0 and 255) mode.
+static void encodealphablock(const uchar *values, int stride, uchar *dst)
+{
+    int lo = 255, hi = 0, innerlo = 255, innerhi = 0;
+    loopi(16)
+    {
+        int v = values[i*stride];
+        lo = std::min(lo, v);
+        hi = std::max(hi, v);
+        if(v > 0 && v < 255) { innerlo = std::min(innerlo, v); innerhi = std::max(innerhi, v); }
+    }
+    if(innerlo > innerhi) innerlo = innerhi = lo;
+
+    int candidates[2][2] = { { hi, lo }, { innerlo, innerhi } }, besterror = 1 << 30;
+    unsigned long long bestbits = 0;
+    int besta0 = hi, besta1 = lo;
+    loopk(lo == hi ? 1 : 2)
+    {
+        int a0 = candidates[k][0], a1 = candidates[k][1], pal[8], error = 0; // a single value ends up in the 6 value mode, index 0 is exact
+        alphapalette(a0, a1, pal);
+        unsigned long long bits = 0;
+        loopi(16)
+        {
+            int v = values[i*stride], bestindex = 0, bestdist = 1 << 30;
+            loopj(8)
+            {
+                int dist = (v - pal[j])*(v - pal[j]);
+                if(dist < bestdist) { bestdist = dist; bestindex = j; }
+            }
+            error += bestdist;
+            bits |= (unsigned long long)bestindex << (3*i);
+        }
+        if(error < besterror)
+        {
+            besterror = error;
+            bestbits = bits;
+            besta0 = a0;
+            besta1 = a1;
+        }
+    }
+    dst[0] = uchar(besta0);
+    dst[1] = uchar(besta1);
+    loopi(6) dst[2 + i] = uchar(bestbits >> (8*i));
+}
+
+void encodebc1(const uchar *rgba, uchar *dst, bool punchthrough)
+{
+    bool transparent = false;
+    if(punchthrough) loopi(16) if(rgba[4*i + 3] < 128) { transparent = true; break; }
+    encodecolors(rgba, dst, transparent ? FIT_THREECOLOR : FIT_ANY, transparent);
+}
+
+void encodebc3(const uchar *rgba, uchar *dst)
+{
+    encodealphablock(rgba + 3, 4, dst);
+    encodecolors(rgba, dst + 8, FIT_FOURCOLOR, false);
+}
+
+void encodebc5(const uchar *rgba, uchar *dst)
+{
+    encodealphablock(rgba, 4, dst);
+    encodealphablock(rgba + 1, 4, dst + 8);
+}
+
+/// Copy the 4x4 pixels at block bx, by into rgba, repeating the last row and column at the borders.
+static void readblock(const uchar *src, int w, int h, int bpp, int pitch, int bx, int by, uchar *rgba)
+{
+    loop(y, 4) loop(x, 4)
+    {
+        const uchar *s = src + std::min(by*4 + y, h - 1)*pitch + std::min(bx*4 + x, w - 1)*bpp;
+        uchar *d = rgba + 4*(y*4 + x);
+        switch(bpp)
+        {
+            case 1: d[0] = d[1] = d[2] = s[0]; d[3] = 0xFF; break;
+            case 2: d[0] = d[1] = d[2] = s[0]; d[3] = s[1]; break;
+            case 3: d[0] = s[0]; d[1] = s[1]; d[2] = s[2]; d[3] = 0xFF; break;
+            default: d[0] = s[0]; d[1] = s[1]; d[2] = s[2]; d[3] = s[3]; break;
+        }
+    }
+}
+
+void compressimage(bcformat f, const uchar *src, int w, int h, int bpp, int pitch, uchar *dst, job_system *js)
+{
+    int bw = (w + 3)/4, bh = (h + 3)/4, blocksize = bcblocksize(f);
+    (js ? *js : jobs()).parallel_for(0, bh, 4, [&](int from, int to)
+    {
+        uchar rgba[64];
+        for(int by = from; by < to; by++) loop(bx, bw)
+        {
+            readblock(src, w, h, bpp, pitch, bx, by, rgba);
+            uchar *block = dst + (by*bw + bx)*blocksize;
+            switch(f)
+            {
+                case BC1: encodebc1(rgba, block, false); break;
+                case BC1A: encodebc1(rgba, block, true); break;
+                case BC3: encodebc3(rgba, block); break;
+                case BC5: encodebc5(rgba, block); break;
+            }
+        }
+    });
+}
+
+void halveimage(const uchar *src, int w, int h, int bpp, int pitch, uchar *dst, bool normals)
+{
+    int dw = std::max(w/2, 1), dh = std::max(h/2, 1);
+    loop(y, dh)
+    {
+        const uchar *row0 = src + std::min(2*y, h - 1)*pitch, *row1 = src + std::min(2*y + 1, h - 1)*pitch;
+        loop(x, dw)
+        {
+            int x0 = std::min(2*x, w - 1)*bpp, x1 = std::min(2*x + 1, w - 1)*bpp;
+            uchar *d = dst + (y*dw + x)*bpp;
+            loopi(bpp) d[i] = uchar((row0[x0 + i] + row0[x1 + i] + row1[x0 + i] + row1[x1 + i] + 2)/4);
+            if(normals && bpp >= 3)
+            {
+                float n[3];
+                loopi(3) n[i] = (row0[x0 + i] + row0[x1 + i] + row1[x0 + i] + row1[x1 + i])*(2.0f/(4*255)) - 1;
+                float len = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+                if(len > 1e-6f) loopi(3) d[i] = uchar(std::min(std::max(int((n[i]/len*0.5f + 0.5f)*255 + 0.5f), 0), 255));
+            }
+        }
+    }
+}
+
+int compressmipmaps(bcformat f, const uchar *src, int w, int h, int bpp, int pitch, std::vector<uchar> &out, job_system *js)
+{
+    std::vector<uchar> cur, next;
+    const uchar *level = src;
+    int levels = 0;
+    for(int lw = w, lh = h, lpitch = pitch;;)
+    {
+        size_t offset = out.size();
+        out.resize(offset + size_t((lw + 3)/4)*((lh + 3)/4)*bcblocksize(f));
+        compressimage(f, level, lw, lh, bpp, lpitch, &out[offset], js);
+        levels++;
+        if(lw <= 1 && lh <= 1) break;
+        int nw = std::max(lw/2, 1), nh = std::max(lh/2, 1);
+        next.resize(size_t(nw)*nh*bpp);
+        halveimage(level, lw, lh, bpp, lpitch, next.data(), f == BC5);
+        cur.swap(next);
+        level = cur.data();
+        lw = nw;
+        lh = nh;
+        lpitch = nw*bpp;
+    }
+    return levels;
+}
+
+} // namespace util
+} // namespace inexor
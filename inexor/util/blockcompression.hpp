@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>                  // for vector
+
+namespace inexor {
+namespace util {
+
+class job_system;
+
+/// The block compressed formats we can write: 4x4 pixels make one block of 8 or 16 bytes.
+enum bcformat
+{
+    BC1 = 0, ///< DXT1: rgb
+    BC1A,    ///< DXT1 with 1 bit alpha, pixels with an alpha below 128 become transparent black
+    BC3,     ///< DXT5: rgb and a smooth alpha
+    BC5,     ///< ATI2: two channels (red and green), for the x and y of normal maps
+};
+
+/// Bytes per block.
+inline int bcblocksize(bcformat f) { return f == BC1 || f == BC1A ? 8 : 16; }
+
+/// Compress one block, rgba holds the 16 pixels row by row with 4 bytes each.
+void encodebc1(const unsigned char *rgba, unsigned char *dst, bool punchthrough = false);
+void encodebc3(const unsigned char *rgba, unsigned char *dst);
+void encodebc5(const unsigned char *rgba, unsigned char *dst);
+
+/// Decode one block into 16 rgba pixels, these are the decoders loaddds() uses when the GPU can not do it.
+void decodebc1(const unsigned char *src, unsigned char *rgba);
+void decodebc2(const unsigned char *src, unsigned char *rgba);
+void decodebc3(const unsigned char *src, unsigned char *rgba);
+/// The blue channel gets the z of the normal, reconstructed from x and y.
+void decodebc5(const unsigned char *src, unsigned char *rgba);
+
+/// Compress an image of w x h pixels with bpp (1 to 4: luminance, luminance alpha, rgb, rgba) bytes each and pitch bytes per row.
+/// dst needs room for ((w+3)/4)*((h+3)/4) blocks, the rows of blocks are spread over the job system (jobs() if js is null).
+void compressimage(bcformat f, const unsigned char *src, int w, int h, int bpp, int pitch, unsigned char *dst, job_system *js = nullptr);
+
+/// Scale an image down to half its size (at least 1 x 1) with a box filter, renormalizing the rgb vectors if normals is set.
+void halveimage(const unsigned char *src, int w, int h, int bpp, int pitch, unsigned char *dst, bool normals = false);
+
+/// Compress the image and all its mipmaps down to 1 x 1, appended to out level by level like DDS files store them.
+/// BC5 images are treated as normal maps for the mipmaps.
+/// @return the number of levels
+int compressmipmaps(bcformat f, const unsigned char *src, int w, int h, int bpp, int pitch, std::vector<unsigned char> &out, job_system *js = nullptr);
+
+} // namespace util
+} // namespace inexor
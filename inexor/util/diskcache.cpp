@@ -0,0 +1,150 @@
+#include "inexor/util/diskcache.hpp"
+
+#include <boost/filesystem/operations.hpp> // for directory_iterator, file_size, rename
+#include <boost/filesystem/path.hpp>       // for path
+#include <boost/system/error_code.hpp>     // for error_code
+#include <stdio.h>                         // for snprintf, fopen, fwrite
+#include <string.h>                        // for memcmp, memcpy
+#include <time.h>                          // for time, time_t
+#include <algorithm>                       // for sort
+#include <vector>                          // for vector
+
+namespace inexor {
+namespace util {
+
+namespace bfs = boost::filesystem;
+
+struct diskcacheheader
+{
+    char magic[4];
+    int version, desclen;
+};
+
+diskcache::diskcache(const char *magic, int version, const char *ext) : version(version), ext(ext)
+{
+    memcpy(this->magic, magic, 4);
+}
+
+std::string diskcache::entryfile(const std::string &dir, const diskcachekey &key, const char *suffix) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", key.hash);
+    return dir + name + ext + suffix;
+}
+
+bool diskcache::load(const std::string &dir, const diskcachekey &key, mappedfile &file, const unsigned char *&data, size_t &len)
+{
+    if(!key.valid()) return false;
+    std::string name = entryfile(dir, key);
+    if(!file.open(name.c_str())) return false;
+
+    diskcacheheader hdr;
+    size_t size = file.size();
+    if(size < sizeof(hdr)) { file.close(); return false; }
+    memcpy(&hdr, file.data(), sizeof(hdr));
+    // the hash may collide, the description must not
+    if(memcmp(hdr.magic, magic, 4) || hdr.version != version || hdr.desclen != int(key.desc.size()) ||
+       size - sizeof(hdr) < key.desc.size() || memcmp(file.data() + sizeof(hdr), key.desc.data(), key.desc.size()))
+    {
+        file.close();
+        return false;
+    }
+    data = file.data() + sizeof(hdr) + key.desc.size();
+    len = size - sizeof(hdr) - key.desc.size();
+
+    boost::system::error_code ec;
+    bfs::last_write_time(bfs::path(name), time(nullptr), ec); // the eviction goes by the last use
+    return true;
+}
+
+void diskcache::evict(const std::string &dir, long long limit)
+{
+    struct entry
+    {
+        time_t time;
+        long long size;
+        bfs::path file;
+    };
+    std::vector<entry> entries;
+    long long total = 0;
+    boost::system::error_code ec;
+    for(bfs::directory_iterator it(bfs::path(dir), ec), end; !ec && it != end; it.increment(ec))
+    {
+        const bfs::path &file = it->path();
+        if(file.extension() != ext) continue;
+        boost::system::error_code fileec;
+        entry e = { bfs::last_write_time(file, fileec), (long long)bfs::file_size(file, fileec), file };
+        if(fileec) continue;
+        total += e.size;
+        entries.push_back(e);
+    }
+    if(total > limit)
+    {
+        // evict down to three quarters, so we do not scan the directory again after every new entry
+        std::sort(entries.begin(), entries.end(), [](const entry &a, const entry &b) { return a.time < b.time; });
+        for(const entry &e : entries)
+        {
+            if(total <= limit*3/4) break;
+            if(bfs::remove(e.file, ec)) total -= e.size;
+        }
+    }
+    bytes = total;
+}
+
+void diskcache::save(const std::string &dir, const diskcachekey &key, long long limit, const std::function<bool(FILE *)> &write)
+{
+    if(!key.valid()) return;
+
+    // written under another name first, a thread loading the same entry must never see half a file
+    static std::atomic<int> tmpcounter(0);
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d.tmp", tmpcounter++);
+    std::string tmpfile = entryfile(dir, key, suffix), file = entryfile(dir, key);
+    FILE *f = fopen(tmpfile.c_str(), "wb");
+    if(!f) return;
+    diskcacheheader hdr;
+    memcpy(hdr.magic, magic, 4);
+    hdr.version = version;
+    hdr.desclen = int(key.desc.size());
+    bool ok = fwrite(&hdr, 1, sizeof(hdr), f) == sizeof(hdr) && fwrite(key.desc.data(), 1, key.desc.size(), f) == key.desc.size() &&
+              write(f);
+    long size = ftell(f);
+    ok = fclose(f) == 0 && ok;
+
+    boost::system::error_code ec;
+    if(ok) bfs::rename(bfs::path(tmpfile), bfs::path(file), ec);
+    if(!ok || ec)
+    {
+        bfs::remove(bfs::path(tmpfile), ec);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(evictmutex);
+    if(bytes >= 0) bytes += size;
+    if(bytes < 0 || bytes > limit) evict(dir, limit);
+}
+
+void diskcache::clear(const std::string &dir)
+{
+    std::lock_guard<std::mutex> lock(evictmutex);
+    evict(dir, 0);
+}
+
+void diskcache::count(bool hit, unsigned millis)
+{
+    if(hit) { hits++; hitmillis += millis; }
+    else { misses++; missmillis += millis; }
+}
+
+diskcache::stats diskcache::takestats()
+{
+    stats s;
+    s.hits = hits.exchange(0);
+    s.misses = misses.exchange(0);
+    s.hitmillis = hitmillis.exchange(0);
+    s.missmillis = missmillis.exchange(0);
+    return s;
+}
+
+} // namespace util
+} // namespace inexor
@@ -0,0 +1,99 @@
+/// @file diskcache.hpp
+/// A directory of files derived from other files (decoded textures, parsed models), so loading them again can skip the work.
+///
+/// Every entry is named after the hash of its key and starts with a small header: the magic and version of the cache and the
+/// description of the key, which has to match on loading as hashes may collide. What follows is up to the cache using it.
+/// Entries are written under a temporary name and renamed, so nobody ever sees half an entry. When the directory grows beyond
+/// the limit the least recently used entries get deleted.
+/// Everything is written in the byte order of the machine, a cache is not meant to be shared between machines.
+
+#pragma once
+
+#include <stddef.h>                   // for size_t
+#include <stdio.h>                    // for FILE
+#include <atomic>                     // for atomic
+#include <functional>                 // for function
+#include <mutex>                      // for mutex
+#include <string>                     // for string
+
+#include "inexor/util/mappedfile.hpp" // for mappedfile
+
+namespace inexor {
+namespace util {
+
+/// Where FNV-1a hashing starts.
+static const unsigned long long FNV1A_BASIS = 0xcbf29ce484222325ULL;
+
+/// Add len bytes to the FNV-1a hash, fast enough compared to decoding and we do not need more than telling files apart.
+inline void fnv1a(unsigned long long &hash, const void *data, size_t len)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    for(size_t i = 0; i < len; i++)
+    {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+}
+
+/// Identifies a cache entry, empty if it can not be cached.
+struct diskcachekey
+{
+    std::string desc; ///< what the entry is made from, readable
+    unsigned long long hash = 0;
+
+    bool valid() const { return hash != 0; }
+};
+
+class diskcache
+{
+public:
+    /// Hits and misses counted with count() and the milliseconds they took.
+    struct stats
+    {
+        int hits = 0, misses = 0;
+        unsigned hitmillis = 0, missmillis = 0;
+    };
+
+    /// magic are the 4 characters every entry starts with, version has to be bumped whenever the contents change.
+    /// ext is the extension of the entries (with the dot), nothing else in the directory gets touched.
+    diskcache(const char *magic, int version, const char *ext);
+
+    diskcache(const diskcache &) = delete;
+    diskcache &operator=(const diskcache &) = delete;
+
+    /// Map the entry of key in dir (which ends in a path separator) and check its header.
+    /// Sets data and len to what follows the header, returns false if there is no (valid) entry.
+    bool load(const std::string &dir, const diskcachekey &key, mappedfile &file, const unsigned char *&data, size_t &len);
+
+    /// Store the entry of key in dir: write gets the temporary file to put what follows the header into, returning false drops it.
+    /// If the cache gets bigger than limit bytes afterwards the least recently used entries are deleted.
+    /// Safe to call on several threads at once.
+    void save(const std::string &dir, const diskcachekey &key, long long limit, const std::function<bool(FILE *)> &write);
+
+    /// Delete every entry, e.g. to measure a cold load.
+    void clear(const std::string &dir);
+
+    /// Count the time spent on loading something for the statistics, hit whether it came from the cache.
+    void count(bool hit, unsigned millis);
+    /// The counts since the last call.
+    stats takestats();
+
+private:
+    char magic[4];
+    int version;
+    std::string ext;
+
+    std::mutex evictmutex;  ///< guards bytes and the eviction
+    long long bytes = -1;   ///< what the entries use, -1 until the directory got scanned
+
+    std::atomic<int> hits{0}, misses{0};
+    std::atomic<unsigned> hitmillis{0}, missmillis{0};
+
+    std::string entryfile(const std::string &dir, const diskcachekey &key, const char *suffix = "") const;
+    /// Delete the least recently used entries until the cache is well below limit, also counts what it uses.
+    /// @warning evictmutex has to be locked.
+    void evict(const std::string &dir, long long limit);
+};
+
+} // namespace util
+} // namespace inexor
@@ -0,0 +1,379 @@
+#include "inexor/util/imagekernels.hpp"
+
+#include <atomic>                                // for atomic
+
+#include "inexor/shared/simd.hpp"                // for simd4f, INEXOR_SIMD_SSE2
+#include "inexor/util/imagekernels_simd.hpp"     // for halvetexture, blurtexture, avx2
+
+#if defined(_MSC_VER) && defined(INEXOR_IMAGESIMD_AVX2)
+#include <immintrin.h>                           // for _xgetbv
+#include <intrin.h>                              // for __cpuid, __cpuidex
+#endif
+
+namespace inexor {
+namespace util {
+
+using namespace imagekernels;
+
+/// The reference implementations.
+namespace scalar {
+
+template<int BPP> static void halvetexture(const uchar *src, uint sw, uint sh, uint stride, uchar *dst)
+{
+    for(const uchar *yend = &src[sh*stride]; src < yend;)
+    {
+        for(const uchar *xend = &src[sw*BPP], *xsrc = src; xsrc < xend; xsrc += 2*BPP, dst += BPP)
+        {
+            loopi(BPP) dst[i] = (uint(xsrc[i]) + uint(xsrc[i+BPP]) + uint(xsrc[stride+i]) + uint(xsrc[stride+i+BPP]))>>2;
+        }
+        src += 2*stride;
+    }
+}
+
+template<int n, int bpp, bool normals>
+static void blurtexture(int w, int h, uchar *dst, const uchar *src, int margin)
+{
+    const int *mat = n > 1 ? blurweights5x5 : blurweights3x3;
+    int mstride = 2 * n + 1,
+        mstartoffset = n*(mstride + 1),
+        stride = bpp*w,
+        startoffset = n*bpp,
+        nextoffset1 = stride + mstride*bpp,
+        nextoffset2 = stride - mstride*bpp;
+    src += margin*(stride + bpp);
+    for(int y = margin; y < h - margin; y++)
+    {
+        for(int x = margin; x < w - margin; x++)
+        {
+            int dr = 0, dg = 0, db = 0;
+            const uchar *p = src - startoffset;
+            const int *m = mat + mstartoffset;
+            for(int t = y; t >= y - n; t--, p -= nextoffset1, m -= mstride)
+            {
+                if(t < 0) p += stride;
+                int a = 0;
+                if(n > 1) { a += m[-2]; if(x >= 2) { dr += p[0] * a; dg += p[1] * a; db += p[2] * a; a = 0; } p += bpp; }
+                a += m[-1]; if(x >= 1) { dr += p[0] * a; dg += p[1] * a; db += p[2] * a; a = 0; } p += bpp;
+                int cr = p[0], cg = p[1], cb = p[2]; a += m[0]; dr += cr * a; dg += cg * a; db += cb * a; p += bpp;
+                if(x + 1 < w) { cr = p[0]; cg = p[1]; cb = p[2]; } dr += cr * m[1]; dg += cg * m[1]; db += cb * m[1]; p += bpp;
+                if(n > 1) { if(x + 2 < w) { cr = p[0]; cg = p[1]; cb = p[2]; } dr += cr * m[2]; dg += cg * m[2]; db += cb * m[2]; p += bpp; }
+            }
+            p = src - startoffset + stride;
+            m = mat + mstartoffset + mstride;
+            for(int t = y + 1; t <= y + n; t++, p += nextoffset2, m += mstride)
+            {
+                if(t >= h) p -= stride;
+                int a = 0;
+                if(n > 1) { a += m[-2]; if(x >= 2) { dr += p[0] * a; dg += p[1] * a; db += p[2] * a; a = 0; } p += bpp; }
+                a += m[-1]; if(x >= 1) { dr += p[0] * a; dg += p[1] * a; db += p[2] * a; a = 0; } p += bpp;
+                int cr = p[0], cg = p[1], cb = p[2]; a += m[0]; dr += cr * a; dg += cg * a; db += cb * a; p += bpp;
+                if(x + 1 < w) { cr = p[0]; cg = p[1]; cb = p[2]; } dr += cr * m[1]; dg += cg * m[1]; db += cb * m[1]; p += bpp;
+                if(n > 1) { if(x + 2 < w) { cr = p[0]; cg = p[1]; cb = p[2]; } dr += cr * m[2]; dg += cg * m[2]; db += cb * m[2]; p += bpp; }
+            }
+            if(normals) finishblurnormal(dr, dg, db, dst);
+            else
+            {
+                dst[0] = dr >> 8;
+                dst[1] = dg >> 8;
+                dst[2] = db >> 8;
+            }
+            if(bpp > 3) dst[3] = src[3];
+            dst += bpp;
+            src += bpp;
+        }
+        src += 2 * margin*bpp;
+    }
+}
+
+static void premultiply(uchar *data, int w, int h, int bpp, int pitch)
+{
+    for(uchar *row = data, *end = &data[h*pitch]; row < end; row += pitch)
+    {
+        for(uchar *dst = row, *rowend = &row[w*bpp]; dst < rowend; dst += bpp)
+        {
+            uint alpha = dst[bpp - 1];
+            loopk(bpp - 1) dst[k] = uchar((uint(dst[k])*alpha) / 255);
+        }
+    }
+}
+
+static void madtexture(uchar *data, int w, int h, int bpp, int pitch, const float mul[3], const float add[3])
+{
+    int maxk = bpp < 3 ? bpp : 3;
+    for(uchar *row = data, *end = &data[h*pitch]; row < end; row += pitch)
+    {
+        for(uchar *dst = row, *rowend = &row[w*bpp]; dst < rowend; dst += bpp)
+        {
+            loopk(maxk)
+            {
+                float c = dst[k] * mul[k] + 255 * add[k];
+                dst[k] = uchar(c < 0.0f ? 0.0f : (c > 255.0f ? 255.0f : c));
+            }
+        }
+    }
+}
+
+static void normalpixel(const uchar *src, int w, int h, int bpp, int pitch, int x, int y, uchar *dst, float nz)
+{
+    float nx = 0.0f, ny = 0.0f;
+    nx += src[y*pitch + ((x + w - 1) % w)*bpp];
+    nx -= src[y*pitch + ((x + 1) % w)*bpp];
+    ny += src[((y + h - 1) % h)*pitch + x*bpp];
+    ny -= src[((y + 1) % h)*pitch + x*bpp];
+    float mag = sqrtf(nx*nx + ny*ny + nz*nz);
+    dst[0] = uchar(127.5f + (nx/mag)*127.5f);
+    dst[1] = uchar(127.5f + (ny/mag)*127.5f);
+    dst[2] = uchar(127.5f + (nz/mag)*127.5f);
+}
+
+static void normalmap(const uchar *src, int w, int h, int bpp, int pitch, uchar *dst, int emphasis)
+{
+    loop(y, h) loop(x, w) normalpixel(src, w, h, bpp, pitch, x, y, &dst[(y*w + x)*3], 255.0f / emphasis);
+}
+
+} // namespace scalar
+
+#ifdef INEXOR_SIMD_SSE2
+namespace sse2 {
+
+/// 8 16 bit lanes, see imagekernels_simd.hpp.
+struct lanes
+{
+    __m128i v;
+    static const int N = 8;
+
+    lanes() {}
+    lanes(__m128i v) : v(v) {}
+
+    static lanes load(const uchar *p) { return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)p), _mm_setzero_si128()); }
+    static void store(uchar *p, lanes a) { _mm_storel_epi64((__m128i *)p, _mm_packus_epi16(a.v, a.v)); }
+    static void storewide(ushort *p, lanes a) { _mm_storeu_si128((__m128i *)p, a.v); }
+    static lanes splat(int x) { return _mm_set1_epi16(short(x)); }
+    static lanes add(lanes a, lanes b) { return _mm_add_epi16(a.v, b.v); }
+    static lanes mul(lanes a, lanes b) { return _mm_mullo_epi16(a.v, b.v); }
+    template<int S> static lanes shr(lanes a) { return _mm_srli_epi16(a.v, S); }
+
+    template<int BPP> static lanes pairsum(lanes a, lanes b)
+    {
+        if(BPP == 1) return _mm_packs_epi32(_mm_madd_epi16(a.v, _mm_set1_epi16(1)), _mm_madd_epi16(b.v, _mm_set1_epi16(1)));
+        if(BPP == 2)
+        {
+            a.v = _mm_shuffle_epi32(a.v, _MM_SHUFFLE(3, 1, 2, 0));
+            b.v = _mm_shuffle_epi32(b.v, _MM_SHUFFLE(3, 1, 2, 0));
+        }
+        return _mm_add_epi16(_mm_unpacklo_epi64(a.v, b.v), _mm_unpackhi_epi64(a.v, b.v));
+    }
+
+    template<int BPP> static lanes alpha(lanes a)
+    {
+        if(BPP == 2) return _mm_shufflehi_epi16(_mm_shufflelo_epi16(a.v, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1));
+        return _mm_shufflehi_epi16(_mm_shufflelo_epi16(a.v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    }
+
+    template<int BPP> static lanes keepalpha(lanes a, lanes orig)
+    {
+        __m128i mask = BPP == 2 ? _mm_set_epi16(-1, 0, -1, 0, -1, 0, -1, 0) : _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+        return _mm_or_si128(_mm_and_si128(mask, orig.v), _mm_andnot_si128(mask, a.v));
+    }
+
+    static void mad(const uchar *src, const float *mul, const float *add, uchar *dst)
+    {
+        __m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)src), _mm_setzero_si128());
+        __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(c, _mm_setzero_si128())),
+               hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(c, _mm_setzero_si128()));
+        lo = _mm_add_ps(_mm_mul_ps(lo, _mm_loadu_ps(mul)), _mm_loadu_ps(add));
+        hi = _mm_add_ps(_mm_mul_ps(hi, _mm_loadu_ps(mul + 4)), _mm_loadu_ps(add + 4));
+        lo = _mm_min_ps(_mm_max_ps(lo, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+        hi = _mm_min_ps(_mm_max_ps(hi, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+        store(dst, _mm_packs_epi32(_mm_cvttps_epi32(lo), _mm_cvttps_epi32(hi)));
+    }
+};
+
+/// Only needs simd4f, so the AVX2 level uses this one as well.
+static void normalmap(const uchar *src, int w, int h, int bpp, int pitch, uchar *dst, int emphasis)
+{
+    const float nz = 255.0f / emphasis;
+    const simd4f half(127.5f), z(nz), zz = z*z;
+    loop(y, h)
+    {
+        const uchar *row = &src[y*pitch], *up = &src[((y + h - 1) % h)*pitch], *down = &src[((y + 1) % h)*pitch];
+        uchar *drow = &dst[y*w*3];
+        // the first and last pixel wrap around, these are left to the scalar version
+        int x = 0;
+        scalar::normalpixel(src, w, h, bpp, pitch, x++, y, drow, nz);
+        for(; x + 4 < w; x += 4)
+        {
+            float nx[4], ny[4], n[12];
+            loopi(4)
+            {
+                nx[i] = float(int(row[(x + i - 1)*bpp]) - int(row[(x + i + 1)*bpp]));
+                ny[i] = float(int(up[(x + i)*bpp]) - int(down[(x + i)*bpp]));
+            }
+            simd4f vx = simd4f::load(nx), vy = simd4f::load(ny), mag = simdsqrt(vx*vx + vy*vy + zz);
+            (half + (vx/mag)*half).store(&n[0]);
+            (half + (vy/mag)*half).store(&n[4]);
+            (half + (z/mag)*half).store(&n[8]);
+            loopi(4) loopk(3) drow[(x + i)*3 + k] = uchar(n[k*4 + i]);
+        }
+        for(; x < w; x++) scalar::normalpixel(src, w, h, bpp, pitch, x, y, &drow[x*3], nz);
+    }
+}
+
+static void halvetexture(const uchar *src, uint sw, uint sh, uint bpp, uint pitch, uchar *dst)
+{
+    switch(bpp)
+    {
+        case 1: return imagekernels::halvetexture<lanes, 1>(src, sw, sh, pitch, dst);
+        case 2: return imagekernels::halvetexture<lanes, 2>(src, sw, sh, pitch, dst);
+        case 3: return imagekernels::halvetexture<lanes, 3>(src, sw, sh, pitch, dst);
+        case 4: return imagekernels::halvetexture<lanes, 4>(src, sw, sh, pitch, dst);
+    }
+}
+
+} // namespace sse2
+#endif
+
+#ifdef INEXOR_IMAGESIMD_AVX2
+static bool cpuhasavx2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if(info[0] < 7) return false;
+    __cpuid(info, 1);
+    // the OS has to save the AVX registers as well
+    if(!(info[2] & (1<<27)) || !(info[2] & (1<<28)) || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1<<5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+int bestimagesimd()
+{
+#ifdef INEXOR_IMAGESIMD_AVX2
+    static const bool avx2 = cpuhasavx2();
+    if(avx2) return IMAGESIMD_AVX2;
+#endif
+#ifdef INEXOR_SIMD_SSE2
+    return IMAGESIMD_SSE2;
+#else
+    return IMAGESIMD_SCALAR;
+#endif
+}
+
+static std::atomic<int> &levelvar()
+{
+    static std::atomic<int> level(bestimagesimd());
+    return level;
+}
+
+int setimagesimd(int level)
+{
+    level = level < IMAGESIMD_SCALAR ? IMAGESIMD_SCALAR : (level > bestimagesimd() ? bestimagesimd() : level);
+    levelvar() = level;
+    return level;
+}
+
+int imagesimd()
+{
+    return levelvar();
+}
+
+const char *imagesimdname(int level)
+{
+    switch(level)
+    {
+        case IMAGESIMD_SSE2: return "SSE2";
+        case IMAGESIMD_AVX2: return "AVX2";
+        default: return "scalar";
+    }
+}
+
+void halvetexture(const uchar *src, uint sw, uint sh, uint bpp, uint pitch, uchar *dst)
+{
+    switch(imagesimd())
+    {
+#ifdef INEXOR_IMAGESIMD_AVX2
+        case IMAGESIMD_AVX2: return avx2::halvetexture(src, sw, sh, bpp, pitch, dst);
+#endif
+#ifdef INEXOR_SIMD_SSE2
+        case IMAGESIMD_SSE2: return sse2::halvetexture(src, sw, sh, bpp, pitch, dst);
+#endif
+    }
+    switch(bpp)
+    {
+        case 1: return scalar::halvetexture<1>(src, sw, sh, pitch, dst);
+        case 2: return scalar::halvetexture<2>(src, sw, sh, pitch, dst);
+        case 3: return scalar::halvetexture<3>(src, sw, sh, pitch, dst);
+        case 4: return scalar::halvetexture<4>(src, sw, sh, pitch, dst);
+    }
+}
+
+void blurtexture(int n, int bpp, int w, int h, uchar *dst, const uchar *src, int margin, bool normals)
+{
+    n = n < 1 ? 1 : (n > 2 ? 2 : n);
+    if(bpp != 3 && (bpp != 4 || normals)) return;
+    switch(imagesimd())
+    {
+#ifdef INEXOR_IMAGESIMD_AVX2
+        case IMAGESIMD_AVX2: return avx2::blurtexture(n, bpp, w, h, dst, src, margin, normals);
+#endif
+#ifdef INEXOR_SIMD_SSE2
+        case IMAGESIMD_SSE2: return imagekernels::blurtexture<sse2::lanes>(n, bpp, w, h, dst, src, margin, normals);
+#endif
+    }
+    switch((n << 4) | bpp | (normals ? 0x100 : 0))
+    {
+        case 0x13: scalar::blurtexture<1, 3, false>(w, h, dst, src, margin); break;
+        case 0x23: scalar::blurtexture<2, 3, false>(w, h, dst, src, margin); break;
+        case 0x14: scalar::blurtexture<1, 4, false>(w, h, dst, src, margin); break;
+        case 0x24: scalar::blurtexture<2, 4, false>(w, h, dst, src, margin); break;
+        case 0x113: scalar::blurtexture<1, 3, true>(w, h, dst, src, margin); break;
+        case 0x123: scalar::blurtexture<2, 3, true>(w, h, dst, src, margin); break;
+    }
+}
+
+void premultiply(uchar *data, int w, int h, int bpp, int pitch)
+{
+    if(bpp != 2 && bpp != 4) return;
+    switch(imagesimd())
+    {
+#ifdef INEXOR_IMAGESIMD_AVX2
+        case IMAGESIMD_AVX2: return avx2::premultiply(data, w, h, bpp, pitch);
+#endif
+#ifdef INEXOR_SIMD_SSE2
+        case IMAGESIMD_SSE2:
+            if(bpp == 2) return imagekernels::premultiply<sse2::lanes, 2>(data, w, h, pitch);
+            return imagekernels::premultiply<sse2::lanes, 4>(data, w, h, pitch);
+#endif
+    }
+    scalar::premultiply(data, w, h, bpp, pitch);
+}
+
+void madtexture(uchar *data, int w, int h, int bpp, int pitch, const float mul[3], const float add[3])
+{
+    switch(imagesimd())
+    {
+#ifdef INEXOR_IMAGESIMD_AVX2
+        case IMAGESIMD_AVX2: return avx2::madtexture(data, w, h, bpp, pitch, mul, add);
+#endif
+#ifdef INEXOR_SIMD_SSE2
+        case IMAGESIMD_SSE2: return imagekernels::madtexture<sse2::lanes>(data, w, h, bpp, pitch, mul, add);
+#endif
+    }
+    scalar::madtexture(data, w, h, bpp, pitch, mul, add);
+}
+
+void normalmap(const uchar *src, int w, int h, int bpp, int pitch, uchar *dst, int emphasis)
+{
+#ifdef INEXOR_SIMD_SSE2
+    if(imagesimd() >= IMAGESIMD_SSE2) return sse2::normalmap(src, w, h, bpp, pitch, dst, emphasis);
+#endif
+    scalar::normalmap(src, w, h, bpp, pitch, dst, emphasis);
+}
+
+} // namespace util
+} // namespace inexor
@@ -0,0 +1,51 @@
+/// @file imagekernels.hpp
+/// The per pixel loops of texture processing (mipmaps, blur, normal maps, premultiplied alpha, <mad>) with SIMD implementations.
+///
+/// Images are 8 bit per channel with 1 to 4 channels (bpp) and pitch bytes per row.
+/// Every kernel has a scalar version, which is the reference, and SSE2 and AVX2 versions which are picked at runtime
+/// depending on the CPU. The SIMD versions produce the same bytes as the scalar ones (the float kernels may differ by one
+/// if the compiler is allowed to reorder float math, e.g. /fp:fast).
+/// The kernels are written against a small vector type (see imagekernels_simd.hpp), another instruction set (e.g. NEON)
+/// only needs another one of these.
+
+#pragma once
+
+namespace inexor {
+namespace util {
+
+enum imagesimdlevel
+{
+    IMAGESIMD_SCALAR = 0,
+    IMAGESIMD_SSE2,
+    IMAGESIMD_AVX2,
+    IMAGESIMD_MAX = IMAGESIMD_AVX2
+};
+
+/// The best level this CPU and build support.
+int bestimagesimd();
+/// Use at most the given level, returns the one used. Defaults to bestimagesimd().
+int setimagesimd(int level);
+/// The level in use.
+int imagesimd();
+const char *imagesimdname(int level);
+
+/// Halve the size of an image with a box filter, sw and sh have to be even. dst is written without padding between rows.
+void halvetexture(const unsigned char *src, unsigned int sw, unsigned int sh, unsigned int bpp, unsigned int pitch, unsigned char *dst);
+
+/// Blur the rgb of an image with bpp 3 or 4 with a 3x3 (n = 1) or 5x5 (n = 2) gaussian, alpha is kept.
+/// Only the pixels margin or more pixels away from the border are written, without padding between rows.
+/// If normals is set the rgb vectors get renormalized afterwards.
+void blurtexture(int n, int bpp, int w, int h, unsigned char *dst, const unsigned char *src, int margin = 0, bool normals = false);
+
+/// Multiply the color channels of an image with bpp 2 or 4 with its alpha.
+void premultiply(unsigned char *data, int w, int h, int bpp, int pitch);
+
+/// Scale and bias the (up to 3) color channels: c = clamp(c*mul + 255*add, 0, 255).
+void madtexture(unsigned char *data, int w, int h, int bpp, int pitch, const float mul[3], const float add[3]);
+
+/// Turn the first channel of src into a normal map with 3 bytes per pixel, dst is written without padding between rows.
+/// The higher emphasis, the steeper the normals get.
+void normalmap(const unsigned char *src, int w, int h, int bpp, int pitch, unsigned char *dst, int emphasis);
+
+} // namespace util
+} // namespace inexor
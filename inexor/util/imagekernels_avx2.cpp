@@ -0,0 +1,107 @@
+/// @file imagekernels_avx2.cpp
+/// The kernels of imagekernels_simd.hpp compiled for AVX2 (this file gets -mavx2, see CMakeLists.txt).
+/// Nothing else may be compiled here: code shared with the other instruction sets could end up using AVX2 instructions.
+
+#include "inexor/util/imagekernels_simd.hpp"  // for halvetexture, blurtexture, premultiply, madtexture
+
+#ifdef INEXOR_IMAGESIMD_AVX2
+
+#if !defined(__AVX2__) && !defined(_MSC_VER)
+#error "imagekernels_avx2.cpp has to be compiled with -mavx2"
+#endif
+
+#include <immintrin.h>                         // for __m256i, _mm256_add_epi16
+
+namespace inexor {
+namespace util {
+namespace avx2 {
+
+/// 16 16 bit lanes, see imagekernels_simd.hpp.
+/// Most AVX2 instructions work on two independent halves, the results which cross them get fixed up with permutes.
+struct lanes
+{
+    __m256i v;
+    static const int N = 16;
+
+    lanes() {}
+    lanes(__m256i v) : v(v) {}
+
+    static lanes load(const uchar *p) { return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)p)); }
+    static void store(uchar *p, lanes a) { _mm_storeu_si128((__m128i *)p, _mm_packus_epi16(_mm256_castsi256_si128(a.v), _mm256_extracti128_si256(a.v, 1))); }
+    static void storewide(ushort *p, lanes a) { _mm256_storeu_si256((__m256i *)p, a.v); }
+    static lanes splat(int x) { return _mm256_set1_epi16(short(x)); }
+    static lanes add(lanes a, lanes b) { return _mm256_add_epi16(a.v, b.v); }
+    static lanes mul(lanes a, lanes b) { return _mm256_mullo_epi16(a.v, b.v); }
+    template<int S> static lanes shr(lanes a) { return _mm256_srli_epi16(a.v, S); }
+
+    template<int BPP> static lanes pairsum(lanes a, lanes b)
+    {
+        __m256i r;
+        if(BPP == 1) r = _mm256_packs_epi32(_mm256_madd_epi16(a.v, _mm256_set1_epi16(1)), _mm256_madd_epi16(b.v, _mm256_set1_epi16(1)));
+        else
+        {
+            if(BPP == 2)
+            {
+                a.v = _mm256_shuffle_epi32(a.v, _MM_SHUFFLE(3, 1, 2, 0));
+                b.v = _mm256_shuffle_epi32(b.v, _MM_SHUFFLE(3, 1, 2, 0));
+            }
+            r = _mm256_add_epi16(_mm256_unpacklo_epi64(a.v, b.v), _mm256_unpackhi_epi64(a.v, b.v));
+        }
+        // the halves hold a0 b0 | a1 b1, we want a0 a1 | b0 b1
+        return _mm256_permute4x64_epi64(r, _MM_SHUFFLE(3, 1, 2, 0));
+    }
+
+    template<int BPP> static lanes alpha(lanes a)
+    {
+        if(BPP == 2) return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(a.v, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1));
+        return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(a.v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    }
+
+    template<int BPP> static lanes keepalpha(lanes a, lanes orig) { return _mm256_blend_epi16(a.v, orig.v, BPP == 2 ? 0xAA : 0x88); }
+
+    static void mad(const uchar *src, const float *mul, const float *add, uchar *dst)
+    {
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)src))),
+               hi = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + 8))));
+        // no FMA: the result has to be rounded like the scalar version
+        lo = _mm256_add_ps(_mm256_mul_ps(lo, _mm256_loadu_ps(mul)), _mm256_loadu_ps(add));
+        hi = _mm256_add_ps(_mm256_mul_ps(hi, _mm256_loadu_ps(mul + 8)), _mm256_loadu_ps(add + 8));
+        lo = _mm256_min_ps(_mm256_max_ps(lo, _mm256_setzero_ps()), _mm256_set1_ps(255.0f));
+        hi = _mm256_min_ps(_mm256_max_ps(hi, _mm256_setzero_ps()), _mm256_set1_ps(255.0f));
+        __m256i c = _mm256_packs_epi32(_mm256_cvttps_epi32(lo), _mm256_cvttps_epi32(hi));
+        store(dst, _mm256_permute4x64_epi64(c, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+};
+
+void halvetexture(const uchar *src, uint sw, uint sh, uint bpp, uint pitch, uchar *dst)
+{
+    switch(bpp)
+    {
+        case 1: return imagekernels::halvetexture<lanes, 1>(src, sw, sh, pitch, dst);
+        case 2: return imagekernels::halvetexture<lanes, 2>(src, sw, sh, pitch, dst);
+        case 3: return imagekernels::halvetexture<lanes, 3>(src, sw, sh, pitch, dst);
+        case 4: return imagekernels::halvetexture<lanes, 4>(src, sw, sh, pitch, dst);
+    }
+}
+
+void blurtexture(int n, int bpp, int w, int h, uchar *dst, const uchar *src, int margin, bool normals)
+{
+    imagekernels::blurtexture<lanes>(n, bpp, w, h, dst, src, margin, normals);
+}
+
+void premultiply(uchar *data, int w, int h, int bpp, int pitch)
+{
+    if(bpp == 2) imagekernels::premultiply<lanes, 2>(data, w, h, pitch);
+    else imagekernels::premultiply<lanes, 4>(data, w, h, pitch);
+}
+
+void madtexture(uchar *data, int w, int h, int bpp, int pitch, const float mul[3], const float add[3])
+{
+    imagekernels::madtexture<lanes>(data, w, h, bpp, pitch, mul, add);
+}
+
+} // namespace avx2
+} // namespace util
+} // namespace inexor
+
+#endif
@@ -0,0 +1,213 @@
+/// @file imagekernels_simd.hpp
+/// The SIMD kernels of imagekernels.hpp, written once against a vector type V and compiled for every instruction set.
+///
+/// V holds V::N unsigned 16 bit lanes and provides:
+///  - load(p): V::N bytes widened to 16 bit, store(p, a): narrowed back with saturation, storewide(p, a): the 16 bit lanes
+///  - splat(x), add(a, b), mul(a, b) (the low 16 bits), shr<S>(a)
+///  - pairsum<BPP>(a, b): adds neighbouring pixels of BPP (1, 2 or 4) lanes, a holds the first V::N/2 results, b the rest
+///  - alpha<BPP>(a): every lane of a pixel set to its alpha, keepalpha<BPP>(a, orig): a with the alpha lanes of orig
+///  - mad(src, mul, add, dst): V::N bytes as floats: dst = clamp(src*mul + add, 0, 255)
+///
+/// Everything in here is static, so the copies compiled with different instruction sets (imagekernels_avx2.cpp) never get merged.
+
+#pragma once
+
+#include <math.h>                        // for sqrtf
+
+#include "inexor/shared/cube_loops.hpp"  // for loopi, loopk, loop
+#include "inexor/shared/cube_types.hpp"  // for uchar, ushort, uint
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define INEXOR_IMAGESIMD_AVX2 1
+#endif
+
+namespace inexor {
+namespace util {
+
+#ifdef INEXOR_IMAGESIMD_AVX2
+/// Compiled with AVX2 enabled in imagekernels_avx2.cpp, only call these if the CPU has it.
+namespace avx2 {
+void halvetexture(const uchar *src, uint sw, uint sh, uint bpp, uint pitch, uchar *dst);
+void blurtexture(int n, int bpp, int w, int h, uchar *dst, const uchar *src, int margin, bool normals);
+void premultiply(uchar *data, int w, int h, int bpp, int pitch);
+void madtexture(uchar *data, int w, int h, int bpp, int pitch, const float mul[3], const float add[3]);
+} // namespace avx2
+#endif
+
+namespace imagekernels {
+
+static const int blurweights3x3[9] =
+{
+    0x10, 0x20, 0x10,
+    0x20, 0x40, 0x20,
+    0x10, 0x20, 0x10
+};
+static const int blurweights5x5[25] =
+{
+    0x05, 0x05, 0x09, 0x05, 0x05,
+    0x05, 0x0A, 0x14, 0x0A, 0x05,
+    0x09, 0x14, 0x28, 0x14, 0x09,
+    0x05, 0x0A, 0x14, 0x0A, 0x05,
+    0x05, 0x05, 0x09, 0x05, 0x05
+};
+
+static inline int clampcoord(int i, int size) { return i < 0 ? 0 : (i >= size ? size - 1 : i); }
+
+/// Turn the weighted sums (256 = 1) of a blurred normal into a unit vector again.
+static inline void finishblurnormal(int dr, int dg, int db, uchar *dst)
+{
+    float x = float(dr - 0x7F80), y = float(dg - 0x7F80), z = float(db - 0x7F80);
+    float mag = 127.5f / sqrtf(x*x + y*y + z*z);
+    dst[0] = uchar(x*mag + 127.5f);
+    dst[1] = uchar(y*mag + 127.5f);
+    dst[2] = uchar(z*mag + 127.5f);
+}
+
+/// Blur one pixel, pixels beyond the border repeat the border like the scalar blur does.
+template<int n, int bpp, bool normals>
+static void blurpixel(int w, int h, int x, int y, uchar *dst, const uchar *src)
+{
+    const int *mat = n > 1 ? blurweights5x5 : blurweights3x3;
+    const int mstride = 2*n + 1, stride = w*bpp;
+    int dr = 0, dg = 0, db = 0;
+    loop(dy, mstride)
+    {
+        const uchar *row = &src[clampcoord(y + dy - n, h)*stride];
+        loop(dx, mstride)
+        {
+            const uchar *p = &row[clampcoord(x + dx - n, w)*bpp];
+            int m = mat[dy*mstride + dx];
+            dr += p[0]*m;
+            dg += p[1]*m;
+            db += p[2]*m;
+        }
+    }
+    if(normals) finishblurnormal(dr, dg, db, dst);
+    else
+    {
+        dst[0] = dr >> 8;
+        dst[1] = dg >> 8;
+        dst[2] = db >> 8;
+    }
+    if(bpp > 3) dst[3] = src[y*stride + x*bpp + 3];
+}
+
+template<class V, int BPP>
+static void halvetexture(const uchar *src, uint sw, uint sh, uint stride, uchar *dst)
+{
+    const uint dbytes = (sw/2)*BPP;
+    for(uint y = 0; y < sh; y += 2, src += 2*stride, dst += dbytes)
+    {
+        const uchar *r0 = src, *r1 = src + stride;
+        uint i = 0;
+        // 3 bytes per pixel never line up with the vectors, the compiler does as well as we could for them
+        if(BPP != 3) for(; i + V::N <= dbytes; i += V::N)
+        {
+            V a = V::add(V::load(&r0[2*i]), V::load(&r1[2*i])),
+              b = V::add(V::load(&r0[2*i + V::N]), V::load(&r1[2*i + V::N]));
+            V::store(&dst[i], V::template shr<2>(V::template pairsum<BPP>(a, b)));
+        }
+        for(; i < dbytes; i += BPP)
+        {
+            loopk(BPP) dst[i + k] = (uint(r0[2*i + k]) + uint(r0[2*i + k + BPP]) + uint(r1[2*i + k]) + uint(r1[2*i + k + BPP])) >> 2;
+        }
+    }
+}
+
+template<class V, int n, int bpp, bool normals>
+static void blurtexture(int w, int h, uchar *dst, const uchar *src, int margin)
+{
+    const int *mat = n > 1 ? blurweights5x5 : blurweights3x3;
+    const int mstride = 2*n + 1, stride = w*bpp, dw = w - 2*margin;
+    V weights[25];
+    loopi(mstride*mstride) weights[i] = V::splat(mat[i]);
+    for(int y = margin; y < h - margin; y++)
+    {
+        uchar *drow = &dst[(y - margin)*dw*bpp];
+        int x = margin;
+        if(y >= n && y + n < h)
+        {
+            for(; x < n; x++) blurpixel<n, bpp, normals>(w, h, x, y, &drow[(x - margin)*bpp], src);
+            // V::N pixels at once, as bpp vectors: the weights are the same for every channel, so the lanes need not know about pixels
+            for(; x + V::N <= w - n; x += V::N)
+            {
+                ushort sums[4*V::N];
+                loopj(bpp)
+                {
+                    const uchar *p = &src[(y - n)*stride + (x - n)*bpp + j*V::N];
+                    V acc = V::splat(0);
+                    loop(dy, mstride) loop(dx, mstride) acc = V::add(acc, V::mul(V::load(&p[dy*stride + dx*bpp]), weights[dy*mstride + dx]));
+                    if(normals) V::storewide(&sums[j*V::N], acc);
+                    else V::store(&drow[(x - margin)*bpp + j*V::N], V::template shr<8>(acc));
+                }
+                if(normals) loopk(V::N) finishblurnormal(sums[k*bpp], sums[k*bpp + 1], sums[k*bpp + 2], &drow[(x - margin + k)*bpp]);
+                else if(bpp > 3) loopk(V::N) drow[(x - margin + k)*bpp + 3] = src[y*stride + (x + k)*bpp + 3];
+            }
+        }
+        for(; x < w - margin; x++) blurpixel<n, bpp, normals>(w, h, x, y, &drow[(x - margin)*bpp], src);
+    }
+}
+
+template<class V>
+static void blurtexture(int n, int bpp, int w, int h, uchar *dst, const uchar *src, int margin, bool normals)
+{
+    switch((n << 4) | bpp | (normals ? 0x100 : 0))
+    {
+    case 0x13: blurtexture<V, 1, 3, false>(w, h, dst, src, margin); break;
+    case 0x23: blurtexture<V, 2, 3, false>(w, h, dst, src, margin); break;
+    case 0x14: blurtexture<V, 1, 4, false>(w, h, dst, src, margin); break;
+    case 0x24: blurtexture<V, 2, 4, false>(w, h, dst, src, margin); break;
+    case 0x113: blurtexture<V, 1, 3, true>(w, h, dst, src, margin); break;
+    case 0x123: blurtexture<V, 2, 3, true>(w, h, dst, src, margin); break;
+    }
+}
+
+template<class V, int BPP>
+static void premultiply(uchar *data, int w, int h, int pitch)
+{
+    const V one = V::splat(1);
+    for(uchar *row = data, *end = &data[h*pitch]; row < end; row += pitch)
+    {
+        int i = 0, bytes = w*BPP;
+        for(; i + V::N <= bytes; i += V::N)
+        {
+            V c = V::load(&row[i]), p = V::mul(c, V::template alpha<BPP>(c));
+            // p/255 for p <= 255*255
+            V q = V::template shr<8>(V::add(V::add(p, one), V::template shr<8>(p)));
+            V::store(&row[i], V::template keepalpha<BPP>(q, c));
+        }
+        for(; i < bytes; i += BPP)
+        {
+            uint alpha = row[i + BPP - 1];
+            loopk(BPP - 1) row[i + k] = uchar((uint(row[i + k])*alpha)/255);
+        }
+    }
+}
+
+template<class V>
+static void madtexture(uchar *data, int w, int h, int bpp, int pitch, const float mul[3], const float add[3])
+{
+    // 48 bytes are a whole number of pixels and vectors for every bpp
+    const int maxk = bpp < 3 ? bpp : 3;
+    float muls[48], adds[48];
+    loopi(48)
+    {
+        int k = i%bpp;
+        muls[i] = k < maxk ? mul[k] : 1.0f;
+        adds[i] = k < maxk ? 255*add[k] : 0.0f;
+    }
+    for(uchar *row = data, *end = &data[h*pitch]; row < end; row += pitch)
+    {
+        int i = 0, bytes = w*bpp;
+        for(; i + 48 <= bytes; i += 48) for(int j = 0; j < 48; j += V::N) V::mad(&row[i + j], &muls[j], &adds[j], &row[i + j]);
+        for(; i < bytes; i++)
+        {
+            float c = row[i]*muls[i%48] + adds[i%48];
+            row[i] = uchar(c < 0.0f ? 0.0f : (c > 255.0f ? 255.0f : c));
+        }
+    }
+}
+
+} // namespace imagekernels
+} // namespace util
+} // namespace inexor
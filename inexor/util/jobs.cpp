@@ -0,0 +1,320 @@
+#include "inexor/util/jobs.hpp"
+
+#include <algorithm>               // for max, min
+#include <fstream>                 // for ifstream
+#include <set>                     // for set
+#include <string>                  // for string, to_string
+#include <utility>                 // for pair, move
+
+#if defined(_WIN32)
+#include <windows.h>               // for GetLogicalProcessorInformation
+#elif defined(__APPLE__)
+#include <sys/sysctl.h>            // for sysctlbyname
+#elif defined(__linux__)
+#include <sched.h>                 // for sched_getaffinity, CPU_COUNT
+#include <unistd.h>                // for sysconf
+#endif
+
+namespace inexor {
+namespace util {
+
+cpu_topology detect_cpu_topology()
+{
+    int hw = int(std::thread::hardware_concurrency());
+    cpu_topology t;
+    t.logical = t.cores = std::max(hw, 1);
+    t.packages = 1;
+
+#if defined(_WIN32)
+    DWORD len = 0;
+    GetLogicalProcessorInformation(nullptr, &len);
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(len/sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if(!info.empty() && GetLogicalProcessorInformation(info.data(), &len))
+    {
+        int logical = 0, cores = 0, packages = 0;
+        for(const SYSTEM_LOGICAL_PROCESSOR_INFORMATION &i : info)
+        {
+            if(i.Relationship == RelationProcessorCore)
+            {
+                cores++;
+                for(ULONG_PTR mask = i.ProcessorMask; mask; mask &= mask - 1) logical++;
+            }
+            else if(i.Relationship == RelationProcessorPackage) packages++;
+        }
+        if(logical > 0) t.logical = logical;
+        if(cores > 0) t.cores = cores;
+        if(packages > 0) t.packages = packages;
+    }
+#elif defined(__APPLE__)
+    int value = 0;
+    size_t size = sizeof(value);
+    if(!sysctlbyname("hw.logicalcpu", &value, &size, nullptr, 0) && value > 0) t.logical = value;
+    size = sizeof(value);
+    if(!sysctlbyname("hw.physicalcpu", &value, &size, nullptr, 0) && value > 0) t.cores = value;
+    size = sizeof(value);
+    if(!sysctlbyname("hw.packages", &value, &size, nullptr, 0) && value > 0) t.packages = value;
+#elif defined(__linux__)
+    // the cpus we may run on, which is less than the machine has in a container or with taskset
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool affinity = !sched_getaffinity(0, sizeof(allowed), &allowed);
+    if(affinity && CPU_COUNT(&allowed) > 0) t.logical = CPU_COUNT(&allowed);
+
+    std::set<std::pair<int, int>> cores;
+    std::set<int> packages;
+    long configured = sysconf(_SC_NPROCESSORS_CONF);
+    for(int cpu = 0; cpu < configured && cpu < CPU_SETSIZE; cpu++)
+    {
+        if(affinity && !CPU_ISSET(cpu, &allowed)) continue;
+        std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+        std::ifstream corefile(dir + "core_id"), packagefile(dir + "physical_package_id");
+        int core = -1, package = -1;
+        if(!(corefile >> core) || !(packagefile >> package)) continue;
+        cores.insert(std::make_pair(package, core));
+        packages.insert(package);
+    }
+    if(!cores.empty()) t.cores = std::min(int(cores.size()), t.logical);
+    if(!packages.empty()) t.packages = int(packages.size());
+#endif
+
+    t.cores = std::max(std::min(t.cores, t.logical), 1);
+    t.packages = std::max(std::min(t.packages, t.cores), 1);
+    return t;
+}
+
+/// Which job system the current thread is a worker of and which one, so spawn() can push to its own deque.
+static thread_local const job_system *current_system = nullptr;
+static thread_local int current_worker = -1;
+
+void job_system::start(int n)
+{
+    n = std::max(std::min(n, int(MAXWORKERS)), 0);
+    {
+        std::lock_guard<std::mutex> lock(sleepmutex);
+        // all deques have to exist before the first worker looks for something to steal
+        for(int i = created.load(); i < n; i++) workers[i].reset(new worker);
+        if(n > created.load()) created.store(n);
+        active.store(n);
+        for(int i = 0; i < n; i++)
+        {
+            worker &w = *workers[i];
+            if(w.alive) continue; // possibly retiring, it sees the new count before it exits
+            if(w.thread.joinable()) w.thread.join(); // it exited already, this does not block
+            w.alive = true;
+            w.thread = std::thread(&job_system::workerloop, this, i);
+        }
+    }
+    // sleeping surplus workers exit
+    wakeup.notify_all();
+}
+
+void job_system::stop()
+{
+    int n = created.load();
+    if(!n) return;
+    {
+        std::lock_guard<std::mutex> lock(sleepmutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    for(int i = 0; i < n; i++) if(workers[i]->thread.joinable()) workers[i]->thread.join();
+    // the ones which retired before did not run the rest
+    for(task_ptr t; (t = take(-1, true));) run(t);
+    std::lock_guard<std::mutex> lock(sleepmutex);
+    for(int i = 0; i < n; i++) workers[i].reset();
+    created.store(0);
+    active.store(0);
+    stopping = false;
+}
+
+/// Let the worker exit if there are more than wanted now.
+/// @warning sleepmutex has to be locked.
+bool job_system::retire(int self)
+{
+    if(self < active.load()) return false;
+    workers[self]->alive = false;
+    return true;
+}
+
+void job_system::enqueue(const task_ptr &t)
+{
+    if(t->background)
+    {
+        std::lock_guard<std::mutex> lock(injectmutex);
+        background.push_back(t);
+    }
+    else if(current_system == this && current_worker >= 0)
+    {
+        worker &w = *workers[current_worker];
+        std::lock_guard<std::mutex> lock(w.m);
+        w.tasks.push_back(t);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(injectmutex);
+        injected.push_back(t);
+    }
+    queued.fetch_add(1);
+    {
+        // counted before taking the lock, so a worker going to sleep either sees it or gets woken up
+        std::lock_guard<std::mutex> lock(sleepmutex);
+        if(sleeping) wakeup.notify_one();
+    }
+    signalwaiters();
+}
+
+/// Wake the threads in wait(), to check their task or help with the new one.
+void job_system::signalwaiters()
+{
+    // counted before looking at waiters, so a thread going to sleep in wait() either sees the change or gets woken up
+    changes.fetch_add(1);
+    if(!waiters.load()) return;
+    std::lock_guard<std::mutex> lock(waitmutex);
+    waitdone.notify_all();
+}
+
+task_ptr job_system::take(int self, bool allowbackground)
+{
+    task_ptr t;
+    int n = created.load(std::memory_order_acquire);
+    if(self >= 0)
+    {
+        worker &w = *workers[self];
+        std::lock_guard<std::mutex> lock(w.m);
+        if(!w.tasks.empty())
+        {
+            t = std::move(w.tasks.back());
+            w.tasks.pop_back();
+        }
+    }
+    if(!t)
+    {
+        std::lock_guard<std::mutex> lock(injectmutex);
+        if(!injected.empty())
+        {
+            t = std::move(injected.front());
+            injected.pop_front();
+        }
+    }
+    for(int i = 1; !t && i <= n; i++)
+    {
+        worker &victim = *workers[(std::max(self, 0) + i)%n];
+        std::lock_guard<std::mutex> lock(victim.m);
+        if(!victim.tasks.empty())
+        {
+            t = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+        }
+    }
+    if(!t && allowbackground)
+    {
+        std::lock_guard<std::mutex> lock(injectmutex);
+        if(!background.empty())
+        {
+            t = std::move(background.front());
+            background.pop_front();
+        }
+    }
+    if(t) queued.fetch_sub(1);
+    return t;
+}
+
+void job_system::run(const task_ptr &t)
+{
+    t->fn();
+    t->fn = nullptr; // let go of whatever it captured
+    std::vector<task_ptr> ready;
+    {
+        std::lock_guard<std::mutex> lock(t->m);
+        t->finished.store(true, std::memory_order_release);
+        ready.swap(t->dependents);
+    }
+    for(const task_ptr &d : ready) if(d->unfinished_deps.fetch_sub(1) == 1) enqueue(d);
+    signalwaiters();
+}
+
+task_ptr job_system::spawn(std::function<void()> fn, std::initializer_list<task_ptr> deps, bool background)
+{
+    return spawn(std::move(fn), std::vector<task_ptr>(deps), background);
+}
+
+task_ptr job_system::spawn(std::function<void()> fn, const std::vector<task_ptr> &deps, bool background)
+{
+    task_ptr t = std::make_shared<task>(std::move(fn), background);
+    for(const task_ptr &d : deps)
+    {
+        if(!d) continue;
+        std::lock_guard<std::mutex> lock(d->m);
+        if(d->done()) continue;
+        t->unfinished_deps.fetch_add(1);
+        d->dependents.push_back(t);
+    }
+    if(t->unfinished_deps.fetch_sub(1) == 1) enqueue(t);
+    return t;
+}
+
+void job_system::wait(const task_ptr &t)
+{
+    if(!t) return;
+    int self = current_system == this ? current_worker : -1;
+    // without workers nobody else would ever run the background tasks
+    bool allowbackground = !numworkers();
+    while(!t->done())
+    {
+        unsigned seen = changes.load();
+        task_ptr other = take(self, allowbackground);
+        if(other)
+        {
+            run(other);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(waitmutex);
+        waiters++;
+        waitdone.wait(lock, [&] { return t->done() || changes.load() != seen; });
+        waiters--;
+    }
+}
+
+void job_system::workerloop(int self)
+{
+    current_system = this;
+    current_worker = self;
+    for(;;)
+    {
+        if(self >= active.load())
+        {
+            std::lock_guard<std::mutex> lock(sleepmutex);
+            if(retire(self)) break;
+        }
+        task_ptr t = take(self, true);
+        if(t)
+        {
+            run(t);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepmutex);
+        if(stopping && queued.load() <= 0) break;
+        if(retire(self)) break;
+        sleeping++;
+        wakeup.wait(lock, [this, self] { return stopping || queued.load() > 0 || self >= active.load(); });
+        sleeping--;
+    }
+    current_system = nullptr;
+    current_worker = -1;
+}
+
+job_system &jobs()
+{
+    // never destroyed: background tasks may still block in a system call when we exit
+    static job_system *system = nullptr;
+    static std::once_flag started;
+    std::call_once(started, []
+    {
+        system = new job_system;
+        system->start(std::max(detect_cpu_topology().logical - 1, 1));
+    });
+    return *system;
+}
+
+} // namespace util
+} // namespace inexor
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <atomic>                  // for atomic
+#include <condition_variable>      // for condition_variable
+#include <deque>                   // for deque
+#include <functional>              // for function
+#include <initializer_list>        // for initializer_list
+#include <memory>                  // for shared_ptr, unique_ptr
+#include <mutex>                   // for mutex
+#include <thread>                  // for thread
+#include <vector>                  // for vector
+
+namespace inexor {
+namespace util {
+
+/// What the machine we run on offers.
+struct cpu_topology
+{
+    int logical;  ///< hardware threads
+    int cores;    ///< physical cores, smaller than logical with simultaneous multithreading
+    int packages; ///< sockets
+};
+
+/// Ask the operating system, falls back to std::thread::hardware_concurrency() for everything it does not tell us.
+/// There is no upper limit.
+cpu_topology detect_cpu_topology();
+
+/// A unit of work for the job_system, it runs once all tasks it depends on are done.
+class task
+{
+    friend class job_system;
+
+    std::function<void()> fn;
+    bool background;
+    std::atomic<int> unfinished_deps; ///< plus one until spawn() is through with it
+    std::atomic<bool> finished;
+    std::mutex m;                     ///< guards dependents
+    std::vector<std::shared_ptr<task>> dependents;
+
+public:
+    task(std::function<void()> fn, bool background) : fn(std::move(fn)), background(background), unfinished_deps(1), finished(false) {}
+
+    bool done() const { return finished.load(std::memory_order_acquire); }
+};
+
+typedef std::shared_ptr<task> task_ptr;
+
+/// One pool of worker threads for everything which runs in parallel, so the subsystems do not oversubscribe the machine.
+///
+/// Every worker has its own deque: tasks spawned on a worker go to the back of its deque and it works from there (newest first,
+/// which keeps the data warm), idle workers steal the oldest tasks from the front of the others.
+/// Tasks spawned from other threads (e.g. the main thread) go to a shared queue which every worker takes from.
+/// A thread which waits for a task runs other tasks in the meantime, so waiting inside a task or with zero workers can not deadlock.
+///
+/// The job system is meant for CPU bound work, things which mostly block (like name lookups) get threads of their own.
+/// Background tasks may wait for a while (a lightmap worker waiting for the main thread) or nobody waits for them (route planning),
+/// so they are only ever run by the workers themselves when they have nothing else to do and never by a thread which just waits for something.
+class job_system
+{
+public:
+    enum { MAXWORKERS = 1024 };
+
+    job_system() : active(0), created(0), stopping(false), queued(0), sleeping(0), changes(0), waiters(0) {}
+    ~job_system() { stop(); }
+
+    job_system(const job_system &) = delete;
+    job_system &operator=(const job_system &) = delete;
+
+    /// Run with numworkers threads besides the ones which wait, may be called any time from the thread which owns the job system.
+    /// Nobody gets joined: missing workers start right away, surplus ones finish what they are running and exit once they are idle.
+    void start(int numworkers);
+    /// Finish everything queued and join the workers.
+    void stop();
+
+    int numworkers() const { return active.load(); }
+    /// How many threads work on a parallel_for(): the workers and the caller.
+    int concurrency() const { return numworkers() + 1; }
+
+    /// Queue fn to run once all deps are done, deps may be empty or contain null pointers.
+    task_ptr spawn(std::function<void()> fn, std::initializer_list<task_ptr> deps = {}, bool background = false);
+    task_ptr spawn(std::function<void()> fn, const std::vector<task_ptr> &deps, bool background = false);
+
+    /// Block until t is done, running other tasks meanwhile. Sleeps while there is nothing else to run.
+    void wait(const task_ptr &t);
+    void wait(const std::vector<task_ptr> &tasks) { for(const task_ptr &t : tasks) wait(t); }
+
+    /// Call fn(from, to) for consecutive chunks of grain items covering [begin, end) on up to maxthreads threads (0 for all).
+    /// The caller takes part, chunks are handed out in order as threads become free.
+    template<class F> void parallel_for(int begin, int end, int grain, F fn, int maxthreads = 0)
+    {
+        if(end <= begin) return;
+        if(grain < 1) grain = 1;
+        int numchunks = (end - begin + grain - 1)/grain, numthreads = concurrency();
+        if(maxthreads > 0 && maxthreads < numthreads) numthreads = maxthreads;
+        if(numchunks < numthreads) numthreads = numchunks;
+        if(numthreads <= 1)
+        {
+            for(int from = begin; from < end; from += grain) fn(from, from + grain < end ? from + grain : end);
+            return;
+        }
+        std::atomic<int> next(0);
+        auto run = [&]()
+        {
+            for(int chunk; (chunk = next.fetch_add(1, std::memory_order_relaxed)) < numchunks;)
+            {
+                int from = begin + chunk*grain, to = from + grain < end ? from + grain : end;
+                fn(from, to);
+            }
+        };
+        std::vector<task_ptr> helpers;
+        helpers.reserve(numthreads - 1);
+        for(int i = 1; i < numthreads; i++) helpers.push_back(spawn(run));
+        run();
+        wait(helpers);
+    }
+
+    /// Like parallel_for(), but map(from, to) returns a T for every chunk, which are combined with reduce() in chunk order,
+    /// so the result does not depend on the number of threads even if reduce() is not associative in floating point.
+    template<class T, class M, class R> T parallel_reduce(int begin, int end, int grain, T identity, M map, R reduce, int maxthreads = 0)
+    {
+        if(end <= begin) return identity;
+        if(grain < 1) grain = 1;
+        int numchunks = (end - begin + grain - 1)/grain;
+        std::vector<T> partial(numchunks, identity);
+        parallel_for(0, numchunks, 1, [&](int from, int to)
+        {
+            for(int chunk = from; chunk < to; chunk++)
+            {
+                int first = begin + chunk*grain, last = first + grain < end ? first + grain : end;
+                partial[chunk] = map(first, last);
+            }
+        }, maxthreads);
+        T result = identity;
+        for(const T &p : partial) result = reduce(result, p);
+        return result;
+    }
+
+private:
+    struct worker
+    {
+        std::thread thread;
+        bool alive = false; ///< whether thread runs workerloop(), guarded by sleepmutex
+        std::mutex m;
+        std::deque<task_ptr> tasks;
+    };
+
+    /// Never shrinks until stop(): a retired worker may have left tasks in its deque for the others to steal.
+    std::unique_ptr<worker> workers[MAXWORKERS];
+    std::atomic<int> active, created;
+    std::mutex injectmutex;
+    std::deque<task_ptr> injected, background;
+    std::mutex sleepmutex;
+    std::condition_variable wakeup;
+    bool stopping;
+    std::atomic<int> queued;
+    int sleeping;
+    std::mutex waitmutex;
+    std::condition_variable waitdone;  ///< for wait(): a task finished or got queued
+    std::atomic<unsigned> changes;     ///< counts these, so wait() does not miss one while it looks for work
+    std::atomic<int> waiters;
+
+    void enqueue(const task_ptr &t);
+    void signalwaiters();
+    task_ptr take(int self, bool allowbackground);
+    void run(const task_ptr &t);
+    void workerloop(int self);
+    bool retire(int self);
+};
+
+/// The engine wide job system, started with a worker for every hardware thread besides the main one (but at least one).
+job_system &jobs();
+
+} // namespace util
+} // namespace inexor
@@ -0,0 +1,95 @@
+#include "inexor/util/mappedfile.hpp"
+
+#include <stdio.h>                       // for FILE, fopen, fread
+
+#ifdef WIN32
+#include <windows.h>                     // for CreateFileMapping, MapViewOfFile
+#else
+#include <fcntl.h>                       // for open, O_RDONLY
+#include <sys/mman.h>                    // for mmap, munmap
+#include <sys/stat.h>                    // for fstat
+#include <unistd.h>                      // for close
+#endif
+
+namespace inexor {
+namespace util {
+
+/// Map the whole file into memory, returns nullptr if that is not possible here. size is set if the file could be opened.
+static void *mapfile(const char *file, size_t &size, bool &exists)
+{
+#ifdef WIN32
+    HANDLE f = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(f == INVALID_HANDLE_VALUE) return nullptr;
+    exists = true;
+    LARGE_INTEGER len;
+    void *data = nullptr;
+    if(GetFileSizeEx(f, &len) && len.QuadPart > 0)
+    {
+        HANDLE m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(m)
+        {
+            data = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(m); // the view keeps the mapping alive
+        }
+        size = size_t(len.QuadPart);
+    }
+    CloseHandle(f);
+    return data;
+#else
+    int fd = ::open(file, O_RDONLY);
+    if(fd < 0) return nullptr;
+    exists = true;
+    struct stat st;
+    void *data = nullptr;
+    if(!fstat(fd, &st) && st.st_size > 0)
+    {
+        data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED) data = nullptr;
+        size = size_t(st.st_size);
+    }
+    ::close(fd);
+    return data;
+#endif
+}
+
+bool mappedfile::open(const char *file)
+{
+    close();
+    bool exists = false;
+    mapping = mapfile(file, mappedsize, exists);
+    if(mapping) return opened = true;
+    if(!exists) return false;
+
+    FILE *f = fopen(file, "rb");
+    if(!f) return false;
+    bool ok = !fseek(f, 0, SEEK_END);
+    long len = ok ? ftell(f) : -1;
+    ok = len >= 0 && !fseek(f, 0, SEEK_SET);
+    if(ok)
+    {
+        buf.resize(size_t(len));
+        ok = fread(buf.data(), 1, buf.size(), f) == buf.size();
+    }
+    fclose(f);
+    if(!ok) buf.clear();
+    return opened = ok;
+}
+
+void mappedfile::close()
+{
+    if(mapping)
+    {
+#ifdef WIN32
+        UnmapViewOfFile(mapping);
+#else
+        munmap(mapping, mappedsize);
+#endif
+        mapping = nullptr;
+    }
+    mappedsize = 0;
+    buf.clear();
+    opened = false;
+}
+
+} // namespace util
+} // namespace inexor
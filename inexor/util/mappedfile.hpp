@@ -0,0 +1,40 @@
+/// @file mappedfile.hpp
+/// Read only view of a whole file, memory mapped where the platform and the file system allow it.
+
+#pragma once
+
+#include <stddef.h>      // for size_t
+#include <vector>        // for vector
+
+namespace inexor {
+namespace util {
+
+class mappedfile
+{
+public:
+    mappedfile() {}
+    explicit mappedfile(const char *file) { open(file); }
+    ~mappedfile() { close(); }
+
+    mappedfile(const mappedfile &) = delete;
+    mappedfile &operator=(const mappedfile &) = delete;
+
+    /// Map the file, or read it into memory if it can not be mapped (e.g. it lives on a network share).
+    /// An empty file opens fine with size() 0.
+    bool open(const char *file);
+    void close();
+
+    bool ok() const { return opened; }
+    bool ismapped() const { return mapping != nullptr; }
+    const unsigned char *data() const { return mapping ? static_cast<const unsigned char *>(mapping) : buf.data(); }
+    size_t size() const { return mapping ? mappedsize : buf.size(); }
+
+private:
+    void *mapping = nullptr;
+    size_t mappedsize = 0;
+    std::vector<unsigned char> buf;
+    bool opened = false;
+};
+
+} // namespace util
+} // namespace inexor
@@ -0,0 +1,397 @@
+#include "inexor/util/mixer.hpp"
+
+#include <math.h>                        // for sqrtf
+#include <algorithm>                     // for min, max, nth_element, fill
+#include <chrono>                        // for steady_clock
+#include <utility>                       // for move
+
+#include "inexor/shared/cube_loops.hpp"  // for loopi, loopk
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>                   // for __m128, _mm_add_ps
+#define INEXOR_MIXER_SSE2 1
+#endif
+
+namespace inexor {
+namespace util {
+
+namespace mixkernels {
+
+// Everything mixes into interleaved stereo floats, the gain of each side ramps linearly by dl/dr per frame.
+// SSE2 is part of every x86-64 CPU, so there is no need to pick the kernels at runtime like the texture kernels do.
+
+#ifdef INEXOR_MIXER_SSE2
+/// Add two vectors of two stereo frames each, then step the gains on by four frames.
+static inline void accumulate(float *acc, __m128 lr01, __m128 lr23, __m128 &g01, __m128 &g23, __m128 dg)
+{
+    _mm_storeu_ps(acc, _mm_add_ps(_mm_loadu_ps(acc), _mm_mul_ps(lr01, g01)));
+    _mm_storeu_ps(acc + 4, _mm_add_ps(_mm_loadu_ps(acc + 4), _mm_mul_ps(lr23, g23)));
+    g01 = _mm_add_ps(g01, dg);
+    g23 = _mm_add_ps(g23, dg);
+}
+
+static inline void setupgains(float gl, float gr, float dl, float dr, __m128 &g01, __m128 &g23, __m128 &dg)
+{
+    g01 = _mm_setr_ps(gl, gr, gl + dl, gr + dr);
+    g23 = _mm_setr_ps(gl + 2*dl, gr + 2*dr, gl + 3*dl, gr + 3*dr);
+    dg = _mm_setr_ps(4*dl, 4*dr, 4*dl, 4*dr);
+}
+
+/// Four 16 bit samples as floats.
+static inline __m128 loadsamples(const short *src)
+{
+    __m128i s = _mm_loadl_epi64((const __m128i *)src);
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+}
+#endif
+
+/// Source frames at the output rate, no interpolation needed.
+template<int CH>
+static void mixdirect(float *acc, const short *src, int n, float gl, float gr, float dl, float dr)
+{
+    int i = 0;
+#ifdef INEXOR_MIXER_SSE2
+    __m128 g01, g23, dg;
+    setupgains(gl, gr, dl, dr, g01, g23, dg);
+    for(; i + 4 <= n; i += 4)
+    {
+        if(CH == 1)
+        {
+            __m128 m = loadsamples(&src[i]);
+            accumulate(&acc[2*i], _mm_unpacklo_ps(m, m), _mm_unpackhi_ps(m, m), g01, g23, dg);
+        }
+        else accumulate(&acc[2*i], loadsamples(&src[2*i]), loadsamples(&src[2*i + 4]), g01, g23, dg);
+    }
+    gl += i*dl;
+    gr += i*dr;
+#endif
+    for(; i < n; i++, gl += dl, gr += dr)
+    {
+        float l = src[i*CH], r = src[i*CH + CH - 1];
+        acc[2*i] += l*gl;
+        acc[2*i + 1] += r*gr;
+    }
+}
+
+/// Source frames at another rate, interpolated linearly. The frame after the last one repeats it.
+template<int CH>
+static void mixresampled(float *acc, const short *src, int srcframes, unsigned long long pos, unsigned long long step,
+                         int n, float gl, float gr, float dl, float dr)
+{
+    const float fracscale = 1.0f/4294967296.0f;
+    int i = 0;
+#ifdef INEXOR_MIXER_SSE2
+    __m128 g01, g23, dg;
+    setupgains(gl, gr, dl, dr, g01, g23, dg);
+    for(; i + 4 <= n; i += 4)
+    {
+        // the gathers are scalar, the interpolation is not
+        float a[8], b[8], f[8];
+        loopk(4)
+        {
+            unsigned long long p = pos + (i + k)*step;
+            int i0 = int(p >> 32), i1 = std::min(i0 + 1, srcframes - 1);
+            float frac = float(p & 0xFFFFFFFFULL)*fracscale;
+            if(CH == 1) { a[k] = src[i0]; b[k] = src[i1]; f[k] = frac; }
+            else
+            {
+                a[2*k] = src[2*i0]; a[2*k + 1] = src[2*i0 + 1];
+                b[2*k] = src[2*i1]; b[2*k + 1] = src[2*i1 + 1];
+                f[2*k] = f[2*k + 1] = frac;
+            }
+        }
+        __m128 lo = _mm_loadu_ps(a), hi;
+        lo = _mm_add_ps(lo, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b), lo), _mm_loadu_ps(f)));
+        if(CH == 1)
+        {
+            hi = _mm_unpackhi_ps(lo, lo);
+            lo = _mm_unpacklo_ps(lo, lo);
+        }
+        else
+        {
+            hi = _mm_loadu_ps(&a[4]);
+            hi = _mm_add_ps(hi, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&b[4]), hi), _mm_loadu_ps(&f[4])));
+        }
+        accumulate(&acc[2*i], lo, hi, g01, g23, dg);
+    }
+    gl += i*dl;
+    gr += i*dr;
+#endif
+    for(; i < n; i++, gl += dl, gr += dr)
+    {
+        unsigned long long p = pos + i*step;
+        int i0 = int(p >> 32), i1 = std::min(i0 + 1, srcframes - 1);
+        float frac = float(p & 0xFFFFFFFFULL)*fracscale;
+        float l = src[i0*CH] + (src[i1*CH] - src[i0*CH])*frac,
+              r = src[i0*CH + CH - 1] + (src[i1*CH + CH - 1] - src[i0*CH + CH - 1])*frac;
+        acc[2*i] += l*gl;
+        acc[2*i + 1] += r*gr;
+    }
+}
+
+/// Round the mix to 16 bit with saturation.
+static void clip(const float *acc, short *out, int n)
+{
+    int i = 0;
+#ifdef INEXOR_MIXER_SSE2
+    for(; i + 8 <= n; i += 8)
+    {
+        __m128i lo = _mm_cvtps_epi32(_mm_loadu_ps(&acc[i])), hi = _mm_cvtps_epi32(_mm_loadu_ps(&acc[i + 4]));
+        _mm_storeu_si128((__m128i *)&out[i], _mm_packs_epi32(lo, hi));
+    }
+#endif
+    for(; i < n; i++)
+    {
+        float v = std::max(-32768.0f, std::min(32767.0f, acc[i]));
+        out[i] = short(v < 0 ? v - 0.5f : v + 0.5f);
+    }
+}
+
+} // namespace mixkernels
+
+softmixer::softmixer(int freq, int maxmixed, int maxframes) : freq(freq), maxframes(std::max(maxframes, 1)), maxmixed(maxmixed),
+    acc(size_t(this->maxframes)*2)
+{
+}
+
+bool softmixer::play(int voice, unsigned serial, const std::shared_ptr<const pcmsample> &pcm, float gainl, float gainr,
+                     float priority, int loops, int fade, int expire)
+{
+    if(voice < 0 || voice >= MAXVOICES || !pcm) return false;
+    command c;
+    c.type = PLAY;
+    c.voice = voice;
+    c.serial = serial;
+    c.pcm = pcm;
+    c.gainl = gainl;
+    c.gainr = gainr;
+    c.priority = priority;
+    c.loops = loops;
+    c.fade = fade;
+    c.expire = expire;
+    return commands.push(c);
+}
+
+bool softmixer::setgain(int voice, float gainl, float gainr)
+{
+    if(voice < 0 || voice >= MAXVOICES) return false;
+    command c;
+    c.type = SETGAIN;
+    c.voice = voice;
+    c.gainl = gainl;
+    c.gainr = gainr;
+    return commands.push(c);
+}
+
+bool softmixer::stop(int voice, int fade)
+{
+    if(voice < 0 || voice >= MAXVOICES) return false;
+    command c;
+    c.type = STOP;
+    c.voice = voice;
+    c.fade = fade;
+    return commands.push(c);
+}
+
+bool softmixer::stopall()
+{
+    command c;
+    c.type = STOPALL;
+    return commands.push(c);
+}
+
+softmixer::stats softmixer::getstats() const
+{
+    stats s;
+    s.blocks = statblocks;
+    s.frames = statframes;
+    s.mixedframes = statmixed;
+    s.virtualframes = statvirtual;
+    s.mixmillis = statnanos/1e6;
+    s.peakvoices = statpeakvoices;
+    s.peakmixed = statpeakmixed;
+    return s;
+}
+
+/// Hand the sample of a finished voice back to the game thread.
+/// Returns false if neither events nor the overflow have room, the voice keeps the sample then.
+bool softmixer::release(voice &v)
+{
+    if(!v.pcm) return true;
+    if(numoverflow >= MAXVOICES) return false;
+    event e;
+    e.voice = int(&v - voices);
+    e.serial = v.serial;
+    e.pcm = std::move(v.pcm);
+    // moved, a copy left here would be freed on this thread once the game thread dropped its own
+    if(!events.push(std::move(e))) overflow[numoverflow++] = std::move(e);
+    return true;
+}
+
+void softmixer::run(command &c)
+{
+    switch(c.type)
+    {
+        case PLAY:
+        {
+            voice &v = voices[c.voice];
+            release(v);
+            v.pcm = std::move(c.pcm);
+            v.serial = c.serial;
+            v.pos = 0;
+            v.step = (((unsigned long long)v.pcm->freq) << 32)/freq;
+            v.loops = c.loops;
+            v.expire = c.expire >= 0 ? int((long long)c.expire*freq/1000) : -1;
+            v.gainl = c.gainl;
+            v.gainr = c.gainr;
+            v.priority = c.priority;
+            v.fade = c.fade > 0 ? 0.0f : 1.0f;
+            v.fadestep = c.fade > 0 ? 1000.0f/(float(c.fade)*freq) : 0.0f;
+            v.curl = v.gainl*v.fade;
+            v.curr = v.gainr*v.fade;
+            break;
+        }
+        case SETGAIN:
+            voices[c.voice].gainl = c.gainl;
+            voices[c.voice].gainr = c.gainr;
+            break;
+        case STOP:
+        {
+            voice &v = voices[c.voice];
+            // without a fade it ramps down within the next block
+            v.fadestep = c.fade > 0 ? -1000.0f/(float(c.fade)*freq) : -1.0f;
+            break;
+        }
+        case STOPALL:
+            loopi(MAXVOICES) voices[i].fadestep = -1.0f;
+            break;
+    }
+}
+
+/// Play frames of the voice, only advancing it unless it is audible. Returns false once it finished.
+bool softmixer::render(voice &v, float *acc, int frames, bool audible)
+{
+    const pcmsample &s = *v.pcm;
+    const int srcframes = s.frames();
+    const unsigned long long srcend = (unsigned long long)srcframes << 32;
+
+    float fadeend = std::max(0.0f, std::min(1.0f, v.fade + v.fadestep*frames));
+    float endl = v.gainl*fadeend, endr = v.gainr*fadeend;
+    // a voice which was virtual fades in from silence, so it does not click
+    float gl = audible ? v.curl : 0.0f, gr = audible ? v.curr : 0.0f;
+    float dl = (endl - gl)/frames, dr = (endr - gr)/frames;
+    v.fade = fadeend;
+    v.curl = audible ? endl : 0.0f;
+    v.curr = audible ? endr : 0.0f;
+
+    for(int done = 0; done < frames;)
+    {
+        if(!v.expire || !srcframes) return false;
+        if(v.pos >= srcend)
+        {
+            if(!v.loops) return false;
+            if(v.loops > 0) v.loops--;
+            v.pos -= srcend;
+            continue;
+        }
+        int n = int(std::min<unsigned long long>(frames - done, (srcend - v.pos + v.step - 1)/v.step));
+        if(v.expire > 0) n = std::min(n, v.expire);
+        if(audible)
+        {
+            float *dst = &acc[2*done];
+            const short *src = s.data.data();
+            if(v.step == 1ULL << 32 && !(v.pos & 0xFFFFFFFFULL))
+            {
+                src += (v.pos >> 32)*s.channels;
+                if(s.channels == 1) mixkernels::mixdirect<1>(dst, src, n, gl, gr, dl, dr);
+                else mixkernels::mixdirect<2>(dst, src, n, gl, gr, dl, dr);
+            }
+            else if(s.channels == 1) mixkernels::mixresampled<1>(dst, src, srcframes, v.pos, v.step, n, gl, gr, dl, dr);
+            else mixkernels::mixresampled<2>(dst, src, srcframes, v.pos, v.step, n, gl, gr, dl, dr);
+            gl += n*dl;
+            gr += n*dr;
+        }
+        v.pos += n*v.step;
+        if(v.expire > 0) v.expire -= n;
+        done += n;
+    }
+    return !(v.fadestep < 0 && fadeend <= 0);
+}
+
+void softmixer::mix(short *out, int frames)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // reports which did not fit last time go first, so they stay in order
+    int pushed = 0;
+    while(pushed < numoverflow && events.push(std::move(overflow[pushed]))) pushed++;
+    if(pushed)
+    {
+        loopi(numoverflow - pushed) overflow[i] = std::move(overflow[pushed + i]);
+        numoverflow -= pushed;
+    }
+
+    // playing on a voice releases what it played before, so commands wait while there is no room to report that
+    command c;
+    while(numoverflow < MAXVOICES && commands.pop(c)) run(c);
+
+    // the most audible voices get mixed, the others only advance. One which just got quiet still ramps down.
+    int active[MAXVOICES], numactive = 0;
+    float audibility[MAXVOICES];
+    loopi(MAXVOICES) if(voices[i].pcm)
+    {
+        const voice &v = voices[i];
+        audibility[i] = v.priority*std::max(std::max(v.gainl, v.gainr), std::max(v.curl, v.curr));
+        active[numactive++] = i;
+    }
+    int budget = std::max(0, std::min(int(maxmixed), numactive));
+    if(budget < numactive)
+    {
+        std::nth_element(active, active + budget, active + numactive,
+                         [&](int a, int b) { return audibility[a] > audibility[b]; });
+    }
+
+    int mixed = 0;
+    loopi(numactive) if(i < budget && audibility[active[i]] > 0) mixed++;
+    for(int done = 0; done < frames;)
+    {
+        int n = std::min(frames - done, maxframes);
+        std::fill(acc.begin(), acc.begin() + 2*n, 0.0f);
+        loopi(numactive)
+        {
+            voice &v = voices[active[i]];
+            if(!v.pcm || render(v, acc.data(), n, i < budget && audibility[active[i]] > 0)) continue;
+            // a voice which can not be reported yet stays silent and tries again in the next block
+            if(!release(v)) { v.expire = 0; v.gainl = v.gainr = v.curl = v.curr = 0; }
+        }
+        mixkernels::clip(acc.data(), out + 2*done, 2*n);
+        done += n;
+    }
+
+    statblocks++;
+    statframes += frames;
+    statmixed += (long long)mixed*frames;
+    statvirtual += (long long)(numactive - mixed)*frames;
+    statnanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    if(numactive > statpeakvoices) statpeakvoices = numactive;
+    if(mixed > statpeakmixed) statpeakmixed = mixed;
+}
+
+void attenuate(int n, const float *rx, const float *ry, const float *dist, const float *inner, const float *radius,
+               bool stereo, float *gainl, float *gainr)
+{
+    // branch free, so the compiler can vectorize it
+    loopi(n)
+    {
+        float span = radius[i] - inner[i];
+        float falloff = span > 0 ? std::max(0.0f, std::min(1.0f, (dist[i] - inner[i])/span)) : 0.0f;
+        float gain = 1.0f - falloff;
+        float side = sqrtf(rx[i]*rx[i] + ry[i]*ry[i]);
+        float right = stereo && side > 0 && dist[i] > 0 ? 0.5f - 0.5f*rx[i]/side : 0.5f;
+        gainl[i] = gain*(1.0f - right);
+        gainr[i] = gain*right;
+    }
+}
+
+} // namespace util
+} // namespace inexor
@@ -0,0 +1,161 @@
+/// @file mixer.hpp
+/// Software mixer for the sound samples of samplecache.hpp, run from the callback of the audio device.
+///
+/// The game thread never touches the voices directly: it sends commands through a lock free queue which the audio thread
+/// takes in at the start of every block, finished voices are reported back through another one.
+/// Only the most audible voices (their gain times their priority) up to a limit get mixed, the others are virtual:
+/// they keep their position advancing in time without costing any mixing, so they come back at the right spot when they
+/// get loud enough again.
+
+#pragma once
+
+#include <stddef.h>      // for size_t
+#include <atomic>        // for atomic
+#include <memory>        // for shared_ptr
+#include <utility>       // for forward, move
+#include <vector>        // for vector
+
+#include "inexor/util/samplecache.hpp" // for pcmsample
+
+namespace inexor {
+namespace util {
+
+/// Lock free queue for exactly one thread pushing and one thread popping.
+template<class T, int SIZE> class spscqueue
+{
+    T items[SIZE];
+    std::atomic<unsigned> head{0}, tail{0};
+
+    template<class U> bool put(U &&v)
+    {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        if(t - head.load(std::memory_order_acquire) >= unsigned(SIZE)) return false;
+        items[t%SIZE] = std::forward<U>(v);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+public:
+    /// Returns false if the queue is full.
+    bool push(const T &v) { return put(v); }
+    /// Like push(), v is only moved from if it got pushed.
+    bool push(T &&v) { return put(std::move(v)); }
+
+    /// Returns false if the queue is empty, the slot is left empty (moved from).
+    bool pop(T &v)
+    {
+        unsigned h = head.load(std::memory_order_relaxed);
+        if(h == tail.load(std::memory_order_acquire)) return false;
+        v = std::move(items[h%SIZE]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+/// Mixes voices into 16 bit interleaved stereo.
+class softmixer
+{
+public:
+    enum { MAXVOICES = 256 };
+
+    /// A voice which stopped playing. It carries the sample back so the audio thread never frees one.
+    struct event
+    {
+        int voice = -1;
+        unsigned serial = 0;
+        std::shared_ptr<const pcmsample> pcm;
+    };
+
+    struct stats
+    {
+        long long blocks = 0, frames = 0;
+        long long mixedframes = 0,   ///< frames of voices which got mixed
+                  virtualframes = 0; ///< frames of voices which only advanced
+        double mixmillis = 0;        ///< time spent in mix()
+        int peakvoices = 0, peakmixed = 0;
+    };
+
+    /// Mix at freq frames per second, maxmixed voices at most.
+    /// Blocks of up to maxframes get mixed in one go, longer ones in several, so mixing never allocates.
+    softmixer(int freq, int maxmixed, int maxframes = 4096);
+
+    softmixer(const softmixer &) = delete;
+    softmixer &operator=(const softmixer &) = delete;
+
+    // Called from the game thread only:
+
+    /// Start playing pcm on the voice (0 to MAXVOICES-1), replacing what it played before.
+    /// The serial is reported back when the voice finishes, so a late report for an earlier sound on the same voice can be told apart.
+    /// loops: how often to repeat the sample (-1 forever), fade: milliseconds to fade in, expire: milliseconds to play at most (-1 no limit).
+    /// Returns false if the queue to the audio thread is full.
+    bool play(int voice, unsigned serial, const std::shared_ptr<const pcmsample> &pcm, float gainl, float gainr,
+              float priority = 1, int loops = 0, int fade = 0, int expire = -1);
+    /// Change the gain of both sides, the change is spread over the next block so it does not click.
+    bool setgain(int voice, float gainl, float gainr);
+    /// Fade out over fade milliseconds, 0 stops within the next block.
+    bool stop(int voice, int fade = 0);
+    bool stopall();
+    void setmaxmixed(int n) { maxmixed = n; }
+    /// Take a report about a voice which finished, returns false if there is none.
+    bool finished(event &e) { return events.pop(e); }
+
+    /// Also works while the audio thread mixes, the numbers are counted since the creation.
+    stats getstats() const;
+
+    int getfreq() const { return freq; }
+
+    // Called from the audio thread only:
+
+    /// Fill out with frames stereo frames.
+    void mix(short *out, int frames);
+
+private:
+    enum { PLAY, SETGAIN, STOP, STOPALL };
+
+    struct command
+    {
+        int type = PLAY, voice = 0;
+        unsigned serial = 0;
+        std::shared_ptr<const pcmsample> pcm;
+        float gainl = 0, gainr = 0, priority = 1;
+        int loops = 0, fade = 0, expire = -1;
+    };
+
+    struct voice
+    {
+        std::shared_ptr<const pcmsample> pcm; ///< nullptr if the voice is free
+        unsigned serial = 0;
+        unsigned long long pos = 0, step = 0; ///< in source frames, 32.32 fixed point
+        int loops = 0, expire = -1;           ///< loops left, frames left
+        float gainl = 0, gainr = 0, priority = 1;
+        float curl = 0, curr = 0;             ///< the gain the last block ended with, fades included
+        float fade = 1, fadestep = 0;         ///< per frame
+    };
+
+    int freq, maxframes;
+    std::atomic<int> maxmixed;
+    spscqueue<command, 1024> commands;
+    spscqueue<event, 1024> events;
+    /// The reports which did not fit into events yet, pushed again at the start of the next block.
+    event overflow[MAXVOICES];
+    int numoverflow = 0;
+    voice voices[MAXVOICES];
+    std::vector<float> acc;
+
+    std::atomic<long long> statblocks{0}, statframes{0}, statmixed{0}, statvirtual{0}, statnanos{0};
+    std::atomic<int> statpeakvoices{0}, statpeakmixed{0};
+
+    void run(command &c);
+    bool release(voice &v);
+    bool render(voice &v, float *acc, int frames, bool audible);
+};
+
+/// Distance attenuation and panning for a batch of emitters in one go.
+/// rx and ry are the emitter positions relative to the listener rotated by its yaw (x positive: to the left), dist the distance to them.
+/// The gain falls off linearly from 1 at dist <= inner to 0 at radius (no falloff if radius <= inner) and gets split between
+/// the sides by the direction, half each without stereo or right at the listener (like SDL_mixer's panning did).
+void attenuate(int n, const float *rx, const float *ry, const float *dist, const float *inner, const float *radius,
+               bool stereo, float *gainl, float *gainr);
+
+} // namespace util
+} // namespace inexor
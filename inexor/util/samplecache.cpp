@@ -0,0 +1,299 @@
+#include "inexor/util/samplecache.hpp"
+
+#include <string.h>                      // for memcmp, memcpy
+#include <algorithm>                     // for sort, min, max
+
+#include "inexor/shared/cube_loops.hpp"  // for loopi, loopj
+#include "inexor/shared/cube_types.hpp"  // for uchar, ushort, uint
+
+namespace inexor {
+namespace util {
+
+static inline uint getushort(const uchar *p) { return uint(p[0]) | (uint(p[1]) << 8); }
+static inline uint getuint(const uchar *p) { return uint(p[0]) | (uint(p[1]) << 8) | (uint(p[2]) << 16) | (uint(p[3]) << 24); }
+
+/// One sample of the given format as 16 bit.
+static inline short getsample(const uchar *p, int bits, bool isfloat)
+{
+    if(isfloat)
+    {
+        uint u = getuint(p);
+        float f;
+        memcpy(&f, &u, sizeof(f));
+        f = f < -1.0f ? -1.0f : (f > 1.0f ? 1.0f : f);
+        return short(f*32767.0f);
+    }
+    switch(bits)
+    {
+        case 8: return short((int(p[0]) - 128) << 8);
+        case 16: return short(getushort(p));
+        case 24: return short(getushort(p + 1));
+        default: return short(getushort(p + 2));
+    }
+}
+
+bool decodewav(const uchar *data, size_t len, pcmsample &out)
+{
+    if(len < 12 || memcmp(data, "RIFF", 4) || memcmp(data + 8, "WAVE", 4)) return false;
+    int format = -1, channels = 0, freq = 0, bits = 0, blockalign = 0;
+    const uchar *samples = nullptr;
+    size_t sampleslen = 0;
+    for(size_t pos = 12; pos + 8 <= len;)
+    {
+        const uchar *chunk = data + pos;
+        size_t chunklen = getuint(chunk + 4), avail = std::min(chunklen, len - pos - 8);
+        if(!memcmp(chunk, "fmt ", 4) && avail >= 16)
+        {
+            format = getushort(chunk + 8);
+            channels = getushort(chunk + 10);
+            freq = int(getuint(chunk + 12));
+            blockalign = getushort(chunk + 20);
+            bits = getushort(chunk + 22);
+            // WAVE_FORMAT_EXTENSIBLE names the real format in the first two bytes of its sub format GUID
+            if(format == 0xFFFE && avail >= 26) format = getushort(chunk + 32);
+        }
+        else if(!memcmp(chunk, "data", 4))
+        {
+            samples = chunk + 8;
+            sampleslen = avail;
+        }
+        pos += 8 + chunklen + (chunklen&1); // chunks are padded to even sizes
+    }
+    bool isfloat = format == 3;
+    if((format != 1 && !isfloat) || (isfloat && bits != 32) || (bits != 8 && bits != 16 && bits != 24 && bits != 32) ||
+       channels < 1 || freq <= 0 || blockalign < channels*bits/8 || !samples)
+        return false;
+
+    int outchannels = std::min(channels, 2), frames = int(sampleslen/blockalign), bytes = bits/8;
+    out.channels = outchannels;
+    out.freq = freq;
+    out.data.resize(size_t(frames)*outchannels);
+    short *dst = out.data.data();
+    loopi(frames)
+    {
+        const uchar *frame = samples + size_t(i)*blockalign;
+        loopj(outchannels) *dst++ = getsample(frame + j*bytes, bits, isfloat);
+    }
+    return true;
+}
+
+void resamplepcm(pcmsample &s, int freq)
+{
+    if(s.freq == freq || freq <= 0 || !s.channels) return;
+    int frames = s.frames();
+    if(!frames) { s.freq = freq; return; }
+    int outframes = int((long long)frames*freq/s.freq);
+    if(outframes < 1) outframes = 1;
+    std::vector<short> out(size_t(outframes)*s.channels);
+    const double step = double(s.freq)/freq;
+    loopi(outframes)
+    {
+        double pos = i*step;
+        int i0 = std::min(int(pos), frames - 1), i1 = std::min(i0 + 1, frames - 1);
+        float t = float(pos - i0);
+        loopj(s.channels)
+        {
+            float a = s.data[size_t(i0)*s.channels + j], b = s.data[size_t(i1)*s.channels + j];
+            float v = a + (b - a)*t;
+            out[size_t(i)*s.channels + j] = short(v < 0 ? v - 0.5f : v + 0.5f);
+        }
+    }
+    s.data.swap(out);
+    s.freq = freq;
+}
+
+bool samplecache::readfile(const std::string &file, vfsdata &data)
+{
+    return data.map(file.c_str());
+}
+
+samplecache::samplecache(int freq, size_t maxbytes, reader read) : read(std::move(read)), freq(freq), maxbytes(maxbytes)
+{
+}
+
+samplecache::~samplecache()
+{
+    waitpending();
+}
+
+std::shared_ptr<const pcmsample> samplecache::request(const std::string &file)
+{
+    std::lock_guard<std::mutex> lock(m);
+    counters.requests++;
+    entry_ptr &e = entries[file];
+    if(e)
+    {
+        e->lastuse = ++usecounter;
+        if(e->state != READY) return nullptr;
+        counters.hits++;
+        return e->pcm;
+    }
+
+    e = std::make_shared<entry>();
+    e->file = file;
+    e->lastuse = ++usecounter;
+    e->requested = std::chrono::steady_clock::now();
+    pending.erase(std::remove_if(pending.begin(), pending.end(), [](const task_ptr &t) { return t->done(); }), pending.end());
+    entry_ptr loading = e;
+    int decodefreq = freq;
+    e->task = jobs().spawn([this, loading, decodefreq] { decode(loading, decodefreq); });
+    pending.push_back(e->task);
+    return nullptr;
+}
+
+std::shared_ptr<const pcmsample> samplecache::load(const std::string &file)
+{
+    std::shared_ptr<const pcmsample> pcm = request(file);
+    if(pcm) return pcm;
+    entry_ptr e;
+    {
+        std::lock_guard<std::mutex> lock(m);
+        auto it = entries.find(file);
+        if(it == entries.end()) return nullptr;
+        e = it->second;
+    }
+    if(e->task) jobs().wait(e->task);
+    std::lock_guard<std::mutex> lock(m);
+    return e->state == READY ? e->pcm : nullptr;
+}
+
+bool samplecache::failed(const std::string &file)
+{
+    std::lock_guard<std::mutex> lock(m);
+    auto it = entries.find(file);
+    return it != entries.end() && it->second->state == FAILED;
+}
+
+void samplecache::decode(const entry_ptr &e, int decodefreq)
+{
+    vfsdata data;
+    bool ok = read(e->file, data);
+
+    // FNV-1a of the contents, the same file under another name gets the same samples
+    unsigned long long hash = 0xcbf29ce484222325ULL ^ data.size();
+    for(size_t i = 0; i < data.size(); i++) { hash ^= data.data()[i]; hash *= 0x100000001b3ULL; }
+    std::shared_ptr<const pcmsample> shared;
+    std::string samefile;
+    if(ok)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        auto it = contents.find(hash);
+        if(it != contents.end() && it->second.size == data.size() && (shared = it->second.pcm.lock())) samefile = it->second.file;
+    }
+    if(shared)
+    {
+        vfsdata same;
+        if(!read(samefile, same) || same.size() != data.size() || memcmp(same.data(), data.data(), data.size())) shared.reset();
+    }
+
+    std::shared_ptr<pcmsample> pcm;
+    if(ok && !shared)
+    {
+        pcm = std::make_shared<pcmsample>();
+        ok = decodewav(data.data(), data.size(), *pcm);
+        if(ok) resamplepcm(*pcm, decodefreq);
+    }
+
+    std::lock_guard<std::mutex> lock(m);
+    double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - e->requested).count();
+    if(!ok) counters.failures++;
+    else
+    {
+        if(shared) { e->pcm = shared; counters.shared++; }
+        else
+        {
+            e->pcm = pcm;
+            content &c = contents[hash];
+            c.size = data.size();
+            c.file = e->file;
+            c.pcm = e->pcm;
+            counters.loads++;
+        }
+        counters.totallatency += latency;
+        counters.maxlatency = std::max(counters.maxlatency, latency);
+    }
+    e->lastuse = ++usecounter;
+    e->state = ok ? READY : FAILED;
+    if(ok) evict();
+}
+
+/// What the decoded samples use, shared ones counted once.
+/// @warning m has to be locked.
+size_t samplecache::usedbytes()
+{
+    std::unordered_map<const pcmsample *, int> seen;
+    size_t total = 0;
+    for(auto &it : entries) if(it.second->pcm && !seen[it.second->pcm.get()]++) total += it.second->pcm->bytes();
+    return total;
+}
+
+/// Drop the least recently used samples nobody plays until the rest fits.
+/// @warning m has to be locked.
+void samplecache::evict()
+{
+    size_t used = usedbytes();
+    if(used <= maxbytes) return;
+    // a sample is playing if somebody besides the entries holds it
+    std::unordered_map<const pcmsample *, long> refs;
+    for(auto &it : entries) if(it.second->pcm) refs[it.second->pcm.get()]++;
+    std::vector<entry_ptr> unused;
+    for(auto &it : entries)
+    {
+        const entry_ptr &e = it.second;
+        if(e->state == READY && e->pcm.use_count() == refs[e->pcm.get()]) unused.push_back(e);
+    }
+    std::sort(unused.begin(), unused.end(), [](const entry_ptr &a, const entry_ptr &b) { return a->lastuse < b->lastuse; });
+    for(const entry_ptr &e : unused)
+    {
+        if(used <= maxbytes) break;
+        if(!--refs[e->pcm.get()]) used -= e->pcm->bytes();
+        entries.erase(e->file);
+        counters.evictions++;
+    }
+}
+
+void samplecache::setlimit(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m);
+    maxbytes = bytes;
+    evict();
+}
+
+void samplecache::waitpending()
+{
+    std::vector<task_ptr> tasks;
+    {
+        std::lock_guard<std::mutex> lock(m);
+        tasks.swap(pending);
+    }
+    jobs().wait(tasks);
+}
+
+void samplecache::clear()
+{
+    waitpending();
+    std::lock_guard<std::mutex> lock(m);
+    entries.clear();
+    contents.clear();
+}
+
+void samplecache::setfreq(int newfreq)
+{
+    if(newfreq == freq) return;
+    waitpending();
+    std::lock_guard<std::mutex> lock(m);
+    freq = newfreq;
+    entries.clear();
+    contents.clear();
+}
+
+samplecache::stats samplecache::getstats()
+{
+    std::lock_guard<std::mutex> lock(m);
+    stats s = counters;
+    s.bytes = usedbytes();
+    return s;
+}
+
+} // namespace util
+} // namespace inexor
@@ -0,0 +1,125 @@
+/// @file samplecache.hpp
+/// Decoded sound samples, loaded on the job system and shared by every sound slot which plays the same file.
+///
+/// Files get decoded into 16 bit PCM at the rate of the output, so mixing them needs no conversion.
+/// Identical files (the same path, or the same contents under different names) are decoded and kept once.
+/// When the decoded samples grow beyond the limit the least recently used ones which are not playing get dropped,
+/// they are loaded again the next time they are asked for.
+
+#pragma once
+
+#include <stddef.h>      // for size_t
+#include <atomic>        // for atomic
+#include <chrono>        // for steady_clock
+#include <functional>    // for function
+#include <memory>        // for shared_ptr
+#include <mutex>         // for mutex
+#include <string>        // for string
+#include <unordered_map> // for unordered_map
+#include <vector>        // for vector
+
+#include "inexor/util/jobs.hpp" // for task_ptr
+#include "inexor/util/vfs.hpp"  // for vfsdata
+
+namespace inexor {
+namespace util {
+
+/// 16 bit signed PCM, the channels interleaved.
+struct pcmsample
+{
+    std::vector<short> data;
+    int channels = 0, freq = 0;
+
+    int frames() const { return channels ? int(data.size()/channels) : 0; }
+    size_t bytes() const { return data.size()*sizeof(short); }
+};
+
+/// Decode a RIFF WAVE file with 8, 16, 24 or 32 bit integer or 32 bit float samples, returns false if it is none of these.
+/// More than two channels are reduced to the first two.
+bool decodewav(const unsigned char *data, size_t len, pcmsample &out);
+
+/// Convert the sample to another rate with linear interpolation.
+void resamplepcm(pcmsample &s, int freq);
+
+class samplecache
+{
+public:
+    /// Gets at the contents of a whole file, called on worker threads. They get decoded right out of data.
+    typedef std::function<bool(const std::string &file, vfsdata &data)> reader;
+
+    /// Maps the file from disk.
+    static bool readfile(const std::string &file, vfsdata &data);
+
+    struct stats
+    {
+        int requests = 0, hits = 0, loads = 0, shared = 0, failures = 0, evictions = 0;
+        size_t bytes = 0;            ///< what the decoded samples use now
+        double totallatency = 0,     ///< milliseconds from the first request to the decoded sample, summed over all loads
+               maxlatency = 0;
+    };
+
+    samplecache(int freq, size_t maxbytes, reader read = readfile);
+    /// Waits for the loads still running.
+    ~samplecache();
+
+    samplecache(const samplecache &) = delete;
+    samplecache &operator=(const samplecache &) = delete;
+
+    /// The decoded sample of file, or nullptr if it is still loading or failed to load (see failed()).
+    /// Starts loading it if it is neither loaded nor loading, never blocks.
+    std::shared_ptr<const pcmsample> request(const std::string &file);
+    /// Like request(), but waits until the file is loaded (helping the job system meanwhile).
+    std::shared_ptr<const pcmsample> load(const std::string &file);
+    /// Whether loading the file failed, it is not tried again until clear().
+    bool failed(const std::string &file);
+
+    /// Drop the least recently used samples until the rest fits into maxbytes.
+    void setlimit(size_t maxbytes);
+    /// Decode into another rate from now on, drops everything.
+    void setfreq(int freq);
+    int getfreq() const { return freq; }
+    /// Drop everything, waits for the loads still running.
+    void clear();
+
+    stats getstats();
+
+private:
+    enum { PENDING, READY, FAILED };
+
+    struct entry
+    {
+        std::string file;
+        std::atomic<int> state;
+        std::shared_ptr<const pcmsample> pcm; ///< guarded by the cache's mutex
+        unsigned long long lastuse = 0;
+        std::chrono::steady_clock::time_point requested;
+        task_ptr task;
+
+        entry() : state(PENDING) {}
+    };
+    typedef std::shared_ptr<entry> entry_ptr;
+
+    reader read;
+    int freq;
+    size_t maxbytes;
+    std::mutex m; ///< guards everything below
+    std::unordered_map<std::string, entry_ptr> entries;
+    struct content
+    {
+        size_t size;
+        std::string file; ///< to compare the contents with, a hash is no proof
+        std::weak_ptr<const pcmsample> pcm;
+    };
+    std::unordered_map<unsigned long long, content> contents; ///< by a hash of the file contents
+    std::vector<task_ptr> pending;
+    unsigned long long usecounter = 0;
+    stats counters;
+
+    void decode(const entry_ptr &e, int freq);
+    void evict();
+    size_t usedbytes();
+    void waitpending();
+};
+
+} // namespace util
+} // namespace inexor
@@ -0,0 +1,338 @@
+#include "inexor/util/vfs.hpp"
+
+#include <string.h>                      // for memcmp, strlen, strchr
+#include <algorithm>                     // for min
+#include <chrono>                        // for steady_clock, duration
+#include <zlib.h>                        // for z_stream, inflate
+
+#ifdef WIN32
+#include <windows.h>                     // for FindFirstFile, FindNextFile
+#else
+#include <dirent.h>                      // for opendir, readdir, closedir
+#include <sys/stat.h>                    // for stat, S_ISDIR
+#endif
+
+namespace inexor {
+namespace util {
+
+static inline unsigned getushort(const unsigned char *p) { return unsigned(p[0]) | (unsigned(p[1]) << 8); }
+static inline unsigned getuint(const unsigned char *p) { return getushort(p) | (getushort(p + 2) << 16); }
+
+/// The key of a name in the maps: '/' separated, without "." parts and (where the file system ignores it) case.
+/// Returns false for names which are absolute or leave the root.
+static bool normalize(const char *name, std::string &out)
+{
+    out.clear();
+    if(strchr(name, '<') || strchr(name, ':') || name[0] == '/' || name[0] == '\\') return false;
+    for(const char *part = name; *part;)
+    {
+        const char *end = part;
+        while(*end && *end != '/' && *end != '\\') end++;
+        size_t len = end - part;
+        if(len == 2 && part[0] == '.' && part[1] == '.') return false;
+        if(len && !(len == 1 && part[0] == '.'))
+        {
+            if(!out.empty()) out += '/';
+            out.append(part, len);
+        }
+        part = *end ? end + 1 : end;
+    }
+#ifdef WIN32
+    for(char &c : out) if(c >= 'A' && c <= 'Z') c += 'a' - 'A';
+#endif
+    return true;
+}
+
+static inline bool haszipext(const std::string &name)
+{
+    if(name.size() <= 4) return false;
+    const char *ext = name.c_str() + name.size() - 4;
+    return ext[0] == '.' && (ext[1] | 0x20) == 'z' && (ext[2] | 0x20) == 'i' && (ext[3] | 0x20) == 'p';
+}
+
+void vfsindex::clear()
+{
+    roots.clear();
+    archives.clear();
+    files.clear();
+    dirs.clear();
+    dirs[""];
+    scanmillis = 0;
+}
+
+bool vfsindex::indexable(const char *name)
+{
+    std::string key;
+    return normalize(name, key);
+}
+
+void vfsindex::adddir(const std::string &rel)
+{
+    if(dirs.count(rel)) return;
+    dirs[rel];
+    size_t slash = rel.rfind('/');
+    std::string parent = slash == std::string::npos ? std::string() : rel.substr(0, slash);
+    adddir(parent);
+    dirs[parent].names.push_back(slash == std::string::npos ? rel : rel.substr(slash + 1));
+}
+
+void vfsindex::addfile(const std::string &rel, const entry &e)
+{
+    std::string key;
+    normalize(rel.c_str(), key);
+    if(key.empty() || files.count(key) || dirs.count(key)) return;
+    files.emplace(key, e);
+    size_t slash = key.rfind('/');
+    std::string parent = slash == std::string::npos ? std::string() : key.substr(0, slash);
+    adddir(parent);
+    // the listing keeps the case the name has on disk
+    size_t relslash = rel.find_last_of("/\\");
+    dirs[parent].names.push_back(relslash == std::string::npos ? rel : rel.substr(relslash + 1));
+}
+
+void vfsindex::scandir(int root, const std::string &dir, const std::string &rel, std::vector<std::string> &zips)
+{
+    std::vector<std::string> subdirs;
+#ifdef WIN32
+    WIN32_FIND_DATAA fd;
+    HANDLE find = FindFirstFileA((dir + "*").c_str(), &fd);
+    if(find == INVALID_HANDLE_VALUE) return;
+    do
+    {
+        std::string name = fd.cFileName;
+        if(name == "." || name == "..") continue;
+        bool isdir = (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+    DIR *d = opendir(dir.empty() ? "." : dir.c_str());
+    if(!d) return;
+    while(struct dirent *de = readdir(d))
+    {
+        std::string name = de->d_name;
+        if(name == "." || name == "..") continue;
+        bool isdir = false;
+#ifdef _DIRENT_HAVE_D_TYPE
+        if(de->d_type != DT_UNKNOWN && de->d_type != DT_LNK) isdir = de->d_type == DT_DIR;
+        else
+#endif
+        {
+            struct stat st;
+            if(stat((dir + name).c_str(), &st)) continue;
+            isdir = S_ISDIR(st.st_mode);
+        }
+#endif
+        std::string relname = rel.empty() ? name : rel + "/" + name;
+        if(isdir) subdirs.push_back(name);
+        else
+        {
+            entry e;
+            e.root = root;
+            e.path = dir + name;
+            addfile(relname, e);
+            if(rel.empty() && haszipext(name)) zips.push_back(e.path);
+        }
+#ifdef WIN32
+    } while(FindNextFileA(find, &fd));
+    FindClose(find);
+    const char div = '\\';
+#else
+    }
+    closedir(d);
+    const char div = '/';
+#endif
+    for(const std::string &name : subdirs)
+    {
+        std::string relname = rel.empty() ? name : rel + "/" + name;
+        std::string key;
+        normalize(relname.c_str(), key);
+        if(files.count(key)) continue;
+        if(!dirs.count(key))
+        {
+            // keep the case of the directory on disk in the listing of its parent
+            std::string parent = key.substr(0, key.size() - name.size());
+            if(!parent.empty()) parent.pop_back();
+            dirs[key];
+            dirs[parent].names.push_back(name);
+        }
+        scandir(root, dir + name + div, relname, zips);
+    }
+}
+
+void vfsindex::mountzip(int root, const std::string &file)
+{
+    std::shared_ptr<mappedfile> f = std::make_shared<mappedfile>();
+    if(!f->open(file.c_str())) return;
+    const unsigned char *data = f->data();
+    size_t size = f->size();
+
+    // the end of central directory record is followed by a comment of up to 64k
+    const unsigned char *eocd = nullptr;
+    if(size >= 22) for(size_t pos = size - 22;; pos--)
+    {
+        if(!memcmp(data + pos, "PK\5\6", 4)) { eocd = data + pos; break; }
+        if(!pos || size - pos >= 22 + 0xFFFF) break;
+    }
+    if(!eocd) return;
+    size_t count = getushort(eocd + 10), cdsize = getuint(eocd + 12), cdoffset = getuint(eocd + 16);
+    if(cdoffset > size || cdsize > size - cdoffset) return;
+
+    int index = int(archives.size());
+    archive a;
+    a.path = file;
+    a.file = f;
+    archives.push_back(a);
+
+    const unsigned char *p = data + cdoffset, *end = p + cdsize;
+    for(size_t i = 0; i < count && end - p >= 46 && !memcmp(p, "PK\1\2", 4); i++)
+    {
+        unsigned flags = getushort(p + 8), method = getushort(p + 10);
+        size_t csize = getuint(p + 20), usize = getuint(p + 24), local = getuint(p + 42);
+        size_t namelen = getushort(p + 28), extralen = getushort(p + 30), commentlen = getushort(p + 32);
+        if(size_t(end - p) < 46 + namelen) break;
+        std::string name((const char *)p + 46, namelen);
+        p += 46 + namelen + extralen + commentlen;
+
+        if(name.empty()) continue;
+        if(name.back() == '/')
+        {
+            name.pop_back();
+            std::string key;
+            if(normalize(name.c_str(), key) && !key.empty() && !files.count(key)) adddir(key);
+            continue;
+        }
+        // encrypted entries, methods other than stored or deflated and zip64 sizes are left out
+        if((flags & 1) || (method != 0 && method != 8) || csize == 0xFFFFFFFF || usize == 0xFFFFFFFF || local == 0xFFFFFFFF) continue;
+        if(!indexable(name.c_str())) continue;
+        if(local > size || size - local < 30 || memcmp(data + local, "PK\3\4", 4)) continue;
+        size_t offset = local + 30 + getushort(data + local + 26) + getushort(data + local + 28);
+        if(offset > size || csize > size - offset) continue;
+
+        entry e;
+        e.root = root;
+        e.archive = index;
+        e.path = name;
+        e.offset = offset;
+        e.size = usize;
+        e.csize = csize;
+        e.method = int(method);
+        addfile(name, e);
+    }
+}
+
+int vfsindex::addroot(const char *dir)
+{
+    auto start = std::chrono::steady_clock::now();
+    size_t before = files.size();
+    int root = int(roots.size());
+    std::string d = dir;
+#ifdef WIN32
+    if(!d.empty() && d.back() != '\\' && d.back() != '/') d += '\\';
+#else
+    if(!d.empty() && d.back() != '/') d += '/';
+#endif
+    roots.push_back(d);
+    std::vector<std::string> zips;
+    scandir(root, d, std::string(), zips);
+    for(const std::string &zip : zips) mountzip(root, zip);
+    scanmillis += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return int(files.size() - before);
+}
+
+const vfsindex::entry *vfsindex::find(const char *name) const
+{
+    statlookups++;
+    std::string key;
+    if(normalize(name, key))
+    {
+        auto it = files.find(key);
+        if(it != files.end()) return &it->second;
+    }
+    statmisses++;
+    return nullptr;
+}
+
+bool vfsindex::isdir(const char *name) const
+{
+    std::string key;
+    return normalize(name, key) && dirs.count(key);
+}
+
+bool vfsindex::list(const char *dir, const char *ext, std::vector<std::string> &out) const
+{
+    std::string key;
+    if(!normalize(dir, key)) return false;
+    auto it = dirs.find(key);
+    if(it == dirs.end()) return false;
+    if(!ext)
+    {
+        out.push_back(".");
+        out.push_back("..");
+        out.insert(out.end(), it->second.names.begin(), it->second.names.end());
+        return true;
+    }
+    size_t extlen = strlen(ext);
+    for(const std::string &name : it->second.names)
+    {
+        if(name.size() <= extlen + 1) continue;
+        size_t len = name.size() - extlen - 1;
+        if(name[len] == '.' && !name.compare(len + 1, extlen, ext)) out.push_back(name.substr(0, len));
+    }
+    return true;
+}
+
+bool vfsindex::load(const entry &e, vfsdata &out) const
+{
+    out.clear();
+    statloads++;
+    if(e.archive < 0) return out.opened = out.file.open(e.path.c_str());
+
+    const archive &a = archives[e.archive];
+    const unsigned char *src = a.file->data() + e.offset;
+    if(e.method == 0)
+    {
+        if(e.csize != e.size) return false;
+        out.archive = a.file;
+        out.ptr = src;
+        out.len = e.size;
+        return out.opened = true;
+    }
+
+    statinflated++;
+    if(!e.size) return out.opened = true; // zlib refuses to inflate into no buffer at all
+    out.buf.resize(e.size);
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if(inflateInit2(&zs, -MAX_WBITS) != Z_OK) return false;
+    zs.next_in = const_cast<Bytef *>(src);
+    zs.avail_in = uInt(e.csize);
+    zs.next_out = out.buf.data();
+    zs.avail_out = uInt(e.size);
+    int err = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    if(err != Z_STREAM_END || zs.total_out != e.size) { out.buf.clear(); return false; }
+    return out.opened = true;
+}
+
+bool vfsindex::load(const char *name, vfsdata &out) const
+{
+    const entry *e = find(name);
+    if(!e) { out.clear(); return false; }
+    return load(*e, out);
+}
+
+vfsindex::stats vfsindex::getstats() const
+{
+    stats s;
+    s.roots = int(roots.size());
+    s.archives = int(archives.size());
+    s.files = int(files.size());
+    s.dirs = int(dirs.size());
+    s.lookups = statlookups;
+    s.misses = statmisses;
+    s.loads = statloads;
+    s.inflated = statinflated;
+    s.scanmillis = scanmillis;
+    return s;
+}
+
+} // namespace util
+} // namespace inexor
@@ -0,0 +1,123 @@
+/// @file vfs.hpp
+/// Index of the package directories and the zip archives in them, so looking up or listing a file does not hit the disk.
+///
+/// The roots get scanned once, every file and directory below them goes into a hash map keyed by its relative name.
+/// Zip archives at the top level of a root get mounted into it as if they were unpacked there, loose files of the same root
+/// win over them and earlier roots win over later ones.
+
+#pragma once
+
+#include <stddef.h>      // for size_t
+#include <atomic>        // for atomic
+#include <memory>        // for shared_ptr
+#include <string>        // for string
+#include <unordered_map> // for unordered_map
+#include <vector>        // for vector
+
+#include "inexor/util/mappedfile.hpp" // for mappedfile
+
+namespace inexor {
+namespace util {
+
+/// Contents of a file out of the index: mapped, pointing into a mapped archive or inflated into memory.
+class vfsdata
+{
+public:
+    bool ok() const { return opened; }
+    const unsigned char *data() const { return file.ok() ? file.data() : (archive ? ptr : buf.data()); }
+    size_t size() const { return file.ok() ? file.size() : (archive ? len : buf.size()); }
+    /// Whether no copy of the file was made.
+    bool iszerocopy() const { return file.ismapped() || archive; }
+
+    /// Map a file which is not in an index.
+    bool map(const char *path) { clear(); return opened = file.open(path); }
+    /// Hold a copy of data which is not in a file at all.
+    void copy(const unsigned char *src, size_t len) { clear(); buf.assign(src, src + len); opened = true; }
+    void clear() { file.close(); archive.reset(); ptr = nullptr; len = 0; buf.clear(); opened = false; }
+
+private:
+    friend class vfsindex;
+
+    mappedfile file;
+    std::shared_ptr<mappedfile> archive; ///< keeps the archive mapped as long as this points into it
+    const unsigned char *ptr = nullptr;
+    size_t len = 0;
+    std::vector<unsigned char> buf;
+    bool opened = false;
+};
+
+class vfsindex
+{
+public:
+    struct entry
+    {
+        int root = 0;
+        int archive = -1;          ///< -1 for loose files
+        std::string path;          ///< the path on disk for loose files
+        size_t offset = 0,         ///< of the data in the archive
+               size = 0, csize = 0;
+        int method = 0;            ///< 0 stored, 8 deflated
+    };
+
+    struct stats
+    {
+        int roots = 0, archives = 0, files = 0, dirs = 0;
+        long long lookups = 0, misses = 0, loads = 0, inflated = 0;
+        double scanmillis = 0;
+    };
+
+    vfsindex() { clear(); }
+
+    vfsindex(const vfsindex &) = delete;
+    vfsindex &operator=(const vfsindex &) = delete;
+
+    /// Scan the directory (with a trailing path separator or none) and add everything below it, returns the number of files added.
+    /// @warning not thread safe, do it before looking things up from other threads.
+    int addroot(const char *dir);
+    /// Forget all roots.
+    void clear();
+
+    /// Whether the name can be looked up here: relative and not leaving the root.
+    static bool indexable(const char *name);
+
+    /// The file, nullptr if it is in none of the roots (or not indexable).
+    const entry *find(const char *name) const;
+    bool isdir(const char *name) const;
+    /// Append the names in the directory like listdir() does: only the ones ending in .ext with it cut off,
+    /// or all of them and "." and ".." if ext is nullptr. Returns false if the directory is in none of the roots.
+    bool list(const char *dir, const char *ext, std::vector<std::string> &files) const;
+
+    bool load(const entry &e, vfsdata &out) const;
+    bool load(const char *name, vfsdata &out) const;
+
+    const std::string &archivename(const entry &e) const { return archives[e.archive].path; }
+    stats getstats() const;
+
+private:
+    struct archive
+    {
+        std::string path;
+        std::shared_ptr<mappedfile> file;
+    };
+
+    struct directory
+    {
+        std::vector<std::string> names; ///< files and subdirectories, in the order they were found
+    };
+
+    std::vector<std::string> roots;
+    std::vector<archive> archives;
+    std::unordered_map<std::string, entry> files;
+    std::unordered_map<std::string, directory> dirs;
+    double scanmillis = 0;
+
+    mutable std::atomic<long long> statlookups{0}, statmisses{0}, statloads{0}, statinflated{0};
+
+    void scandir(int root, const std::string &dir, const std::string &rel, std::vector<std::string> &zips);
+    void mountzip(int root, const std::string &file);
+    void addfile(const std::string &rel, const entry &e);
+    void adddir(const std::string &rel);
+};
+
+} // namespace util
+} // namespace inexor